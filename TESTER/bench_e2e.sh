@@ -0,0 +1,31 @@
+#!/bin/bash
+# start a pcc_server, run the e2e benchmark over a few payload sizes, stop the server.
+# usage: bench_e2e.sh <pcc_server> <bench_pcc> [requests]
+# also the training workload of the PGO build, so keep it representative
+set -e
+
+SERVER=$1
+BENCH=$2
+REQUESTS=${3:-2000}
+HOST=127.0.0.1
+PORT=$(python3 -c 'import socket; s = socket.socket(); s.bind(("127.0.0.1", 0)); print(s.getsockname()[1])')
+
+$SERVER $PORT > /dev/null 2>&1 &
+SERVER_PID=$!
+trap 'kill $SERVER_PID 2>/dev/null || true' EXIT
+
+for _ in $(seq 200); do
+    if (exec 3<>/dev/tcp/$HOST/$PORT) 2>/dev/null; then break; fi
+    sleep 0.05
+done
+
+for size in 1 64 1024 16384 262144 4194304; do
+    n=$REQUESTS
+    if [ $size -ge 262144 ]; then n=$((REQUESTS / 20 + 1)); fi
+    $BENCH e2e -n $n -s $size $HOST $PORT
+done
+
+# SIGINT lets the server exit normally (which also writes its PGO profile)
+kill -INT $SERVER_PID
+wait $SERVER_PID
+trap - EXIT
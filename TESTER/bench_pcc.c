@@ -0,0 +1,538 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../pcc_count.h"
+#include "../pcc_crc.h"
+#include "../pcc_io.h"
+#include "../pcc_net.h"
+#include "../pcc_ngram.h"
+#include "../pcc_pool.h"
+#include "../pcc_proto.h"
+#include "../pcc_sm.h"
+
+/*
+    benchmarks
+
+    bench_pcc kernel [-s size] [-t seconds]
+        throughput of pcc_count_ref and pcc_count over random and printable buffers, of
+        pcc_count and pcc_crc32c one after the other against pcc_count_crc doing both in
+        one pass, and of pcc_ngram counting the chars with the bigrams, then with the
+        trigrams too, each also with the CRC32C taken in the same pass
+    bench_pcc pool [-s size] [-t seconds] [-c threads]
+        one stream of size bytes (default 64MiB) counted by the counting pool with 1, 2, 4 ..
+        threads, up to the given number (default the online cpus): the submitting thread
+        copies every chunk into a pool buffer like a receiving server worker would, so
+        this is the rate a single big request can be counted at, next to pcc_count alone
+    bench_pcc e2e [-n requests] [-s size] [-c clients] <server IP> <server port>
+        round trips of basic frames with a size byte payload against a running server,
+        from clients concurrent connections (default 1) sending requests each,
+        prints requests/s, MB/s and latency percentiles
+    bench_pcc rtt [-n requests] [-t seconds] [-w nagle|nodelay|cork|more] <server IP> <server port>
+        round trips of small requests on one kept connection: extended COUNT frames of
+        1 byte to 4KiB, the header and the payload written separately in the given
+        pcc_net.h mode (default more), each size for up to requests requests or seconds
+        (default 1000 and 1). prints latency percentiles per size. a kept connection is
+        where Nagle and delayed acks meet, see TESTER/bench_rtt.sh
+    bench_pcc backends [-s size] [-t seconds] [-c conns]
+        the same basic frame state machine (pcc_sm.h) on every I/O backend of pcc_io.h:
+        blocking, epoll and io_uring serve conns (default 16) loopback connections in
+        this process, a client thread sends a frame of size bytes (default 4096) on each
+        of them, reads the replies and starts over for seconds. prints frames/s and MB/s
+        per backend, one that the kernel doesn't have is skipped
+
+    TESTER/bench_e2e.sh starts a server and runs the e2e mode over a few sizes,
+    it is also the training workload of the PGO build (make pgo).
+    TESTER/bench_pinning.sh compares multi-client latency of a server with and without
+    cpu pinning, SO_INCOMING_CPU steering and busy polling.
+*/
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned char *make_buf(size_t size, int printable_only) {
+    unsigned char *buf = malloc(size + 1);
+    if (buf == NULL) {
+        fprintf(stderr, "Error allocating buffer: %s\n", strerror(errno));
+        exit(1);
+    }
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = printable_only ? 32 + rand() % 95 : rand();
+    }
+    return buf;
+}
+
+static void bench_kernel(size_t size, double seconds) {
+    const char *names[] = {"random", "printable"};
+    for (int kind = 0; kind < 2; kind++) {
+        unsigned char *buf = make_buf(size, kind);
+        uint64_t (*kernels[])(const unsigned char *, size_t, uint64_t *) = {pcc_count_ref, pcc_count};
+        const char *knames[] = {"pcc_count_ref", "pcc_count"};
+
+        for (int k = 0; k < 2; k++) {
+            uint64_t counts[PCC_NPRINTABLE] = {0};
+            uint64_t bytes = 0, C = 0;
+            double start = now_sec(), elapsed;
+            do {
+                C += kernels[k](buf, size, counts);
+                bytes += size;
+            } while ((elapsed = now_sec() - start) < seconds);
+            printf("kernel %-13s %-9s %8zu bytes/call %10.1f MB/s (C %" PRIu64 ")\n", knames[k], names[kind], size,
+                   bytes / elapsed / 1e6, C);
+        }
+
+        // counted and checksummed, in two passes and fused
+        for (int fused = 0; fused < 2; fused++) {
+            uint64_t counts[PCC_NPRINTABLE] = {0};
+            uint64_t bytes = 0, C = 0;
+            uint32_t crc = 0;
+            double start = now_sec(), elapsed;
+            do {
+                if (fused) {
+                    C += pcc_count_crc(buf, size, counts, &crc);
+                } else {
+                    C += pcc_count(buf, size, counts);
+                    crc = pcc_crc32c(crc, buf, size);
+                }
+                bytes += size;
+            } while ((elapsed = now_sec() - start) < seconds);
+            printf("kernel %-13s %-9s %8zu bytes/call %10.1f MB/s (C %" PRIu64 " crc %08" PRIx32 ")\n",
+                   fused ? "pcc_count_crc" : "count+crc32c", names[kind], size, bytes / elapsed / 1e6, C, crc);
+        }
+
+        // one stream fed size bytes at a time, like the reads of one request
+        static struct pcc_ngram g;
+        const char *gnames[] = {"bigrams", "trigrams"};
+        for (int k = 0; k < 2; k++) {
+            uint64_t bytes = 0;
+            double start = now_sec(), elapsed;
+            pcc_ngram_init(&g, k == 0 ? PCC_NGRAM_BIGRAMS : PCC_NGRAM_BIGRAMS | PCC_NGRAM_TRIGRAMS);
+            do {
+                pcc_ngram_update(&g, buf, size);
+                bytes += size;
+            } while ((elapsed = now_sec() - start) < seconds);
+            pcc_ngram_finish(&g);
+            printf("kernel %-13s %-9s %8zu bytes/call %10.1f MB/s (C %" PRIu64 ")\n", gnames[k], names[kind], size,
+                   bytes / elapsed / 1e6, g.c);
+        }
+        // and checksummed in the same pass
+        for (int k = 0; k < 2; k++) {
+            uint64_t bytes = 0;
+            uint32_t crc = 0;
+            double start = now_sec(), elapsed;
+            pcc_ngram_init(&g, k == 0 ? PCC_NGRAM_BIGRAMS : PCC_NGRAM_BIGRAMS | PCC_NGRAM_TRIGRAMS);
+            do {
+                pcc_ngram_update_crc(&g, buf, size, &crc);
+                bytes += size;
+            } while ((elapsed = now_sec() - start) < seconds);
+            pcc_ngram_finish(&g);
+            printf("kernel %-13s %-9s %8zu bytes/call %10.1f MB/s (C %" PRIu64 " crc %08" PRIx32 ")\n",
+                   k == 0 ? "bigrams+crc" : "trigrams+crc", names[kind], size, bytes / elapsed / 1e6, g.c, crc);
+        }
+        free(buf);
+    }
+}
+
+static void bench_pool(size_t size, double seconds, int max_threads) {
+    unsigned char *buf = make_buf(size, 0);
+    uint64_t counts[PCC_NPRINTABLE] = {0};
+    uint64_t bytes = 0, C = 0;
+    double start = now_sec(), elapsed;
+    do {
+        C += pcc_count(buf, size, counts);
+        bytes += size;
+    } while ((elapsed = now_sec() - start) < seconds);
+    printf("pool  serial      %10.1f MB/s (C %" PRIu64 ")\n", bytes / elapsed / 1e6, C);
+
+    for (int threads = 1;; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+        struct pcc_pool *pool = pcc_pool_new(threads, PCC_POOL_CHUNK);
+        struct pcc_pool_job *job = pool != NULL ? pcc_pool_job_new(pool) : NULL;
+        if (job == NULL) {
+            fprintf(stderr, "Error creating pool: %s\n", strerror(errno));
+            exit(1);
+        }
+        bytes = C = 0;
+        start = now_sec();
+        do {
+            for (size_t off = 0; off < size; off += PCC_POOL_CHUNK) {
+                size_t len = size - off < PCC_POOL_CHUNK ? size - off : PCC_POOL_CHUNK;
+                unsigned char *chunk = pcc_pool_job_buf(job);
+                memcpy(chunk, buf + off, len);
+                pcc_pool_job_submit(job, chunk, len);
+            }
+            C += pcc_pool_job_wait(job, counts);
+            bytes += size;
+        } while ((elapsed = now_sec() - start) < seconds);
+        uint64_t stolen = 0;
+        for (int i = 0; i < threads; i++) {
+            uint64_t c, st;
+            pcc_pool_stats(pool, i, &c, &st);
+            stolen += st;
+        }
+        printf("pool  %3d threads %10.1f MB/s (C %" PRIu64 ", %" PRIu64 " chunks stolen)\n", threads,
+               bytes / elapsed / 1e6, C, stolen);
+        pcc_pool_job_free(job);
+        pcc_pool_free(pool);
+        if (threads == max_threads) break;
+    }
+    free(buf);
+}
+
+static void write_all(int fd, const void *buf, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t r = write(fd, (const char *)buf + sent, len - sent);
+        if (r < 0) {
+            fprintf(stderr, "Error sending: %s\n", strerror(errno));
+            exit(1);
+        }
+        sent += r;
+    }
+}
+
+static void read_all(int fd, void *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t r = read(fd, (char *)buf + got, len - got);
+        if (r <= 0) {
+            fprintf(stderr, "Error receiving: %s\n", r == 0 ? "connection closed" : strerror(errno));
+            exit(1);
+        }
+        got += r;
+    }
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+struct e2e_client {
+    pthread_t thread;
+    struct sockaddr_in serv_addr;
+    const unsigned char *payload;
+    size_t size;
+    long requests;
+    double *lat; // requests latencies, seconds
+};
+
+static void *e2e_client_main(void *arg) {
+    struct e2e_client *c = arg;
+    for (long i = 0; i < c->requests; i++) {
+        double t0 = now_sec();
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&c->serv_addr, sizeof(c->serv_addr)) < 0) {
+            fprintf(stderr, "Error: connect failed. %s\n", strerror(errno));
+            exit(1);
+        }
+        uint32_t N = htonl((uint32_t)c->size), C;
+        write_all(fd, &N, sizeof(N));
+        write_all(fd, c->payload, c->size);
+        read_all(fd, &C, sizeof(C));
+        close(fd);
+        c->lat[i] = now_sec() - t0;
+    }
+    return NULL;
+}
+
+static void bench_e2e(const char *ip, int port, long requests, size_t size, int nclients) {
+    struct e2e_client *clients = calloc(nclients, sizeof(*clients));
+    unsigned char *payload = make_buf(size, 0);
+    long total = requests * nclients;
+    double *lat = malloc(total * sizeof(*lat));
+
+    for (int k = 0; k < nclients; k++) {
+        struct e2e_client *c = &clients[k];
+        c->serv_addr.sin_family = AF_INET;
+        c->serv_addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, ip, &c->serv_addr.sin_addr) <= 0) {
+            fprintf(stderr, "Error converting IP address: %s\n", strerror(EINVAL));
+            exit(1);
+        }
+        c->payload = payload;
+        c->size = size;
+        c->requests = requests;
+        c->lat = lat + k * requests;
+    }
+
+    double start = now_sec();
+    if (nclients == 1) {
+        e2e_client_main(&clients[0]);
+    } else {
+        for (int k = 0; k < nclients; k++) pthread_create(&clients[k].thread, NULL, e2e_client_main, &clients[k]);
+        for (int k = 0; k < nclients; k++) pthread_join(clients[k].thread, NULL);
+    }
+    double elapsed = now_sec() - start;
+
+    qsort(lat, total, sizeof(*lat), cmp_double);
+    printf("e2e %8zu bytes x%-3d %9.0f req/s %9.1f MB/s  latency p50 %7.1f us p99 %7.1f us p99.9 %7.1f us\n", size,
+           nclients, total / elapsed, total * (double)size / elapsed / 1e6, lat[total / 2] * 1e6,
+           lat[total * 99 / 100] * 1e6, lat[total * 999 / 1000] * 1e6);
+    free(lat);
+    free(payload);
+    free(clients);
+}
+
+static void send_flags(int fd, const void *buf, size_t len, int flags) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t r = send(fd, (const char *)buf + sent, len - sent, flags);
+        if (r < 0) {
+            fprintf(stderr, "Error sending: %s\n", strerror(errno));
+            exit(1);
+        }
+        sent += r;
+    }
+}
+
+static void bench_rtt(const char *ip, int port, long requests, double seconds, int mode) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    unsigned char *payload = make_buf(4096, 0);
+    double *lat = malloc(requests * sizeof(*lat));
+    char body[4096];
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (inet_pton(AF_INET, ip, &addr.sin_addr) <= 0 || fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Error: connect failed. %s\n", strerror(errno));
+        exit(1);
+    }
+    pcc_net_setup(fd, mode);
+
+    for (size_t size = 1; size <= 4096; size *= 4) {
+        unsigned char hdr[4 + PCC_EXT_REQ_HDR_LEN], rep_hdr[PCC_EXT_REP_HDR_LEN];
+        struct pcc_ext_req req = {.version = PCC_EXT_VERSION, .op = PCC_OP_COUNT, .flags = PCC_FLAG_KEEPALIVE, .n = size};
+        struct pcc_ext_rep rep;
+        uint32_t marker = htonl(PCC_EXT_MARKER);
+        memcpy(hdr, &marker, 4);
+        pcc_ext_req_pack(&req, hdr + 4);
+
+        long n = 0;
+        double start = now_sec();
+        while (n < requests && (n == 0 || now_sec() - start < seconds)) {
+            double t0 = now_sec();
+            pcc_net_begin(fd, mode);
+            send_flags(fd, hdr, sizeof(hdr), pcc_net_more(mode));
+            send_flags(fd, payload, size, 0);
+            pcc_net_end(fd, mode);
+            read_all(fd, rep_hdr, sizeof(rep_hdr));
+            pcc_ext_rep_unpack(&rep, rep_hdr);
+            if (rep.status != PCC_STATUS_OK || !(rep.flags & PCC_FLAG_KEEPALIVE) || rep.body_len > sizeof(body)) {
+                fprintf(stderr, "Error: request refused or connection not kept (status %u)\n", rep.status);
+                exit(1);
+            }
+            read_all(fd, body, rep.body_len);
+            lat[n++] = now_sec() - t0;
+        }
+
+        qsort(lat, n, sizeof(*lat), cmp_double);
+        printf("rtt %-7s %5zu bytes %6ld requests  latency p50 %8.1f us p99 %8.1f us max %8.1f us\n",
+               pcc_net_mode_name(mode), size, n, lat[n / 2] * 1e6, lat[n * 99 / 100] * 1e6, lat[n - 1] * 1e6);
+    }
+    close(fd);
+    free(lat);
+    free(payload);
+}
+
+#define BACKEND_BUF (64 * 1024) // the chunk buffer of every connection's machine
+
+struct backend_conn {
+    int fd;
+    struct pcc_sm sm;
+    unsigned char *buf;
+    struct pcc_io *io;
+    uint64_t *frames;
+};
+
+struct backend_client {
+    int *fds;
+    int nconns;
+    const unsigned char *payload;
+    size_t size;
+    uint32_t C; // the reply every frame should get
+    double seconds;
+};
+
+// rounds of one frame on every connection, then their replies, until the time is up.
+// closing the connections ends the server's machines
+static void *backend_client_main(void *arg) {
+    struct backend_client *c = arg;
+    uint32_t N = htonl((uint32_t)c->size);
+    double start = now_sec();
+    do {
+        for (int i = 0; i < c->nconns; i++) {
+            write_all(c->fds[i], &N, sizeof(N));
+            write_all(c->fds[i], c->payload, c->size);
+        }
+        for (int i = 0; i < c->nconns; i++) {
+            uint32_t C;
+            read_all(c->fds[i], &C, sizeof(C));
+            if (ntohl(C) != c->C) {
+                fprintf(stderr, "Error: reply %u, expected %u\n", ntohl(C), c->C);
+                exit(1);
+            }
+        }
+    } while (now_sec() - start < c->seconds);
+    for (int i = 0; i < c->nconns; i++) close(c->fds[i]);
+    return NULL;
+}
+
+static void backend_done(struct pcc_sm *sm, void *arg) {
+    struct backend_conn *bc = arg;
+    if (sm->result == PCC_SM_GONE && sm->err == 0 && sm->pos == 0) return; // closed between frames: the client is through
+    if (sm->result != PCC_SM_OK) {
+        fprintf(stderr, "Error: frame ended with result %d (%s)\n", sm->result, strerror(sm->err));
+        exit(1);
+    }
+    (*bc->frames)++;
+    pcc_sm_init(&bc->sm, bc->buf, BACKEND_BUF);
+    if (pcc_io_add(bc->io, bc->fd, &bc->sm, backend_done, bc) < 0) {
+        fprintf(stderr, "Error adding connection: %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+static void bench_backends(size_t size, double seconds, int nconns) {
+    unsigned char *payload = make_buf(size, 0);
+    uint64_t counts[PCC_NPRINTABLE] = {0};
+    uint32_t C = (uint32_t)pcc_count(payload, size, counts);
+
+    for (int backend = PCC_IO_BLOCKING; backend <= PCC_IO_URING; backend++) {
+        struct pcc_io *io = pcc_io_new(backend, nconns);
+        if (io == NULL) {
+            printf("backends %-8s not available: %s\n", pcc_io_name(backend), strerror(errno));
+            continue;
+        }
+
+        // nconns loopback connections, the server ends of them go into io
+        struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+        socklen_t addr_len = sizeof(addr);
+        int lfd = socket(AF_INET, SOCK_STREAM, 0);
+        if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, nconns) < 0 ||
+            getsockname(lfd, (struct sockaddr *)&addr, &addr_len) < 0) {
+            fprintf(stderr, "Error listening: %s\n", strerror(errno));
+            exit(1);
+        }
+        uint64_t frames = 0;
+        struct backend_conn *conns = calloc(nconns, sizeof(*conns));
+        struct backend_client client = {.fds = calloc(nconns, sizeof(int)), .nconns = nconns, .payload = payload,
+                                        .size = size, .C = C, .seconds = seconds};
+        for (int i = 0; i < nconns; i++) {
+            struct backend_conn *bc = &conns[i];
+            int cfd = socket(AF_INET, SOCK_STREAM, 0);
+            if (cfd < 0 || connect(cfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || (bc->fd = accept(lfd, NULL, NULL)) < 0) {
+                fprintf(stderr, "Error: connect failed. %s\n", strerror(errno));
+                exit(1);
+            }
+            // the header and payload are two writes, Nagle would hold the second one back
+            pcc_net_setup(cfd, PCC_NET_NODELAY);
+            pcc_net_setup(bc->fd, PCC_NET_NODELAY);
+            client.fds[i] = cfd;
+            bc->buf = malloc(BACKEND_BUF);
+            bc->io = io;
+            bc->frames = &frames;
+            pcc_sm_init(&bc->sm, bc->buf, BACKEND_BUF);
+            if (bc->buf == NULL || pcc_io_add(io, bc->fd, &bc->sm, backend_done, bc) < 0) {
+                fprintf(stderr, "Error adding connection: %s\n", strerror(errno));
+                exit(1);
+            }
+        }
+        close(lfd);
+
+        pthread_t thread;
+        double start = now_sec();
+        pthread_create(&thread, NULL, backend_client_main, &client);
+        while (pcc_io_active(io) > 0) {
+            if (pcc_io_run(io, 100) < 0) {
+                fprintf(stderr, "Error running %s: %s\n", pcc_io_name(backend), strerror(errno));
+                exit(1);
+            }
+        }
+        double elapsed = now_sec() - start;
+        pthread_join(thread, NULL);
+
+        printf("backends %-8s %4d conns %8zu bytes %9.0f frames/s %9.1f MB/s\n", pcc_io_name(backend), nconns, size,
+               frames / elapsed, frames * (double)size / elapsed / 1e6);
+        for (int i = 0; i < nconns; i++) {
+            close(conns[i].fd);
+            free(conns[i].buf);
+        }
+        free(conns);
+        free(client.fds);
+        pcc_io_free(io);
+    }
+    free(payload);
+}
+
+int main(int argc, char *argv[]) {
+    size_t size = 0;
+    long requests = 1000;
+    int nclients = 0;
+    double seconds = 1.0;
+    int net_mode = PCC_NET_DEFAULT;
+    int opt;
+
+    if (argc < 2) {
+        fprintf(stderr, "Error: %s\n", strerror(EINVAL));
+        exit(1);
+    }
+    const char *mode = argv[1];
+    argv++;
+    argc--;
+
+    while ((opt = getopt(argc, argv, "n:s:t:c:w:")) != -1) {
+        switch (opt) {
+        case 'w':
+            if ((net_mode = pcc_net_mode_parse(optarg)) < 0) {
+                fprintf(stderr, "Error: %s\n", strerror(EINVAL));
+                exit(1);
+            }
+            break;
+        case 'n':
+            requests = atol(optarg);
+            break;
+        case 's':
+            size = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'c':
+            nclients = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Error: %s\n", strerror(EINVAL));
+            exit(1);
+        }
+    }
+
+    srand(1);
+    if (strcmp(mode, "kernel") == 0 && optind == argc) {
+        bench_kernel(size > 0 ? size : 65536, seconds);
+    } else if (strcmp(mode, "pool") == 0 && optind == argc && nclients >= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        int threads = nclients > 0 ? nclients : online > 0 ? (int)online : 1;
+        bench_pool(size > 0 ? size : 64 << 20, seconds, threads < PCC_POOL_MAX_THREADS ? threads : PCC_POOL_MAX_THREADS);
+    } else if (strcmp(mode, "e2e") == 0 && optind + 2 == argc && requests > 0 && nclients >= 0) {
+        bench_e2e(argv[optind], atoi(argv[optind + 1]), requests, size > 0 ? size : 4096, nclients > 0 ? nclients : 1);
+    } else if (strcmp(mode, "backends") == 0 && optind == argc && nclients >= 0) {
+        bench_backends(size > 0 ? size : 4096, seconds, nclients > 0 ? nclients : 16);
+    } else if (strcmp(mode, "rtt") == 0 && optind + 2 == argc && requests > 0) {
+        bench_rtt(argv[optind], atoi(argv[optind + 1]), requests, seconds, net_mode);
+    } else {
+        fprintf(stderr, "Error: %s\n", strerror(EINVAL));
+        exit(1);
+    }
+    return 0;
+}
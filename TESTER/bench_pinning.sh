@@ -0,0 +1,48 @@
+#!/bin/bash
+# latency of a multi-worker pcc_server with and without cpu placement.
+# usage: bench_pinning.sh <pcc_server> <bench_pcc> [workers] [requests per client]
+#   plain     -w workers
+#   pinned    -w workers -c 0-(workers-1), limited to the online cpus
+#   steered   pinned + -i (SO_INCOMING_CPU listeners with a reuseport cpu program)
+#   busypoll  steered + -b 50
+# every setup runs the e2e mode with one client per worker over small and large payloads
+set -e
+
+SERVER=$1
+BENCH=$2
+WORKERS=${3:-$(nproc)}
+REQUESTS=${4:-2000}
+HOST=127.0.0.1
+NCPUS=$(nproc)
+# workers share cpus round robin when there are more of them than cpus
+CPUS="0-$(( (WORKERS < NCPUS ? WORKERS : NCPUS) - 1 ))"
+
+run() {
+    local name=$1
+    shift
+    local port
+    port=$(python3 -c 'import socket; s = socket.socket(); s.bind(("127.0.0.1", 0)); print(s.getsockname()[1])')
+    $SERVER "$@" $port > /dev/null 2>&1 &
+    local pid=$!
+    for _ in $(seq 200); do
+        if (exec 3<>/dev/tcp/$HOST/$port) 2>/dev/null; then break; fi
+        sleep 0.05
+    done
+    if ! kill -0 $pid 2>/dev/null; then
+        echo "$name: server failed to start" >&2
+        return 1
+    fi
+    for size in 64 4096 262144; do
+        n=$REQUESTS
+        if [ $size -ge 262144 ]; then n=$((REQUESTS / 20 + 1)); fi
+        echo -n "$(printf '%-9s' $name) "
+        $BENCH e2e -c $WORKERS -n $n -s $size $HOST $port
+    done
+    kill -INT $pid
+    wait $pid || true
+}
+
+run plain -w $WORKERS
+run pinned -w $WORKERS -c $CPUS
+run steered -w $WORKERS -c $CPUS -i
+run busypoll -w $WORKERS -c $CPUS -i -b 50
@@ -0,0 +1,34 @@
+#!/bin/bash
+# round trips of small requests on a kept connection under every pcc_net.h write mode:
+# for each mode a pcc_server with -n <mode> and bench_pcc rtt -w <mode> against it, then
+# Nagle on both sides with the server acking at once (-Q).
+# usage: bench_rtt.sh <pcc_server> <bench_pcc> [seconds per size]
+set -e
+
+SERVER=$1
+BENCH=$2
+SECONDS_PER_SIZE=${3:-1}
+HOST=127.0.0.1
+PORT=$(python3 -c 'import socket; s = socket.socket(); s.bind(("127.0.0.1", 0)); print(s.getsockname()[1])')
+
+run() {
+    local mode=$1
+    shift
+    $SERVER -k 60000 -n $mode "$@" $PORT > /dev/null 2>&1 &
+    SERVER_PID=$!
+    trap 'kill $SERVER_PID 2>/dev/null || true' EXIT
+    for _ in $(seq 200); do
+        if (exec 3<>/dev/tcp/$HOST/$PORT) 2>/dev/null; then break; fi
+        sleep 0.05
+    done
+    echo "# server -n $mode $*"
+    $BENCH rtt -t $SECONDS_PER_SIZE -w $mode $HOST $PORT
+    kill -INT $SERVER_PID
+    wait $SERVER_PID || true
+    trap - EXIT
+}
+
+for mode in nagle nodelay cork more; do
+    run $mode
+done
+run nagle -Q
@@ -0,0 +1,149 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../pcc_count.h"
+#include "../pcc_crc.h"
+#include "../pcc_ngram.h"
+
+/*
+    libFuzzer target, differential test of the counting kernels against pcc_count_ref
+
+    build with clang:
+        clang -g -O1 -fsanitize=fuzzer,address,undefined -o fuzz_count fuzz_count.c ../pcc_count.c ../pcc_ngram.c ../pcc_crc.c
+        ./fuzz_count corpus/count
+    or with gcc and the standalone driver (fuzz_main.c), see the Makefile.
+
+    the first byte of the input picks a chunk size, the rest is the stream. the stream is
+    counted once with the reference kernel and once chunk by chunk (like the server does
+    with its reads) with the optimized one, at a misaligned start to catch alignment bugs.
+    the histograms and C have to match exactly.
+
+    pcc_count_crc counts the same chunks once more: its counts have to match too, and its
+    CRC32C the one of pcc_crc32c over the whole stream.
+
+    the same chunks also go through pcc_ngram, with the trigram sketch: its chars and
+    bigrams have to match a byte by byte count exactly, and no trigram may be estimated
+    below its true count. pcc_ngram_update_crc, with and without the sketch, has to give
+    the same counts, n-grams and CRC32C.
+*/
+
+static struct pcc_ngram g; // too big for the stack
+static uint32_t trigrams[PCC_NPRINTABLE * PCC_NBIGRAMS]; // exact counts, cleared after every input
+
+static int printable(unsigned char b) {
+    return b >= PCC_FIRST_PRINTABLE && b < PCC_FIRST_PRINTABLE + PCC_NPRINTABLE;
+}
+
+static uint32_t trigram(const uint8_t *p) {
+    return ((p[0] - PCC_FIRST_PRINTABLE) * PCC_NPRINTABLE + p[1] - PCC_FIRST_PRINTABLE) * PCC_NPRINTABLE + p[2] -
+           PCC_FIRST_PRINTABLE;
+}
+
+static void check_ngrams(const uint8_t *data, size_t size, size_t chunk, const uint64_t ref[PCC_NPRINTABLE],
+                         uint64_t C_ref) {
+    static uint64_t bigrams[PCC_NBIGRAMS];
+    uint64_t nbigrams = 0, ntrigrams = 0;
+
+    // the checksummed update must count the same and take the same crc as pcc_crc32c,
+    // with only bigrams first, then with the sketch that the rest checks
+    static const int crc_flags[] = {PCC_NGRAM_BIGRAMS, PCC_NGRAM_BIGRAMS | PCC_NGRAM_TRIGRAMS};
+    for (int k = 0; k < 2; k++) {
+        int flags = crc_flags[k];
+        uint32_t crc = 0;
+        pcc_ngram_init(&g, flags);
+        for (size_t off = 0; off < size; off += chunk) {
+            pcc_ngram_update_crc(&g, data + off, size - off < chunk ? size - off : chunk, &crc);
+        }
+        pcc_ngram_finish(&g);
+        if (crc != pcc_crc32c(0, data, size) || g.c != C_ref || memcmp(g.counts, ref, sizeof(g.counts)) != 0) {
+            fprintf(stderr, "ngram crc mismatch: flags %d crc %08x ref %08x\n", flags, crc, pcc_crc32c(0, data, size));
+            abort();
+        }
+    }
+    // and the plain update the same n-grams as the checksummed one
+    static struct pcc_ngram g_crc;
+    memcpy(&g_crc, &g, sizeof(g));
+    pcc_ngram_init(&g, PCC_NGRAM_BIGRAMS | PCC_NGRAM_TRIGRAMS);
+    for (size_t off = 0; off < size; off += chunk) {
+        pcc_ngram_update(&g, data + off, size - off < chunk ? size - off : chunk);
+    }
+    pcc_ngram_finish(&g);
+    if (memcmp(g.bigrams, g_crc.bigrams, sizeof(g.bigrams)) != 0 || memcmp(g.sketch, g_crc.sketch, sizeof(g.sketch)) != 0) {
+        fprintf(stderr, "ngram crc update counted other n-grams\n");
+        abort();
+    }
+
+    memset(bigrams, 0, sizeof(bigrams));
+    for (size_t i = 0; i + 1 < size; i++) {
+        if (!printable(data[i]) || !printable(data[i + 1])) continue;
+        bigrams[(data[i] - PCC_FIRST_PRINTABLE) * PCC_NPRINTABLE + data[i + 1] - PCC_FIRST_PRINTABLE]++;
+        nbigrams++;
+    }
+    for (size_t i = 0; i + 2 < size; i++) {
+        if (!printable(data[i]) || !printable(data[i + 1]) || !printable(data[i + 2])) continue;
+        trigrams[trigram(data + i)]++;
+        ntrigrams++;
+    }
+
+    if (g.c != C_ref || memcmp(g.counts, ref, sizeof(g.counts)) != 0 || g.nbigrams != nbigrams ||
+        memcmp(g.bigrams, bigrams, sizeof(bigrams)) != 0 || g.ntrigrams != ntrigrams) {
+        fprintf(stderr, "ngram mismatch: C ref %llu ngram %llu, bigrams %llu / %llu, trigrams %llu / %llu\n",
+                (unsigned long long)C_ref, (unsigned long long)g.c, (unsigned long long)nbigrams,
+                (unsigned long long)g.nbigrams, (unsigned long long)ntrigrams, (unsigned long long)g.ntrigrams);
+        abort();
+    }
+    for (size_t i = 0; i + 2 < size; i++) {
+        if (!printable(data[i]) || !printable(data[i + 1]) || !printable(data[i + 2])) continue;
+        uint32_t t = trigram(data + i);
+        if (trigrams[t] == 0) continue; // checked and cleared already
+        if (pcc_ngram_estimate(g.sketch, data[i], data[i + 1], data[i + 2]) < trigrams[t]) {
+            fprintf(stderr, "trigram '%.3s' estimated below its count %u\n", (const char *)data + i, trigrams[t]);
+            abort();
+        }
+        trigrams[t] = 0;
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    uint64_t ref[PCC_NPRINTABLE] = {0};
+    uint64_t opt[PCC_NPRINTABLE] = {0};
+
+    if (size == 0) return 0;
+    size_t chunk = (size_t)data[0] * 37 + 1; // 1 .. ~9KB, crosses the small buffer cutoff
+    size_t misalign = data[0] % 8;
+    data++;
+    size--;
+
+    uint64_t C_ref = pcc_count_ref(data, size, ref);
+
+    unsigned char *copy = malloc(size + misalign + 1);
+    memcpy(copy + misalign, data, size);
+    uint64_t C_opt = 0;
+    for (size_t off = 0; off < size; off += chunk) {
+        size_t len = size - off < chunk ? size - off : chunk;
+        C_opt += pcc_count(copy + misalign + off, len, opt);
+    }
+    free(copy);
+
+    if (C_ref != C_opt || memcmp(ref, opt, sizeof(ref)) != 0) {
+        fprintf(stderr, "kernel mismatch: C ref %llu opt %llu (size %zu chunk %zu)\n",
+                (unsigned long long)C_ref, (unsigned long long)C_opt, size, chunk);
+        abort();
+    }
+
+    uint64_t fused[PCC_NPRINTABLE] = {0};
+    uint64_t C_fused = 0;
+    uint32_t crc = 0;
+    for (size_t off = 0; off < size; off += chunk) {
+        C_fused += pcc_count_crc(data + off, size - off < chunk ? size - off : chunk, fused, &crc);
+    }
+    if (C_ref != C_fused || memcmp(ref, fused, sizeof(ref)) != 0 || crc != pcc_crc32c(0, data, size)) {
+        fprintf(stderr, "fused kernel mismatch: C ref %llu fused %llu, crc %08x expected %08x (size %zu chunk %zu)\n",
+                (unsigned long long)C_ref, (unsigned long long)C_fused, crc, pcc_crc32c(0, data, size), size, chunk);
+        abort();
+    }
+    check_ngrams(data, size, chunk, ref, C_ref);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../pcc_frame.h"
+
+/*
+    libFuzzer target for the server's request header parser (pcc_frame.c)
+
+    build with clang:
+        clang -g -O1 -fsanitize=fuzzer,address,undefined -o fuzz_frame fuzz_frame.c ../pcc_frame.c
+        ./fuzz_frame corpus/frame
+    or with gcc and the standalone driver (fuzz_main.c), see the Makefile.
+
+    besides not crashing, the parser must:
+        never claim a header longer than the input
+        ask for more bytes (return 0) on every strict prefix of a complete header
+        hand out a NUL terminated tenant id of at most PCC_TENANT_ID_MAX bytes
+        only pass a known checksum, on a request that counts
+        only pass a sample whose payload is whole blocks and then the tail
+        accept its own re-serialization of an extended header
+*/
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    struct pcc_frame f, g;
+    const char *err = NULL;
+    ssize_t r = pcc_frame_parse(data, size, &f, &err);
+
+    if (r < 0) {
+        assert(err != NULL);
+        return 0;
+    }
+    if (r == 0) return 0;
+
+    assert((size_t)r <= size);
+    assert(f.req.op == PCC_OP_COUNT || f.req.op == PCC_OP_QUERY || f.req.op == PCC_OP_SAMPLE ||
+           (f.req.op == PCC_OP_RING && f.req.n == 0));
+    if (f.req.op == PCC_OP_SAMPLE) {
+        assert(f.opts.sampled && f.opts.sample_block > 0 && f.req.n <= f.opts.sample_n);
+        assert((f.req.n - f.opts.sample_tail) % f.opts.sample_block == 0);
+    }
+    assert(strlen(f.opts.tenant) <= PCC_TENANT_ID_MAX);
+    assert(strlen(f.opts.stream) <= PCC_STREAM_ID_MAX && (f.opts.stream[0] == '\0' || f.req.op == PCC_OP_COUNT));
+    assert(f.opts.checksum == 0 || (f.opts.checksum == PCC_CHECKSUM_CRC32C && f.req.op == PCC_OP_COUNT));
+    if (!f.ext) {
+        assert(r == sizeof(uint32_t));
+        assert(f.req.n != PCC_EXT_MARKER);
+        return 0;
+    }
+    assert((size_t)r == sizeof(uint32_t) + PCC_EXT_REQ_HDR_LEN + f.req.opt_len);
+
+    // a strict prefix is never a complete header
+    for (size_t cut = 0; cut < (size_t)r; cut++) {
+        assert(pcc_frame_parse(data, cut, &g, &err) == 0);
+    }
+
+    // pack what we parsed and parse it again
+    unsigned char *copy = malloc(r);
+    memcpy(copy, data, r);
+    pcc_ext_req_pack(&f.req, copy + sizeof(uint32_t));
+    assert(pcc_frame_parse(copy, r, &g, &err) == r);
+    assert(memcmp(&f.req, &g.req, sizeof(f.req)) == 0);
+    assert(strcmp(f.opts.tenant, g.opts.tenant) == 0);
+    assert(memcmp(&f.opts, &g.opts, sizeof(f.opts)) == 0);
+    free(copy);
+    return 0;
+}
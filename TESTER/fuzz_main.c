@@ -0,0 +1,174 @@
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+    standalone driver for the libFuzzer targets, for builds without clang/libFuzzer.
+    links with one fuzz_*.c and calls its LLVMFuzzerTestOneInput.
+
+    usage: fuzz_xxx [-n iterations] [-s seed] [corpus files...]
+        every corpus file is run once as is, then the driver runs iterations random
+        inputs: mutations (bit flips, byte sets, inserts, truncation, splices) of a random
+        corpus file, or plain random bytes when there is no corpus.
+        an input that crashes the target is saved to crash-<seed>-<iteration>.
+*/
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+#define MAX_INPUT (64 * 1024)
+
+struct input {
+    unsigned char *data;
+    size_t size;
+};
+
+static struct input read_input(const char *path) {
+    struct input in = {NULL, 0};
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    in.data = malloc(st.st_size + 1);
+    while (in.size < (size_t)st.st_size) {
+        ssize_t r = read(fd, in.data + in.size, st.st_size - in.size);
+        if (r <= 0) {
+            fprintf(stderr, "Error reading %s: %s\n", path, strerror(errno));
+            exit(1);
+        }
+        in.size += r;
+    }
+    close(fd);
+    return in;
+}
+
+// the input being run, saved by the crash handler
+static const unsigned char *cur_data;
+static size_t cur_size;
+static char crash_path[64];
+
+static void save_crash(int sig) {
+    int fd = open(crash_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        if (write(fd, cur_data, cur_size) < 0) {
+            // nothing left to do about it
+        }
+        close(fd);
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void run_input(const unsigned char *data, size_t size, unsigned seed, long iter) {
+    cur_data = data;
+    cur_size = size;
+    snprintf(crash_path, sizeof(crash_path), "crash-%u-%ld", seed, iter);
+    LLVMFuzzerTestOneInput(data, size);
+}
+
+static size_t mutate(unsigned char *buf, size_t size, const struct input *corpus, size_t ncorpus) {
+    int rounds = 1 + rand() % 4;
+    for (int k = 0; k < rounds; k++) {
+        switch (rand() % 6) {
+        case 0: // flip a bit
+            if (size > 0) buf[rand() % size] ^= 1 << (rand() % 8);
+            break;
+        case 1: // set a byte to an interesting value
+            if (size > 0) {
+                static const unsigned char vals[] = {0x00, 0x01, 0x1f, 0x20, 0x7e, 0x7f, 0x80, 0xff};
+                buf[rand() % size] = vals[rand() % sizeof(vals)];
+            }
+            break;
+        case 2: // insert random bytes
+            if (size < MAX_INPUT) {
+                size_t pos = size > 0 ? rand() % (size + 1) : 0;
+                size_t n = 1 + rand() % 16;
+                if (size + n > MAX_INPUT) n = MAX_INPUT - size;
+                memmove(buf + pos + n, buf + pos, size - pos);
+                for (size_t i = 0; i < n; i++) buf[pos + i] = rand();
+                size += n;
+            }
+            break;
+        case 3: // truncate
+            if (size > 0) size = rand() % size;
+            break;
+        case 4: // splice in the tail of another corpus entry
+            if (ncorpus > 0) {
+                const struct input *o = &corpus[rand() % ncorpus];
+                size_t pos = size > 0 ? rand() % size : 0;
+                size_t n = o->size < MAX_INPUT - pos ? o->size : MAX_INPUT - pos;
+                memcpy(buf + pos, o->data, n);
+                if (pos + n > size) size = pos + n;
+            }
+            break;
+        default: // grow with a run of one byte, to exercise the long buffer paths
+            if (size < MAX_INPUT) {
+                size_t n = rand() % (MAX_INPUT - size + 1);
+                memset(buf + size, rand(), n);
+                size += n;
+            }
+            break;
+        }
+    }
+    return size;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = 10000;
+    unsigned seed = (unsigned)getpid();
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = atol(optarg);
+            break;
+        case 's':
+            seed = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Error: %s\n", strerror(EINVAL));
+            exit(1);
+        }
+    }
+
+    signal(SIGABRT, save_crash);
+    signal(SIGSEGV, save_crash);
+    signal(SIGBUS, save_crash);
+
+    size_t ncorpus = argc - optind;
+    struct input *corpus = calloc(ncorpus + 1, sizeof(*corpus));
+    for (size_t i = 0; i < ncorpus; i++) {
+        corpus[i] = read_input(argv[optind + i]);
+        run_input(corpus[i].data, corpus[i].size, seed, -1 - (long)i);
+    }
+
+    srand(seed);
+    unsigned char *buf = malloc(MAX_INPUT);
+    for (long it = 0; it < iterations; it++) {
+        size_t size;
+        if (ncorpus > 0) {
+            const struct input *in = &corpus[rand() % ncorpus];
+            memcpy(buf, in->data, in->size < MAX_INPUT ? in->size : MAX_INPUT);
+            size = mutate(buf, in->size < MAX_INPUT ? in->size : MAX_INPUT, corpus, ncorpus);
+        } else {
+            size = rand() % 4096;
+            for (size_t i = 0; i < size; i++) buf[i] = rand();
+        }
+
+        run_input(buf, size, seed, it);
+    }
+
+    printf("%s: %zu corpus inputs and %ld random inputs ok (seed %u)\n", argv[0], ncorpus, iterations, seed);
+    free(buf);
+    for (size_t i = 0; i < ncorpus; i++) free(corpus[i].data);
+    free(corpus);
+    return 0;
+}
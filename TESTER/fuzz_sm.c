@@ -0,0 +1,174 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../pcc_count.h"
+#include "../pcc_sm.h"
+
+/*
+    libFuzzer target for the basic frame state machine (pcc_sm.h)
+
+    build with clang:
+        clang -g -O1 -fsanitize=fuzzer,address,undefined -o fuzz_sm fuzz_sm.c ../pcc_sm.c ../pcc_count.c ../pcc_crc.c
+        ./fuzz_sm corpus/sm
+    or with gcc and the standalone driver (fuzz_main.c), see the Makefile.
+
+    the first byte of the input picks the chunk buffer size and whether a sink takes the
+    payload, the second one seeds how the I/O goes: reads and writes of random lengths,
+    -EINTR and -EAGAIN in between, and now and then an error that ends the machine. the
+    rest is what the client sent. the outcome has to be what the bytes say: PCC_SM_EXT for
+    the marker, PCC_SM_GONE for a frame cut short, otherwise the histogram and C of
+    pcc_count_ref and C as the reply, without a byte read past the frame.
+*/
+
+static uint32_t rng;
+
+static uint32_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// a sink that hands out buffers of random sizes, to check where they go
+static struct {
+    unsigned char buf[64];
+    uint64_t counts[PCC_NPRINTABLE];
+    uint64_t c;
+    int out; // a buffer is handed out and not back yet
+} sink;
+
+static unsigned char *sink_buf(void *arg, size_t *len) {
+    (void)arg;
+    size_t max = next_rand() % sizeof(sink.buf) + 1;
+    if (sink.out) {
+        fprintf(stderr, "sink buffer handed out twice\n");
+        abort();
+    }
+    if (*len > max) *len = max;
+    sink.out = 1;
+    return sink.buf;
+}
+
+static void sink_data(void *arg, unsigned char *buf, size_t len) {
+    (void)arg;
+    sink.c += pcc_count(buf, len, sink.counts);
+    sink.out = 0;
+}
+
+static uint64_t sink_end(void *arg, unsigned char *unused, uint64_t counts[PCC_NPRINTABLE]) {
+    (void)arg;
+    if ((unused != NULL) != sink.out) {
+        fprintf(stderr, "sink end: unused buffer %p, one out %d\n", (void *)unused, sink.out);
+        abort();
+    }
+    memcpy(counts, sink.counts, sizeof(sink.counts));
+    return sink.c;
+}
+
+static const struct pcc_sm_sink fuzz_sink = {sink_buf, sink_data, sink_end};
+
+static void fuzz_header(struct pcc_sm *sm, void *arg) {
+    (void)arg;
+    if (sm->phase != PCC_SM_PAYLOAD && sm->phase != PCC_SM_REPLY) {
+        fprintf(stderr, "header hook in phase %d\n", sm->phase);
+        abort();
+    }
+    if (sm->phase == PCC_SM_PAYLOAD) pcc_sm_set_sink(sm, &fuzz_sink, NULL);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static unsigned char buf[64];
+    struct pcc_sm sm;
+
+    if (size < 2) return 0;
+    size_t buf_size = data[0] % sizeof(buf) + 1;
+    int use_sink = data[0] & 0x80;
+    rng = data[1] * 2654435761u + 1;
+    data += 2;
+    size -= 2;
+
+    memset(&sink, 0, sizeof(sink));
+    pcc_sm_init(&sm, buf, buf_size);
+    // the sink comes in once N is, like the server sets it
+    if (use_sink) pcc_sm_set_header(&sm, fuzz_header, NULL);
+
+    size_t pos = 0; // bytes of data read so far
+    unsigned char reply[4];
+    size_t replied = 0;
+    int fatal = 0; // the error injected to end the machine, if one was
+    unsigned char *p;
+    size_t len;
+    int op;
+    while ((op = pcc_sm_next(&sm, &p, &len)) != PCC_SM_DONE) {
+        if (len == 0) {
+            fprintf(stderr, "machine waits for a zero length I/O in phase %d\n", sm.phase);
+            abort();
+        }
+        uint32_t r = next_rand();
+        ssize_t res;
+        if (r % 16 == 0) {
+            res = r & 16 ? -EINTR : -EAGAIN;
+        } else if (r % 509 == 1) {
+            fatal = r & 16 ? ECONNRESET : EIO;
+            res = -fatal;
+        } else if (op == PCC_SM_READ) {
+            size_t n = (r >> 8) % len + 1;
+            if (n > size - pos) n = size - pos;
+            memcpy(p, data + pos, n);
+            pos += n;
+            res = (ssize_t)n;
+        } else {
+            size_t n = (r >> 8) % len + 1;
+            if (replied + n > sizeof(reply)) abort();
+            memcpy(reply + replied, p, n);
+            replied += n;
+            res = (ssize_t)n;
+        }
+        pcc_sm_done(&sm, res);
+    }
+
+    if (fatal) {
+        if (sm.phase != PCC_SM_END || sm.err != fatal ||
+            sm.result != (fatal == ECONNRESET ? PCC_SM_GONE : PCC_SM_FAILED)) {
+            fprintf(stderr, "error %d ended in result %d err %d\n", fatal, sm.result, sm.err);
+            abort();
+        }
+        return 0;
+    }
+
+    // what the bytes say
+    int want;
+    uint32_t n = 0;
+    if (size >= 4) {
+        memcpy(&n, data, 4);
+        n = ntohl(n);
+    }
+    if (size < 4) want = PCC_SM_GONE;
+    else if (n == PCC_EXT_MARKER) want = PCC_SM_EXT;
+    else if (size - 4 < n) want = PCC_SM_GONE;
+    else want = PCC_SM_OK;
+    if (sm.result != want) {
+        fprintf(stderr, "result %d, expected %d (N %u, %zu bytes)\n", sm.result, want, n, size);
+        abort();
+    }
+    if (want == PCC_SM_EXT && pos != 4) {
+        fprintf(stderr, "read %zu bytes past the marker\n", pos - 4);
+        abort();
+    }
+    if (want != PCC_SM_OK) return 0;
+
+    uint64_t ref[PCC_NPRINTABLE] = {0};
+    uint64_t c = pcc_count_ref(data + 4, n, ref);
+    uint32_t c_net = htonl((uint32_t)c);
+    if (pos != 4 + (size_t)n || sm.c != c || memcmp(sm.counts, ref, sizeof(ref)) != 0 || replied != 4 ||
+        memcmp(reply, &c_net, 4) != 0) {
+        fprintf(stderr, "frame of N %u: read %zu, C %llu expected %llu, replied %zu bytes\n", n, pos,
+                (unsigned long long)sm.c, (unsigned long long)c, replied);
+        abort();
+    }
+    return 0;
+}
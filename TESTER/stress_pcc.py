@@ -0,0 +1,220 @@
+#!/usr/bin/env python3
+"""
+Randomized multi-client stress test for pcc_server over loopback.
+
+Every client thread runs a random mix of requests:
+    ok          basic frame, header and payload trickled in random pieces with short
+                pauses (so the server sees partial reads), reply read a byte at a time
+    ext         the same through an extended COUNT frame with a tenant id
+    drop        header and part of the payload, then a close (or a RST) mid-stream
+    drop_header part of the 4-byte N, then a close
+
+With --sigint the server gets SIGINT at a random point while clients are running,
+otherwise once they are all done. Either way it has to exit 0 and print exactly the
+counts of the requests whose clients got a reply, which are checked with
+count_printable_per_char.py and compare_counts.py like test_pcc.sh does.
+
+usage: stress_pcc.py [--server ./pcc_server] [--server-args "-w 4"] [--clients 8] [--requests 40] [--seed N] [--sigint]
+"""
+import argparse
+import os
+import random
+import signal
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+EXT_MARKER = 0xFFFFFFFF
+OP_COUNT = 1
+OPT_TENANT = 1
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def wait_listening(port, proc, timeout=5.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        if proc.poll() is not None:
+            sys.exit("server exited early with code %d" % proc.returncode)
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=0.2).close()
+            return
+        except OSError:
+            time.sleep(0.01)
+    sys.exit("server did not start listening")
+
+
+def make_payload(rng):
+    size = rng.choice([0, 1, rng.randrange(2, 64), rng.randrange(64, 4096), rng.randrange(4096, 200000)])
+    kind = rng.random()
+    if kind < 0.4:
+        return bytes(rng.randrange(32, 127) for _ in range(size))
+    if kind < 0.8:
+        return rng.randbytes(size)
+    return bytes([rng.randrange(256)]) * size
+
+
+def printable(data):
+    return sum(1 for b in data if 32 <= b <= 126)
+
+
+def send_trickle(sock, data, rng):
+    pos = 0
+    while pos < len(data):
+        n = rng.choice([1, 2, 3, rng.randrange(1, 1500), rng.randrange(1, 65536)])
+        sock.sendall(data[pos:pos + n])
+        pos += n
+        if rng.random() < 0.05:
+            time.sleep(rng.random() * 0.005)
+
+
+def recv_exact(sock, n):
+    buf = b""
+    while len(buf) < n:
+        chunk = sock.recv(1)  # partial reads on purpose
+        if not chunk:
+            raise ConnectionError("server closed the connection")
+        buf += chunk
+    return buf
+
+
+class Client(threading.Thread):
+    def __init__(self, idx, port, nreq, seed, outdir, stop):
+        super().__init__(daemon=True)
+        self.idx = idx
+        self.port = port
+        self.nreq = nreq
+        self.rng = random.Random(seed)
+        self.outdir = outdir
+        self.stop = stop
+        self.completed = []  # files holding payloads the server acknowledged
+        self.errors = []
+
+    def run(self):
+        for i in range(self.nreq):
+            if self.stop.is_set():
+                return
+            action = self.rng.choices(["ok", "ext", "drop", "drop_header"], [6, 2, 2, 1])[0]
+            data = make_payload(self.rng)
+            try:
+                sock = socket.create_connection(("127.0.0.1", self.port), timeout=10)
+            except OSError:
+                return  # server is gone (SIGINT)
+            try:
+                if action in ("ok", "ext"):
+                    if action == "ok":
+                        hdr = struct.pack(">I", len(data))
+                    else:
+                        tenant = b"tenant-%d" % self.rng.randrange(4)
+                        opts = struct.pack(">HH", OPT_TENANT, len(tenant)) + tenant
+                        hdr = struct.pack(">IBBHIQ", EXT_MARKER, 1, OP_COUNT, 0, len(opts), len(data)) + opts
+                    send_trickle(sock, hdr + data, self.rng)
+                    if action == "ok":
+                        (C,) = struct.unpack(">I", recv_exact(sock, 4))
+                    else:
+                        _, status, _, body_len, C = struct.unpack(">BBHIQ", recv_exact(sock, 16))
+                        recv_exact(sock, body_len)
+                        if status != 0:
+                            self.errors.append("client %d req %d: status %d" % (self.idx, i, status))
+                            continue
+                    if C != printable(data):
+                        self.errors.append("client %d req %d: got C=%d expected %d" % (self.idx, i, C, printable(data)))
+                    path = os.path.join(self.outdir, "c%d_r%d" % (self.idx, i))
+                    with open(path, "wb") as f:
+                        f.write(data)
+                    self.completed.append(path)
+                elif action == "drop":
+                    cut = self.rng.randrange(len(data)) if data else 0
+                    send_trickle(sock, struct.pack(">I", len(data) + 1) + data[:cut], self.rng)
+                    if self.rng.random() < 0.5:
+                        # RST instead of FIN
+                        sock.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+                else:
+                    sock.sendall(struct.pack(">I", len(data))[: self.rng.randrange(4)])
+            except OSError:
+                pass  # reset by a server that is shutting down, not counted by either side
+            finally:
+                sock.close()
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("--server", default=os.path.join(HERE, "pcc_server"))
+    ap.add_argument("--server-args", default="", help="extra server options, e.g. \"-w 4 -i\"")
+    ap.add_argument("--clients", type=int, default=8)
+    ap.add_argument("--requests", type=int, default=40)
+    ap.add_argument("--seed", type=int, default=int(time.time()))
+    ap.add_argument("--sigint", action="store_true", help="interrupt the server at a random point")
+    args = ap.parse_args()
+
+    print("stress: seed %d, %d clients x %d requests%s%s" % (args.seed, args.clients, args.requests,
+                                                           ", random SIGINT" if args.sigint else "",
+                                                           ", server " + args.server_args if args.server_args else ""))
+    rng = random.Random(args.seed)
+    port = free_port()
+    outdir = tempfile.mkdtemp(prefix="pcc_stress_")
+    server = subprocess.Popen([args.server] + args.server_args.split() + [str(port)], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    wait_listening(port, server)
+
+    stop = threading.Event()
+    clients = [Client(i, port, args.requests, rng.randrange(1 << 30), outdir, stop) for i in range(args.clients)]
+    for c in clients:
+        c.start()
+
+    if args.sigint:
+        time.sleep(rng.random() * 2.0)
+        server.send_signal(signal.SIGINT)
+        stop.set()
+    for c in clients:
+        c.join()
+    if not args.sigint:
+        server.send_signal(signal.SIGINT)
+
+    try:
+        out, _ = server.communicate(timeout=30)
+    except subprocess.TimeoutExpired:
+        server.kill()
+        sys.exit("Test Failed - server did not exit after SIGINT")
+
+    failed = False
+    if server.returncode != 0:
+        print("Test Failed - server exited with code %d" % server.returncode)
+        failed = True
+    errors = [e for c in clients for e in c.errors]
+    for e in errors:
+        print("Test Failed - " + e)
+    failed |= bool(errors)
+
+    completed = [p for c in clients for p in c.completed]
+    got = os.path.join(outdir, "server_stats.txt")
+    want = os.path.join(outdir, "expected_stats.txt")
+    with open(got, "w") as f:
+        f.write("".join(l + "\n" for l in out.decode(errors="replace").splitlines() if l.startswith("char '")))
+    with open(want, "w") as f:
+        # an empty list of files means all counts are zero
+        subprocess.run([sys.executable, os.path.join(HERE, "count_printable_per_char.py")] + completed,
+                       stdout=f, check=True)
+    if subprocess.run([sys.executable, os.path.join(HERE, "compare_counts.py"), got, want]).returncode != 0:
+        print("Test Failed - server totals do not match the %d acknowledged requests" % len(completed))
+        failed = True
+
+    if failed:
+        print("stress: FAILED (seed %d, files kept in %s)" % (args.seed, outdir))
+        sys.exit(1)
+    for p in completed + [got, want]:
+        os.unlink(p)
+    os.rmdir(outdir)
+    print("Test Passed - stress: %d acknowledged requests match the server totals" % len(completed))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,267 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../pcc_lib.h"
+#include "../pcc_proto.h"
+
+/*
+    client library test against running servers
+
+    test_lib [-n requests] [-c conns per server] [-i inflight] [-p pause ms] [-l least|p2c]
+             [-t timeout ms] [-e failures] <ip> <port> [<ip> <port> ...]
+
+    submits all requests at once (random payloads and tenants) and checks every count,
+    then the blocking calls: pcc_count_buf, pcc_count_fd on a file and a pipe, pcc_count_sample_fd,
+    pcc_count_stream_fd, pcc_query.
+    with -p half of the requests go out, then it sleeps so kept connections go idle and get
+    closed by the server before the other half.
+    some of the servers may be down or never answer, -e is how many requests (and checks) may
+    fail then (counts that reached a server that stopped answering can't be retried). per server
+    stats go to stderr.
+    prints the expected server totals in the "char '%c' : %u times" format to stdout, for
+    compare_counts.py against the server's SIGINT output. problems go to stderr, exit 1.
+*/
+
+static uint64_t totals[PCC_NPRINTABLE];
+static long failures;
+
+struct job {
+    unsigned char *data;
+    size_t len;
+    uint64_t expected;
+};
+
+static uint64_t expect(const unsigned char *data, size_t len) {
+    uint64_t c = 0;
+    for (size_t i = 0; i < len; i++) c += data[i] >= PCC_FIRST_PRINTABLE && data[i] <= PCC_LAST_PRINTABLE;
+    return c;
+}
+
+static void account(const unsigned char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] >= PCC_FIRST_PRINTABLE && data[i] <= PCC_LAST_PRINTABLE) totals[data[i] - PCC_FIRST_PRINTABLE]++;
+    }
+}
+
+static void job_done(const struct pcc_result *res, void *arg) {
+    struct job *j = arg;
+    if (res->err != 0 || res->status != PCC_STATUS_OK || res->c != j->expected) {
+        fprintf(stderr, "request of %zu bytes: err %s status %u c %" PRIu64 " expected %" PRIu64 "\n", j->len,
+                res->err ? strerror(res->err) : "none", res->status, res->c, j->expected);
+        failures++;
+    } else {
+        account(j->data, j->len);
+    }
+    free(j->data);
+    free(j);
+}
+
+static struct job *make_job(void) {
+    struct job *j = malloc(sizeof(*j));
+    size_t sizes[] = {0, 1, 17, 1000, 4096, 65536};
+    j->len = sizes[rand() % 6] + (rand() % 2 ? rand() % 300 : 0);
+    j->data = malloc(j->len + 1);
+    int printable = rand() % 2;
+    for (size_t i = 0; i < j->len; i++) j->data[i] = printable ? 32 + rand() % 95 : rand();
+    j->expected = expect(j->data, j->len);
+    return j;
+}
+
+static void submit_jobs(struct pcc_ctx *ctx, long n) {
+    char tenant[32];
+    for (long i = 0; i < n; i++) {
+        struct job *j = make_job();
+        snprintf(tenant, sizeof(tenant), "lib-%d", rand() % 4);
+        if (pcc_submit_buf(ctx, j->data, j->len, rand() % 3 ? tenant : NULL, job_done, j) < 0) {
+            fprintf(stderr, "submit: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+}
+
+static void drain(struct pcc_ctx *ctx) {
+    while (pcc_pending(ctx) > 0) {
+        if (pcc_poll(ctx, 1000) < 0) {
+            fprintf(stderr, "poll: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+}
+
+static void check_blocking(struct pcc_ctx *ctx) {
+    const char *text = "hello, library\n\x01\x02";
+    uint64_t c;
+
+    if (pcc_count_buf(ctx, text, strlen(text), "lib-0", &c) < 0 || c != 14) {
+        fprintf(stderr, "pcc_count_buf: %s, c %" PRIu64 "\n", strerror(errno), c);
+        failures++;
+    } else {
+        account((const unsigned char *)text, strlen(text));
+    }
+
+    // a file from a non zero offset
+    char path[] = "/tmp/pcc_test_lib_XXXXXX";
+    int fd = mkstemp(path);
+    unlink(path);
+    if (fd < 0 || write(fd, text, strlen(text)) != (ssize_t)strlen(text) || lseek(fd, 7, SEEK_SET) != 7) {
+        fprintf(stderr, "temp file: %s\n", strerror(errno));
+        exit(1);
+    }
+    if (pcc_count_fd(ctx, fd, NULL, &c) < 0 || c != 7 || lseek(fd, 0, SEEK_CUR) != 7) {
+        fprintf(stderr, "pcc_count_fd (file): %s, c %" PRIu64 "\n", strerror(errno), c);
+        failures++;
+    } else {
+        account((const unsigned char *)text + 7, strlen(text) - 7);
+    }
+    // a sample of every block is exact, the estimate goes to the server's estimated totals
+    // only. the file is at offset 7 again
+    struct pcc_sample all = {.rate = 1, .block = 4};
+    uint64_t ci;
+    if (pcc_count_sample_fd(ctx, fd, NULL, &all, &c, &ci) < 0 || c != 7 || ci != 0) {
+        fprintf(stderr, "pcc_count_sample_fd: %s, c %" PRIu64 " ci %" PRIu64 "\n", strerror(errno), c, ci);
+        failures++;
+    }
+
+    // a stream: the whole file, a refused append at the wrong offset, then the rest after
+    // the file grew. the stream id is per run so earlier runs don't get in the way
+    char stream[32];
+    uint64_t off = 0, total;
+    snprintf(stream, sizeof(stream), "lib-%d", (int)getpid());
+    if (pcc_count_stream_fd(ctx, fd, NULL, stream, &off, &total) < 0 || off != strlen(text) || total != 14) {
+        fprintf(stderr, "pcc_count_stream_fd: %s, offset %" PRIu64 " total %" PRIu64 "\n", strerror(errno), off, total);
+        failures++;
+    } else {
+        account((const unsigned char *)text, strlen(text));
+    }
+    off = 3;
+    if (pcc_count_stream_fd(ctx, fd, NULL, stream, &off, &total) == 0 || errno != ESPIPE || off != strlen(text)) {
+        fprintf(stderr, "pcc_count_stream_fd at a wrong offset: %s, offset %" PRIu64 "\n", strerror(errno), off);
+        failures++;
+    }
+    off = strlen(text);
+    if (pwrite(fd, "abc", 3, off) != 3 || pcc_count_stream_fd(ctx, fd, NULL, stream, &off, &total) < 0 ||
+        off != strlen(text) + 3 || total != 17) {
+        fprintf(stderr, "pcc_count_stream_fd append: %s, offset %" PRIu64 " total %" PRIu64 "\n", strerror(errno), off,
+                total);
+        failures++;
+    } else {
+        account((const unsigned char *)"abc", 3);
+    }
+    close(fd);
+
+    // a pipe has no size, the library reads it to the end first
+    int p[2];
+    if (pipe(p) < 0 || write(p[1], text, 5) != 5) {
+        fprintf(stderr, "pipe: %s\n", strerror(errno));
+        exit(1);
+    }
+    close(p[1]);
+    if (pcc_count_fd(ctx, p[0], "lib-1", &c) < 0 || c != 5) {
+        fprintf(stderr, "pcc_count_fd (pipe): %s, c %" PRIu64 "\n", strerror(errno), c);
+        failures++;
+    } else {
+        account((const unsigned char *)text, 5);
+    }
+    close(p[0]);
+
+    char *answer;
+    if (pcc_query(ctx, "tenants", &answer) < 0 || strstr(answer, "tenant lib-0 ") == NULL) {
+        fprintf(stderr, "pcc_query tenants: %s\n%s", strerror(errno), answer ? answer : "");
+        failures++;
+    }
+    free(answer);
+    if (pcc_query(ctx, "no such query", &answer) == 0 || errno != EINVAL || answer == NULL) {
+        fprintf(stderr, "pcc_query of a bad query did not fail with EINVAL\n");
+        failures++;
+    }
+    free(answer);
+}
+
+int main(int argc, char *argv[]) {
+    struct pcc_ctx_opts opts = {.conns_per_server = 2, .max_inflight = 16};
+    long requests = 2000;
+    int pause_ms = 0;
+    long max_failures = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:i:p:l:t:e:x:")) != -1) {
+        switch (opt) {
+        case 'n':
+            requests = atol(optarg);
+            break;
+        case 'c':
+            opts.conns_per_server = atoi(optarg);
+            break;
+        case 'i':
+            opts.max_inflight = atoi(optarg);
+            break;
+        case 'p':
+            pause_ms = atoi(optarg);
+            break;
+        case 'l':
+            opts.lb = strcmp(optarg, "p2c") == 0 ? PCC_LB_P2C : PCC_LB_LEAST;
+            break;
+        case 't':
+            opts.timeout_ms = atoi(optarg);
+            break;
+        case 'e':
+            max_failures = atol(optarg);
+            break;
+        case 'x':
+            opts.tls_ca = optarg;
+            break;
+        default:
+            fprintf(stderr, "Error: %s\n", strerror(EINVAL));
+            exit(1);
+        }
+    }
+    if (optind == argc || (argc - optind) % 2 != 0) {
+        fprintf(stderr, "Error: %s\n", strerror(EINVAL));
+        exit(1);
+    }
+
+    struct pcc_ctx *ctx = pcc_ctx_new(&opts);
+    for (int i = optind; i < argc; i += 2) {
+        if (ctx == NULL || pcc_ctx_add_server(ctx, argv[i], atoi(argv[i + 1])) < 0) {
+            fprintf(stderr, "Error adding server %s:%s: %s\n", argv[i], argv[i + 1], strerror(errno));
+            exit(1);
+        }
+    }
+
+    srand(1);
+    if (pause_ms > 0) {
+        submit_jobs(ctx, requests / 2);
+        drain(ctx);
+        struct timespec ts = {pause_ms / 1000, (pause_ms % 1000) * 1000000L};
+        nanosleep(&ts, NULL);
+        submit_jobs(ctx, requests - requests / 2);
+    } else {
+        submit_jobs(ctx, requests);
+    }
+    drain(ctx);
+    check_blocking(ctx);
+
+    for (int i = 0; i < pcc_ctx_servers(ctx); i++) {
+        struct pcc_server_stats st;
+        pcc_ctx_server_stats(ctx, i, &st);
+        fprintf(stderr, "test_lib: server %s:%s requests %" PRIu64 " failures %" PRIu64 " ejections %" PRIu64 "\n",
+                argv[optind + 2 * i], argv[optind + 2 * i + 1], st.requests, st.failures, st.ejections);
+    }
+    pcc_ctx_free(ctx);
+
+    for (int i = 0; i < PCC_NPRINTABLE; i++) {
+        if (totals[i] > 0) printf("char '%c' : %" PRIu64 " times\n", i + PCC_FIRST_PRINTABLE, totals[i]);
+    }
+    if (failures > max_failures) {
+        fprintf(stderr, "test_lib: %ld failures\n", failures);
+        return 1;
+    }
+    fprintf(stderr, "test_lib: %ld requests, %ld failed\n", requests, failures);
+    return 0;
+}
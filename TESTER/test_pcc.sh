@@ -3,17 +3,33 @@
 set -e
 cd "$(dirname "$0")"
 
-SERVER=./pcc_server
-CLIENT=./pcc_client
-PORT=3000
+# binaries come from the Makefile (make test sets these), default to the release build
+SERVER=${PCC_SERVER:-../build/release/pcc_server}
+CLIENT=${PCC_CLIENT:-../build/release/pcc_client}
+TEST_LIB=${PCC_TEST_LIB:-../build/release/test_lib}
+DUMP=${PCC_DUMP:-../build/release/pcc_dump}
+REPLAY=${PCC_REPLAY:-../build/release/pcc_replay}
+PORT=${PCC_PORT:-3000}
+HOST=${PCC_HOST:-127.0.0.1}
 SERVER_OUT=server_out.txt
 CLIENTS_OUT=clients_out.txt
 PYTHON=python3
 
-# Build server and client
-echo "Compiling server and client..."
-gcc -Wall -O2 -o pcc_server pcc_server.c
-gcc -Wall -O2 -o pcc_client pcc_client.c
+# Build server and client unless we were handed binaries
+if [ -z "$PCC_SERVER" ]; then
+    echo "Compiling server and client..."
+    make -C .. --no-print-directory > /dev/null
+fi
+
+# wait until something accepts connections on $PORT instead of guessing with sleep
+wait_for_server() {
+    for _ in $(seq 200); do
+        if (exec 3<>/dev/tcp/$HOST/$PORT) 2>/dev/null; then return 0; fi
+        sleep 0.05
+    done
+    echo "Server did not start listening on $HOST:$PORT"
+    exit 1
+}
 
 # Clean up from previous runs
 rm -f $SERVER_OUT $CLIENTS_OUT testfile_*
@@ -31,12 +47,12 @@ head -c 1000 < /dev/zero | tr '\0' '\1' > testfile_1000nonprint
 # Start server in background
 $SERVER $PORT > $SERVER_OUT 2>&1 &
 SERVER_PID=$!
-sleep 1
+wait_for_server
 
 run_client() {
     local file=$1
     local expected=$2
-    $CLIENT 10.0.2.15 $PORT $file > client_out_tmp 2>&1
+    $CLIENT $HOST $PORT $file > client_out_tmp 2>&1
     local got=$(grep -o '[0-9]\+' client_out_tmp | tail -1)
     if [ "$got" != "$expected" ]; then
         echo "Test Failed - $file: expected $expected, got $got"
@@ -68,6 +84,27 @@ for file in "${ALL_TESTS[@]}"; do
     run_client "$file" "$expected"
 done
 
+echo "=================================================="
+echo "Running query bound tests..."
+
+# a count that is negative or doesn't fit is refused, and the server stays up for the next
+# query. only queries here, the totals checked below don't change
+QUERY_OK=1
+for q in tenants bigrams; do
+    for k in -1 99999999999999999999 12abc abc; do
+        if $CLIENT -q "$q $k" $HOST $PORT > /dev/null 2>&1; then QUERY_OK=0; fi
+    done
+done
+$CLIENT -q "tenants 1" $HOST $PORT | grep -c "^tenant " | grep -qx 1 || QUERY_OK=0
+$CLIENT -q "bigrams 99999" $HOST $PORT | grep -q "^# bigrams " || QUERY_OK=0
+if [ $QUERY_OK -eq 1 ]; then
+    echo "Test Passed - query bounds"
+else
+    echo "Test Failed - query bounds"
+    kill $SERVER_PID
+    exit 1
+fi
+
 echo "=================================================="
 echo "Checking server stats after all client tests..."
 
@@ -89,8 +126,8 @@ echo "Running Special SIGINT during large transfer test..."
 # Special test: SIGINT during large transfer
 $SERVER $PORT > server_out_sigint.txt 2>&1 &
 SERVER_PID2=$!
-sleep 1
-$CLIENT 10.0.2.15 $PORT testfile_large_printable > /dev/null 2>&1 &
+wait_for_server
+$CLIENT $HOST $PORT testfile_large_printable > /dev/null 2>&1 &
 CLIENT_PID2=$!
 sleep 0.5
 kill -INT $SERVER_PID2 2>/dev/null || true
@@ -106,10 +143,748 @@ else
     echo "Test Failed - Special SIGINT test, Output does not match expected (per-character only)"
 fi
 
+echo "=================================================="
+echo "Running client library tests..."
+
+# pipelined keep-alive connections, keep-alive turned off, and kept connections that go
+# idle and get closed by the server halfway through
+LIB_OK=1
+run_lib_test() {
+    local server_args=$1
+    shift
+    $SERVER $server_args $PORT > server_out_lib.txt 2>&1 &
+    local pid=$!
+    wait_for_server
+    if ! $TEST_LIB "$@" $HOST $PORT > tmp_lib_expected.txt; then LIB_OK=0; fi
+    kill -INT $pid 2>/dev/null || true
+    wait $pid 2>/dev/null || true
+    grep "char '" server_out_lib.txt | sort > tmp_lib_server.txt
+    sort -o tmp_lib_expected.txt tmp_lib_expected.txt
+    if $PYTHON compare_counts.py tmp_lib_server.txt tmp_lib_expected.txt; then
+        echo "Test Passed - client library, server $server_args, test_lib $*"
+    else
+        echo "Test Failed - client library, server $server_args, test_lib $*"
+        LIB_OK=0
+    fi
+}
+run_lib_test "-w 2" -n 3000
+run_lib_test "-w 1 -k 0" -n 300
+run_lib_test "-w 2 -k 100" -n 1000 -p 300
+run_lib_test "-w 2 -n cork -Q -D 5" -n 1000 -p 300
+
+# several servers: two real ones, a port nothing listens on and one that never answers
+# (listens but never accepts). the refused requests are retried on the others, the ones
+# stuck on the silent server time out, only those may fail
+run_lib_multi_test() {
+    local lb=$1
+    $SERVER -w 2 $PORT > server_out_lib.txt 2>&1 &
+    local pid1=$!
+    $SERVER -w 2 $((PORT + 1)) > server_out_lib2.txt 2>&1 &
+    local pid2=$!
+    $PYTHON -c "import socket, time; s = socket.socket(); s.bind(('$HOST', $((PORT + 3)))); s.listen(64); time.sleep(60)" &
+    local pid3=$!
+    wait_for_server
+    if ! $TEST_LIB -l $lb -t 300 -e 20 -n 3000 $HOST $PORT $HOST $((PORT + 1)) $HOST $((PORT + 2)) $HOST $((PORT + 3)) \
+        > tmp_lib_expected.txt; then
+        LIB_OK=0
+    fi
+    kill -INT $pid1 $pid2 2>/dev/null || true
+    wait $pid1 $pid2 2>/dev/null || true
+    kill $pid3 2>/dev/null || true
+    wait $pid3 2>/dev/null || true
+    cat server_out_lib.txt server_out_lib2.txt | $PYTHON -c '
+import collections, re, sys
+total = collections.Counter()
+for line in sys.stdin:
+    m = re.match(r"char (.*) : (\d+) times", line)
+    if m:
+        total[m.group(1)] += int(m.group(2))
+for c in sorted(total):
+    print("char %s : %d times" % (c, total[c]))' | sort > tmp_lib_server.txt
+    sort -o tmp_lib_expected.txt tmp_lib_expected.txt
+    if $PYTHON compare_counts.py tmp_lib_server.txt tmp_lib_expected.txt; then
+        echo "Test Passed - client library failover, $lb"
+    else
+        echo "Test Failed - client library failover, $lb"
+        LIB_OK=0
+    fi
+}
+run_lib_multi_test least
+run_lib_multi_test p2c
+
+echo "=================================================="
+echo "Running sampled counting tests..."
+
+# every block sent must be exact, a tenth of them must be within the confidence interval
+# (3 of them, so a correct estimate practically never fails). estimates never reach the
+# server's exact totals
+$PYTHON -c "import random; random.seed(7); open('testfile_sample', 'wb').write(bytes(random.choice(b'abcdefgh \x00\x01') for _ in range(3000017)))"
+$SERVER -w 2 $PORT > server_out_sample.txt 2>&1 &
+SAMPLE_PID=$!
+wait_for_server
+$CLIENT -S 1 $HOST $PORT testfile_sample > tmp_sample_all.txt || LIB_OK=0
+$CLIENT -S 0.1 -B 16384 -R $HOST $PORT testfile_sample > tmp_sample_part.txt || LIB_OK=0
+kill -INT $SAMPLE_PID 2>/dev/null || true
+wait $SAMPLE_PID 2>/dev/null || true
+$PYTHON count_printable_per_char.py testfile_sample > tmp_expected_sample.txt
+sed -n "s/^\(char '.*'\) : \([0-9]*\) +- 0 times$/\1 : \2 times/p" tmp_sample_all.txt | sort > tmp_sample_server.txt
+if $PYTHON compare_counts.py tmp_sample_server.txt tmp_expected_sample.txt; then
+    echo "Test Passed - sampled counting, every block"
+else
+    echo "Test Failed - sampled counting, every block"
+    LIB_OK=0
+fi
+if $PYTHON -c "
+import re, sys
+data = open('testfile_sample', 'rb').read()
+true_c = sum(1 for b in data if 32 <= b < 127)
+est, ci = map(int, re.search(r': (\d+) \+- (\d+) \(estimated\)', open('tmp_sample_part.txt').read()).groups())
+sys.exit(0 if 0 < ci < true_c and abs(est - true_c) <= 3 * ci else 1)
+" && grep -q "^estimated 'a' : " server_out_sample.txt && ! grep -q "^char '" server_out_sample.txt; then
+    echo "Test Passed - sampled counting, a tenth of the blocks"
+else
+    echo "Test Failed - sampled counting, a tenth of the blocks"
+    LIB_OK=0
+fi
+
+echo "=================================================="
+echo "Running append (tail) mode tests..."
+
+# a file that grows between runs: every run sends only the new bytes and prints the count
+# of the whole file, the server totals see every byte once. then the file is replaced by
+# a shorter one, which is counted from the start
+$SERVER -w 2 $PORT > server_out_append.txt 2>&1 &
+APPEND_PID=$!
+wait_for_server
+rm -f tmp_append.state testfile_append
+: > testfile_append
+APPEND_OK=1
+for i in 1 2 3 4 5; do
+    $PYTHON -c "import random, sys; random.seed($i); sys.stdout.buffer.write(bytes(random.randrange(256) for _ in range($i * 5000)))" >> testfile_append
+    expected=$($PYTHON -c "print(sum(1 for b in open('testfile_append', 'rb').read() if 32 <= b < 127))")
+    got=$($CLIENT -a tmp_append.state $HOST $PORT testfile_append | awk '{print $NF}')
+    [ "$got" = "$expected" ] || APPEND_OK=0
+done
+stream_id=$(awk '{print $2}' tmp_append.state)
+$CLIENT -q "stream $stream_id" $HOST $PORT | head -1 > tmp_append_stream.txt
+grep -q "offset $(stat -c %s testfile_append) .* appends 5 restarts 0" tmp_append_stream.txt || APPEND_OK=0
+cp testfile_append tmp_append_all
+printf 'short\n' > testfile_append.new && mv testfile_append.new testfile_append
+[ "$($CLIENT -a tmp_append.state $HOST $PORT testfile_append 2>/dev/null | awk '{print $NF}')" = "5" ] || APPEND_OK=0
+kill -INT $APPEND_PID 2>/dev/null || true
+wait $APPEND_PID 2>/dev/null || true
+$PYTHON count_printable_per_char.py tmp_append_all testfile_append > tmp_expected_append.txt
+grep "char '" server_out_append.txt | sort > tmp_append_server.txt
+if [ $APPEND_OK -eq 1 ] && $PYTHON compare_counts.py tmp_append_server.txt tmp_expected_append.txt; then
+    echo "Test Passed - append mode"
+else
+    echo "Test Failed - append mode"
+    LIB_OK=0
+fi
+
+echo "=================================================="
+echo "Running TLS tests..."
+
+# a self-signed certificate for 127.0.0.1 is its own CA. the basic client and the library
+# (pipelined, keep-alive, streams) over TLS must count as without it, a client that trusts
+# another certificate must fail the handshake and send nothing
+openssl req -x509 -newkey rsa:2048 -nodes -keyout tmp_tls.key -out tmp_tls.crt -days 1 \
+    -subj /CN=$HOST -addext subjectAltName=IP:$HOST > /dev/null 2>&1
+openssl req -x509 -newkey rsa:2048 -nodes -keyout tmp_tls_other.key -out tmp_tls_other.crt -days 1 \
+    -subj /CN=$HOST -addext subjectAltName=IP:$HOST > /dev/null 2>&1
+run_lib_test "-w 2 -C tmp_tls.crt -K tmp_tls.key" -x tmp_tls.crt -n 1000
+$SERVER -w 2 -C tmp_tls.crt -K tmp_tls.key $PORT > server_out_tls.txt 2>&1 &
+TLS_PID=$!
+wait_for_server
+TLS_OK=1
+for f in testfile_large_printable testfile_all_ascii testfile_empty; do
+    expected=$($PYTHON -c "print(sum(1 for b in open('$f', 'rb').read() if 32 <= b < 127))")
+    [ "$($CLIENT -x tmp_tls.crt $HOST $PORT $f | awk '{print $NF}')" = "$expected" ] || TLS_OK=0
+done
+if $CLIENT -x tmp_tls_other.crt $HOST $PORT testfile_1000A > /dev/null 2>&1; then TLS_OK=0; fi
+$CLIENT -x tmp_tls.crt -q workers $HOST $PORT > tmp_tls_workers.txt || TLS_OK=0
+grep -q " tls " tmp_tls_workers.txt || TLS_OK=0
+kill -INT $TLS_PID 2>/dev/null || true
+wait $TLS_PID 2>/dev/null || true
+$PYTHON count_printable_per_char.py testfile_large_printable testfile_all_ascii > tmp_expected_tls.txt
+grep "char '" server_out_tls.txt | sort > tmp_tls_server.txt
+if [ $TLS_OK -eq 1 ] && $PYTHON compare_counts.py tmp_tls_server.txt tmp_expected_tls.txt; then
+    echo "Test Passed - TLS"
+else
+    echo "Test Failed - TLS"
+    LIB_OK=0
+fi
+
+echo "=================================================="
+echo "Running UNIX socket and shared memory ring tests..."
+
+# basic frames over the UNIX socket, and files through the ring, one bigger than the ring
+# so it wraps around while the server counts. the totals must see every byte once
+$SERVER -w 2 -u tmp_pcc.sock $PORT > server_out_unix.txt 2>&1 &
+UNIX_PID=$!
+wait_for_server
+head -c 6000000 </dev/urandom > testfile_ring
+UNIX_OK=1
+for f in testfile_printable testfile_all_ascii; do
+    expected=$($PYTHON -c "print(sum(1 for b in open('$f', 'rb').read() if 32 <= b < 127))")
+    [ "$($CLIENT -u tmp_pcc.sock $f | awk '{print $NF}')" = "$expected" ] || UNIX_OK=0
+done
+ring_files="testfile_ring testfile_empty testfile_large_printable testfile_1000A"
+$CLIENT -u tmp_pcc.sock -m -t ring $ring_files > tmp_ring_out.txt || UNIX_OK=0
+for f in $ring_files; do
+    expected=$($PYTHON -c "print(sum(1 for b in open('$f', 'rb').read() if 32 <= b < 127))")
+    grep -qx "# of printable characters in $f: $expected" tmp_ring_out.txt || UNIX_OK=0
+done
+# doorbells that are pipes are refused, a blocking read of one would hang the worker
+$PYTHON -c "
+import fcntl, os, socket, struct
+memfd = os.memfd_create('ring', os.MFD_ALLOW_SEALING)
+os.ftruncate(memfd, 8192)
+os.pwrite(memfd, struct.pack('=IIQ', 0x50434352, 1, 4096), 0)
+fcntl.fcntl(memfd, fcntl.F_ADD_SEALS, fcntl.F_SEAL_SHRINK)
+r, w = os.pipe()
+s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+s.connect('tmp_pcc.sock')
+frame = struct.pack('!IBBHIQ', 0xFFFFFFFF, 1, 4, 0, 0, 0)
+s.sendmsg([frame], [(socket.SOL_SOCKET, socket.SCM_RIGHTS, struct.pack('3i', memfd, r, w))])
+rep = b''
+while len(rep) < 16:
+    b = s.recv(16 - len(rep))
+    assert b
+    rep += b
+version, status, flags, body_len, c = struct.unpack('!BBHIQ', rep)
+assert status != 0 and b'bad ring' in s.recv(body_len)
+" || UNIX_OK=0
+$CLIENT -q "tenant ring" $HOST $PORT | grep -q "requests 4 " || UNIX_OK=0
+kill -INT $UNIX_PID 2>/dev/null || true
+wait $UNIX_PID 2>/dev/null || true
+[ ! -e tmp_pcc.sock ] || UNIX_OK=0
+$PYTHON count_printable_per_char.py testfile_printable testfile_all_ascii $ring_files > tmp_expected_unix.txt
+grep "char '" server_out_unix.txt | sort > tmp_unix_server.txt
+if [ $UNIX_OK -eq 1 ] && $PYTHON compare_counts.py tmp_unix_server.txt tmp_expected_unix.txt; then
+    echo "Test Passed - UNIX socket and shared memory ring"
+else
+    echo "Test Failed - UNIX socket and shared memory ring"
+    LIB_OK=0
+fi
+
+echo "=================================================="
+echo "Running multiple listener tests..."
+
+# the port, an IPv6 one, a dual-stack one and a UNIX socket on one server: every file
+# through every one of them lands in the same totals, and IPv6 peers are their own tenant
+if $PYTHON -c "import socket; socket.socket(socket.AF_INET6).bind(('::1', 0))" 2>/dev/null; then
+    PORT6=$((PORT + 1))
+    PORT46=$((PORT + 2))
+    $SERVER -w 2 -l "[::1]:$PORT6" --listen "*:$PORT46" -u tmp_pcc_l.sock $PORT > server_out_listen.txt 2>&1 &
+    LISTEN_PID=$!
+    wait_for_server
+    LISTEN_OK=1
+    listen_files=""
+    for f in testfile_printable testfile_bin testfile_1000A; do
+        expected=$($PYTHON -c "print(sum(1 for b in open('$f', 'rb').read() if 32 <= b < 127))")
+        for to in "127.0.0.1 $PORT" "::1 $PORT6" "127.0.0.1 $PORT46" "::1 $PORT46"; do
+            [ "$($CLIENT $to $f | awk '{print $NF}')" = "$expected" ] || LISTEN_OK=0
+            listen_files="$listen_files $f"
+        done
+        [ "$($CLIENT -u tmp_pcc_l.sock $f | awk '{print $NF}')" = "$expected" ] || LISTEN_OK=0
+        listen_files="$listen_files $f"
+    done
+    # the client library over IPv6, spread over both IPv6 listeners
+    $CLIENT -t v6 -s "[::1]:$PORT46" ::1 $PORT6 testfile_large_printable testfile_1000A > /dev/null || LISTEN_OK=0
+    listen_files="$listen_files testfile_large_printable testfile_1000A"
+    $CLIENT -q "tenant ::1" ::1 $PORT6 | grep -q "^# tenant ::1 requests 6 " || LISTEN_OK=0
+    $CLIENT -q "tenant 127.0.0.1" $HOST $PORT | grep -q "^# tenant 127.0.0.1 requests 6 " || LISTEN_OK=0
+    $CLIENT -q listeners $HOST $PORT > tmp_listeners.txt || LISTEN_OK=0
+    grep -q "^listener 0 \[::1\]:$PORT6 accepted " tmp_listeners.txt || LISTEN_OK=0
+    grep -q "^listener 2 unix:tmp_pcc_l.sock accepted 3$" tmp_listeners.txt || LISTEN_OK=0
+    grep -q "^listener 3 0.0.0.0:$PORT accepted " tmp_listeners.txt || LISTEN_OK=0
+    if $SERVER -l "bogus" $PORT > /dev/null 2>&1; then LISTEN_OK=0; fi
+    kill -INT $LISTEN_PID 2>/dev/null || true
+    wait $LISTEN_PID 2>/dev/null || true
+    [ ! -e tmp_pcc_l.sock ] || LISTEN_OK=0
+    $PYTHON count_printable_per_char.py $listen_files > tmp_expected_listen.txt
+    grep "char '" server_out_listen.txt | sort > tmp_listen_server.txt
+    if [ $LISTEN_OK -eq 1 ] && $PYTHON compare_counts.py tmp_listen_server.txt tmp_expected_listen.txt; then
+        echo "Test Passed - multiple listeners"
+    else
+        echo "Test Failed - multiple listeners"
+        cat tmp_listeners.txt
+        LIB_OK=0
+    fi
+else
+    echo "Test Skipped - multiple listeners, no IPv6 loopback"
+fi
+
+echo "=================================================="
+echo "Running counting pool tests..."
+
+# big requests are counted in chunks by the pool, small ones by the worker; both must land
+# in the totals exactly once, and a client that drops halfway through a big one must not
+$SERVER -w 2 -p 3 $PORT > server_out_pool.txt 2>&1 &
+POOL_PID=$!
+wait_for_server
+head -c 9000000 </dev/urandom > testfile_pool
+POOL_OK=1
+for f in testfile_pool testfile_large_printable; do
+    expected=$($PYTHON -c "print(sum(1 for b in open('$f', 'rb').read() if 32 <= b < 127))")
+    [ "$($CLIENT $HOST $PORT $f | awk '{print $NF}')" = "$expected" ] || POOL_OK=0
+done
+$CLIENT -t pool $HOST $PORT testfile_pool testfile_1000A > /dev/null || POOL_OK=0
+$PYTHON -c "
+import socket, struct
+s = socket.create_connection(('$HOST', $PORT))
+s.sendall(struct.pack('!I', 9000000) + open('testfile_pool', 'rb').read(3000000))
+s.close()
+"
+$CLIENT -q workers $HOST $PORT > tmp_pool_workers.txt || POOL_OK=0
+[ "$(awk '/^counter / {n += $4} END {print n}' tmp_pool_workers.txt)" -gt 0 ] || POOL_OK=0
+kill -INT $POOL_PID 2>/dev/null || true
+wait $POOL_PID 2>/dev/null || true
+$PYTHON count_printable_per_char.py testfile_pool testfile_large_printable testfile_pool testfile_1000A > tmp_expected_pool.txt
+grep "char '" server_out_pool.txt | sort > tmp_pool_server.txt
+if [ $POOL_OK -eq 1 ] && $PYTHON compare_counts.py tmp_pool_server.txt tmp_expected_pool.txt; then
+    echo "Test Passed - counting pool"
+else
+    echo "Test Failed - counting pool"
+    LIB_OK=0
+fi
+
+echo "=================================================="
+echo "Running write mode tests..."
+
+# the basic client in every mode against servers in every mode, and replies with a body
+# (header and body written apart) on a kept connection
+NET_OK=1
+NET_FILES=""
+for server_mode in nagle nodelay cork more; do
+    $SERVER -n $server_mode -Q $PORT > server_out_net.txt 2>&1 &
+    NET_PID=$!
+    wait_for_server
+    for mode in nagle nodelay cork more; do
+        for f in testfile_empty testfile_printable testfile_large_printable; do
+            expected=$($PYTHON -c "print(sum(1 for b in open('$f', 'rb').read() if 32 <= b < 127))")
+            [ "$($CLIENT -n $mode $HOST $PORT $f | awk '{print $NF}')" = "$expected" ] || NET_OK=0
+        done
+    done
+    $CLIENT -q "window -60 0" $HOST $PORT | grep -q "^# window" || NET_OK=0
+    kill -INT $NET_PID 2>/dev/null || true
+    wait $NET_PID 2>/dev/null || true
+done
+if $CLIENT -n fast $HOST $PORT testfile_printable > /dev/null 2>&1; then NET_OK=0; fi
+if [ $NET_OK -eq 1 ]; then
+    echo "Test Passed - write modes"
+else
+    echo "Test Failed - write modes"
+    LIB_OK=0
+fi
+
+echo "=================================================="
+echo "Running I/O backend tests..."
+
+# basic frames on the epoll and io_uring backends, big ones through the pool, an extended
+# frame after them on the same socket, and a client that drops halfway; a backend the
+# kernel doesn't have makes the server fail at startup and is skipped
+IO_OK=1
+for backend in epoll io_uring; do
+    $SERVER --io $backend -p 2 $PORT > server_out_io.txt 2>&1 &
+    IO_PID=$!
+    sleep 0.2
+    if ! kill -0 $IO_PID 2>/dev/null; then
+        grep -q "Error creating $backend backend" server_out_io.txt || IO_OK=0
+        echo "I/O backend $backend not available, skipped"
+        continue
+    fi
+    wait_for_server
+    for f in testfile_empty testfile_printable testfile_large_printable testfile_pool; do
+        expected=$($PYTHON -c "print(sum(1 for b in open('$f', 'rb').read() if 32 <= b < 127))")
+        [ "$($CLIENT $HOST $PORT $f | awk '{print $NF}')" = "$expected" ] || IO_OK=0
+    done
+    $CLIENT -t io $HOST $PORT testfile_1000A > /dev/null || IO_OK=0
+    $PYTHON -c "
+import socket, struct
+s = socket.create_connection(('$HOST', $PORT))
+s.sendall(struct.pack('!I', 9000000) + open('testfile_pool', 'rb').read(3000000))
+s.close()
+"
+    $CLIENT -q "tenants 5" $HOST $PORT | grep -q "^tenant io " || IO_OK=0
+    kill -INT $IO_PID 2>/dev/null || true
+    wait $IO_PID 2>/dev/null || true
+    $PYTHON count_printable_per_char.py testfile_empty testfile_printable testfile_large_printable testfile_pool testfile_1000A > tmp_expected_io.txt
+    grep "char '" server_out_io.txt | sort > tmp_io_server.txt
+    $PYTHON compare_counts.py tmp_io_server.txt tmp_expected_io.txt > /dev/null || IO_OK=0
+done
+if $SERVER --io select $PORT > /dev/null 2>&1; then IO_OK=0; fi
+if [ $IO_OK -eq 1 ]; then
+    echo "Test Passed - I/O backends"
+else
+    echo "Test Failed - I/O backends"
+    LIB_OK=0
+fi
+
+echo "=================================================="
+echo "Running snapshot tests..."
+
+# the snapshot saved after SIGINT holds what the server printed, in every export format.
+# a server loaded from it goes on from there, totals and tenants, and a snapshot with one
+# byte flipped loads nowhere
+$SERVER -w 2 --snapshot tmp_snap.bin $PORT > server_out_snap.txt 2>&1 &
+SNAP_PID=$!
+wait_for_server
+SNAP_OK=1
+$CLIENT -t snap $HOST $PORT testfile_1000A > /dev/null || SNAP_OK=0
+$CLIENT $HOST $PORT testfile_large_printable > /dev/null || SNAP_OK=0
+$CLIENT -q snapshot $HOST $PORT | grep -q "^# snapshot tmp_snap.bin" || SNAP_OK=0
+kill -INT $SNAP_PID 2>/dev/null || true
+wait $SNAP_PID 2>/dev/null || true
+grep "char '" server_out_snap.txt | sort > tmp_snap_server.txt
+$DUMP tmp_snap.bin | grep "char '" | sort > tmp_snap_dump.txt || SNAP_OK=0
+cmp -s tmp_snap_server.txt tmp_snap_dump.txt || SNAP_OK=0
+$DUMP -f csv tmp_snap.bin | grep -q '^tenant,"snap",65,1000$' || SNAP_OK=0
+$DUMP -f json tmp_snap.bin | $PYTHON -c "
+import json, sys
+d = json.load(sys.stdin)
+assert d['requests'] == 2 and d['totals']['65'] >= 1000
+assert [t['bytes'] for t in d['tenants'] if t['id'] == 'snap'] == [1000]
+" || SNAP_OK=0
+
+$SERVER -w 2 --load tmp_snap.bin -S tmp_snap.bin $PORT > server_out_snap.txt 2>&1 &
+SNAP_PID=$!
+wait_for_server
+$CLIENT -t snap $HOST $PORT testfile_1000A > /dev/null || SNAP_OK=0
+$CLIENT -q "tenant snap" $HOST $PORT | grep -q "^# tenant snap requests 2 bytes 2000 " || SNAP_OK=0
+kill -INT $SNAP_PID 2>/dev/null || true
+wait $SNAP_PID 2>/dev/null || true
+grep -q "^loaded snapshot tmp_snap.bin: 2 requests" server_out_snap.txt || SNAP_OK=0
+[ "$($DUMP tmp_snap.bin | grep '^# requests' | awk '{print $3}')" = "3" ] || SNAP_OK=0
+
+# snapshot queries of many workers at once all succeed, leave no temporary file behind
+# and publish a snapshot that loads
+$SERVER -w 8 --snapshot tmp_snap_race.bin $PORT > server_out_snap_race.txt 2>&1 &
+SNAP_PID=$!
+wait_for_server
+$CLIENT -t race $HOST $PORT testfile_1000A > /dev/null || SNAP_OK=0
+RACE_PIDS=""
+for i in $(seq 8); do
+    (for j in $(seq 30); do $CLIENT -q snapshot $HOST $PORT; done > tmp_snap_race_$i.txt 2>&1) &
+    RACE_PIDS="$RACE_PIDS $!"
+done
+wait $RACE_PIDS
+[ "$(cat tmp_snap_race_*.txt | grep -c "^# snapshot tmp_snap_race.bin")" = "240" ] || SNAP_OK=0
+kill -INT $SNAP_PID 2>/dev/null || true
+wait $SNAP_PID 2>/dev/null || true
+ls tmp_snap_race.bin.* > /dev/null 2>&1 && SNAP_OK=0
+$SERVER --load tmp_snap_race.bin $PORT > server_out_snap_race.txt 2>&1 &
+SNAP_PID=$!
+wait_for_server
+$CLIENT -q "tenant race" $HOST $PORT | grep -q "^# tenant race requests 1 bytes 1000 " || SNAP_OK=0
+kill -INT $SNAP_PID 2>/dev/null || true
+wait $SNAP_PID 2>/dev/null || true
+grep -q "^loaded snapshot tmp_snap_race.bin" server_out_snap_race.txt || SNAP_OK=0
+
+$PYTHON -c "
+b = bytearray(open('tmp_snap.bin', 'rb').read())
+b[len(b) // 2] ^= 1
+open('tmp_snap_bad.bin', 'wb').write(b)
+"
+if $SERVER --load tmp_snap_bad.bin $PORT > /dev/null 2>&1; then SNAP_OK=0; fi
+if $DUMP tmp_snap_bad.bin > /dev/null 2>&1; then SNAP_OK=0; fi
+
+$PYTHON count_printable_per_char.py testfile_1000A testfile_large_printable testfile_1000A > tmp_expected_snap.txt
+grep "char '" server_out_snap.txt | sort > tmp_snap_server.txt
+if [ $SNAP_OK -eq 1 ] && $PYTHON compare_counts.py tmp_snap_server.txt tmp_expected_snap.txt; then
+    echo "Test Passed - snapshots"
+else
+    echo "Test Failed - snapshots"
+    LIB_OK=0
+fi
+
+echo "=================================================="
+echo "Running capture and replay tests..."
+
+# basic, tenant, query and pipelined keep-alive traffic with streams, captured with its
+# payloads. replayed as fast as possible and at (four times) its pace against fresh
+# servers, every reply and the totals must be the same. captured without payloads the
+# replay makes them up, and a trace cut in the middle of a record replays up to there
+REPLAY_OK=1
+$SERVER -w 2 --capture tmp_trace.bin --capture-payloads $PORT > server_out_trace.txt 2>&1 &
+TRACE_PID=$!
+wait_for_server
+$CLIENT $HOST $PORT testfile_large_printable > /dev/null || REPLAY_OK=0
+$CLIENT -t trace $HOST $PORT testfile_bin > /dev/null || REPLAY_OK=0
+$CLIENT -q "tenants" $HOST $PORT > /dev/null || REPLAY_OK=0
+$TEST_LIB -n 300 -p 100 $HOST $PORT > /dev/null || REPLAY_OK=0
+kill -INT $TRACE_PID 2>/dev/null || true
+wait $TRACE_PID 2>/dev/null || true
+grep "char '" server_out_trace.txt | sort > tmp_trace_server.txt
+
+for mode in -f "-s 4"; do
+    $SERVER -w 2 $PORT > server_out_trace.txt 2>&1 &
+    TRACE_PID=$!
+    wait_for_server
+    $REPLAY $mode tmp_trace.bin $HOST $PORT > tmp_replay_out.txt || REPLAY_OK=0
+    grep -q "^0 replies differ, 0 errors" tmp_replay_out.txt || REPLAY_OK=0
+    kill -INT $TRACE_PID 2>/dev/null || true
+    wait $TRACE_PID 2>/dev/null || true
+    grep "char '" server_out_trace.txt | sort > tmp_replay_server.txt
+    cmp -s tmp_trace_server.txt tmp_replay_server.txt || REPLAY_OK=0
+done
+
+$SERVER --capture tmp_trace.bin $PORT > server_out_trace.txt 2>&1 &
+TRACE_PID=$!
+wait_for_server
+$CLIENT $HOST $PORT testfile_large_printable > /dev/null || REPLAY_OK=0
+kill -INT $TRACE_PID 2>/dev/null || true
+wait $TRACE_PID 2>/dev/null || true
+[ "$(stat -c %s tmp_trace.bin)" -lt 1000 ] || REPLAY_OK=0
+head -c -8 tmp_trace.bin > tmp_trace_cut.bin
+$SERVER $PORT > server_out_trace.txt 2>&1 &
+TRACE_PID=$!
+wait_for_server
+$REPLAY -f tmp_trace.bin $HOST $PORT | grep -q "^replayed 2 connections, 1 frames (0 skipped)" || REPLAY_OK=0
+$REPLAY -f tmp_trace_cut.bin $HOST $PORT 2>&1 | grep -q "middle of a record" || REPLAY_OK=0
+kill -INT $TRACE_PID 2>/dev/null || true
+wait $TRACE_PID 2>/dev/null || true
+
+if [ $REPLAY_OK -eq 1 ]; then
+    echo "Test Passed - capture and replay"
+else
+    echo "Test Failed - capture and replay"
+    cat tmp_replay_out.txt
+    LIB_OK=0
+fi
+
+echo "=================================================="
+echo "Running n-gram tests..."
+
+# bigrams of text, random bytes and random printables, every read of the server a 1024
+# byte chunk so many of them cross one: exactly those of a byte by byte count. the
+# server's sketch never estimates a trigram below its count, and the chars still add up
+NGRAM_OK=1
+$SERVER $PORT > server_out_ngram.txt 2>&1 &
+NGRAM_PID=$!
+wait_for_server
+cp ../pcc_server.c testfile_text
+for f in testfile_text testfile_bin testfile_large_printable; do
+    $CLIENT -g 2 $HOST $PORT $f > tmp_ngram_out.txt || NGRAM_OK=0
+    grep "^bigram '" tmp_ngram_out.txt | sort > tmp_ngram_got.txt
+    $PYTHON -c "
+import collections
+d = open('$f', 'rb').read()
+c = collections.Counter(d[i:i + 2] for i in range(len(d) - 1) if 32 <= d[i] < 127 and 32 <= d[i + 1] < 127)
+print('# bigrams %d' % sum(c.values()))
+for b in sorted(c): print(\"bigram '%s' : %d times\" % (b.decode(), c[b]))
+" > tmp_ngram_expected.txt
+    grep "^# bigrams" tmp_ngram_out.txt | cmp -s - <(head -1 tmp_ngram_expected.txt) || NGRAM_OK=0
+    tail -n +2 tmp_ngram_expected.txt | sort | cmp -s - tmp_ngram_got.txt || NGRAM_OK=0
+done
+$CLIENT -g 3 $HOST $PORT testfile_text | grep -q "^sketch 3 " || NGRAM_OK=0
+for t in the int "  *" "); "; do
+    expected=$($PYTHON -c "d = open('testfile_text', 'rb').read(); print(sum(d[i:i + 3] == b'$t' for i in range(len(d))))")
+    got=$($CLIENT -q "trigram $t" $HOST $PORT | awk '/^trigram/ {print $(NF - 3)}')
+    [ -n "$got" ] && [ "$got" -ge "$expected" ] || NGRAM_OK=0
+done
+$CLIENT -q "bigrams 3" $HOST $PORT | grep -c "^bigram '" | grep -qx 3 || NGRAM_OK=0
+if $CLIENT -q "trigram ab" $HOST $PORT > /dev/null 2>&1; then NGRAM_OK=0; fi
+kill -INT $NGRAM_PID 2>/dev/null || true
+wait $NGRAM_PID 2>/dev/null || true
+$PYTHON count_printable_per_char.py testfile_text testfile_bin testfile_large_printable testfile_text > tmp_expected_ngram.txt
+grep "char '" server_out_ngram.txt | sort > tmp_ngram_server.txt
+if [ $NGRAM_OK -eq 1 ] && $PYTHON compare_counts.py tmp_ngram_server.txt tmp_expected_ngram.txt; then
+    echo "Test Passed - n-grams"
+else
+    echo "Test Failed - n-grams"
+    LIB_OK=0
+fi
+
+echo "=================================================="
+echo "Running resource budget tests..."
+
+# what a server uses before any client is its budget query's "used" (with the query's own
+# connection), every budget below is that plus a little room
+budget_used() {
+    $CLIENT -q budget $HOST $PORT | awk -v k=$1 '$2 == k {print $4}'
+}
+BUDGET_OK=1
+BUDGET_ARGS="-w 8 -p 1 --max-entries 4"
+$SERVER $BUDGET_ARGS --max-mem 1G --max-fds 1000 $PORT > server_out_budget.txt 2>&1 &
+BUDGET_PID=$!
+wait_for_server
+MEM0=$(budget_used memory)
+FDS0=$(budget_used fds)
+# more tenants than --max-entries: the lightest go
+for t in a b c d e f; do $CLIENT -t $t $HOST $PORT testfile_1000A > /dev/null || BUDGET_OK=0; done
+$CLIENT -q budget $HOST $PORT | grep -q "^budget tenants used 4 limit 4 evictions 2$" || BUDGET_OK=0
+kill -INT $BUDGET_PID 2>/dev/null || true
+wait $BUDGET_PID 2>/dev/null || true
+
+# no room for the pool's buffers (the worker counts instead) nor for n-gram tables (busy),
+# and fds for three connections: two of five get closed right away
+$SERVER $BUDGET_ARGS --max-mem $((MEM0 + 100000)) --max-fds $((FDS0 + 2)) $PORT > server_out_budget.txt 2>&1 &
+BUDGET_PID=$!
+wait_for_server
+expected=$($PYTHON -c "print(sum(1 for b in open('testfile_pool', 'rb').read() if 32 <= b < 127))")
+[ "$($CLIENT $HOST $PORT testfile_pool | awk '{print $NF}')" = "$expected" ] || BUDGET_OK=0
+if $CLIENT -g 2 $HOST $PORT testfile_text > /dev/null 2>&1; then BUDGET_OK=0; fi
+[ "$($PYTHON -c "
+import socket
+conns = [socket.create_connection(('$HOST', $PORT)) for _ in range(5)]
+shed = 0
+for s in conns:
+    s.settimeout(1)
+    try:
+        shed += s.recv(1) == b''
+    except socket.timeout:
+        pass
+print(shed)
+")" = 2 ] || BUDGET_OK=0
+$CLIENT -q budget $HOST $PORT > tmp_budget.txt || BUDGET_OK=0
+grep -q "^budget memory used $MEM0 limit $((MEM0 + 100000)) .* refused [1-9]" tmp_budget.txt || BUDGET_OK=0
+grep -q "^budget fds used $FDS0 limit $((FDS0 + 2)) peak $((FDS0 + 2)) refused 2 " tmp_budget.txt || BUDGET_OK=0
+$CLIENT -q workers $HOST $PORT | grep -q "^counter 0 chunks 0 " || BUDGET_OK=0
+kill -INT $BUDGET_PID 2>/dev/null || true
+wait $BUDGET_PID 2>/dev/null || true
+$PYTHON count_printable_per_char.py testfile_pool > tmp_expected_budget.txt
+grep "char '" server_out_budget.txt | sort > tmp_budget_server.txt
+$PYTHON compare_counts.py tmp_budget_server.txt tmp_expected_budget.txt || BUDGET_OK=0
+
+# room for the pool's buffers, which leave the budget near its limit: the worker gives
+# them back after the request
+$SERVER -w 1 -p 1 --max-mem 1G $PORT > server_out_budget.txt 2>&1 &
+BUDGET_PID=$!
+wait_for_server
+MEM0=$(budget_used memory)
+kill -INT $BUDGET_PID 2>/dev/null || true
+wait $BUDGET_PID 2>/dev/null || true
+$SERVER -w 1 -p 1 --max-mem $((MEM0 + 1200000)) $PORT > server_out_budget.txt 2>&1 &
+BUDGET_PID=$!
+wait_for_server
+$CLIENT $HOST $PORT testfile_pool > /dev/null || BUDGET_OK=0
+$CLIENT -q budget $HOST $PORT | grep -q "^budget memory used $MEM0 .* refused 0 released 1 " || BUDGET_OK=0
+if $SERVER -w 1 --max-mem 1K $PORT > /dev/null 2>&1; then BUDGET_OK=0; fi
+kill -INT $BUDGET_PID 2>/dev/null || true
+wait $BUDGET_PID 2>/dev/null || true
+# a payload capture grows out of the budget: a big frame gets traced without the part
+# that didn't fit, and is still counted
+CAPTURE_ARGS="-w 1 --capture tmp_budget_trace.bin --capture-payloads"
+$SERVER $CAPTURE_ARGS --max-mem 1G $PORT > server_out_budget.txt 2>&1 &
+BUDGET_PID=$!
+wait_for_server
+MEM0=$(budget_used memory)
+kill -INT $BUDGET_PID 2>/dev/null || true
+wait $BUDGET_PID 2>/dev/null || true
+$SERVER $CAPTURE_ARGS --max-mem $((MEM0 + 100000)) $PORT > server_out_budget.txt 2>&1 &
+BUDGET_PID=$!
+wait_for_server
+expected=$($PYTHON -c "print(sum(1 for b in open('testfile_pool', 'rb').read() if 32 <= b < 127))")
+[ "$($CLIENT $HOST $PORT testfile_pool | awk '{print $NF}')" = "$expected" ] || BUDGET_OK=0
+$CLIENT -q budget $HOST $PORT | grep -q "^budget memory used $MEM0 .* refused [1-9]" || BUDGET_OK=0
+kill -INT $BUDGET_PID 2>/dev/null || true
+wait $BUDGET_PID 2>/dev/null || true
+
+if [ $BUDGET_OK -eq 1 ]; then
+    echo "Test Passed - resource budgets"
+else
+    echo "Test Failed - resource budgets"
+    cat tmp_budget.txt
+    LIB_OK=0
+fi
+
+echo "=================================================="
+echo "Running payload checksum tests..."
+
+# files with their CRC32C, one big enough for the pool (which checksummed requests skip)
+# and one with n-grams. a raw frame with a wrong trailer is answered PCC_STATUS_CHECKSUM
+# and counted nowhere, the kept connection then takes a good one. the capture of it all
+# replays to the same replies and totals
+CRC_OK=1
+$SERVER -w 1 -p 1 --capture tmp_trace.bin --capture-payloads $PORT > server_out_crc.txt 2>&1 &
+CRC_PID=$!
+wait_for_server
+for f in testfile_pool testfile_1000A testfile_empty; do
+    expected=$($PYTHON -c "print(sum(1 for b in open('$f', 'rb').read() if 32 <= b < 127))")
+    [ "$($CLIENT -c crc32c $HOST $PORT $f | awk '{print $NF}')" = "$expected" ] || CRC_OK=0
+done
+$CLIENT -c crc32c -g 2 $HOST $PORT testfile_text | grep -q "^# bigrams " || CRC_OK=0
+if $CLIENT -c xxh3 $HOST $PORT testfile_1000A > /dev/null 2>&1; then CRC_OK=0; fi
+printf 'checked twice, counted once' > testfile_crc
+[ "$($PYTHON -c "
+import socket, struct
+def crc32c(d):
+    c = 0xffffffff
+    for b in d:
+        c ^= b
+        for _ in range(8): c = (c >> 1) ^ (0x82f63b78 & -(c & 1))
+    return c ^ 0xffffffff
+def frame(data, trailer):
+    opts = struct.pack('>HHB', 5, 1, 1)
+    return struct.pack('>IBBHIQ', 0xffffffff, 1, 1, 1, len(opts), len(data)) + opts + data + struct.pack('>I', trailer)
+def reply(s):
+    hdr = b''
+    while len(hdr) < 16: hdr += s.recv(16 - len(hdr))
+    version, status, flags, body_len, c = struct.unpack('>BBHIQ', hdr)
+    while body_len > 0: body_len -= len(s.recv(body_len))
+    return status, c, flags & 1
+s = socket.create_connection(('$HOST', $PORT))
+d = open('testfile_crc', 'rb').read()
+s.sendall(frame(b'damaged' + d, crc32c(d)))
+bad = reply(s)
+s.sendall(frame(d, crc32c(d)))
+print(bad, reply(s))
+")" = "(4, 0, 1) (0, 27, 1)" ] || CRC_OK=0
+$CLIENT -q workers $HOST $PORT | grep -q "^worker 0 .* corrupt 1" || CRC_OK=0
+kill -INT $CRC_PID 2>/dev/null || true
+wait $CRC_PID 2>/dev/null || true
+$PYTHON count_printable_per_char.py testfile_pool testfile_1000A testfile_text testfile_crc > tmp_expected_crc.txt
+grep "char '" server_out_crc.txt | sort > tmp_crc_server.txt
+$PYTHON compare_counts.py tmp_crc_server.txt tmp_expected_crc.txt > /dev/null || CRC_OK=0
+
+$SERVER -w 1 -p 1 $PORT > server_out_crc.txt 2>&1 &
+CRC_PID=$!
+wait_for_server
+$REPLAY -f tmp_trace.bin $HOST $PORT > tmp_replay_out.txt || CRC_OK=0
+grep -q "^0 replies differ, 0 errors" tmp_replay_out.txt || CRC_OK=0
+kill -INT $CRC_PID 2>/dev/null || true
+wait $CRC_PID 2>/dev/null || true
+grep "char '" server_out_crc.txt | sort | cmp -s - tmp_crc_server.txt || CRC_OK=0
+if [ $CRC_OK -eq 1 ]; then
+    echo "Test Passed - payload checksums"
+else
+    echo "Test Failed - payload checksums"
+    LIB_OK=0
+fi
+
+echo "=================================================="
+echo "Running randomized stress tests..."
+
+STRESS_OK=1
+$PYTHON stress_pcc.py --server $SERVER || STRESS_OK=0
+$PYTHON stress_pcc.py --server $SERVER --sigint || STRESS_OK=0
+$PYTHON stress_pcc.py --server $SERVER --server-args "-w 4" --sigint || STRESS_OK=0
+$PYTHON stress_pcc.py --server $SERVER --server-args "-w 4 -i" || STRESS_OK=0
+
 echo "=================================================="
 
 rm -f testfile_*
 rm -f tmp_server_stats.txt tmp_expected_stats.txt client_out_tmp server_out_sigint.txt tmp_partial_printable tmp_expected_sigint.txt tmp_server_sigint_stats.txt
+rm -f server_out_lib.txt server_out_lib2.txt tmp_lib_expected.txt tmp_lib_server.txt
+rm -f server_out_sample.txt tmp_sample_all.txt tmp_sample_part.txt tmp_expected_sample.txt tmp_sample_server.txt
+rm -f server_out_append.txt tmp_append.state tmp_append_stream.txt tmp_append_all tmp_expected_append.txt tmp_append_server.txt
+rm -f server_out_tls.txt tmp_tls.key tmp_tls.crt tmp_tls_other.key tmp_tls_other.crt tmp_tls_workers.txt tmp_expected_tls.txt tmp_tls_server.txt
+rm -f server_out_pool.txt tmp_pool_workers.txt tmp_expected_pool.txt tmp_pool_server.txt
+rm -f server_out_unix.txt tmp_pcc.sock tmp_ring_out.txt tmp_expected_unix.txt tmp_unix_server.txt
+rm -f server_out_listen.txt tmp_pcc_l.sock tmp_listeners.txt tmp_expected_listen.txt tmp_listen_server.txt
+rm -f server_out_net.txt
+rm -f server_out_snap.txt tmp_snap.bin tmp_snap_bad.bin tmp_snap_server.txt tmp_snap_dump.txt tmp_expected_snap.txt
+rm -f server_out_snap_race.txt tmp_snap_race.bin tmp_snap_race_*.txt
+rm -f server_out_trace.txt tmp_trace.bin tmp_trace_cut.bin tmp_trace_server.txt tmp_replay_server.txt tmp_replay_out.txt
+rm -f server_out_ngram.txt tmp_ngram_out.txt tmp_ngram_got.txt tmp_ngram_expected.txt tmp_expected_ngram.txt tmp_ngram_server.txt
+rm -f server_out_budget.txt tmp_budget.txt tmp_expected_budget.txt tmp_budget_server.txt tmp_budget_trace.bin
+rm -f server_out_crc.txt tmp_expected_crc.txt tmp_crc_server.txt
+rm -f server_out_io.txt tmp_expected_io.txt tmp_io_server.txt
 kill $SERVER_PID 2>/dev/null || true
 
+if [ $STRESS_OK -ne 1 ] || [ $LIB_OK -ne 1 ]; then
+    exit 1
+fi
 exit 0
@@ -0,0 +1,62 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include "pcc_budget.h"
+
+void pcc_budget_init(struct pcc_budget *b, uint64_t limit) {
+    b->limit = limit;
+    atomic_init(&b->used, 0);
+    atomic_init(&b->peak, 0);
+    atomic_init(&b->refused, 0);
+}
+
+static void raise_peak(struct pcc_budget *b, uint64_t used) {
+    uint64_t peak = atomic_load_explicit(&b->peak, memory_order_relaxed);
+    while (used > peak && !atomic_compare_exchange_weak_explicit(&b->peak, &peak, used, memory_order_relaxed,
+                                                                 memory_order_relaxed)) {
+    }
+}
+
+int pcc_budget_take(struct pcc_budget *b, uint64_t n) {
+    uint64_t used = atomic_load_explicit(&b->used, memory_order_relaxed);
+    do {
+        if (b->limit != 0 && (used > b->limit || n > b->limit - used)) {
+            atomic_fetch_add_explicit(&b->refused, 1, memory_order_relaxed);
+            errno = ENOBUFS;
+            return -1;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&b->used, &used, used + n, memory_order_relaxed,
+                                                    memory_order_relaxed));
+    raise_peak(b, used + n);
+    return 0;
+}
+
+void pcc_budget_charge(struct pcc_budget *b, uint64_t n) {
+    raise_peak(b, atomic_fetch_add_explicit(&b->used, n, memory_order_relaxed) + n);
+}
+
+void pcc_budget_give(struct pcc_budget *b, uint64_t n) {
+    atomic_fetch_sub_explicit(&b->used, n, memory_order_relaxed);
+}
+
+int pcc_budget_near(const struct pcc_budget *b) {
+    uint64_t used = atomic_load_explicit(&b->used, memory_order_relaxed);
+    return b->limit != 0 && used > b->limit / PCC_BUDGET_HIGH_DEN * PCC_BUDGET_HIGH_NUM;
+}
+
+int pcc_budget_parse(const char *s, uint64_t *v) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(s, &end, 10);
+    int shift = 0;
+    if (*end == 'K' || *end == 'k') shift = 10;
+    else if (*end == 'M' || *end == 'm') shift = 20;
+    else if (*end == 'G' || *end == 'g') shift = 30;
+    if (shift != 0) end++;
+    if (end == s || *s == '-' || *end != '\0' || errno != 0 || n > UINT64_MAX >> shift) {
+        errno = EINVAL;
+        return -1;
+    }
+    *v = (uint64_t)n << shift;
+    return 0;
+}
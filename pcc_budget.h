@@ -0,0 +1,47 @@
+#ifndef PCC_BUDGET_H
+#define PCC_BUDGET_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+    resource budgets: how much of a resource (bytes, fds) the server may use, and how much
+    of it is in use
+
+    whoever is about to allocate takes the amount from the budget first and gives it back
+    once it freed it again. a take that would go over the limit fails, nothing is allocated
+    then and the caller sheds whatever it wanted it for. a take is a compare and swap on
+    used, so the limit holds at every moment across any number of threads, without a lock.
+
+    near is used above PCC_BUDGET_HIGH_NUM / PCC_BUDGET_HIGH_DEN of the limit: the point
+    from which the server gives back what it only keeps to be faster (scratch buffers,
+    caches), before takes start to fail.
+
+    charge is a take that can't fail, for what has to exist anyway (the server's startup
+    state). it may push used over the limit, the caller decides what that means. peak is
+    the most that was ever in use, refused the takes that failed.
+*/
+
+#define PCC_BUDGET_HIGH_NUM 7
+#define PCC_BUDGET_HIGH_DEN 8
+
+struct pcc_budget {
+    uint64_t limit; // 0 for none
+    _Atomic uint64_t used;
+    _Atomic uint64_t peak;
+    _Atomic uint64_t refused;
+};
+
+void pcc_budget_init(struct pcc_budget *b, uint64_t limit);
+// returns 0, or -1 with errno ENOBUFS if used would go over the limit
+int pcc_budget_take(struct pcc_budget *b, uint64_t n);
+void pcc_budget_charge(struct pcc_budget *b, uint64_t n);
+void pcc_budget_give(struct pcc_budget *b, uint64_t n);
+// 1 if there is a limit and used is close to it
+int pcc_budget_near(const struct pcc_budget *b);
+
+// parse a size: a number with an optional K, M or G suffix (powers of 1024). returns 0, or
+// -1 with errno EINVAL
+int pcc_budget_parse(const char *s, uint64_t *v);
+
+#endif
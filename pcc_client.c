@@ -5,11 +5,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <inttypes.h>
+
+#include "pcc_lib.h"
+#include "pcc_net.h"
+#include "pcc_proto.h"
+#include "pcc_ring.h"
+#include "pcc_tenant.h"
+#include "pcc_tls.h"
+
 /*
     1. validate the cmd args and detect errors while opening the file
        argc == 4
@@ -38,21 +53,604 @@
         on error: print error to stderr containing the errno string and exit with code 1
         no need for cleanup on exit
 
+    EXTENSIONS:
+        pcc_client -q "<query>" <server IP> <server port>
+            send a query (see pcc_server.c) in an extended frame and print the server's answer
+        pcc_client -t <tenant id> <server IP> <server port> <file>
+            account the count to the given tenant instead of our IP address
+        files of 4GiB - 1 bytes and more are sent in an extended frame, which has a 64-bit N
+        pcc_client [-s <IP>:<port>]... [-l least|p2c] <server IP> <server port> <file> [<file>...]
+            more servers, and more files sent concurrently. requests are spread over the
+            servers by outstanding requests (or power of two choices with p2c), retried
+            on another server when that is safe and failing servers are ejected with
+            exponential backoff. with several files every result line names its file
+        pcc_client -S <rate> [-B <block bytes>] [-R] <server IP> <server port> <file> [<file>...]
+            send only about rate (0 < rate <= 1) of every file, in blocks picked with a fixed
+            stride (random ones with -R), and print the server's estimate with its 95%
+            confidence interval, then the estimate of every char (see pcc_sample.h)
+        pcc_client -a <state file> [-f] <server IP> <server port> <file>
+            count a growing file by sending only what was appended since the last run. the
+            state file keeps the stream id, the offset reached and hashes of the file around
+            it. the server adds every delta to the stream (see pcc_stream.h) and answers with
+            the count of the whole file. a file that was truncated or replaced (other inode,
+            other bytes before the offset) is counted again from the start.
+            with -f it keeps following the file (inotify), printing the count after every
+            delta, until SIGINT or SIGTERM
+        pcc_client -x <CA file> ...
+            TLS to the server (pcc_server -C/-K), whose certificate must chain to the CA file
+            (a self-signed certificate is its own CA) and name the server IP. with kTLS the
+            file goes out with sendfile(), the kernel encrypts it. combines with all of the above
+        pcc_client -u <socket path> [-m [-t <tenant id>]] <file> [<file>...]
+            to a server on this host through its UNIX socket (pcc_server -u), in place of
+            the IP and the port. one file goes in a basic frame; with -m the files go through
+            a shared memory ring (see pcc_ring.h): every file is read straight into the
+            ring's pages and counted there by the server, no socket copies, and all of them
+            are in flight at once
+        pcc_client -n nagle|nodelay|cork|more ...
+            how N and the file leave the TCP connection of a basic frame (pcc_net.h), by
+            default more: every write but the last one with MSG_MORE, so a small file goes
+            out in one segment with N instead of waiting for the server's ack of N
+        pcc_client -g 2|3 ... <server IP> <server port> <file> [<file>...]
+            also count the bigrams of every file (2), or its bigrams and trigrams (3), and
+            print them after its count as the server sent them (see pcc_proto.h)
+        pcc_client -c crc32c ... <server IP> <server port> <file> [<file>...]
+            send the CRC32C of every file after it (PCC_OPT_CHECKSUM, see pcc_proto.h), the
+            server counts nothing of a file that arrives damaged and it is sent again. a file
+            that keeps arriving damaged fails with EBADMSG. combines with -s, -t, -a, -g, -x
+        the server IP may be an IPv6 address (::1), with -s in brackets: [::1]:<port>
+        the extended frames go through the client library, see pcc_lib.h
 */
 
+
+struct file_job {
+    const char *path;
+    int fd;
+    int err;
+    uint64_t C;
+    uint64_t ci; // sampled
+    char *body; // sampled, the estimate of every char
+};
+
+static void file_done(const struct pcc_result *res, void *arg) {
+    struct file_job *job = arg;
+    job->err = res->err != 0                           ? res->err
+               : res->status == PCC_STATUS_BUSY     ? EBUSY
+               : res->status == PCC_STATUS_CHECKSUM ? EBADMSG
+               : res->status != PCC_STATUS_OK       ? EINVAL
+                                                    : 0;
+    job->C = res->c;
+    job->ci = res->ci;
+    if (job->err == 0 && res->body_len > 0) job->body = strndup(res->body, res->body_len);
+    close(job->fd);
+}
+
+// add "ip:port" to the context
+static void add_server(struct pcc_ctx *ctx, const char *ip, const char *port) {
+    if (pcc_ctx_add_server(ctx, ip, atoi(port)) < 0) {
+        fprintf(stderr, "Error converting IP address: %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+static struct pcc_tls *tls; // -x, the basic frame goes over this session
+
+// send(2)/read(2) on the server connection, through TLS with -x (which takes no flags)
+static ssize_t sock_send(int fd, const void *buf, size_t len, int flags) {
+    return tls != NULL ? pcc_tls_write(tls, buf, len) : send(fd, buf, len, flags);
+}
+
+static ssize_t sock_read(int fd, void *buf, size_t len) {
+    return tls != NULL ? pcc_tls_read(tls, buf, len) : read(fd, buf, len);
+}
+
+// connect to a server's UNIX socket, -1 with errno set
+static int connect_unix(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+// wait for the server to move the ring, taking the replies that came back meanwhile.
+// exits if the server is gone
+static void ring_wait_server(struct pcc_ring *ring, int sock_fd, struct file_job *jobs, int njobs, int *replied) {
+    uint32_t seen = pcc_ring_peer_seq(ring);
+    int before = *replied;
+    while (*replied < njobs && pcc_ring_take_reply(ring, &jobs[*replied].C) == 0) (*replied)++;
+    if (*replied == before && pcc_ring_wait(ring, seen, sock_fd, -1) < 0) {
+        fprintf(stderr, "Error receiving data from server: %s\n", strerror(ECONNRESET));
+        exit(1);
+    }
+}
+
+// copy len bytes into the ring, waiting for space
+static void ring_put(struct pcc_ring *ring, int sock_fd, const void *buf, size_t len, struct file_job *jobs, int njobs,
+                     int *replied) {
+    while (len > 0) {
+        unsigned char *p;
+        size_t room = pcc_ring_reserve(ring, &p);
+        if (room == 0) {
+            ring_wait_server(ring, sock_fd, jobs, njobs, replied);
+            continue;
+        }
+        if (room > len) room = len;
+        memcpy(p, buf, room);
+        pcc_ring_produce(ring, room);
+        buf = (const char *)buf + room;
+        len -= room;
+    }
+}
+
+// -u -m: hand the files to the server in a shared memory ring, prints the results and exits
+static void run_ring(const char *path, const char *tenant, struct file_job *jobs, int njobs) {
+    struct pcc_ring ring;
+    int sock_fd = connect_unix(path);
+    if (sock_fd < 0) {
+        fprintf(stderr, "Error: connect failed. %s \n", strerror(errno));
+        exit(1);
+    }
+    if (pcc_ring_create(&ring, PCC_RING_DEFAULT_SIZE) < 0) {
+        fprintf(stderr, "Error creating ring: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    // the ring request, the memfd and both doorbells go along with its first byte
+    unsigned char frame[sizeof(uint32_t) + PCC_EXT_REQ_HDR_LEN + PCC_OPT_HDR_LEN + PCC_TENANT_ID_MAX];
+    uint32_t marker = htonl(PCC_EXT_MARKER);
+    struct pcc_ext_req req = {.version = PCC_EXT_VERSION, .op = PCC_OP_RING};
+    unsigned char *opts = frame + sizeof(marker) + PCC_EXT_REQ_HDR_LEN;
+    if (tenant != NULL) req.opt_len = pcc_opt_put(opts, 0, PCC_OPT_TENANT, tenant, strlen(tenant));
+    memcpy(frame, &marker, sizeof(marker));
+    pcc_ext_req_pack(&req, frame + sizeof(marker));
+
+    int fds[3] = {ring.memfd, ring.efd[0], ring.efd[1]};
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } ctrl;
+    struct iovec iov = {.iov_base = frame, .iov_len = sizeof(marker) + PCC_EXT_REQ_HDR_LEN + req.opt_len};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf)};
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    if (sendmsg(sock_fd, &msg, MSG_NOSIGNAL) != (ssize_t)iov.iov_len) {
+        fprintf(stderr, "Error sending ring: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    // the reply says whether the server took the ring, its body why not
+    unsigned char rep_hdr[PCC_EXT_REP_HDR_LEN];
+    struct pcc_ext_rep rep;
+    size_t got = 0;
+    while (got < sizeof(rep_hdr)) {
+        ssize_t r = read(sock_fd, rep_hdr + got, sizeof(rep_hdr) - got);
+        if (r <= 0) {
+            fprintf(stderr, "Error receiving data from server: %s\n", r == 0 ? strerror(ECONNRESET) : strerror(errno));
+            exit(1);
+        }
+        got += r;
+    }
+    pcc_ext_rep_unpack(&rep, rep_hdr);
+    if (rep.status != PCC_STATUS_OK) {
+        char body[512];
+        ssize_t r = read(sock_fd, body, rep.body_len < sizeof(body) - 1 ? rep.body_len : sizeof(body) - 1);
+        body[r > 0 ? r : 0] = '\0';
+        fprintf(stderr, "Error: server refused the ring: %s", r > 0 ? body : "\n");
+        exit(1);
+    }
+
+    // every file is its n, then its bytes read right into the ring
+    int replied = 0;
+    for (int i = 0; i < njobs; i++) {
+        struct stat st;
+        if (fstat(jobs[i].fd, &st) < 0) {
+            fprintf(stderr, "Error reading file %s: %s\n", jobs[i].path, strerror(errno));
+            exit(1);
+        }
+        uint64_t n = st.st_size;
+        ring_put(&ring, sock_fd, &n, sizeof(n), jobs, njobs, &replied);
+        while (n > 0) {
+            unsigned char *p;
+            size_t room = pcc_ring_reserve(&ring, &p);
+            if (room == 0) {
+                ring_wait_server(&ring, sock_fd, jobs, njobs, &replied);
+                continue;
+            }
+            ssize_t r = read(jobs[i].fd, p, room < n ? room : n);
+            if (r <= 0) { // the file shrank under us, the server drops the request when we go
+                fprintf(stderr, "Error reading file %s: %s\n", jobs[i].path, r == 0 ? strerror(EIO) : strerror(errno));
+                exit(1);
+            }
+            pcc_ring_produce(&ring, r);
+            n -= r;
+        }
+        close(jobs[i].fd);
+    }
+    while (replied < njobs) ring_wait_server(&ring, sock_fd, jobs, njobs, &replied);
+    close(sock_fd);
+    pcc_ring_free(&ring);
+
+    for (int i = 0; i < njobs; i++) {
+        if (njobs == 1) printf("# of printable characters: %" PRIu64 "\n", jobs[i].C);
+        else printf("# of printable characters in %s: %" PRIu64 "\n", jobs[i].path, jobs[i].C);
+    }
+    exit(0);
+}
+
+#define HASH_SPAN 4096 // bytes hashed at the start of the file and right before the offset
+
+// what -a remembers about a file between runs
+struct stream_state {
+    char id[PCC_STREAM_ID_MAX + 1];
+    uint64_t offset;
+    uint64_t dev, ino;
+    uint64_t head, tail; // FNV-1a of the first and of the last HASH_SPAN bytes before offset
+};
+
+static volatile sig_atomic_t stop_following;
+
+static void on_stop(int sig) {
+    (void)sig;
+    stop_following = 1;
+}
+
+// FNV-1a of len bytes of fd at off, 0 if they can't all be read
+static uint64_t hash_range(int fd, uint64_t off, size_t len) {
+    unsigned char buf[HASH_SPAN];
+    uint64_t h = 0xcbf29ce484222325ULL;
+    if (pread(fd, buf, len, off) != (ssize_t)len) return 0;
+    for (size_t i = 0; i < len; i++) {
+        h ^= buf[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void hash_prefix(int fd, uint64_t off, uint64_t *head, uint64_t *tail) {
+    size_t span = off < HASH_SPAN ? off : HASH_SPAN;
+    *head = hash_range(fd, 0, span);
+    *tail = hash_range(fd, off - span, span);
+}
+
+// the state file is one line: "pcc-stream <id> <offset> <dev> <ino> <head> <tail>".
+// returns 0 if it was there and valid
+static int load_state(const char *path, struct stream_state *st) {
+    char buf[256];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return -1;
+    buf[len] = '\0';
+    if (sscanf(buf, "pcc-stream %64s %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNx64 " %" SCNx64, st->id, &st->offset,
+               &st->dev, &st->ino, &st->head, &st->tail) != 6) {
+        return -1;
+    }
+    return 0;
+}
+
+// written to a temporary file and renamed over the old one, a crash leaves one or the other
+static void save_state(const char *path, const struct stream_state *st) {
+    char tmp[4096], buf[256];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int len = snprintf(buf, sizeof(buf), "pcc-stream %s %" PRIu64 " %" PRIu64 " %" PRIu64 " %016" PRIx64 " %016" PRIx64 "\n",
+                       st->id, st->offset, st->dev, st->ino, st->head, st->tail);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, buf, len) != len || fsync(fd) < 0 || close(fd) < 0 || rename(tmp, path) < 0) {
+        fprintf(stderr, "Error saving state file: %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+// -a: send what was appended to path since the state file's offset, with -f keep doing it.
+// prints the count of the whole file after every delta and exits
+static void run_append(struct pcc_ctx *ctx, const char *tenant, const char *state_path, const char *path, int fd,
+                       int follow) {
+    struct stream_state st = {0};
+    struct stat sb;
+    int have_state = load_state(state_path, &st) == 0;
+    if (!have_state) {
+        // ids only have to be unique among the server's streams
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        snprintf(st.id, sizeof(st.id), "%08lx%08lx%04x", (unsigned long)ts.tv_sec, (unsigned long)ts.tv_nsec,
+                 (unsigned)getpid() & 0xffff);
+    }
+
+    int in_fd = -1;
+    if (follow) {
+        struct sigaction sa = {.sa_handler = on_stop}; // no SA_RESTART, poll returns EINTR
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+        if ((in_fd = inotify_init1(IN_CLOEXEC)) < 0 ||
+            inotify_add_watch(in_fd, path, IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF) < 0) {
+            fprintf(stderr, "Error watching file: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+
+    int first = 1;
+    while (!stop_following) {
+        struct stat cur;
+        // tail -F like: when the path now names another file (rotated), follow the new one
+        if (follow && stat(path, &cur) == 0 && fstat(fd, &sb) == 0 && (cur.st_dev != sb.st_dev || cur.st_ino != sb.st_ino)) {
+            int new_fd = open(path, O_RDONLY);
+            if (new_fd >= 0) {
+                close(fd);
+                fd = new_fd;
+                inotify_add_watch(in_fd, path, IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF);
+            }
+        }
+        if (fstat(fd, &sb) < 0) {
+            fprintf(stderr, "Error reading file: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        if (st.offset > 0) {
+            uint64_t head = 0, tail = 0;
+            if ((uint64_t)sb.st_size >= st.offset) hash_prefix(fd, st.offset, &head, &tail);
+            if (st.dev != (uint64_t)sb.st_dev || st.ino != (uint64_t)sb.st_ino || (uint64_t)sb.st_size < st.offset ||
+                head != st.head || tail != st.tail) {
+                fprintf(stderr, "%s was truncated or replaced, counting it from the start\n", path);
+                st.offset = 0;
+            }
+        }
+
+        if (first || (uint64_t)sb.st_size > st.offset || st.offset == 0) {
+            uint64_t off = st.offset, total;
+            int ret = pcc_count_stream_fd(ctx, fd, tenant, st.id, &off, &total);
+            if (ret < 0 && errno == ESPIPE) {
+                // the server has the stream elsewhere: further on if it counted a delta whose
+                // reply we lost (those bytes came from this file), otherwise it lost the stream
+                off = off > st.offset && off <= (uint64_t)sb.st_size ? off : 0;
+                ret = pcc_count_stream_fd(ctx, fd, tenant, st.id, &off, &total);
+            }
+            if (ret < 0) {
+                fprintf(stderr, "Error: count of %s failed: %s\n", path, strerror(errno));
+                exit(1);
+            }
+            st.offset = off;
+            st.dev = sb.st_dev;
+            st.ino = sb.st_ino;
+            hash_prefix(fd, st.offset, &st.head, &st.tail);
+            save_state(state_path, &st);
+            printf("# of printable characters: %" PRIu64 "\n", total);
+            fflush(stdout);
+            first = 0;
+        }
+        if (!follow) break;
+
+        // wake up on a change, or after a second anyway in case an event was missed
+        struct pollfd pfd = {.fd = in_fd, .events = POLLIN};
+        if (poll(&pfd, 1, 1000) > 0) {
+            char events[4096];
+            while (read(in_fd, events, sizeof(events)) < 0 && errno == EINTR && !stop_following) {
+            }
+        }
+    }
+    pcc_ctx_free(ctx);
+    exit(0);
+}
+
+// queries, tenant ids, files too big for a 32-bit N, several servers or several files go
+// through the client library (extended frames), prints the results and exits
+static void run_ext(struct pcc_ctx *ctx, const char *query, const char *tenant, const struct pcc_sample *sample,
+                    int ngram, struct file_job *jobs, int njobs) {
+    if (query != NULL) {
+        char *answer;
+        if (pcc_query(ctx, query, &answer) < 0) {
+            if (answer != NULL) fprintf(stderr, "Error: query failed: %s", answer);
+            else fprintf(stderr, "Error: query failed: %s\n", strerror(errno));
+            exit(1);
+        }
+        fputs(answer, stdout);
+        free(answer);
+        pcc_ctx_free(ctx);
+        exit(0);
+    }
+
+    // all files at once, the library spreads them over the servers
+    for (int i = 0; i < njobs; i++) {
+        int ret = sample != NULL ? pcc_submit_sample_fd(ctx, jobs[i].fd, tenant, sample, file_done, &jobs[i])
+                  : ngram != 0   ? pcc_submit_ngram_fd(ctx, jobs[i].fd, tenant, ngram, file_done, &jobs[i])
+                                 : pcc_submit_fd(ctx, jobs[i].fd, tenant, file_done, &jobs[i]);
+        if (ret < 0) {
+            fprintf(stderr, "Error reading file %s: %s\n", jobs[i].path, strerror(errno));
+            exit(1);
+        }
+    }
+    while (pcc_pending(ctx) > 0) {
+        if (pcc_poll(ctx, -1) < 0) {
+            fprintf(stderr, "Error: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+    pcc_ctx_free(ctx);
+
+    int failed = 0;
+    for (int i = 0; i < njobs; i++) {
+        if (jobs[i].err != 0) {
+            fprintf(stderr, "Error: count of %s failed: %s\n", jobs[i].path, strerror(jobs[i].err));
+            failed = 1;
+        } else if (sample != NULL) {
+            printf("# of printable characters in %s: %" PRIu64 " +- %" PRIu64 " (estimated)\n", jobs[i].path, jobs[i].C,
+                   jobs[i].ci);
+            if (jobs[i].body != NULL) fputs(jobs[i].body, stdout);
+        } else if (njobs == 1) {
+            printf("# of printable characters: %" PRIu64 "\n", jobs[i].C);
+        } else {
+            printf("# of printable characters in %s: %" PRIu64 "\n", jobs[i].path, jobs[i].C);
+        }
+        if (jobs[i].err == 0 && ngram != 0 && jobs[i].body != NULL) fputs(jobs[i].body, stdout);
+    }
+    exit(failed);
+}
+
 int main(int argc, char *argv[]) {
 
+    const char *query = NULL; // set in query mode, no file is sent then
+    const char *tenant = NULL; // tenant id to account the count to, the server uses our IP if not set
+    char *extra[64]; // more servers, "ip:port"
+    int nextra = 0;
+    struct pcc_ctx_opts lib_opts = {0};
+    struct pcc_sample sample = {.mode = PCC_SAMPLE_STRIDE}; // used when rate is set
+    const char *state_path = NULL; // -a, count only what was appended since the last run
+    int follow = 0;
+    const char *unix_path = NULL; // -u, the server's UNIX socket instead of IP and port
+    int use_ring = 0;
+    int net_mode = PCC_NET_DEFAULT; // -n
+    int ngram = 0; // -g, PCC_NGRAM_* flags
+    int opt;
+    while ((opt = getopt(argc, argv, "q:t:s:l:S:B:Ra:fx:u:mn:g:c:")) != -1) {
+        switch (opt) {
+        case 'c':
+            if (strcmp(optarg, "crc32c") != 0) {
+                fprintf(stderr, "Error: bad checksum: %s\n", strerror(EINVAL));
+                exit(1);
+            }
+            lib_opts.checksum = PCC_CHECKSUM_CRC32C;
+            break;
+        case 'g':
+            if (strcmp(optarg, "2") == 0) ngram = PCC_NGRAM_BIGRAMS;
+            else if (strcmp(optarg, "3") == 0) ngram = PCC_NGRAM_BIGRAMS | PCC_NGRAM_TRIGRAMS;
+            else {
+                fprintf(stderr, "Error: bad n-gram size: %s\n", strerror(EINVAL));
+                exit(1);
+            }
+            break;
+        case 'n':
+            if ((net_mode = pcc_net_mode_parse(optarg)) < 0) {
+                fprintf(stderr, "Error: bad write mode: %s\n", strerror(EINVAL));
+                exit(1);
+            }
+            break;
+        case 'u':
+            unix_path = optarg;
+            break;
+        case 'm':
+            use_ring = 1;
+            break;
+        case 'x':
+            lib_opts.tls_ca = optarg;
+            signal(SIGPIPE, SIG_IGN); // OpenSSL writes with write(), a closed connection is EPIPE
+            break;
+        case 'a':
+            state_path = optarg;
+            break;
+        case 'f':
+            follow = 1;
+            break;
+        case 'S':
+            sample.rate = atof(optarg);
+            if (!(sample.rate > 0 && sample.rate <= 1)) {
+                fprintf(stderr, "Error: bad sample rate: %s\n", strerror(EINVAL));
+                exit(1);
+            }
+            break;
+        case 'B':
+            sample.block = strtoul(optarg, NULL, 10);
+            if (sample.block == 0 || sample.block > PCC_SAMPLE_MAX_BLOCK) {
+                fprintf(stderr, "Error: bad sample block: %s\n", strerror(EINVAL));
+                exit(1);
+            }
+            break;
+        case 'R':
+            sample.mode = PCC_SAMPLE_RANDOM;
+            break;
+        case 's':
+            if (nextra == 64 || strchr(optarg, ':') == NULL) {
+                fprintf(stderr, "Error: bad server: %s\n", strerror(EINVAL));
+                exit(1);
+            }
+            extra[nextra++] = optarg;
+            break;
+        case 'l':
+            if (strcmp(optarg, "least") == 0) lib_opts.lb = PCC_LB_LEAST;
+            else if (strcmp(optarg, "p2c") == 0) lib_opts.lb = PCC_LB_P2C;
+            else {
+                fprintf(stderr, "Error: bad balancing policy: %s\n", strerror(EINVAL));
+                exit(1);
+            }
+            break;
+        case 'q':
+            query = optarg;
+            break;
+        case 't':
+            tenant = optarg;
+            if (strlen(tenant) == 0 || strlen(tenant) > PCC_TENANT_ID_MAX) {
+                fprintf(stderr, "Error: bad tenant id: %s\n", strerror(EINVAL));
+                exit(1);
+            }
+            break;
+        default:
+            fprintf(stderr, "Error: %s\n", strerror(EINVAL));
+            exit(1);
+        }
+    }
+    // so argv[1..3] are the positional args like before, with -u the files start at argv[3] too
+    int shift = unix_path != NULL ? 3 : 1;
+    argv += optind - shift;
+    argc -= optind - shift;
+
     // check if the number of command line arguments is correct
-    if (argc != 4) {
+    if ((query != NULL ? argc != 3 : argc < 4) || (state_path != NULL && (argc != 4 || sample.rate > 0)) ||
+        (follow && state_path == NULL) || (use_ring && unix_path == NULL) ||
+        (ngram != 0 && (sample.rate > 0 || state_path != NULL || unix_path != NULL)) ||
+        (lib_opts.checksum != 0 && (query != NULL || sample.rate > 0 || unix_path != NULL)) ||
+        (unix_path != NULL && (query != NULL || nextra > 0 || sample.rate > 0 || state_path != NULL ||
+                               lib_opts.tls_ca != NULL || (!use_ring && (argc != 4 || tenant != NULL))))) {
         fprintf(stderr, "Error: %s\n", strerror(EINVAL));
         exit(1);
     }
 
-    // open the specified file for reading
-    int file_fd = open(argv[3], O_RDONLY);
-    if (file_fd < 0) {
-        fprintf(stderr, "Error opening file: %s\n", strerror(errno));
-        exit(1);
+    // open the specified files for reading
+    int njobs = query != NULL ? 0 : argc - 3;
+    struct file_job *jobs = calloc(njobs + 1, sizeof(*jobs));
+    for (int i = 0; i < njobs; i++) {
+        jobs[i].path = argv[3 + i];
+        if ((jobs[i].fd = open(jobs[i].path, O_RDONLY)) < 0) {
+            fprintf(stderr, "Error opening file: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+    int file_fd = jobs[0].fd;
+
+    if (use_ring) run_ring(unix_path, tenant, jobs, njobs);
+
+    off_t file_size = 0;
+    if (query == NULL) {
+        file_size = lseek(file_fd, 0, SEEK_END);
+        lseek(file_fd, 0, SEEK_SET); // reset file pointer to the beginning
+    }
+    if (unix_path == NULL && (query != NULL || tenant != NULL || (uint64_t)file_size >= PCC_EXT_MARKER || nextra > 0 ||
+                              njobs > 1 || sample.rate > 0 || state_path != NULL || ngram != 0 ||
+                              lib_opts.checksum != 0)) {
+        struct pcc_ctx *ctx = pcc_ctx_new(&lib_opts);
+        if (ctx == NULL) {
+            fprintf(stderr, "Error creating client context: %s\n", lib_opts.tls_ca != NULL ? pcc_tls_error() : strerror(errno));
+            exit(1);
+        }
+        add_server(ctx, argv[1], argv[2]);
+        for (int i = 0; i < nextra; i++) {
+            char *colon = strrchr(extra[i], ':');
+            *colon = '\0';
+            add_server(ctx, extra[i], colon + 1);
+        }
+        if (state_path != NULL) run_append(ctx, tenant, state_path, jobs[0].path, jobs[0].fd, follow);
+        sample.seed = getpid();
+        run_ext(ctx, query, tenant, sample.rate > 0 ? &sample : NULL, ngram, jobs, njobs);
     }
 
     // create a TCP connection to the specified server port on the specified server IP
@@ -61,53 +659,75 @@ int main(int argc, char *argv[]) {
     char recv_buff[sizeof(uint32_t)]; // buffer for receiving data from server
     char send_buff[1024]; // buffer for sending data to server
 
-    struct sockaddr_in serv_addr; // where we Want to get to
+    struct sockaddr_storage serv_addr; // where we Want to get to
+    socklen_t serv_addr_len = 0;
 
     memset(recv_buff, 0, sizeof(recv_buff));
     memset(send_buff, 0, sizeof(send_buff));
     
 
-    if ((sock_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        fprintf(stderr, "Error creating socket: %s\n", strerror(errno));
-        close(file_fd);
-        exit(1);
-    }
-
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET; // IPv4
-    // convert server IP address from string to binary form
-    if (inet_pton(AF_INET, argv[1], &serv_addr.sin_addr) <= 0) {
-        fprintf(stderr, "Error converting IP address: %s\n", strerror(errno));
-        close(file_fd);
-        close(sock_fd);
-        exit(1);
-    }
-    serv_addr.sin_port = htons(atoi(argv[2])); // convert port number to network byte order
+    if (unix_path != NULL) {
+        if ((uint64_t)file_size >= PCC_EXT_MARKER) {
+            fprintf(stderr, "Error: file too big for a basic frame, use -m: %s\n", strerror(EFBIG));
+            exit(1);
+        }
+        if ((sock_fd = connect_unix(unix_path)) < 0) {
+            fprintf(stderr, "Error: connect failed. %s \n", strerror(errno));
+            close(file_fd);
+            exit(1);
+        }
+    } else {
+        // convert server IP address (IPv4 or IPv6) and port from string to binary form
+        if (pcc_net_addr(argv[1], atoi(argv[2]), &serv_addr, &serv_addr_len) < 0) {
+            fprintf(stderr, "Error converting IP address: %s\n", strerror(errno));
+            close(file_fd);
+            exit(1);
+        }
+        if ((sock_fd = socket(serv_addr.ss_family, SOCK_STREAM, 0)) < 0) {
+            fprintf(stderr, "Error creating socket: %s\n", strerror(errno));
+            close(file_fd);
+            exit(1);
+        }
 
-    
-    // connect socket to the target address
-    if (connect(sock_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        fprintf(stderr, "Error: connect failed. %s \n", strerror(errno));
-        close(file_fd);
-        close(sock_fd);
-        exit(1);
+        // connect socket to the target address
+        if (connect(sock_fd, (struct sockaddr *)&serv_addr, serv_addr_len) < 0) {
+            fprintf(stderr, "Error: connect failed. %s \n", strerror(errno));
+            close(file_fd);
+            close(sock_fd);
+            exit(1);
+        }
     }
 
     //printf("Connected to server %s:%s\n", argv[1], argv[2]);
 
+    if (lib_opts.tls_ca != NULL) {
+        struct pcc_tls_ctx *tls_ctx = pcc_tls_client_ctx(lib_opts.tls_ca);
+        if (tls_ctx == NULL || (tls = pcc_tls_connect(tls_ctx, sock_fd, argv[1], 10000)) == NULL) {
+            fprintf(stderr, "Error: TLS failed: %s\n", pcc_tls_error());
+            close(file_fd);
+            close(sock_fd);
+            exit(1);
+        }
+    }
+
     //transfer the contents of the file to the server over TCP
     // and receive the printable characters counts computed by the server
 
+    // N and the file are one message, every write but the last one says there is more
+    if (unix_path != NULL) net_mode = PCC_NET_NODELAY;
+    else if (tls != NULL) net_mode = pcc_net_mode_tls(net_mode);
+    pcc_net_setup(sock_fd, net_mode);
+    pcc_net_begin(sock_fd, net_mode);
+    int more = pcc_net_more(net_mode);
+
     // send the size of the file first (N)
-    off_t file_size = lseek(file_fd, 0, SEEK_END);
-    lseek(file_fd, 0, SEEK_SET); // reset file pointer to the beginning
     uint32_t N = htonl((uint32_t)file_size); // convert to network byte order
     
     ssize_t sent = 0;
     // send the size of the file (N) to the server
     // loop until all bytes are sent
     while (sent < sizeof(N)) {
-        ssize_t r = write(sock_fd, ((char *)&N) + sent, sizeof(N) - sent);
+        ssize_t r = sock_send(sock_fd, ((char *)&N) + sent, sizeof(N) - sent, file_size > 0 ? more : 0);
         if (r < 0) {
             fprintf(stderr, "Error sending file size: %s\n", strerror(errno));
             close(file_fd);
@@ -118,13 +738,29 @@ int main(int argc, char *argv[]) {
     }
 
     //printf("Sent file size: %u bytes\n", ntohl(N));
-    // now send the file contents to the server
-    ssize_t bytes_read;
-    while ((bytes_read = read(file_fd, send_buff, sizeof(send_buff))) > 0) {
+    // now send the file contents to the server. with kTLS the kernel encrypts it on its
+    // way out, sendfile() saves the copies through our buffer
+    ssize_t bytes_read = 0;
+    off_t file_sent = 0;
+    if (tls != NULL && (pcc_tls_ktls(tls) & PCC_KTLS_TX)) {
+        for (off_t off = 0; off < file_size;) {
+            ssize_t r = pcc_tls_sendfile(tls, file_fd, off, file_size - off);
+            if (r <= 0) {
+                fprintf(stderr, "Error sending file data: %s\n", strerror(errno));
+                close(file_fd);
+                close(sock_fd);
+                exit(1);
+            }
+            off += r;
+        }
+    }
+    while (file_size > 0 && (tls == NULL || !(pcc_tls_ktls(tls) & PCC_KTLS_TX)) &&
+           (bytes_read = read(file_fd, send_buff, sizeof(send_buff))) > 0) {
         ssize_t total_sent = 0;
+        file_sent += bytes_read;
         // loop until all bytes are sent
         while (total_sent < bytes_read) {
-            ssize_t r = write(sock_fd, send_buff + total_sent, bytes_read - total_sent);
+            ssize_t r = sock_send(sock_fd, send_buff + total_sent, bytes_read - total_sent, file_sent < file_size ? more : 0);
             if (r < 0) {
                 fprintf(stderr, "Error sending file data: %s\n", strerror(errno));
                 close(file_fd);
@@ -142,6 +778,7 @@ int main(int argc, char *argv[]) {
         close(sock_fd);
         exit(1);
     }
+    pcc_net_end(sock_fd, net_mode);
 
     //printf("Sent file data: %zd bytes\n", file_size);
 
@@ -149,7 +786,7 @@ int main(int argc, char *argv[]) {
     uint32_t C = 0; // to store the number of printable characters
     size_t bytes_received = 0;
     while (bytes_received < sizeof(C)) {
-        ssize_t r = read(sock_fd, recv_buff + bytes_received, sizeof(C) - bytes_received);
+        ssize_t r = sock_read(sock_fd, recv_buff + bytes_received, sizeof(C) - bytes_received);
         //printf("Received %zd bytes from server\n", r);
         if (r <= 0) {
             fprintf(stderr, "Error receiving data from server: %s\n", strerror(errno));
@@ -0,0 +1,130 @@
+#include <string.h>
+
+#include "pcc_count.h"
+#include "pcc_crc.h"
+
+uint64_t pcc_count_ref(const unsigned char *buf, size_t len, uint64_t counts[PCC_NPRINTABLE]) {
+    uint64_t C = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (PCC_FIRST_PRINTABLE <= buf[i] && buf[i] <= PCC_LAST_PRINTABLE) {
+            counts[buf[i] - PCC_FIRST_PRINTABLE]++;
+            C++;
+        }
+    }
+    return C;
+}
+
+/*
+    the byte at a time loop is slow for two reasons: the branch on every byte
+    mispredicts on mixed data, and runs of the same char make every increment wait
+    for the store of the previous one to the same counter.
+
+    so instead count all 256 byte values without any branch into 4 separate tables,
+    byte i of a word going to table i % 4, and keep only the printable bins at the end.
+    the 32-bit table counters are flushed to the caller's 64-bit counts before they
+    can overflow.
+*/
+
+#define NTABLES 4
+#define FLUSH_EVERY ((size_t)1 << 30) // bytes per table between flushes, well below 2^32
+
+// the 8 bytes of w into the tables
+#define COUNT_WORD(tables, w)                                                                                          \
+    do {                                                                                                               \
+        tables[0][(uint8_t)(w)]++;                                                                                     \
+        tables[1][(uint8_t)((w) >> 8)]++;                                                                              \
+        tables[2][(uint8_t)((w) >> 16)]++;                                                                             \
+        tables[3][(uint8_t)((w) >> 24)]++;                                                                             \
+        tables[0][(uint8_t)((w) >> 32)]++;                                                                             \
+        tables[1][(uint8_t)((w) >> 40)]++;                                                                             \
+        tables[2][(uint8_t)((w) >> 48)]++;                                                                             \
+        tables[3][(uint8_t)((w) >> 56)]++;                                                                             \
+    } while (0)
+
+static void flush_tables(uint32_t tables[NTABLES][256], uint64_t counts[PCC_NPRINTABLE], uint64_t *C) {
+    for (size_t b = PCC_FIRST_PRINTABLE; b <= PCC_LAST_PRINTABLE; b++) {
+        uint64_t sum = (uint64_t)tables[0][b] + tables[1][b] + tables[2][b] + tables[3][b];
+        counts[b - PCC_FIRST_PRINTABLE] += sum;
+        *C += sum;
+    }
+    memset(tables, 0, sizeof(uint32_t) * NTABLES * 256);
+}
+
+uint64_t pcc_count(const unsigned char *buf, size_t len, uint64_t counts[PCC_NPRINTABLE]) {
+    uint32_t tables[NTABLES][256];
+    uint64_t C = 0;
+
+    // small buffers don't pay for clearing and folding the tables
+    if (len < 256) return pcc_count_ref(buf, len, counts);
+
+    memset(tables, 0, sizeof(tables));
+    while (len > 0) {
+        size_t chunk = len < NTABLES * FLUSH_EVERY ? len : NTABLES * FLUSH_EVERY;
+        size_t i = 0;
+
+        for (; i + 8 <= chunk; i += 8) {
+            uint64_t w;
+            memcpy(&w, buf + i, sizeof(w));
+            COUNT_WORD(tables, w);
+        }
+        for (; i < chunk; i++) {
+            tables[i % NTABLES][buf[i]]++;
+        }
+
+        flush_tables(tables, counts, &C);
+        buf += chunk;
+        len -= chunk;
+    }
+    return C;
+}
+
+/*
+    pcc_count_crc: the word loop of pcc_count also feeds every word it loaded to the crc32
+    instruction of SSE4.2, so the payload is read once for its counts and its CRC32C. the
+    instruction takes one cycle per word next to the eight table increments, the checksum
+    costs almost nothing on top of the count. without SSE4.2 (or for a short buffer) it is
+    pcc_count and then pcc_crc32c over the same, still cached, bytes.
+*/
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+
+__attribute__((target("sse4.2"))) static uint64_t count_crc_sse42(const unsigned char *buf, size_t len,
+                                                                   uint64_t counts[PCC_NPRINTABLE], uint32_t *crc) {
+    uint32_t tables[NTABLES][256];
+    uint64_t C = 0;
+    uint64_t c = ~*crc;
+
+    memset(tables, 0, sizeof(tables));
+    while (len > 0) {
+        size_t chunk = len < NTABLES * FLUSH_EVERY ? len : NTABLES * FLUSH_EVERY;
+        size_t i = 0;
+
+        for (; i + 8 <= chunk; i += 8) {
+            uint64_t w;
+            memcpy(&w, buf + i, sizeof(w));
+            c = _mm_crc32_u64(c, w);
+            COUNT_WORD(tables, w);
+        }
+        for (; i < chunk; i++) {
+            c = _mm_crc32_u8((uint32_t)c, buf[i]);
+            tables[i % NTABLES][buf[i]]++;
+        }
+
+        flush_tables(tables, counts, &C);
+        buf += chunk;
+        len -= chunk;
+    }
+    *crc = ~(uint32_t)c;
+    return C;
+}
+#endif
+
+uint64_t pcc_count_crc(const unsigned char *buf, size_t len, uint64_t counts[PCC_NPRINTABLE], uint32_t *crc) {
+#if defined(__x86_64__)
+    if (len >= 256 && __builtin_cpu_supports("sse4.2")) return count_crc_sse42(buf, len, counts, crc);
+#endif
+    uint64_t C = pcc_count(buf, len, counts);
+    *crc = pcc_crc32c(*crc, buf, len);
+    return C;
+}
@@ -0,0 +1,30 @@
+#ifndef PCC_COUNT_H
+#define PCC_COUNT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pcc_proto.h"
+
+/*
+    counting kernels
+
+    both kernels add the printable chars of buf to counts (counts is not cleared,
+    so a stream can be counted chunk by chunk) and return how many printable chars
+    buf had.
+
+    pcc_count_ref is the obvious byte at a time loop, it is the reference the other
+    kernels are tested against (TESTER/fuzz_count.c). pcc_count is the one the server uses.
+
+    pcc_count_crc is pcc_count that also takes the CRC32C of buf in the same pass (see
+    pcc_crc.h): *crc is the value so far, 0 to start, like for pcc_crc32c. the server uses
+    it for payloads with a checksum trailer (PCC_OPT_CHECKSUM).
+*/
+
+uint64_t pcc_count_ref(const unsigned char *buf, size_t len, uint64_t counts[PCC_NPRINTABLE]);
+
+uint64_t pcc_count(const unsigned char *buf, size_t len, uint64_t counts[PCC_NPRINTABLE]);
+
+uint64_t pcc_count_crc(const unsigned char *buf, size_t len, uint64_t counts[PCC_NPRINTABLE], uint32_t *crc);
+
+#endif
@@ -0,0 +1,64 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "pcc_crc.h"
+
+#define POLY 0x82f63b78u // CRC32C, reflected
+
+static uint32_t table[8][256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static uint32_t crc_sliced(uint32_t crc, const unsigned char *p, size_t len);
+static uint32_t (*crc_impl)(uint32_t crc, const unsigned char *p, size_t len) = crc_sliced;
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+
+// the crc32 instruction of SSE4.2 is CRC32C, 8 bytes per instruction. compiled for SSE4.2
+// whatever the build targets, and only called when the cpu has it
+__attribute__((target("sse4.2"))) static uint32_t crc_sse42(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t c = ~crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        c = _mm_crc32_u64(c, w);
+    }
+    uint32_t c32 = (uint32_t)c;
+    for (; len > 0; p++, len--) c32 = _mm_crc32_u8(c32, *p);
+    return ~c32;
+}
+#endif
+
+// table[0] is the classic byte table, table[k][b] the crc of b followed by k zero bytes
+static void make_table(void) {
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t c = b;
+        for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ POLY : c >> 1;
+        table[0][b] = c;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xff];
+    }
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) crc_impl = crc_sse42;
+#endif
+}
+
+uint32_t pcc_crc32c(uint32_t crc, const void *buf, size_t len) {
+    pthread_once(&table_once, make_table);
+    return crc_impl(crc, buf, len);
+}
+
+static uint32_t crc_sliced(uint32_t crc, const unsigned char *p, size_t len) {
+    crc = ~crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        w ^= crc; // little endian: the crc covers the first 4 bytes
+        crc = table[7][w & 0xff] ^ table[6][(w >> 8) & 0xff] ^ table[5][(w >> 16) & 0xff] ^
+              table[4][(w >> 24) & 0xff] ^ table[3][(w >> 32) & 0xff] ^ table[2][(w >> 40) & 0xff] ^
+              table[1][(w >> 48) & 0xff] ^ table[0][w >> 56];
+    }
+    for (; len > 0; p++, len--) crc = (crc >> 8) ^ table[0][(crc ^ *p) & 0xff];
+    return ~crc;
+}
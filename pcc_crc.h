@@ -0,0 +1,18 @@
+#ifndef PCC_CRC_H
+#define PCC_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    CRC32C (Castagnoli), the checksum of snapshots (pcc_snap.h)
+
+    crc is the value so far, 0 to start, so a buffer can be checksummed piece by piece:
+    pcc_crc32c(pcc_crc32c(0, a, n), b, m) == pcc_crc32c(0, a || b, n + m).
+    the crc32 instruction of SSE4.2 when the cpu has it (checked once, at the first call),
+    otherwise slicing by 8, eight table lookups per 8 bytes, no branch per byte.
+*/
+
+uint32_t pcc_crc32c(uint32_t crc, const void *buf, size_t len);
+
+#endif
@@ -0,0 +1,229 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pcc_snap.h"
+
+/*
+    pcc_dump [-f text|csv|json] <snapshot>
+
+    print a snapshot of pcc_server (pcc_snap.h) for people or for other tools
+
+    text    (default) the totals in the format of the server's SIGINT output, then the
+            estimated totals, tenants and streams like the matching queries print them
+    csv     one row per non zero count: kind,id,char,count with char as its code. kind is
+            total, estimated, window (id <width>s@<start unix time>), tenant or stream
+    json    one object: version, created, requests, totals, sampled, estimated, window,
+            tenants and streams, every histogram an object of char code to count with
+            only the non zero counts
+
+    exits 1 with a message on stderr if the snapshot can't be read or is broken.
+*/
+
+enum { FMT_TEXT, FMT_CSV, FMT_JSON };
+
+static void usage(void) {
+    fprintf(stderr, "usage: pcc_dump [-f text|csv|json] <snapshot>\n");
+    exit(1);
+}
+
+static void print_text_counts(const char *prefix, const uint64_t counts[PCC_NPRINTABLE]) {
+    for (int i = 0; i < PCC_NPRINTABLE; i++) {
+        if (counts[i] > 0) printf("%s '%c' : %" PRIu64 " times\n", prefix, i + PCC_FIRST_PRINTABLE, counts[i]);
+    }
+}
+
+static void print_csv_counts(const char *kind, const char *id, const uint64_t counts[PCC_NPRINTABLE]) {
+    for (int i = 0; i < PCC_NPRINTABLE; i++) {
+        // ids are printable without commas or quotes in practice, quote them anyway
+        if (counts[i] > 0) printf("%s,\"%s\",%d,%" PRIu64 "\n", kind, id, i + PCC_FIRST_PRINTABLE, counts[i]);
+    }
+}
+
+static void print_json_string(const char *s) {
+    putchar('"');
+    for (; *s != '\0'; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') printf("\\%c", c);
+        else if (c < 0x20) printf("\\u%04x", c);
+        else putchar(c);
+    }
+    putchar('"');
+}
+
+static void print_json_counts(const uint64_t counts[PCC_NPRINTABLE]) {
+    const char *sep = "";
+    putchar('{');
+    for (int i = 0; i < PCC_NPRINTABLE; i++) {
+        if (counts[i] == 0) continue;
+        printf("%s\"%d\": %" PRIu64, sep, i + PCC_FIRST_PRINTABLE, counts[i]);
+        sep = ", ";
+    }
+    putchar('}');
+}
+
+// a window slot's counts as plain integers
+static void window_counts(const struct pcc_window_slot *slot, uint64_t counts[PCC_NPRINTABLE]) {
+    for (int i = 0; i < PCC_NPRINTABLE; i++) counts[i] = atomic_load(&slot->counts[i]);
+}
+
+static void dump_text(const struct pcc_snap *s) {
+    print_text_counts("char", s->totals);
+    printf("# requests %" PRIu64 " created %" PRIu64 "\n", s->requests, s->created);
+    if (s->sampled > 0) {
+        printf("# estimated from %" PRIu64 " sampled requests\n", s->sampled);
+        print_text_counts("estimated", s->est_totals);
+    }
+    for (size_t i = 0; i < s->tenants->tab.nslots; i++) {
+        const struct pcc_tenant *t = &s->tenants->entries[i];
+        if (s->tenants->tab.hashes[i] == 0) continue;
+        printf("tenant %s requests %" PRIu64 " bytes %" PRIu64 " printable %" PRIu64 " error %" PRIu64 "\n", t->id,
+               t->requests, t->bytes, t->printable, t->error);
+    }
+    for (size_t i = 0; i < s->streams->tab.nslots; i++) {
+        const struct pcc_stream *st = &s->streams->entries[i];
+        if (s->streams->tab.hashes[i] == 0) continue;
+        printf("stream %s offset %" PRIu64 " printable %" PRIu64 " appends %" PRIu64 " restarts %" PRIu64 "\n", st->id,
+               st->offset, st->printable, st->appends, st->restarts);
+    }
+}
+
+static void dump_csv(const struct pcc_snap *s) {
+    uint64_t counts[PCC_NPRINTABLE];
+    char id[64];
+
+    printf("kind,id,char,count\n");
+    print_csv_counts("total", "", s->totals);
+    print_csv_counts("estimated", "", s->est_totals);
+    for (int k = 0; k < PCC_WIN_TIERS; k++) {
+        const struct pcc_window_tier *tier = &s->win->tiers[k];
+        for (uint32_t i = 0; i < tier->nslots; i++) {
+            uint64_t epoch = atomic_load(&tier->slots[i].epoch);
+            if (epoch == 0) continue;
+            snprintf(id, sizeof(id), "%us@%" PRIu64, tier->width, (epoch - 1) * tier->width);
+            window_counts(&tier->slots[i], counts);
+            print_csv_counts("window", id, counts);
+        }
+    }
+    for (size_t i = 0; i < s->tenants->tab.nslots; i++) {
+        if (s->tenants->tab.hashes[i] != 0) print_csv_counts("tenant", s->tenants->entries[i].id, s->tenants->entries[i].counts);
+    }
+    for (size_t i = 0; i < s->streams->tab.nslots; i++) {
+        if (s->streams->tab.hashes[i] != 0) print_csv_counts("stream", s->streams->entries[i].id, s->streams->entries[i].counts);
+    }
+}
+
+static void dump_json(const struct pcc_snap *s) {
+    uint64_t counts[PCC_NPRINTABLE];
+    const char *sep = "";
+
+    printf("{\"version\": %d, \"created\": %" PRIu64 ", \"requests\": %" PRIu64 ", \"totals\": ", PCC_SNAP_VERSION,
+           s->created, s->requests);
+    print_json_counts(s->totals);
+    printf(",\n \"sampled\": %" PRIu64 ", \"estimated\": ", s->sampled);
+    print_json_counts(s->est_totals);
+
+    printf(",\n \"window\": [");
+    for (int k = 0; k < PCC_WIN_TIERS; k++) {
+        const struct pcc_window_tier *tier = &s->win->tiers[k];
+        for (uint32_t i = 0; i < tier->nslots; i++) {
+            uint64_t epoch = atomic_load(&tier->slots[i].epoch);
+            if (epoch == 0) continue;
+            printf("%s\n  {\"width\": %u, \"start\": %" PRIu64 ", \"counts\": ", sep, tier->width,
+                   (epoch - 1) * tier->width);
+            window_counts(&tier->slots[i], counts);
+            print_json_counts(counts);
+            putchar('}');
+            sep = ",";
+        }
+    }
+
+    printf("],\n \"tenants\": [");
+    sep = "";
+    for (size_t i = 0; i < s->tenants->tab.nslots; i++) {
+        const struct pcc_tenant *t = &s->tenants->entries[i];
+        if (s->tenants->tab.hashes[i] == 0) continue;
+        printf("%s\n  {\"id\": ", sep);
+        print_json_string(t->id);
+        printf(", \"requests\": %" PRIu64 ", \"bytes\": %" PRIu64 ", \"printable\": %" PRIu64 ", \"error\": %" PRIu64
+               ", \"counts\": ",
+               t->requests, t->bytes, t->printable, t->error);
+        print_json_counts(t->counts);
+        putchar('}');
+        sep = ",";
+    }
+
+    printf("],\n \"streams\": [");
+    sep = "";
+    for (size_t i = 0; i < s->streams->tab.nslots; i++) {
+        const struct pcc_stream *st = &s->streams->entries[i];
+        if (s->streams->tab.hashes[i] == 0) continue;
+        printf("%s\n  {\"id\": ", sep);
+        print_json_string(st->id);
+        printf(", \"offset\": %" PRIu64 ", \"printable\": %" PRIu64 ", \"appends\": %" PRIu64 ", \"restarts\": %" PRIu64
+               ", \"counts\": ",
+               st->offset, st->printable, st->appends, st->restarts);
+        print_json_counts(st->counts);
+        putchar('}');
+        sep = ",";
+    }
+    printf("]}\n");
+}
+
+int main(int argc, char *argv[]) {
+    int fmt = FMT_TEXT, opt;
+    while ((opt = getopt(argc, argv, "f:")) != -1) {
+        if (opt != 'f') usage();
+        if (strcmp(optarg, "text") == 0) fmt = FMT_TEXT;
+        else if (strcmp(optarg, "csv") == 0) fmt = FMT_CSV;
+        else if (strcmp(optarg, "json") == 0) fmt = FMT_JSON;
+        else usage();
+    }
+    if (optind != argc - 1) usage();
+    const char *path = argv[optind];
+
+    const unsigned char *buf;
+    size_t len;
+    if (pcc_snap_map(path, &buf, &len) < 0) {
+        fprintf(stderr, "Error reading %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    // tables as big as the server's were, so every entry lands without evicting another
+    static struct pcc_window win;
+    struct pcc_tenant_table tenants;
+    struct pcc_stream_table streams;
+    size_t tenant_slots, stream_slots;
+    if (pcc_snap_slots(buf, len, &tenant_slots, &stream_slots) < 0) {
+        fprintf(stderr, "Error decoding %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    pcc_window_init(&win);
+    if (pcc_tenant_init(&tenants, tenant_slots ? tenant_slots : 1) < 0 ||
+        pcc_stream_init(&streams, stream_slots ? stream_slots : 1) < 0) {
+        fprintf(stderr, "Error allocating tables: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    struct pcc_snap s = {.win = &win, .tenants = &tenants, .streams = &streams};
+    if (pcc_snap_decode(buf, len, &s) < 0) {
+        fprintf(stderr, "Error decoding %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    pcc_snap_unmap(buf, len);
+
+    if (fmt == FMT_TEXT) dump_text(&s);
+    else if (fmt == FMT_CSV) dump_csv(&s);
+    else dump_json(&s);
+
+    pcc_tenant_free(&tenants);
+    pcc_stream_free(&streams);
+    if (fflush(stdout) != 0) {
+        fprintf(stderr, "Error writing output: %s\n", strerror(errno));
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include <string.h>
+
+#include "pcc_frame.h"
+#include "pcc_sample.h"
+
+int pcc_frame_check(const struct pcc_ext_req *req, const char **err) {
+    if (req->version != PCC_EXT_VERSION) {
+        *err = "unsupported version";
+        return -1;
+    }
+    if (req->opt_len > PCC_MAX_OPT_LEN) {
+        *err = "options too long";
+        return -1;
+    }
+    if (req->op == PCC_OP_COUNT || req->op == PCC_OP_SAMPLE) return 0;
+    if (req->op == PCC_OP_QUERY) {
+        if (req->n > PCC_MAX_QUERY_LEN) {
+            *err = "query too long";
+            return -1;
+        }
+        return 0;
+    }
+    if (req->op == PCC_OP_RING) {
+        if (req->n != 0) {
+            *err = "ring request with a payload";
+            return -1;
+        }
+        return 0;
+    }
+    *err = "unsupported op";
+    return -1;
+}
+
+int pcc_frame_parse_opts(const unsigned char *buf, size_t len, struct pcc_req_opts *opts, const char **err) {
+    size_t pos = 0;
+    uint16_t type, val_len;
+    const unsigned char *val;
+    int r;
+
+    memset(opts, 0, sizeof(*opts));
+    while ((r = pcc_opt_next(buf, len, &pos, &type, &val, &val_len)) > 0) {
+        switch (type) {
+        case PCC_OPT_TENANT:
+            if (val_len == 0 || val_len > PCC_TENANT_ID_MAX || memchr(val, '\0', val_len) != NULL) {
+                *err = "bad tenant id";
+                return -1;
+            }
+            memcpy(opts->tenant, val, val_len);
+            opts->tenant[val_len] = '\0';
+            break;
+        case PCC_OPT_SAMPLE: {
+            uint64_t true_n;
+            uint32_t block, tail;
+            if (val_len != PCC_OPT_SAMPLE_LEN) {
+                *err = "bad sample option";
+                return -1;
+            }
+            memcpy(&true_n, val, sizeof(true_n));
+            memcpy(&block, val + 8, sizeof(block));
+            memcpy(&tail, val + 12, sizeof(tail));
+            opts->sampled = 1;
+            opts->sample_n = pcc_ntoh64(true_n);
+            opts->sample_block = ntohl(block);
+            opts->sample_tail = ntohl(tail);
+            break;
+        }
+        case PCC_OPT_STREAM: {
+            uint64_t off;
+            size_t id_len = val_len - sizeof(off);
+            if (val_len <= sizeof(off) || id_len > PCC_STREAM_ID_MAX || memchr(val + sizeof(off), '\0', id_len) != NULL) {
+                *err = "bad stream option";
+                return -1;
+            }
+            memcpy(&off, val, sizeof(off));
+            opts->stream_off = pcc_ntoh64(off);
+            memcpy(opts->stream, val + sizeof(off), id_len);
+            opts->stream[id_len] = '\0';
+            break;
+        }
+        case PCC_OPT_NGRAM:
+            if (val_len != 1 || val[0] == 0 || (val[0] & ~(PCC_NGRAM_BIGRAMS | PCC_NGRAM_TRIGRAMS)) != 0) {
+                *err = "bad ngram option";
+                return -1;
+            }
+            opts->ngram = val[0];
+            break;
+        case PCC_OPT_CHECKSUM:
+            if (val_len != 1 || val[0] != PCC_CHECKSUM_CRC32C) {
+                *err = "bad checksum option";
+                return -1;
+            }
+            opts->checksum = val[0];
+            break;
+        default:
+            break; // unknown options are ignored
+        }
+    }
+    if (r < 0) {
+        *err = "malformed options";
+        return -1;
+    }
+    return 0;
+}
+
+int pcc_frame_check_opts(const struct pcc_ext_req *req, const struct pcc_req_opts *opts, const char **err) {
+    if (opts->stream[0] != '\0' && req->op != PCC_OP_COUNT) {
+        *err = "stream option on a request that does not count";
+        return -1;
+    }
+    if (opts->ngram != 0 && req->op != PCC_OP_COUNT) {
+        *err = "ngram option on a request that does not count";
+        return -1;
+    }
+    if (opts->checksum != 0 && req->op != PCC_OP_COUNT) {
+        *err = "checksum option on a request that does not count";
+        return -1;
+    }
+    if (opts->stream[0] != '\0' && req->n > UINT64_MAX - opts->stream_off) {
+        *err = "stream offset out of range";
+        return -1;
+    }
+    if (req->op != PCC_OP_SAMPLE) return 0;
+    if (!opts->sampled) {
+        *err = "sample without sample option";
+        return -1;
+    }
+    // the payload is whole blocks and then exactly the tail of the stream
+    uint32_t block = opts->sample_block;
+    if (block == 0 || block > PCC_SAMPLE_MAX_BLOCK || opts->sample_tail != opts->sample_n % block ||
+        req->n < opts->sample_tail || (req->n - opts->sample_tail) % block != 0 || req->n > opts->sample_n) {
+        *err = "inconsistent sample";
+        return -1;
+    }
+    return 0;
+}
+
+ssize_t pcc_frame_parse(const unsigned char *buf, size_t len, struct pcc_frame *f, const char **err) {
+    uint32_t N;
+
+    memset(f, 0, sizeof(*f));
+    if (len < sizeof(N)) return 0;
+    memcpy(&N, buf, sizeof(N));
+    N = ntohl(N);
+
+    if (N != PCC_EXT_MARKER) {
+        f->req.version = PCC_EXT_VERSION;
+        f->req.op = PCC_OP_COUNT;
+        f->req.n = N;
+        return sizeof(N);
+    }
+
+    f->ext = 1;
+    if (len < sizeof(N) + PCC_EXT_REQ_HDR_LEN) return 0;
+    pcc_ext_req_unpack(&f->req, buf + sizeof(N));
+    if (pcc_frame_check(&f->req, err) < 0) return -1;
+
+    size_t hdr_len = sizeof(N) + PCC_EXT_REQ_HDR_LEN + f->req.opt_len;
+    if (len < hdr_len) return 0;
+    if (pcc_frame_parse_opts(buf + sizeof(N) + PCC_EXT_REQ_HDR_LEN, f->req.opt_len, &f->opts, err) < 0) return -1;
+    if (pcc_frame_check_opts(&f->req, &f->opts, err) < 0) return -1;
+    return hdr_len;
+}
@@ -0,0 +1,55 @@
+#ifndef PCC_FRAME_H
+#define PCC_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "pcc_proto.h"
+#include "pcc_stream.h"
+#include "pcc_tenant.h"
+
+/*
+    request frame parsing, shared by the server and the fuzz targets (TESTER/fuzz_frame.c).
+    nothing here does I/O, the caller feeds the bytes it read.
+*/
+
+// options of an extended request, parsed from its TLVs
+struct pcc_req_opts {
+    char tenant[PCC_TENANT_ID_MAX + 1]; // empty means the peer address is the tenant
+    int sampled; // PCC_OPT_SAMPLE was there
+    uint64_t sample_n; // true_n
+    uint32_t sample_block;
+    uint32_t sample_tail;
+    char stream[PCC_STREAM_ID_MAX + 1]; // PCC_OPT_STREAM id, empty if there was none
+    uint64_t stream_off;
+    uint8_t ngram; // PCC_OPT_NGRAM flags, 0 if there was none
+    uint8_t checksum; // PCC_OPT_CHECKSUM algorithm, 0 if there was none
+};
+
+// a parsed request header. a basic frame is reported as an extended PCC_OP_COUNT
+// without options, so the caller handles both the same way
+struct pcc_frame {
+    int ext; // 1 if it came in an extended frame
+    struct pcc_ext_req req;
+    struct pcc_req_opts opts;
+};
+
+// check the fixed extended header. returns 0 if valid, otherwise -1 with *err set
+int pcc_frame_check(const struct pcc_ext_req *req, const char **err);
+
+// parse the option TLVs of a request. returns 0 if valid, otherwise -1 with *err set
+int pcc_frame_parse_opts(const unsigned char *buf, size_t len, struct pcc_req_opts *opts, const char **err);
+
+// check the options against the op of the request (PCC_OP_SAMPLE needs a consistent
+// PCC_OPT_SAMPLE, PCC_OPT_STREAM, PCC_OPT_NGRAM and PCC_OPT_CHECKSUM only go with
+// PCC_OP_COUNT). returns 0 if valid,
+// otherwise -1 with *err set
+int pcc_frame_check_opts(const struct pcc_ext_req *req, const struct pcc_req_opts *opts, const char **err);
+
+// parse the whole request header (N or marker + extended header + options) at the start of buf.
+// returns the header length (the payload starts right after it), 0 if more bytes are needed,
+// -1 if the frame is malformed, with *err set
+ssize_t pcc_frame_parse(const unsigned char *buf, size_t len, struct pcc_frame *f, const char **err);
+
+#endif
@@ -0,0 +1,329 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pcc_io.h"
+
+#define EPOLL_BATCH 64
+
+static const char *const backend_names[] = {"blocking", "epoll", "io_uring"};
+
+struct slot {
+    int fd;
+    struct pcc_sm *sm;
+    pcc_io_done_fn done;
+    void *arg;
+    int used;
+    uint32_t events; // what epoll waits for on fd, 0 if it isn't in the epoll set
+};
+
+struct pcc_io {
+    int backend;
+    int max_conns;
+    struct slot *slots;
+    int *free_slots; // a stack of unused slots
+    int nfree;
+    int *ready; // a queue of slots added since the last run, each in it at most once
+    int ready_head;
+    int nready;
+    int ended; // machines that ended in this run
+
+    int epfd;
+
+    // io_uring: the rings shared with the kernel
+    int ring_fd;
+    unsigned features;
+    void *sq_map, *cq_map;
+    size_t sq_map_len, cq_map_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;
+};
+
+int pcc_io_parse(const char *name) {
+    for (int i = 0; i < (int)(sizeof(backend_names) / sizeof(backend_names[0])); i++) {
+        if (strcmp(name, backend_names[i]) == 0) return i;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+const char *pcc_io_name(int backend) {
+    return backend_names[backend];
+}
+
+size_t pcc_io_active(const struct pcc_io *io) {
+    return (size_t)(io->max_conns - io->nfree);
+}
+
+static int uring_setup(struct pcc_io *io) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // one step in flight per connection, the completion queue is twice that by default
+    io->ring_fd = (int)syscall(__NR_io_uring_setup, (unsigned)io->max_conns, &p);
+    if (io->ring_fd < 0) return -1;
+    io->features = p.features;
+
+    io->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    io->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (io->cq_map_len > io->sq_map_len) io->sq_map_len = io->cq_map_len;
+        io->cq_map_len = io->sq_map_len;
+    }
+    io->sq_map = mmap(NULL, io->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd,
+                      IORING_OFF_SQ_RING);
+    if (io->sq_map == MAP_FAILED) {
+        io->sq_map = NULL;
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        io->cq_map = io->sq_map;
+    } else {
+        io->cq_map = mmap(NULL, io->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd,
+                          IORING_OFF_CQ_RING);
+        if (io->cq_map == MAP_FAILED) {
+            io->cq_map = NULL;
+            return -1;
+        }
+    }
+    io->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    io->sqes = mmap(NULL, io->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd,
+                    IORING_OFF_SQES);
+    if (io->sqes == MAP_FAILED) {
+        io->sqes = NULL;
+        return -1;
+    }
+
+    unsigned char *sq = io->sq_map, *cq = io->cq_map;
+    io->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    io->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    io->sq_array = (unsigned *)(sq + p.sq_off.array);
+    io->cq_head = (unsigned *)(cq + p.cq_off.head);
+    io->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    io->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    io->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+struct pcc_io *pcc_io_new(int backend, int max_conns) {
+    struct pcc_io *io = calloc(1, sizeof(*io));
+    if (io == NULL) return NULL;
+    io->backend = backend;
+    io->max_conns = max_conns;
+    io->epfd = -1;
+    io->ring_fd = -1;
+    io->slots = calloc((size_t)max_conns, sizeof(*io->slots));
+    io->free_slots = malloc((size_t)max_conns * sizeof(*io->free_slots));
+    io->ready = malloc((size_t)max_conns * sizeof(*io->ready));
+    if (io->slots == NULL || io->free_slots == NULL || io->ready == NULL) goto fail;
+    for (int i = 0; i < max_conns; i++) io->free_slots[i] = max_conns - 1 - i;
+    io->nfree = max_conns;
+
+    if (backend == PCC_IO_EPOLL && (io->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) goto fail;
+    if (backend == PCC_IO_URING && uring_setup(io) < 0) goto fail;
+    return io;
+
+fail:;
+    int err = errno;
+    pcc_io_free(io);
+    errno = err;
+    return NULL;
+}
+
+void pcc_io_free(struct pcc_io *io) {
+    if (io == NULL) return;
+    if (io->sqes != NULL) munmap(io->sqes, io->sqes_len);
+    if (io->cq_map != NULL && io->cq_map != io->sq_map) munmap(io->cq_map, io->cq_map_len);
+    if (io->sq_map != NULL) munmap(io->sq_map, io->sq_map_len);
+    if (io->ring_fd >= 0) close(io->ring_fd);
+    if (io->epfd >= 0) close(io->epfd);
+    free(io->slots);
+    free(io->free_slots);
+    free(io->ready);
+    free(io);
+}
+
+int pcc_io_add(struct pcc_io *io, int fd, struct pcc_sm *sm, pcc_io_done_fn done, void *arg) {
+    if (io->nfree == 0) {
+        errno = ENOSPC;
+        return -1;
+    }
+    if (io->backend == PCC_IO_EPOLL) {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+    }
+    int i = io->free_slots[--io->nfree];
+    io->slots[i] = (struct slot){.fd = fd, .sm = sm, .done = done, .arg = arg, .used = 1};
+    // it starts in the next run: done may add while a run goes on, and a blocking machine
+    // started right here would nest one frame deeper into the stack for every frame
+    io->ready[(io->ready_head + io->nready++) % io->max_conns] = i;
+    return 0;
+}
+
+// the slot is free before done runs, so done can add the fd again
+static void end_slot(struct pcc_io *io, int i) {
+    struct slot s = io->slots[i];
+    if (s.events != 0) epoll_ctl(io->epfd, EPOLL_CTL_DEL, s.fd, NULL);
+    io->slots[i].used = 0;
+    io->slots[i].events = 0;
+    io->free_slots[io->nfree++] = i;
+    io->ended++;
+    s.done(s.sm, s.arg);
+}
+
+static ssize_t do_io(int fd, int op, unsigned char *p, size_t len) {
+    // MSG_NOSIGNAL: a client that went away is an EPIPE for the machine, not a SIGPIPE
+    return op == PCC_SM_READ ? recv(fd, p, len, 0) : send(fd, p, len, MSG_NOSIGNAL);
+}
+
+static void blocking_step(struct pcc_io *io, int i) {
+    struct slot *s = &io->slots[i];
+    unsigned char *p;
+    size_t len;
+    int op;
+    while ((op = pcc_sm_next(s->sm, &p, &len)) != PCC_SM_DONE) {
+        ssize_t r = do_io(s->fd, op, p, len);
+        pcc_sm_done(s->sm, r < 0 ? -errno : r);
+    }
+    end_slot(io, i);
+}
+
+static void epoll_step(struct pcc_io *io, int i) {
+    struct slot *s = &io->slots[i];
+    unsigned char *p;
+    size_t len;
+    int op;
+    while ((op = pcc_sm_next(s->sm, &p, &len)) != PCC_SM_DONE) {
+        ssize_t r = do_io(s->fd, op, p, len);
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            uint32_t events = op == PCC_SM_READ ? EPOLLIN : EPOLLOUT;
+            if (events != s->events) {
+                struct epoll_event ev = {.events = events, .data.u32 = (uint32_t)i};
+                if (epoll_ctl(io->epfd, s->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, s->fd, &ev) < 0) {
+                    pcc_sm_done(s->sm, -errno); // ENOMEM or the like, there is no waiting then
+                    continue;
+                }
+                s->events = events;
+            }
+            return;
+        }
+        pcc_sm_done(s->sm, r < 0 ? -errno : r);
+    }
+    end_slot(io, i);
+}
+
+// queue the step the machine waits for, io_uring_enter submits it
+static void uring_step(struct pcc_io *io, int i) {
+    struct slot *s = &io->slots[i];
+    unsigned char *p;
+    size_t len;
+    int op = pcc_sm_next(s->sm, &p, &len);
+    if (op == PCC_SM_DONE) {
+        end_slot(io, i);
+        return;
+    }
+    // only we fill the submission queue, the kernel reads it after the release below
+    unsigned tail = *io->sq_tail;
+    unsigned at = tail & *io->sq_mask;
+    struct io_uring_sqe *sqe = &io->sqes[at];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op == PCC_SM_READ ? IORING_OP_RECV : IORING_OP_SEND;
+    sqe->fd = s->fd;
+    sqe->addr = (uint64_t)(uintptr_t)p;
+    sqe->len = (uint32_t)(len > UINT32_MAX ? UINT32_MAX : len);
+    sqe->msg_flags = op == PCC_SM_READ ? 0 : MSG_NOSIGNAL;
+    sqe->user_data = (uint64_t)i;
+    io->sq_array[at] = at;
+    atomic_store_explicit((_Atomic unsigned *)io->sq_tail, tail + 1, memory_order_release);
+    io->to_submit++;
+}
+
+static void step(struct pcc_io *io, int i) {
+    if (io->backend == PCC_IO_BLOCKING) blocking_step(io, i);
+    else if (io->backend == PCC_IO_EPOLL) epoll_step(io, i);
+    else uring_step(io, i);
+}
+
+static int epoll_wait_steps(struct pcc_io *io, int timeout_ms) {
+    struct epoll_event events[EPOLL_BATCH];
+    int n = epoll_wait(io->epfd, events, EPOLL_BATCH, timeout_ms);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+    for (int k = 0; k < n; k++) {
+        int i = (int)events[k].data.u32;
+        // an error or hang up shows as the read or write failing
+        if (io->slots[i].used) epoll_step(io, i);
+    }
+    return 0;
+}
+
+static int uring_wait_steps(struct pcc_io *io, int timeout_ms) {
+    unsigned flags = 0, wait = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    const void *argp = NULL;
+    size_t argsz = 0;
+    if (timeout_ms != 0 && pcc_io_active(io) != 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        wait = 1;
+        if (timeout_ms > 0 && (io->features & IORING_FEAT_EXT_ARG)) {
+            // older kernels can't time out a wait, it waits for the next completion then
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+            memset(&arg, 0, sizeof(arg));
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            argsz = sizeof(arg);
+        }
+    }
+    if (io->to_submit != 0 || wait != 0) {
+        long r = syscall(__NR_io_uring_enter, io->ring_fd, io->to_submit, wait, flags, argp, argsz);
+        if (r < 0 && errno != EINTR && errno != ETIME) return -1;
+        if (r > 0) io->to_submit -= (unsigned)r;
+    }
+
+    // only we empty the completion queue, the kernel fills it
+    unsigned head = *io->cq_head;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned *)io->cq_tail, memory_order_acquire);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &io->cqes[head & *io->cq_mask];
+        int i = (int)cqe->user_data;
+        int res = cqe->res;
+        head++;
+        atomic_store_explicit((_Atomic unsigned *)io->cq_head, head, memory_order_release);
+        pcc_sm_done(io->slots[i].sm, res);
+        uring_step(io, i);
+    }
+    return 0;
+}
+
+int pcc_io_run(struct pcc_io *io, int timeout_ms) {
+    io->ended = 0;
+    // the slots added before this run, not the ones done adds while it goes on
+    for (int n = io->nready; n > 0; n--) {
+        int i = io->ready[io->ready_head];
+        io->ready_head = (io->ready_head + 1) % io->max_conns;
+        io->nready--;
+        step(io, i);
+    }
+    // what ended, or was added meanwhile, is not kept waiting
+    if (io->ended != 0 || io->nready != 0) timeout_ms = 0;
+
+    int r = 0;
+    if (io->backend == PCC_IO_EPOLL) r = epoll_wait_steps(io, timeout_ms);
+    else if (io->backend == PCC_IO_URING) r = uring_wait_steps(io, timeout_ms);
+    return r < 0 ? -1 : io->ended;
+}
@@ -0,0 +1,51 @@
+#ifndef PCC_IO_H
+#define PCC_IO_H
+
+#include <stddef.h>
+
+#include "pcc_sm.h"
+
+/*
+    I/O backends that drive pcc_sm machines, one per connection, any number of them at once
+
+        blocking    the connections take turns: a machine runs to its end with plain
+                    read/send on the blocking socket before the next one starts. what a
+                    server worker does with its one connection
+        epoll       the sockets are made non-blocking, a machine goes as far as its socket
+                    lets it and waits in epoll for the rest
+        io_uring    every step is a recv or send submitted to an io_uring (raw system
+                    calls, no liburing), its completion is what pcc_sm_done gets. the steps
+                    of all connections go in with one io_uring_enter, which also waits
+
+    pcc_io_add hands a connection and a fresh machine to the backend, pcc_io_run then moves
+    the machines on: it waits up to timeout_ms for I/O (-1 for no limit, 0 not at all)
+    unless one ended already, and calls done for every machine that ended. the backend is
+    through with the fd then, done closes it or adds it again with a new machine (the next
+    frame). the same machine, sink and all, runs on every backend, which is what
+    bench_pcc backends compares.
+
+    only basic frames: a machine that ends with PCC_SM_EXT is handed back like any other.
+*/
+
+enum { PCC_IO_BLOCKING, PCC_IO_EPOLL, PCC_IO_URING };
+
+struct pcc_io;
+
+typedef void (*pcc_io_done_fn)(struct pcc_sm *sm, void *arg);
+
+// "blocking", "epoll" or "io_uring". returns the backend, or -1 with errno EINVAL
+int pcc_io_parse(const char *name);
+const char *pcc_io_name(int backend);
+
+// a backend for up to max_conns connections at once. returns NULL with errno set (for
+// io_uring the error of io_uring_setup, ENOSYS or EPERM where it is not there)
+struct pcc_io *pcc_io_new(int backend, int max_conns);
+void pcc_io_free(struct pcc_io *io);
+// drive sm over fd. returns 0, or -1 with errno ENOSPC if max_conns are in it already
+int pcc_io_add(struct pcc_io *io, int fd, struct pcc_sm *sm, pcc_io_done_fn done, void *arg);
+// returns how many machines ended, or -1 with errno set
+int pcc_io_run(struct pcc_io *io, int timeout_ms);
+// connections in it
+size_t pcc_io_active(const struct pcc_io *io);
+
+#endif
@@ -0,0 +1,1120 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pcc_crc.h"
+#include "pcc_lib.h"
+#include "pcc_net.h"
+#include "pcc_proto.h"
+#include "pcc_sample.h"
+#include "pcc_tenant.h"
+#include "pcc_tls.h"
+
+// marker, fixed header and the longest option list we send: tenant, then a sample, a stream or n-grams, then a
+// checksum
+#define REQ_HDR_MAX                                                                                                    \
+    (sizeof(uint32_t) + PCC_EXT_REQ_HDR_LEN + PCC_OPT_HDR_LEN + PCC_TENANT_ID_MAX + PCC_OPT_HDR_LEN + sizeof(uint64_t) + \
+     PCC_STREAM_ID_MAX + PCC_OPT_HDR_LEN + 1)
+#define STAGE_SIZE 65536 // payload read from a file per write
+#define READ_SIZE 4096
+#define MAX_BODY (64u << 20) // longest reply body we accept
+#define MAX_REQUEUES 3 // times a request is sent again after its connection ended at a frame boundary
+
+struct pcc_req {
+    struct pcc_req *next;
+    unsigned char hdr[REQ_HDR_MAX]; // marker, fixed header and options
+    size_t hdr_len;
+    const unsigned char *buf; // payload in memory, NULL if it comes from fd
+    unsigned char *owned; // buf when we made the copy
+    int fd;
+    off_t off;
+    uint64_t n;
+    uint64_t sent; // of req_len
+    size_t trailer_len; // PCC_CHECKSUM_LEN with a PCC_OPT_CHECKSUM, 0 without
+    uint32_t crc; // CRC32C of the payload, of what was staged so far for fd
+    uint64_t *blocks; // PCC_OP_SAMPLE: source block indices sent, then the tail of the source
+    uint64_t nblocks;
+    uint64_t src_len; // bytes of the source
+    uint32_t block;
+    uint64_t affinity; // stream requests: hash of the stream id, they stick to one server
+    uint8_t op;
+    int requeues; // connection ended at a frame boundary, not a failure
+    int retries; // connection failed
+    pcc_done_fn done;
+    void *arg;
+};
+
+struct req_list {
+    struct pcc_req *head, *tail;
+    size_t len;
+};
+
+struct pcc_server {
+    struct sockaddr_storage addr; // IPv4 or IPv6
+    socklen_t addr_len;
+    char host[INET6_ADDRSTRLEN]; // the address as text, what its certificate has to name
+    int nconns;
+    size_t outstanding;
+    int fails; // failures in a row, 0 when healthy
+    int64_t down_until; // ms, ejected until then
+    struct pcc_server_stats stats;
+};
+
+struct pcc_conn {
+    int srv; // index in ctx->servers, which moves when a server is added
+    int fd;
+    int connecting;
+    struct pcc_tls *tls; // NULL for plain TCP
+    int handshaking; // TLS handshake not done yet, nothing is written before
+    int keepalive; // the server kept the connection after a reply, requests may be pipelined
+    int closing; // the server closes after the reply it owes, no new requests
+    uint32_t events; // armed epoll events
+    int64_t last_io; // ms, last time bytes moved or the connection was opened
+    struct req_list reqs; // assigned requests in wire order, the head gets the next reply
+    struct pcc_req *send_cur; // first request not completely written, NULL if none
+
+    unsigned char rep_hdr[PCC_EXT_REP_HDR_LEN];
+    size_t rep_got;
+    struct pcc_ext_rep rep;
+    char *body;
+    size_t body_got;
+
+    unsigned char *stage; // file payload read but not written yet
+    size_t stage_off, stage_len;
+};
+
+struct pcc_ctx {
+    struct pcc_ctx_opts opts;
+    int epfd;
+    struct pcc_server *servers;
+    int nservers;
+    struct pcc_conn **conns;
+    int nconns;
+    struct req_list queue; // submitted, not assigned to a connection yet
+    size_t pending;
+    size_t completed;
+    unsigned rr; // where ties between servers start, so they share the load
+    unsigned seed; // for PCC_LB_P2C
+    int *cand; // scratch, nservers entries
+    struct pcc_tls_ctx *tls; // opts.tls_ca
+};
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void list_push(struct req_list *l, struct pcc_req *r) {
+    r->next = NULL;
+    if (l->tail != NULL) l->tail->next = r;
+    else l->head = r;
+    l->tail = r;
+    l->len++;
+}
+
+static struct pcc_req *list_pop(struct req_list *l) {
+    struct pcc_req *r = l->head;
+    if (r == NULL) return NULL;
+    l->head = r->next;
+    if (l->head == NULL) l->tail = NULL;
+    l->len--;
+    r->next = NULL;
+    return r;
+}
+
+// move all of src in front of dst, keeping their order
+static void list_prepend(struct req_list *dst, struct req_list *src) {
+    if (src->head == NULL) return;
+    src->tail->next = dst->head;
+    if (dst->tail == NULL) dst->tail = src->tail;
+    dst->head = src->head;
+    dst->len += src->len;
+    src->head = src->tail = NULL;
+    src->len = 0;
+}
+
+static void req_finish(struct pcc_ctx *ctx, struct pcc_req *r, int err, const struct pcc_ext_rep *rep, const char *body) {
+    struct pcc_result res = {.err = err, .n = r->n, .body = body != NULL ? body : ""};
+    if (err == 0) {
+        res.status = rep->status;
+        res.c = rep->c;
+        res.body_len = rep->body_len;
+        if (r->op == PCC_OP_SAMPLE && rep->status == PCC_STATUS_OK) sscanf(res.body, "# estimate %*u ci %" SCNu64, &res.ci);
+    }
+    ctx->pending--;
+    ctx->completed++;
+    r->done(&res, r->arg);
+    free(r->blocks);
+    free(r->owned);
+    free(r);
+}
+
+static void conn_set_events(struct pcc_ctx *ctx, struct pcc_conn *c) {
+    int want_out = c->connecting || (c->handshaking ? pcc_tls_want_write(c->tls) : c->send_cur != NULL);
+    uint32_t events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+    if (events == c->events) return;
+    struct epoll_event ev = {.events = events, .data.ptr = c};
+    epoll_ctl(ctx->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+}
+
+static void conn_free(struct pcc_ctx *ctx, struct pcc_conn *c) {
+    for (int i = 0; i < ctx->nconns; i++) {
+        if (ctx->conns[i] == c) {
+            ctx->conns[i] = ctx->conns[--ctx->nconns];
+            break;
+        }
+    }
+    ctx->servers[c->srv].nconns--;
+    ctx->servers[c->srv].outstanding -= c->reqs.len;
+    pcc_tls_free(c->tls, 0);
+    close(c->fd);
+    free(c->body);
+    free(c->stage);
+    free(c);
+}
+
+static void server_failed(struct pcc_ctx *ctx, struct pcc_server *s) {
+    int64_t backoff = ctx->opts.backoff_ms;
+    for (int i = 1; i < s->fails && backoff < ctx->opts.backoff_max_ms; i++) backoff *= 2;
+    s->fails++;
+    s->down_until = now_ms() + (backoff < ctx->opts.backoff_max_ms ? backoff : ctx->opts.backoff_max_ms);
+    s->stats.failures++;
+    s->stats.ejections++;
+}
+
+// bytes of r's frame: header, payload and trailer
+static uint64_t req_len(const struct pcc_req *r) {
+    return r->hdr_len + r->n + r->trailer_len;
+}
+
+// a request can go to another server if the failed one can't have counted it
+static int req_safe_to_retry(const struct pcc_req *r) {
+    return r->op == PCC_OP_QUERY || r->sent < req_len(r);
+}
+
+// the connection broke: the server is ejected, requests that are safe to repeat go back to
+// the front of the queue and the others fail with err
+static void conn_fail(struct pcc_ctx *ctx, struct pcc_conn *c, int err) {
+    struct req_list reqs = c->reqs, again = {0};
+    struct pcc_req *r;
+    if (err != ECANCELED) server_failed(ctx, &ctx->servers[c->srv]);
+    conn_free(ctx, c);
+    while ((r = list_pop(&reqs)) != NULL) {
+        if (err != ECANCELED && req_safe_to_retry(r) && r->retries++ < ctx->opts.retries) {
+            r->sent = 0;
+            list_push(&again, r);
+        } else {
+            req_finish(ctx, r, err, NULL, NULL);
+        }
+    }
+    list_prepend(&ctx->queue, &again);
+}
+
+// the connection ended at a frame boundary, the server did not process any of its requests
+// (see pcc_proto.h), they go back to the front of the queue
+static void conn_requeue(struct pcc_ctx *ctx, struct pcc_conn *c) {
+    struct req_list reqs = c->reqs, again = {0};
+    struct pcc_req *r;
+    conn_free(ctx, c);
+    while ((r = list_pop(&reqs)) != NULL) {
+        r->sent = 0;
+        if (++r->requeues >= MAX_REQUEUES) req_finish(ctx, r, ECONNRESET, NULL, NULL);
+        else list_push(&again, r);
+    }
+    list_prepend(&ctx->queue, &again);
+}
+
+static struct pcc_conn *conn_open(struct pcc_ctx *ctx, int idx) {
+    struct pcc_server *srv = &ctx->servers[idx];
+    struct pcc_conn *c = calloc(1, sizeof(*c));
+    if (c == NULL) return NULL;
+    c->fd = socket(srv->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) {
+        free(c);
+        return NULL;
+    }
+    // replies are small and pipelined requests go out back to back, don't let Nagle hold them
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(c->fd, (struct sockaddr *)&srv->addr, srv->addr_len) < 0) {
+        if (errno != EINPROGRESS) {
+            int err = errno;
+            close(c->fd);
+            free(c);
+            errno = err;
+            return NULL;
+        }
+        c->connecting = 1;
+    }
+    if (ctx->tls != NULL) {
+        // the certificate has to name the address we connect to
+        if ((c->tls = pcc_tls_client_new(ctx->tls, c->fd, srv->host)) == NULL) {
+            close(c->fd);
+            free(c);
+            errno = EPROTO;
+            return NULL;
+        }
+        c->handshaking = 1;
+    }
+
+    c->srv = idx;
+    c->events = EPOLLIN | EPOLLOUT;
+    struct epoll_event ev = {.events = c->events, .data.ptr = c};
+    if (epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+        int err = errno;
+        pcc_tls_free(c->tls, 0);
+        close(c->fd);
+        free(c);
+        errno = err;
+        return NULL;
+    }
+    srv->nconns++;
+    c->last_io = now_ms();
+    ctx->conns[ctx->nconns++] = c;
+    return c;
+}
+
+// where payload byte pay_off of r is in its source, *run gets how many bytes from there
+// are contiguous there. a sample's payload is its blocks and then the tail of the source
+static uint64_t req_src(const struct pcc_req *r, uint64_t pay_off, uint64_t *run) {
+    if (r->blocks == NULL) {
+        *run = r->n - pay_off;
+        return pay_off;
+    }
+    uint64_t i = pay_off / r->block;
+    if (i < r->nblocks) {
+        *run = r->block - pay_off % r->block;
+        return r->blocks[i] * r->block + pay_off % r->block;
+    }
+    *run = r->n - pay_off;
+    return r->src_len - *run;
+}
+
+// sendmsg(2) of iov on the connection, through TLS if it has it
+static ssize_t conn_send(struct pcc_conn *c, const struct iovec *iov, int niov) {
+    if (c->tls == NULL) {
+        struct msghdr msg = {.msg_iov = (struct iovec *)iov, .msg_iovlen = niov};
+        return sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+    }
+    // a record per piece. the header piece is small, coalescing it would cost a copy of
+    // the payload
+    ssize_t total = 0;
+    for (int i = 0; i < niov; i++) {
+        ssize_t w = pcc_tls_write(c->tls, iov[i].iov_base, iov[i].iov_len);
+        if (w < 0) return total > 0 ? total : -1;
+        total += w;
+        if ((size_t)w < iov[i].iov_len) break;
+    }
+    return total;
+}
+
+// write as much of the assigned requests as the socket takes.
+// returns 0, or an errno value if the connection is broken
+static int conn_write(struct pcc_ctx *ctx, struct pcc_conn *c) {
+    while (c->send_cur != NULL) {
+        struct pcc_req *r = c->send_cur;
+        struct iovec iov[3];
+        int niov = 0;
+        size_t hdr_left = r->sent < r->hdr_len ? r->hdr_len - r->sent : 0;
+        uint64_t pay_off = r->sent - (r->hdr_len - hdr_left); // past n in the trailer
+        uint64_t pay_end = pay_off; // where the payload in iov ends
+        size_t staged = 0; // of it from c->stage
+        unsigned char trailer[PCC_CHECKSUM_LEN];
+
+        if (hdr_left > 0) iov[niov++] = (struct iovec){r->hdr + r->sent, hdr_left};
+        if (pay_off < r->n) {
+            uint64_t left;
+            uint64_t src = req_src(r, pay_off, &left);
+            if (r->buf != NULL) {
+                iov[niov++] = (struct iovec){(void *)(r->buf + src), left < (1u << 30) ? left : (1u << 30)};
+            } else {
+                if (c->stage_off == c->stage_len) {
+                    if (c->stage == NULL && (c->stage = malloc(STAGE_SIZE)) == NULL) return ENOMEM;
+                    ssize_t got = pread(r->fd, c->stage, left < STAGE_SIZE ? left : STAGE_SIZE, r->off + src);
+                    if (got <= 0) return EIO; // file shrank or unreadable, the frame can't be completed
+                    c->stage_off = 0;
+                    c->stage_len = got;
+                    // staged in payload order, once per byte
+                    if (r->trailer_len > 0) r->crc = pcc_crc32c(pay_off == 0 ? 0 : r->crc, c->stage, got);
+                }
+                staged = c->stage_len - c->stage_off;
+                iov[niov++] = (struct iovec){c->stage + c->stage_off, staged};
+            }
+            pay_end += iov[niov - 1].iov_len;
+        }
+        if (r->trailer_len > 0 && pay_end >= r->n) {
+            // the payload is all in iov or sent, its crc complete
+            size_t tr_off = pay_off > r->n ? (size_t)(pay_off - r->n) : 0;
+            uint32_t crc = htonl(r->crc);
+            memcpy(trailer, &crc, sizeof(crc));
+            iov[niov++] = (struct iovec){trailer + tr_off, r->trailer_len - tr_off};
+        }
+
+        if (niov > 0) {
+            ssize_t w = conn_send(c, iov, niov);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return errno;
+            }
+            if ((size_t)w > hdr_left) c->stage_off += (size_t)w - hdr_left < staged ? (size_t)w - hdr_left : staged;
+            r->sent += w;
+            c->last_io = now_ms();
+        }
+        if (r->sent == req_len(r)) c->send_cur = r->next;
+    }
+    conn_set_events(ctx, c);
+    return 0;
+}
+
+// a complete reply for the head request arrived.
+// returns 1 if the connection was closed by it, 0 otherwise
+static int conn_reply(struct pcc_ctx *ctx, struct pcc_conn *c) {
+    struct pcc_req *r = list_pop(&c->reqs);
+    struct pcc_server *srv = &ctx->servers[c->srv];
+    struct pcc_ext_rep rep = c->rep;
+
+    srv->outstanding--;
+    srv->fails = 0; // an answer makes it healthy again
+    srv->stats.requests++;
+    char *body = c->body;
+    int kept = rep.flags & PCC_FLAG_KEEPALIVE;
+
+    if (c->send_cur == r) {
+        // answered before we finished sending, a rejected request: the server closes now
+        c->send_cur = NULL;
+        kept = 0;
+    }
+    c->body = NULL;
+    c->rep_got = c->body_got = 0;
+    if (kept) c->keepalive = 1;
+    else c->closing = 1;
+
+    if (rep.status == PCC_STATUS_BUSY && r->retries++ < ctx->opts.retries) {
+        // shed by a server at its budget, nothing was counted: again once its backoff is
+        // over, or on another server
+        struct req_list again = {0};
+        server_failed(ctx, srv);
+        r->sent = 0;
+        list_push(&again, r);
+        list_prepend(&ctx->queue, &again);
+    } else if (rep.status == PCC_STATUS_CHECKSUM && r->retries++ < ctx->opts.retries) {
+        // damaged on the way, nothing was counted: sent again, the server is not to blame
+        struct req_list again = {0};
+        r->sent = 0;
+        list_push(&again, r);
+        list_prepend(&ctx->queue, &again);
+    } else {
+        req_finish(ctx, r, 0, &rep, body);
+    }
+    free(body);
+
+    if (!kept) {
+        // nothing behind it was processed, usually there is nothing since we only pipeline
+        // once the server kept the connection
+        conn_requeue(ctx, c);
+        return 1;
+    }
+    return 0;
+}
+
+// read and dispatch replies.
+// returns 1 if the connection was closed, 0 otherwise
+static int conn_read(struct pcc_ctx *ctx, struct pcc_conn *c) {
+    unsigned char buf[READ_SIZE];
+    for (;;) {
+        ssize_t got = c->tls != NULL ? pcc_tls_read(c->tls, buf, sizeof(buf)) : recv(c->fd, buf, sizeof(buf), 0);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            conn_fail(ctx, c, errno);
+            return 1;
+        }
+        c->last_io = now_ms();
+        if (got == 0) {
+            if (c->rep_got > 0) conn_fail(ctx, c, EPROTO); // cut in the middle of a reply
+            else conn_requeue(ctx, c);
+            return 1;
+        }
+
+        for (size_t pos = 0; pos < (size_t)got;) {
+            if (c->reqs.head == NULL) {
+                conn_fail(ctx, c, EPROTO); // a reply nobody asked for
+                return 1;
+            }
+            if (c->rep_got < PCC_EXT_REP_HDR_LEN) {
+                size_t take = PCC_EXT_REP_HDR_LEN - c->rep_got;
+                if (take > got - pos) take = got - pos;
+                memcpy(c->rep_hdr + c->rep_got, buf + pos, take);
+                c->rep_got += take;
+                pos += take;
+                if (c->rep_got < PCC_EXT_REP_HDR_LEN) break;
+
+                pcc_ext_rep_unpack(&c->rep, c->rep_hdr);
+                if (c->rep.version != PCC_EXT_VERSION || c->rep.body_len > MAX_BODY ||
+                    (c->body = malloc(c->rep.body_len + 1)) == NULL) {
+                    conn_fail(ctx, c, EPROTO);
+                    return 1;
+                }
+                c->body_got = 0;
+            }
+            size_t take = c->rep.body_len - c->body_got;
+            if (take > got - pos) take = got - pos;
+            memcpy(c->body + c->body_got, buf + pos, take);
+            c->body_got += take;
+            pos += take;
+            if (c->body_got < c->rep.body_len) break;
+
+            c->body[c->body_got] = '\0';
+            if (conn_reply(ctx, c)) return 1;
+        }
+    }
+}
+
+// write and deal with a broken connection. a write that fails because the server already
+// closed a kept connection (idle) must not fail the requests, reading tells: the server's
+// FIN at a frame boundary requeues them
+static void conn_flush(struct pcc_ctx *ctx, struct pcc_conn *c) {
+    int err = conn_write(ctx, c);
+    if (err == 0) return;
+    if ((err == EPIPE || err == ECONNRESET) && conn_read(ctx, c)) return;
+    conn_fail(ctx, c, err);
+}
+
+static int conn_can_take(const struct pcc_ctx *ctx, const struct pcc_conn *c) {
+    if (c->closing) return 0;
+    if (c->reqs.len == 0) return 1;
+    return c->keepalive && c->reqs.len < (size_t)ctx->opts.max_inflight;
+}
+
+static void conn_assign(struct pcc_ctx *ctx, struct pcc_conn *c, struct pcc_req *r) {
+    list_push(&c->reqs, r);
+    ctx->servers[c->srv].outstanding++;
+    if (c->reqs.len == 1) c->last_io = now_ms(); // an idle connection starts its timeout now
+    if (c->send_cur == NULL) c->send_cur = r;
+    if (!c->connecting && !c->handshaking) conn_flush(ctx, c);
+}
+
+// the connection of server i a request would go to, NULL if none can take it.
+// *open is set when another connection to it should be opened instead
+static struct pcc_conn *server_conn(struct pcc_ctx *ctx, int i, int *open) {
+    struct pcc_server *s = &ctx->servers[i];
+    struct pcc_conn *best = NULL;
+    for (int k = 0; k < ctx->nconns; k++) {
+        struct pcc_conn *c = ctx->conns[k];
+        if (c->srv == i && conn_can_take(ctx, c) && (best == NULL || c->reqs.len < best->reqs.len)) best = c;
+    }
+    // a server coming back from an ejection gets one probe connection
+    int room = s->nconns < (s->fails > 0 ? 1 : ctx->opts.conns_per_server);
+    *open = room && (best == NULL || best->reqs.len > 0);
+    return best;
+}
+
+// the server for the next request by ctx->opts.lb, -1 if none is healthy and has room
+static int pick_server(struct pcc_ctx *ctx, int64_t now, const struct pcc_req *r) {
+    int n = 0, open;
+    if (r->affinity != 0) {
+        // a stream lives on one server: rendezvous hashing over the servers that are not
+        // ejected, so it only moves when its server fails (and then starts over there)
+        int home = -1;
+        uint64_t best_w = 0;
+        for (int i = 0; i < ctx->nservers; i++) {
+            if (ctx->servers[i].down_until > now) continue;
+            uint64_t w = (r->affinity ^ (uint64_t)(i + 1) * 0x9e3779b97f4a7c15ULL) * 0xff51afd7ed558ccdULL;
+            w ^= w >> 33;
+            if (home < 0 || w > best_w) {
+                home = i;
+                best_w = w;
+            }
+        }
+        if (home >= 0 && (server_conn(ctx, home, &open) != NULL || open)) return home;
+        return -1;
+    }
+    for (int k = 0; k < ctx->nservers; k++) {
+        int i = (ctx->rr + k) % ctx->nservers;
+        if (ctx->servers[i].down_until > now) continue;
+        if (server_conn(ctx, i, &open) != NULL || open) ctx->cand[n++] = i;
+    }
+    if (n == 0) return -1;
+    ctx->rr++;
+
+    if (ctx->opts.lb == PCC_LB_P2C && n > 2) {
+        int a = ctx->cand[rand_r(&ctx->seed) % n];
+        int b = ctx->cand[rand_r(&ctx->seed) % (n - 1)];
+        if (b == a) b = ctx->cand[n - 1];
+        return ctx->servers[b].outstanding < ctx->servers[a].outstanding ? b : a;
+    }
+    int best = ctx->cand[0];
+    for (int k = 1; k < n; k++) {
+        if (ctx->servers[ctx->cand[k]].outstanding < ctx->servers[best].outstanding) best = ctx->cand[k];
+    }
+    return best;
+}
+
+// hand queued requests to the picked server's least loaded connection, opening another
+// connection when all of its connections are busy and its pool has room
+static void dispatch(struct pcc_ctx *ctx) {
+    int64_t now = now_ms();
+    while (ctx->queue.head != NULL) {
+        int i = pick_server(ctx, now, ctx->queue.head), open;
+        if (i < 0) break; // every server is full or ejected, wait for replies or backoff
+        struct pcc_conn *best = server_conn(ctx, i, &open);
+        if (open) {
+            struct pcc_conn *c = conn_open(ctx, i);
+            if (c != NULL) {
+                best = c;
+            } else if (best == NULL) {
+                // failed right away, counts as an attempt of the request that wanted it
+                int err = errno;
+                struct pcc_req *r = list_pop(&ctx->queue);
+                server_failed(ctx, &ctx->servers[i]);
+                if (r->retries++ < ctx->opts.retries) {
+                    struct req_list again = {0};
+                    list_push(&again, r);
+                    list_prepend(&ctx->queue, &again);
+                } else {
+                    req_finish(ctx, r, err, NULL, NULL);
+                }
+                continue;
+            }
+        }
+        conn_assign(ctx, best, list_pop(&ctx->queue));
+    }
+}
+
+// ms until the next timer: a connection timing out, or an ejected server coming back while
+// requests wait. -1 if none
+static int next_timer(struct pcc_ctx *ctx, int64_t now) {
+    int64_t next = -1;
+    for (int k = 0; k < ctx->nconns; k++) {
+        struct pcc_conn *c = ctx->conns[k];
+        if (c->reqs.len == 0) continue;
+        int64_t t = c->last_io + ctx->opts.timeout_ms;
+        if (next < 0 || t < next) next = t;
+    }
+    for (int i = 0; ctx->queue.head != NULL && i < ctx->nservers; i++) {
+        int64_t t = ctx->servers[i].down_until;
+        if (t > now && (next < 0 || t < next)) next = t;
+    }
+    return next < 0 ? -1 : next <= now ? 0 : (int)(next - now);
+}
+
+// fail connections without progress for timeout_ms, the server is slow or gone
+static void check_timeouts(struct pcc_ctx *ctx, int64_t now) {
+    for (int k = 0; k < ctx->nconns;) {
+        struct pcc_conn *c = ctx->conns[k];
+        if (c->reqs.len > 0 && now - c->last_io >= ctx->opts.timeout_ms) {
+            conn_fail(ctx, c, ETIMEDOUT); // moves the last connection to k
+        } else {
+            k++;
+        }
+    }
+}
+
+struct pcc_ctx *pcc_ctx_new(const struct pcc_ctx_opts *opts) {
+    struct pcc_ctx *ctx = calloc(1, sizeof(*ctx));
+    if (ctx == NULL) return NULL;
+    ctx->opts.conns_per_server = opts != NULL && opts->conns_per_server > 0 ? opts->conns_per_server : 1;
+    ctx->opts.max_inflight = opts != NULL && opts->max_inflight > 0 ? opts->max_inflight : 32;
+    ctx->opts.lb = opts != NULL ? opts->lb : PCC_LB_LEAST;
+    ctx->opts.retries = opts != NULL && opts->retries > 0 ? opts->retries : 2;
+    ctx->opts.timeout_ms = opts != NULL && opts->timeout_ms > 0 ? opts->timeout_ms : 10000;
+    ctx->opts.backoff_ms = opts != NULL && opts->backoff_ms > 0 ? opts->backoff_ms : 100;
+    ctx->opts.backoff_max_ms = opts != NULL && opts->backoff_max_ms > 0 ? opts->backoff_max_ms : 10000;
+    ctx->seed = (unsigned)now_ms() ^ (unsigned)(uintptr_t)ctx;
+    ctx->opts.checksum = opts != NULL ? opts->checksum : 0;
+    if (ctx->opts.checksum != 0 && ctx->opts.checksum != PCC_CHECKSUM_CRC32C) {
+        free(ctx);
+        errno = EINVAL;
+        return NULL;
+    }
+    if (opts != NULL && opts->tls_ca != NULL && (ctx->tls = pcc_tls_client_ctx(opts->tls_ca)) == NULL) {
+        free(ctx);
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((ctx->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        pcc_tls_ctx_free(ctx->tls);
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void pcc_ctx_free(struct pcc_ctx *ctx) {
+    struct pcc_req *r;
+    if (ctx == NULL) return;
+    while (ctx->nconns > 0) conn_fail(ctx, ctx->conns[0], ECANCELED);
+    while ((r = list_pop(&ctx->queue)) != NULL) req_finish(ctx, r, ECANCELED, NULL, NULL);
+    close(ctx->epfd);
+    pcc_tls_ctx_free(ctx->tls);
+    free(ctx->conns);
+    free(ctx->servers);
+    free(ctx->cand);
+    free(ctx);
+}
+
+int pcc_ctx_add_server(struct pcc_ctx *ctx, const char *ip, int port) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    if (port <= 0 || pcc_net_addr(ip, port, &addr, &addr_len) < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct pcc_server *servers = realloc(ctx->servers, (ctx->nservers + 1) * sizeof(*servers));
+    if (servers == NULL) return -1;
+    ctx->servers = servers;
+    struct pcc_conn **conns = realloc(ctx->conns, (ctx->nservers + 1) * ctx->opts.conns_per_server * sizeof(*conns));
+    if (conns == NULL) return -1;
+    ctx->conns = conns;
+    int *cand = realloc(ctx->cand, (ctx->nservers + 1) * sizeof(*cand));
+    if (cand == NULL) return -1;
+    ctx->cand = cand;
+    memset(&servers[ctx->nservers], 0, sizeof(servers[0]));
+    servers[ctx->nservers].addr = addr;
+    servers[ctx->nservers].addr_len = addr_len;
+    pcc_net_addr_name((struct sockaddr *)&addr, servers[ctx->nservers].host, sizeof(servers[0].host));
+    ctx->nservers++;
+    return 0;
+}
+
+int pcc_ctx_servers(const struct pcc_ctx *ctx) {
+    return ctx->nservers;
+}
+
+int pcc_ctx_server_stats(const struct pcc_ctx *ctx, int i, struct pcc_server_stats *stats) {
+    if (i < 0 || i >= ctx->nservers) {
+        errno = EINVAL;
+        return -1;
+    }
+    const struct pcc_server *s = &ctx->servers[i];
+    *stats = s->stats;
+    stats->outstanding = s->outstanding;
+    stats->conns = s->nconns;
+    stats->ejected = s->down_until > now_ms();
+    return 0;
+}
+
+int pcc_ctx_fd(const struct pcc_ctx *ctx) {
+    return ctx->epfd;
+}
+
+size_t pcc_pending(const struct pcc_ctx *ctx) {
+    return ctx->pending;
+}
+
+static struct pcc_req *req_new(uint8_t op, const char *tenant, uint64_t n, pcc_done_fn done, void *arg) {
+    size_t tenant_len = tenant != NULL ? strlen(tenant) : 0;
+    if (done == NULL || (tenant != NULL && (tenant_len == 0 || tenant_len > PCC_TENANT_ID_MAX))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    struct pcc_req *r = calloc(1, sizeof(*r));
+    if (r == NULL) return NULL;
+
+    uint32_t marker = htonl(PCC_EXT_MARKER);
+    unsigned char *opts = r->hdr + sizeof(marker) + PCC_EXT_REQ_HDR_LEN;
+    size_t opt_len = 0;
+    if (tenant != NULL) opt_len = pcc_opt_put(opts, opt_len, PCC_OPT_TENANT, tenant, tenant_len);
+    struct pcc_ext_req req = {PCC_EXT_VERSION, op, PCC_FLAG_KEEPALIVE, opt_len, n};
+    memcpy(r->hdr, &marker, sizeof(marker));
+    pcc_ext_req_pack(&req, r->hdr + sizeof(marker));
+
+    r->hdr_len = sizeof(marker) + PCC_EXT_REQ_HDR_LEN + opt_len;
+    r->op = op;
+    r->fd = -1;
+    r->n = n;
+    r->done = done;
+    r->arg = arg;
+    return r;
+}
+
+// append an option after the ones req_new put in, the header has room for one sample, stream or n-gram and a
+// checksum
+static void req_add_opt(struct pcc_req *r, uint16_t type, const void *val, uint16_t val_len) {
+    unsigned char *fixed = r->hdr + sizeof(uint32_t);
+    struct pcc_ext_req req;
+    pcc_ext_req_unpack(&req, fixed);
+    r->hdr_len = pcc_opt_put(r->hdr, r->hdr_len, type, val, val_len);
+    req.opt_len += PCC_OPT_HDR_LEN + val_len;
+    pcc_ext_req_pack(&req, fixed);
+}
+
+static int submit(struct pcc_ctx *ctx, struct pcc_req *r) {
+    if (ctx->nservers == 0) {
+        free(r->blocks);
+        free(r->owned);
+        free(r);
+        errno = EDESTADDRREQ;
+        return -1;
+    }
+    if (r->op == PCC_OP_COUNT && ctx->opts.checksum != 0) {
+        uint8_t alg = ctx->opts.checksum;
+        req_add_opt(r, PCC_OPT_CHECKSUM, &alg, sizeof(alg));
+        r->trailer_len = PCC_CHECKSUM_LEN;
+        // a file's is taken while it is staged, it is read then anyway
+        if (r->buf != NULL) r->crc = pcc_crc32c(0, r->buf, r->n);
+    }
+    list_push(&ctx->queue, r);
+    ctx->pending++;
+    return 0;
+}
+
+int pcc_submit_buf(struct pcc_ctx *ctx, const void *buf, size_t len, const char *tenant, pcc_done_fn done, void *arg) {
+    struct pcc_req *r = req_new(PCC_OP_COUNT, tenant, len, done, arg);
+    if (r == NULL) return -1;
+    r->buf = buf;
+    return submit(ctx, r);
+}
+
+// read fd to its end into a malloc'ed buffer, NULL on failure
+static unsigned char *slurp(int fd, size_t *len) {
+    unsigned char *data = NULL;
+    size_t cap = 0;
+    *len = 0;
+    for (;;) {
+        if (*len == cap) {
+            unsigned char *grown = realloc(data, cap = cap ? cap * 2 : STAGE_SIZE);
+            if (grown == NULL) {
+                free(data);
+                return NULL;
+            }
+            data = grown;
+        }
+        ssize_t got = read(fd, data + *len, cap - *len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            free(data);
+            return NULL;
+        }
+        if (got == 0) return data;
+        *len += got;
+    }
+}
+
+// a PCC_OP_COUNT request for fd from its current offset, NULL on failure
+static struct pcc_req *fd_req(int fd, const char *tenant, pcc_done_fn done, void *arg) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) return NULL;
+
+    if (S_ISREG(st.st_mode)) {
+        off_t off = lseek(fd, 0, SEEK_CUR);
+        if (off < 0) return NULL;
+        struct pcc_req *r = req_new(PCC_OP_COUNT, tenant, off < st.st_size ? st.st_size - off : 0, done, arg);
+        if (r == NULL) return NULL;
+        r->fd = fd;
+        r->off = off;
+        return r;
+    }
+
+    // pipes and sockets have no size, the frame needs n up front
+    size_t len;
+    unsigned char *data = slurp(fd, &len);
+    if (data == NULL) return NULL;
+    struct pcc_req *r = req_new(PCC_OP_COUNT, tenant, len, done, arg);
+    if (r == NULL) {
+        free(data);
+        return NULL;
+    }
+    r->buf = r->owned = data;
+    return r;
+}
+
+int pcc_submit_fd(struct pcc_ctx *ctx, int fd, const char *tenant, pcc_done_fn done, void *arg) {
+    struct pcc_req *r = fd_req(fd, tenant, done, arg);
+    if (r == NULL) return -1;
+    return submit(ctx, r);
+}
+
+int pcc_submit_ngram_fd(struct pcc_ctx *ctx, int fd, const char *tenant, int ngram, pcc_done_fn done, void *arg) {
+    if (ngram == 0 || (ngram & ~(PCC_NGRAM_BIGRAMS | PCC_NGRAM_TRIGRAMS)) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct pcc_req *r = fd_req(fd, tenant, done, arg);
+    if (r == NULL) return -1;
+    uint8_t flags = ngram;
+    req_add_opt(r, PCC_OPT_NGRAM, &flags, sizeof(flags));
+    return submit(ctx, r);
+}
+
+// a PCC_OP_SAMPLE request for a source of len bytes, its blocks picked as sample says
+static struct pcc_req *sample_req(uint64_t len, const char *tenant, const struct pcc_sample *sample, pcc_done_fn done,
+                                  void *arg) {
+    uint32_t block = sample->block != 0 ? sample->block : PCC_SAMPLE_DEFAULT_BLOCK;
+    if (!(sample->rate > 0 && sample->rate <= 1) || block > PCC_SAMPLE_MAX_BLOCK ||
+        (sample->mode != PCC_SAMPLE_STRIDE && sample->mode != PCC_SAMPLE_RANDOM)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    unsigned seed = sample->seed;
+    uint64_t *blocks;
+    ssize_t k = pcc_sample_pick(len, block, sample->rate, sample->mode, &seed, &blocks);
+    if (k < 0) return NULL;
+
+    unsigned char opt[PCC_OPT_SAMPLE_LEN];
+    uint64_t true_n = pcc_hton64(len);
+    uint32_t b = htonl(block), tail = htonl(len % block);
+    memcpy(opt, &true_n, sizeof(true_n));
+    memcpy(opt + 8, &b, sizeof(b));
+    memcpy(opt + 12, &tail, sizeof(tail));
+
+    struct pcc_req *r = req_new(PCC_OP_SAMPLE, tenant, (uint64_t)k * block + len % block, done, arg);
+    if (r == NULL) {
+        free(blocks);
+        return NULL;
+    }
+    req_add_opt(r, PCC_OPT_SAMPLE, opt, sizeof(opt));
+    r->blocks = blocks;
+    r->nblocks = k;
+    r->block = block;
+    r->src_len = len;
+    return r;
+}
+
+int pcc_submit_sample_buf(struct pcc_ctx *ctx, const void *buf, size_t len, const char *tenant,
+                          const struct pcc_sample *sample, pcc_done_fn done, void *arg) {
+    struct pcc_req *r = sample_req(len, tenant, sample, done, arg);
+    if (r == NULL) return -1;
+    r->buf = buf;
+    return submit(ctx, r);
+}
+
+int pcc_submit_sample_fd(struct pcc_ctx *ctx, int fd, const char *tenant, const struct pcc_sample *sample,
+                         pcc_done_fn done, void *arg) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) return -1;
+
+    if (S_ISREG(st.st_mode)) {
+        off_t off = lseek(fd, 0, SEEK_CUR);
+        if (off < 0) return -1;
+        struct pcc_req *r = sample_req(off < st.st_size ? st.st_size - off : 0, tenant, sample, done, arg);
+        if (r == NULL) return -1;
+        r->fd = fd;
+        r->off = off;
+        return submit(ctx, r);
+    }
+
+    // sampling a pipe saves the network and the server, not the reading
+    size_t len;
+    unsigned char *data = slurp(fd, &len);
+    if (data == NULL) return -1;
+    struct pcc_req *r = sample_req(len, tenant, sample, done, arg);
+    if (r == NULL) {
+        free(data);
+        return -1;
+    }
+    r->buf = r->owned = data;
+    return submit(ctx, r);
+}
+
+int pcc_submit_stream_fd(struct pcc_ctx *ctx, int fd, const char *tenant, const char *stream, uint64_t offset,
+                         pcc_done_fn done, void *arg) {
+    struct stat st;
+    size_t id_len = stream != NULL ? strlen(stream) : 0;
+    if (id_len == 0 || id_len > PCC_STREAM_ID_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) return -1;
+    if (!S_ISREG(st.st_mode)) {
+        errno = ESPIPE;
+        return -1;
+    }
+
+    struct pcc_req *r = req_new(PCC_OP_COUNT, tenant, (uint64_t)st.st_size > offset ? st.st_size - offset : 0, done, arg);
+    if (r == NULL) return -1;
+    unsigned char opt[sizeof(uint64_t) + PCC_STREAM_ID_MAX];
+    uint64_t off = pcc_hton64(offset);
+    memcpy(opt, &off, sizeof(off));
+    memcpy(opt + sizeof(off), stream, id_len);
+    req_add_opt(r, PCC_OPT_STREAM, opt, sizeof(off) + id_len);
+    r->affinity = 0xcbf29ce484222325ULL; // FNV-1a of the id
+    for (size_t i = 0; i < id_len; i++) r->affinity = (r->affinity ^ (unsigned char)stream[i]) * 0x100000001b3ULL;
+    r->affinity |= 1;
+    r->fd = fd;
+    r->off = offset;
+    return submit(ctx, r);
+}
+
+int pcc_submit_query(struct pcc_ctx *ctx, const char *query, pcc_done_fn done, void *arg) {
+    size_t len = strlen(query);
+    if (len > PCC_MAX_QUERY_LEN) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct pcc_req *r = req_new(PCC_OP_QUERY, NULL, len, done, arg);
+    if (r == NULL) return -1;
+    if ((r->owned = malloc(len + 1)) == NULL) {
+        free(r);
+        return -1;
+    }
+    memcpy(r->owned, query, len + 1);
+    r->buf = r->owned;
+    return submit(ctx, r);
+}
+
+int pcc_poll(struct pcc_ctx *ctx, int timeout_ms) {
+    size_t before = ctx->completed;
+    struct epoll_event events[64];
+
+    dispatch(ctx);
+    if (ctx->pending == 0) return (int)(ctx->completed - before);
+
+    // don't block when dispatch already finished something (a failed connect), nor past a timer
+    int wait = ctx->completed != before ? 0 : timeout_ms;
+    int timer = next_timer(ctx, now_ms());
+    if (timer >= 0 && (wait < 0 || timer < wait)) wait = timer;
+    int n = epoll_wait(ctx->epfd, events, 64, wait);
+    if (n < 0) {
+        if (errno == EINTR) return (int)(ctx->completed - before);
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        // a connection only closes itself while its own events are handled, callbacks only queue
+        struct pcc_conn *c = events[i].data.ptr;
+        uint32_t ev = events[i].events;
+
+        if (c->connecting) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (!(ev & (EPOLLOUT | EPOLLERR | EPOLLHUP))) continue;
+            getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err != 0) {
+                conn_fail(ctx, c, err);
+                continue;
+            }
+            c->connecting = 0;
+        }
+        if (c->handshaking) {
+            int r = pcc_tls_handshake(c->tls);
+            if (r < 0) {
+                conn_fail(ctx, c, EPROTO); // bad certificate or not a TLS server
+                continue;
+            }
+            if (r == 0) {
+                conn_set_events(ctx, c);
+                continue;
+            }
+            c->handshaking = 0;
+            c->last_io = now_ms();
+        }
+        if ((ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) && conn_read(ctx, c)) continue;
+        if (c->send_cur != NULL || (ev & EPOLLOUT)) conn_flush(ctx, c);
+    }
+    check_timeouts(ctx, now_ms());
+    dispatch(ctx);
+    return (int)(ctx->completed - before);
+}
+
+// blocking calls: submit with a callback that keeps the result, poll until it ran
+struct sync_call {
+    int done;
+    int err;
+    uint8_t status;
+    uint64_t n;
+    uint64_t c;
+    uint64_t ci;
+    char *body;
+};
+
+static void sync_done(const struct pcc_result *res, void *arg) {
+    struct sync_call *s = arg;
+    s->done = 1;
+    s->err = res->err;
+    s->status = res->status;
+    s->n = res->n;
+    s->c = res->c;
+    s->ci = res->ci;
+    if (res->err == 0) s->body = strndup(res->body, res->body_len);
+}
+
+static int sync_wait(struct pcc_ctx *ctx, struct sync_call *s) {
+    while (!s->done) {
+        if (pcc_poll(ctx, -1) < 0) return -1;
+    }
+    if (s->err != 0) {
+        errno = s->err;
+        return -1;
+    }
+    if (s->status != PCC_STATUS_OK) {
+        errno = s->status == PCC_STATUS_BAD_REQUEST    ? EINVAL
+                : s->status == PCC_STATUS_STREAM_OFFSET ? ESPIPE
+                : s->status == PCC_STATUS_BUSY          ? EBUSY
+                : s->status == PCC_STATUS_CHECKSUM      ? EBADMSG
+                                                        : EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+int pcc_count_buf(struct pcc_ctx *ctx, const void *buf, size_t len, const char *tenant, uint64_t *c) {
+    struct sync_call s = {0};
+    if (pcc_submit_buf(ctx, buf, len, tenant, sync_done, &s) < 0) return -1;
+    int ret = sync_wait(ctx, &s);
+    free(s.body);
+    if (ret == 0) *c = s.c;
+    return ret;
+}
+
+int pcc_count_fd(struct pcc_ctx *ctx, int fd, const char *tenant, uint64_t *c) {
+    struct sync_call s = {0};
+    if (pcc_submit_fd(ctx, fd, tenant, sync_done, &s) < 0) return -1;
+    int ret = sync_wait(ctx, &s);
+    free(s.body);
+    if (ret == 0) *c = s.c;
+    return ret;
+}
+
+int pcc_count_sample_fd(struct pcc_ctx *ctx, int fd, const char *tenant, const struct pcc_sample *sample, uint64_t *c,
+                        uint64_t *ci) {
+    struct sync_call s = {0};
+    if (pcc_submit_sample_fd(ctx, fd, tenant, sample, sync_done, &s) < 0) return -1;
+    int ret = sync_wait(ctx, &s);
+    free(s.body);
+    if (ret == 0) {
+        *c = s.c;
+        *ci = s.ci;
+    }
+    return ret;
+}
+
+int pcc_count_stream_fd(struct pcc_ctx *ctx, int fd, const char *tenant, const char *stream, uint64_t *offset,
+                        uint64_t *total) {
+    struct sync_call s = {0};
+    if (pcc_submit_stream_fd(ctx, fd, tenant, stream, *offset, sync_done, &s) < 0) return -1;
+    int ret = sync_wait(ctx, &s);
+    free(s.body);
+    if (ret == 0) {
+        *offset += s.n;
+        *total = s.c;
+    } else if (s.err == 0 && s.status == PCC_STATUS_STREAM_OFFSET) {
+        *offset = s.c;
+    }
+    return ret;
+}
+
+int pcc_query(struct pcc_ctx *ctx, const char *query, char **answer) {
+    struct sync_call s = {0};
+    *answer = NULL;
+    if (pcc_submit_query(ctx, query, sync_done, &s) < 0) return -1;
+    int ret = sync_wait(ctx, &s);
+    *answer = s.body;
+    return ret;
+}
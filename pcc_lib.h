@@ -0,0 +1,163 @@
+#ifndef PCC_LIB_H
+#define PCC_LIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pcc_sample.h"
+#include "pcc_stream.h"
+
+/*
+    client library (libpcc.a), what pcc_client is built on
+
+    a struct pcc_ctx owns a pool of connections to one or more servers. every request goes
+    out as an extended frame with PCC_FLAG_KEEPALIVE, so a connection carries many requests,
+    and once the server confirmed keep-alive up to max_inflight of them are pipelined on it.
+    sockets are non-blocking and driven by one epoll set, a single thread can keep thousands
+    of counts in flight.
+
+        struct pcc_ctx *ctx = pcc_ctx_new(NULL);
+        pcc_ctx_add_server(ctx, "127.0.0.1", 3000);
+
+        uint64_t c;
+        pcc_count_buf(ctx, buf, len, NULL, &c);             // blocking
+
+        pcc_submit_buf(ctx, buf, len, "tenant", done, arg);  // async, buf stays valid until done
+        while (pcc_pending(ctx) > 0) pcc_poll(ctx, -1);      // done(res, arg) is called from here
+
+    NOTICE:
+        functions return -1 with errno set on failure, they never exit.
+        a request that fails after it was submitted reports it through its callback (res->err).
+        requests the server did not get to when a kept connection ends at a frame boundary
+        are sent again on another connection.
+        callbacks may submit new requests but must not call the blocking functions or
+        pcc_ctx_free. a context is not thread-safe, use one per thread.
+
+    FAILOVER:
+        a server whose connection fails (refused, reset, no progress for timeout_ms) is
+        ejected for backoff_ms, doubled for every failure in a row, and gets a single probe
+        connection when it comes back. requests of a failed connection that are safe to
+        repeat go to another server: queries always, counts only if their frame was not
+        completely written (the server counts a request only after it read all of it).
+        the others fail with the error, a count the server may have committed is never
+        sent twice.
+        requests of a stream (pcc_submit_stream_fd) always go to the same server while it
+        is healthy, the server keeps the stream. when it fails they move to another one,
+        which does not have the stream and refuses anything but a fresh start at offset 0.
+
+    CHECKSUMS:
+        with opts.checksum every count carries the CRC32C of its payload, taken from the
+        buffer when it is submitted, or from a file's bytes as they are staged for the
+        socket, so the file is still read once. a payload the server found damaged
+        (PCC_STATUS_CHECKSUM, nothing counted) is sent again up to opts.retries times, the
+        server stays in rotation. samples and queries go without.
+*/
+
+struct pcc_ctx;
+
+// how a request picks its server among the healthy ones
+#define PCC_LB_LEAST 0 // fewest outstanding requests (default)
+#define PCC_LB_P2C 1 // the less loaded of two servers picked at random
+
+struct pcc_ctx_opts {
+    int conns_per_server; // connections opened to each server, default 1
+    int max_inflight; // requests pipelined on one connection, default 32
+    int lb; // PCC_LB_*
+    int retries; // times a request that is safe to repeat is sent to another server, default 2
+    int timeout_ms; // a connection that makes no progress for this long fails, default 10000
+    int backoff_ms; // a failed server is ejected this long, doubling per failure in a row, default 100
+    int backoff_max_ms; // cap of the ejection time, default 10000
+    const char *tls_ca; // TLS to every server, their certificates verified against this CA file (pcc_tls.h)
+    int checksum; // PCC_CHECKSUM_* trailer on every count (PCC_OPT_CHECKSUM, see pcc_proto.h), 0 for none
+};
+
+// sampled counting (PCC_OP_SAMPLE, see pcc_sample.h): about rate of the source is sent, in
+// blocks of block bytes (0 for PCC_SAMPLE_DEFAULT_BLOCK), and the server estimates the
+// count of all of it. the same seed picks the same blocks
+struct pcc_sample {
+    double rate; // 0 < rate <= 1
+    uint32_t block;
+    int mode; // PCC_SAMPLE_STRIDE or PCC_SAMPLE_RANDOM
+    unsigned seed;
+};
+
+struct pcc_server_stats {
+    uint64_t requests; // answered
+    uint64_t failures; // connections that failed (connect, reset, timeout)
+    uint64_t ejections; // times it was taken out of rotation
+    size_t outstanding; // requests on its connections now
+    int conns;
+    int ejected; // out of rotation right now
+};
+
+struct pcc_result {
+    int err; // 0, or an errno value (ECONNREFUSED, ECONNRESET, ETIMEDOUT, EPROTO, EIO, ECANCELED).
+             // a failed TLS handshake is EPROTO
+    uint8_t status; // PCC_STATUS_* of the reply, valid when err == 0
+    uint64_t n; // payload bytes
+    uint64_t c; // printable characters counted, estimated for a sample
+    uint64_t ci; // sample: half width of the 95% confidence interval of c
+    const char *body; // reply body (query answer, error text), '\0' terminated, valid during the callback
+    size_t body_len;
+};
+
+typedef void (*pcc_done_fn)(const struct pcc_result *res, void *arg);
+
+// opts may be NULL for the defaults. with a tls_ca that can't be loaded, or an unknown
+// checksum, it fails with EINVAL, pcc_tls_error() says why for the tls_ca
+struct pcc_ctx *pcc_ctx_new(const struct pcc_ctx_opts *opts);
+// pending requests complete with ECANCELED
+void pcc_ctx_free(struct pcc_ctx *ctx);
+// ip is a numeric IPv4 or IPv6 address, see pcc_net_addr
+int pcc_ctx_add_server(struct pcc_ctx *ctx, const char *ip, int port);
+// the epoll fd, readable when pcc_poll has work, for embedding in another event loop.
+// pcc_poll also has timers (timeouts, backoff), call it at least every timeout_ms
+int pcc_ctx_fd(const struct pcc_ctx *ctx);
+// servers in the order they were added
+int pcc_ctx_servers(const struct pcc_ctx *ctx);
+int pcc_ctx_server_stats(const struct pcc_ctx *ctx, int i, struct pcc_server_stats *stats);
+
+// tenant may be NULL, the server accounts the request to our IP then
+int pcc_submit_buf(struct pcc_ctx *ctx, const void *buf, size_t len, const char *tenant, pcc_done_fn done, void *arg);
+// counts from the current offset of a regular file to its end (read with pread, the offset
+// is left alone). anything else is read to its end right away and sent from memory
+int pcc_submit_fd(struct pcc_ctx *ctx, int fd, const char *tenant, pcc_done_fn done, void *arg);
+int pcc_submit_query(struct pcc_ctx *ctx, const char *query, pcc_done_fn done, void *arg);
+// append a regular file from offset to its end to a stream on the server (see pcc_stream.h),
+// res->c is the count of the whole stream then. with PCC_STATUS_STREAM_OFFSET it is the
+// offset the stream continues at instead, nothing was counted
+int pcc_submit_stream_fd(struct pcc_ctx *ctx, int fd, const char *tenant, const char *stream, uint64_t offset,
+                         pcc_done_fn done, void *arg);
+// the reply body has the estimate of every char, see pcc_proto.h. a source that is not a
+// regular file is read to its end first, only the network and the server are spared then
+int pcc_submit_sample_buf(struct pcc_ctx *ctx, const void *buf, size_t len, const char *tenant,
+                          const struct pcc_sample *sample, pcc_done_fn done, void *arg);
+int pcc_submit_sample_fd(struct pcc_ctx *ctx, int fd, const char *tenant, const struct pcc_sample *sample,
+                         pcc_done_fn done, void *arg);
+// count like pcc_submit_fd, and the n-grams ngram (PCC_NGRAM_*) asks for. the reply body
+// has them, see pcc_proto.h
+int pcc_submit_ngram_fd(struct pcc_ctx *ctx, int fd, const char *tenant, int ngram, pcc_done_fn done, void *arg);
+
+// run the I/O for up to timeout_ms (-1 blocks until something completes), calling the
+// callbacks of finished requests. returns how many finished, -1 on error
+int pcc_poll(struct pcc_ctx *ctx, int timeout_ms);
+// requests submitted and not finished yet
+size_t pcc_pending(const struct pcc_ctx *ctx);
+
+// blocking versions, they also run the I/O of other pending requests.
+// a request the server rejected fails with EINVAL, one it kept shedding (PCC_STATUS_BUSY,
+// tried again opts.retries times like a failed connection) with EBUSY, one that kept
+// arriving damaged (PCC_STATUS_CHECKSUM) with EBADMSG
+int pcc_count_buf(struct pcc_ctx *ctx, const void *buf, size_t len, const char *tenant, uint64_t *c);
+int pcc_count_fd(struct pcc_ctx *ctx, int fd, const char *tenant, uint64_t *c);
+// *offset is where to append from, and on return where the stream ends now. when the server
+// has the stream somewhere else it fails with ESPIPE and *offset is that place
+int pcc_count_stream_fd(struct pcc_ctx *ctx, int fd, const char *tenant, const char *stream, uint64_t *offset,
+                        uint64_t *total);
+int pcc_count_sample_fd(struct pcc_ctx *ctx, int fd, const char *tenant, const struct pcc_sample *sample, uint64_t *c,
+                        uint64_t *ci);
+// *answer is malloc'ed text, on success and when the server rejected the query (its error
+// message, with EINVAL). the caller frees it
+int pcc_query(struct pcc_ctx *ctx, const char *query, char **answer);
+
+#endif
@@ -0,0 +1,122 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "pcc_net.h"
+
+static const char *const mode_names[] = {"nagle", "nodelay", "cork", "more"};
+
+int pcc_net_mode_parse(const char *name) {
+    for (int i = 0; i < (int)(sizeof(mode_names) / sizeof(mode_names[0])); i++) {
+        if (strcmp(name, mode_names[i]) == 0) return i;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+const char *pcc_net_mode_name(int mode) {
+    return mode_names[mode];
+}
+
+int pcc_net_mode_tls(int mode) {
+    return mode == PCC_NET_MORE ? PCC_NET_CORK : mode;
+}
+
+int pcc_net_setup(int fd, int mode) {
+    int one = 1;
+    if (mode == PCC_NET_NAGLE) return 0;
+    return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+void pcc_net_begin(int fd, int mode) {
+    int one = 1;
+    if (mode == PCC_NET_CORK) setsockopt(fd, IPPROTO_TCP, TCP_CORK, &one, sizeof(one));
+}
+
+void pcc_net_end(int fd, int mode) {
+    int zero = 0;
+    // uncorking pushes what is left right away, TCP_NODELAY or not
+    if (mode == PCC_NET_CORK) setsockopt(fd, IPPROTO_TCP, TCP_CORK, &zero, sizeof(zero));
+}
+
+int pcc_net_more(int mode) {
+    return mode == PCC_NET_MORE ? MSG_MORE : 0;
+}
+
+void pcc_net_quickack(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+}
+
+int pcc_net_addr(const char *ip, int port, struct sockaddr_storage *addr, socklen_t *len) {
+    char buf[INET6_ADDRSTRLEN];
+    size_t ip_len = strlen(ip);
+
+    memset(addr, 0, sizeof(*addr));
+    if (port < 0 || port > 65535) goto bad;
+    if (ip[0] == '[') {
+        if (ip_len < 2 || ip[ip_len - 1] != ']' || ip_len - 2 >= sizeof(buf)) goto bad;
+        memcpy(buf, ip + 1, ip_len - 2);
+        buf[ip_len - 2] = '\0';
+        ip = buf;
+    }
+
+    struct sockaddr_in *in = (struct sockaddr_in *)addr;
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)addr;
+    if (ip != buf && inet_pton(AF_INET, ip, &in->sin_addr) == 1) {
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port);
+        *len = sizeof(*in);
+        return 0;
+    }
+    if (inet_pton(AF_INET6, ip, &in6->sin6_addr) == 1) {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        *len = sizeof(*in6);
+        return 0;
+    }
+bad:
+    errno = EINVAL;
+    return -1;
+}
+
+int pcc_net_addr_port(const char *ip_port, struct sockaddr_storage *addr, socklen_t *len) {
+    char ip[INET6_ADDRSTRLEN + 2];
+    const char *colon = strrchr(ip_port, ':');
+    char *end;
+
+    // an IPv6 address without brackets would lose its last group to the port
+    if (colon == NULL || (size_t)(colon - ip_port) >= sizeof(ip) ||
+        (ip_port[0] != '[' && memchr(ip_port, ':', colon - ip_port) != NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(ip, ip_port, colon - ip_port);
+    ip[colon - ip_port] = '\0';
+    long port = strtol(colon + 1, &end, 10);
+    if (colon[1] == '\0' || *end != '\0' || port <= 0 || port > 65535) {
+        errno = EINVAL;
+        return -1;
+    }
+    return pcc_net_addr(ip, (int)port, addr, len);
+}
+
+void pcc_net_addr_name(const struct sockaddr *addr, char *buf, size_t size) {
+    if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+        if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+            inet_ntop(AF_INET, &in6->sin6_addr.s6_addr[12], buf, size);
+        } else {
+            inet_ntop(AF_INET6, &in6->sin6_addr, buf, size);
+        }
+    } else if (addr->sa_family == AF_INET) {
+        inet_ntop(AF_INET, &((const struct sockaddr_in *)addr)->sin_addr, buf, size);
+    } else {
+        snprintf(buf, size, "?");
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef PCC_NET_H
+#define PCC_NET_H
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+/*
+    how the writes of one message leave a TCP socket
+
+    a request is a header and a payload, an extended reply a header and a body, and both
+    are written with two (or more) writes. with Nagle's algorithm on, the second small
+    write waits until the first one is acked, and the peer delays that ack hoping to
+    piggyback it on data it doesn't have yet: up to 40ms for every small message on a
+    kept connection. the modes:
+
+        nagle       plain writes, Nagle on: the old behaviour, for comparison
+        nodelay     TCP_NODELAY: every write goes out at once, one segment each
+        cork        TCP_NODELAY, and TCP_CORK around a message: the writes collect in
+                    the socket and leave in full segments when it is uncorked, two more
+                    system calls per message
+        more        TCP_NODELAY, and MSG_MORE on every write of a message but the last
+                    one: the same segments as cork without the extra system calls. TLS
+                    writes can't pass flags, there it is cork (pcc_net_mode_tls)
+
+    the peers pick their modes independently, the default is more.
+
+    TCP_QUICKACK acks what arrives right away instead of delaying it, which also rescues
+    a Nagle peer. the kernel leaves quick ack mode again on its own, so it is re-armed
+    after every message read.
+
+    addresses: the programs take numeric IPv4 ("10.0.0.1") and IPv6 ("::1", or "[::1]"
+    where a port follows) addresses alike. a peer of a dual-stack IPv6 socket that came
+    over IPv4 (::ffff:10.0.0.1) is named by its IPv4 address, so it stays one tenant.
+*/
+
+enum { PCC_NET_NAGLE, PCC_NET_NODELAY, PCC_NET_CORK, PCC_NET_MORE };
+
+#define PCC_NET_DEFAULT PCC_NET_MORE
+
+// "nagle", "nodelay", "cork" or "more". returns the mode, or -1 with errno EINVAL
+int pcc_net_mode_parse(const char *name);
+const char *pcc_net_mode_name(int mode);
+// the mode to use over TLS instead of mode
+int pcc_net_mode_tls(int mode);
+
+// set a connected TCP socket up for mode. returns 0, or -1 with errno set
+int pcc_net_setup(int fd, int mode);
+// around the writes of one message
+void pcc_net_begin(int fd, int mode);
+void pcc_net_end(int fd, int mode);
+// send(2) flags for a write that is not the last one of its message
+int pcc_net_more(int mode);
+
+void pcc_net_quickack(int fd);
+
+// the socket address of a numeric IPv4 or IPv6 address, the IPv6 one maybe in [brackets],
+// and a port. returns 0, or -1 with errno EINVAL
+int pcc_net_addr(const char *ip, int port, struct sockaddr_storage *addr, socklen_t *len);
+// "ip:port" or "[ip6]:port" into pcc_net_addr. returns 0, or -1 with errno EINVAL
+int pcc_net_addr_port(const char *ip_port, struct sockaddr_storage *addr, socklen_t *len);
+// the IP of an AF_INET or AF_INET6 address as text, IPv4 mapped ones as plain IPv4.
+// size should be INET6_ADDRSTRLEN
+void pcc_net_addr_name(const struct sockaddr *addr, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,210 @@
+#include <string.h>
+
+#include "pcc_crc.h"
+#include "pcc_ngram.h"
+
+_Static_assert(PCC_NGRAM_DEPTH == 4, "TRIGRAM_STEP has a line per row");
+
+#define FOLD_EVERY ((uint64_t)1 << 31) // bytes between folds, no u32 bin can reach 2^32
+
+// odd multipliers of the row hashes
+static const uint32_t row_mul[PCC_NGRAM_DEPTH] = {0x9e3779b1u, 0x85ebca77u, 0xc2b2ae3du, 0x27d4eb2fu};
+
+static inline uint32_t byte_class(unsigned char b) {
+    uint32_t c = (uint32_t)b - PCC_FIRST_PRINTABLE; // wraps for the bytes below
+    return c < PCC_NPRINTABLE ? c : PCC_NGRAM_NONE;
+}
+
+// a trigram is hashed as the number its three classes make in base 96
+static inline uint32_t cell(int i, uint32_t t) {
+    return (t * row_mul[i]) >> (32 - PCC_NGRAM_WIDTH_BITS);
+}
+
+void pcc_ngram_init(struct pcc_ngram *g, int flags) {
+    // the results and the hot tables, the sketches only when they are used
+    memset(g->hot, 0, sizeof(g->hot));
+    memset(g->counts, 0, sizeof(g->counts));
+    memset(g->bigrams, 0, sizeof(g->bigrams));
+    if (flags & PCC_NGRAM_TRIGRAMS) {
+        memset(g->hot_sketch, 0, sizeof(g->hot_sketch));
+        memset(g->sketch, 0, sizeof(g->sketch));
+    }
+    g->flags = flags;
+    g->prev1 = g->prev2 = PCC_NGRAM_NONE;
+    g->pending = 0;
+    g->c = g->nbigrams = g->ntrigrams = 0;
+}
+
+static void fold(struct pcc_ngram *g) {
+    for (uint32_t a = 0; a < PCC_NGRAM_CLASSES; a++) {
+        const uint32_t *row = &g->hot[a * PCC_NGRAM_CLASSES];
+        for (uint32_t b = 0; b < PCC_NPRINTABLE; b++) {
+            g->counts[b] += row[b];
+            g->c += row[b];
+            if (a < PCC_NPRINTABLE) {
+                g->bigrams[a * PCC_NPRINTABLE + b] += row[b];
+                g->nbigrams += row[b];
+            }
+        }
+    }
+    memset(g->hot, 0, sizeof(g->hot));
+    if (g->flags & PCC_NGRAM_TRIGRAMS) {
+        // every row got one per trigram, the first one counts them
+        for (uint32_t j = 0; j < PCC_NGRAM_WIDTH; j++) g->ntrigrams += g->hot_sketch[0][j];
+        for (int i = 0; i < PCC_NGRAM_DEPTH; i++) {
+            for (uint32_t j = 0; j < PCC_NGRAM_WIDTH; j++) g->sketch[i][j] += g->hot_sketch[i][j];
+        }
+        memset(g->hot_sketch, 0, sizeof(g->hot_sketch));
+    }
+    g->pending = 0;
+}
+
+// one byte of class c into the hot table, and its trigram into the sketch. the loops
+// keep hot, sketch, p1 and p2 in locals
+#define BIGRAM_STEP(c)                                                                                                 \
+    do {                                                                                                               \
+        hot[p1 * PCC_NGRAM_CLASSES + (c)]++;                                                                           \
+        p2 = p1;                                                                                                       \
+        p1 = (c);                                                                                                      \
+    } while (0)
+
+// a trigram with a non printable byte adds 0 to cells it hashes to anyway, that costs less
+// than the branch on mixed data. the rows by hand, gcc -O2 keeps a loop over them and that
+// is a third slower
+#define TRIGRAM_STEP(c)                                                                                                \
+    do {                                                                                                               \
+        uint32_t valid = (p2 < PCC_NPRINTABLE) & (p1 < PCC_NPRINTABLE) & ((c) < PCC_NPRINTABLE);                       \
+        uint32_t t = (p2 * PCC_NGRAM_CLASSES + p1) * PCC_NGRAM_CLASSES + (c);                                          \
+        sketch[0][cell(0, t)] += valid;                                                                                \
+        sketch[1][cell(1, t)] += valid;                                                                                \
+        sketch[2][cell(2, t)] += valid;                                                                                \
+        sketch[3][cell(3, t)] += valid;                                                                                \
+        BIGRAM_STEP(c);                                                                                                \
+    } while (0)
+
+static void update_bigrams(struct pcc_ngram *g, const unsigned char *buf, size_t len) {
+    uint32_t *hot = g->hot;
+    uint32_t p1 = g->prev1, p2 = g->prev2;
+    for (size_t i = 0; i < len; i++) {
+        uint32_t c = byte_class(buf[i]);
+        BIGRAM_STEP(c);
+    }
+    g->prev1 = p1;
+    g->prev2 = p2;
+}
+
+static void update_trigrams(struct pcc_ngram *g, const unsigned char *buf, size_t len) {
+    uint32_t *restrict hot = g->hot;
+    uint32_t (*restrict sketch)[PCC_NGRAM_WIDTH] = g->hot_sketch;
+    uint32_t p1 = g->prev1, p2 = g->prev2;
+    for (size_t i = 0; i < len; i++) {
+        uint32_t c = byte_class(buf[i]);
+        TRIGRAM_STEP(c);
+    }
+    g->prev1 = p1;
+    g->prev2 = p2;
+}
+
+void pcc_ngram_update(struct pcc_ngram *g, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        if (g->pending == FOLD_EVERY) fold(g);
+        size_t chunk = len < FOLD_EVERY - g->pending ? len : (size_t)(FOLD_EVERY - g->pending);
+        if (g->flags & PCC_NGRAM_TRIGRAMS) update_trigrams(g, buf, chunk);
+        else update_bigrams(g, buf, chunk);
+        g->pending += chunk;
+        buf += chunk;
+        len -= chunk;
+    }
+}
+
+/*
+    pcc_ngram_update_crc: like pcc_count_crc, the byte loop goes a word at a time and feeds
+    every word to the crc32 instruction of SSE4.2 before its 8 bytes go to the tables. the
+    crc32 of a word hides behind its 8 dependent table increments, so the checksum costs
+    almost nothing on top of the n-grams. without SSE4.2 it is pcc_ngram_update and then
+    pcc_crc32c over the same, still cached, bytes.
+*/
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+
+__attribute__((target("sse4.2"))) static void update_crc_sse42(struct pcc_ngram *g, const unsigned char *buf,
+                                                                size_t len, uint32_t *crc) {
+    uint32_t *restrict hot = g->hot;
+    uint32_t (*restrict sketch)[PCC_NGRAM_WIDTH] = g->hot_sketch;
+    uint32_t p1 = g->prev1, p2 = g->prev2;
+    uint64_t crc64 = ~*crc;
+    size_t i = 0;
+
+    if (g->flags & PCC_NGRAM_TRIGRAMS) {
+        for (; i + 8 <= len; i += 8) {
+            uint64_t w;
+            memcpy(&w, buf + i, sizeof(w));
+            crc64 = _mm_crc32_u64(crc64, w);
+            for (int k = 0; k < 8; k++) {
+                uint32_t c = byte_class(buf[i + k]);
+                TRIGRAM_STEP(c);
+            }
+        }
+        for (; i < len; i++) {
+            crc64 = _mm_crc32_u8((uint32_t)crc64, buf[i]);
+            uint32_t c = byte_class(buf[i]);
+            TRIGRAM_STEP(c);
+        }
+    } else {
+        for (; i + 8 <= len; i += 8) {
+            uint64_t w;
+            memcpy(&w, buf + i, sizeof(w));
+            crc64 = _mm_crc32_u64(crc64, w);
+            for (int k = 0; k < 8; k++) {
+                uint32_t c = byte_class(buf[i + k]);
+                BIGRAM_STEP(c);
+            }
+        }
+        for (; i < len; i++) {
+            crc64 = _mm_crc32_u8((uint32_t)crc64, buf[i]);
+            uint32_t c = byte_class(buf[i]);
+            BIGRAM_STEP(c);
+        }
+    }
+    g->prev1 = p1;
+    g->prev2 = p2;
+    *crc = ~(uint32_t)crc64;
+}
+#endif
+
+void pcc_ngram_update_crc(struct pcc_ngram *g, const unsigned char *buf, size_t len, uint32_t *crc) {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        while (len > 0) {
+            if (g->pending == FOLD_EVERY) fold(g);
+            size_t chunk = len < FOLD_EVERY - g->pending ? len : (size_t)(FOLD_EVERY - g->pending);
+            update_crc_sse42(g, buf, chunk, crc);
+            g->pending += chunk;
+            buf += chunk;
+            len -= chunk;
+        }
+        return;
+    }
+#endif
+    pcc_ngram_update(g, buf, len);
+    *crc = pcc_crc32c(*crc, buf, len);
+}
+
+void pcc_ngram_finish(struct pcc_ngram *g) {
+    fold(g);
+}
+
+uint32_t pcc_ngram_cell(int i, unsigned char a, unsigned char b, unsigned char c) {
+    return cell(i, (byte_class(a) * PCC_NGRAM_CLASSES + byte_class(b)) * PCC_NGRAM_CLASSES + byte_class(c));
+}
+
+uint64_t pcc_ngram_estimate(const uint64_t sketch[PCC_NGRAM_DEPTH][PCC_NGRAM_WIDTH], unsigned char a,
+                            unsigned char b, unsigned char c) {
+    uint64_t est = UINT64_MAX;
+    for (int i = 0; i < PCC_NGRAM_DEPTH; i++) {
+        uint64_t v = sketch[i][pcc_ngram_cell(i, a, b, c)];
+        if (v < est) est = v;
+    }
+    return est;
+}
@@ -0,0 +1,69 @@
+#ifndef PCC_NGRAM_H
+#define PCC_NGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pcc_proto.h"
+
+/*
+    n-gram counting: the printable bigrams of a stream in a 95x95 table and, optionally,
+    its printable trigrams in a count-min sketch, in the same pass that counts its chars
+
+    a bigram is two consecutive printable bytes, a trigram three. a stream is fed in any
+    number of pcc_ngram_update calls (the server's reads), the class of the last two bytes
+    carries over, so the n-grams across two buffers count like any other.
+
+    every byte has a class, 0..94 for the printable ones and PCC_NGRAM_NONE for the rest
+    (and for "no byte before"). the hot table is 96x96 u32 (36 KiB, stays in L1/L2) and
+    every byte increments bin [class of the byte before][its class], without a branch.
+    its 95x95 corner are the bigrams, its columns summed up the chars. before a bin could
+    overflow the table is folded into the 64-bit results.
+
+    trigram sketch: PCC_NGRAM_DEPTH rows of PCC_NGRAM_WIDTH counters, a trigram adds one
+    to a cell of every row, picked by a multiply-shift hash per row. its estimate is the
+    smallest of those cells: never below its count, and at most e / PCC_NGRAM_WIDTH of
+    all trigrams (0.13%) above it with probability 1 - e^-PCC_NGRAM_DEPTH (98%). sketches
+    of the same size add up cell by cell, the server sums every request's into its own.
+*/
+
+#define PCC_NGRAM_NONE PCC_NPRINTABLE
+#define PCC_NGRAM_CLASSES (PCC_NPRINTABLE + 1)
+#define PCC_NBIGRAMS (PCC_NPRINTABLE * PCC_NPRINTABLE)
+#define PCC_NGRAM_DEPTH 4
+#define PCC_NGRAM_WIDTH_BITS 11
+#define PCC_NGRAM_WIDTH (1u << PCC_NGRAM_WIDTH_BITS)
+
+struct pcc_ngram {
+    int flags; // PCC_NGRAM_BIGRAMS, PCC_NGRAM_TRIGRAMS
+    uint32_t prev1, prev2; // classes of the last byte and the one before
+    uint64_t pending; // bytes in the hot tables since they were folded
+    uint32_t hot[PCC_NGRAM_CLASSES * PCC_NGRAM_CLASSES];
+    uint32_t hot_sketch[PCC_NGRAM_DEPTH][PCC_NGRAM_WIDTH];
+
+    // results, complete after pcc_ngram_finish
+    uint64_t counts[PCC_NPRINTABLE];
+    uint64_t c; // printable chars
+    uint64_t bigrams[PCC_NBIGRAMS]; // [a * 95 + b] for the bigram "ab", a and b minus 32
+    uint64_t nbigrams;
+    uint64_t sketch[PCC_NGRAM_DEPTH][PCC_NGRAM_WIDTH];
+    uint64_t ntrigrams;
+};
+
+// start counting a stream, flags PCC_NGRAM_* (the chars and the bigram table are always
+// counted, the sketch only with PCC_NGRAM_TRIGRAMS)
+void pcc_ngram_init(struct pcc_ngram *g, int flags);
+void pcc_ngram_update(struct pcc_ngram *g, const unsigned char *buf, size_t len);
+// pcc_ngram_update that also takes the CRC32C of buf in the same pass, *crc is the value
+// so far like for pcc_crc32c (see pcc_count_crc)
+void pcc_ngram_update_crc(struct pcc_ngram *g, const unsigned char *buf, size_t len, uint32_t *crc);
+// fold everything into the results. more updates may follow, finish again after them
+void pcc_ngram_finish(struct pcc_ngram *g);
+
+// the sketch cell of row i for trigram "abc" (printable bytes)
+uint32_t pcc_ngram_cell(int i, unsigned char a, unsigned char b, unsigned char c);
+// estimated count of "abc" in a sketch
+uint64_t pcc_ngram_estimate(const uint64_t sketch[PCC_NGRAM_DEPTH][PCC_NGRAM_WIDTH], unsigned char a,
+                            unsigned char b, unsigned char c);
+
+#endif
@@ -0,0 +1,292 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcc_count.h"
+#include "pcc_pool.h"
+
+#define QUEUE_SLOTS 256 // per counting thread, a power of two
+// chunk buffers of a job, enough to keep every counting thread busy while the receiver
+// fills the next ones
+#define JOB_BUFS(pool) (2 * (pool)->nthreads + 2)
+
+struct task {
+    struct pcc_pool_job *job;
+    unsigned char *buf;
+    size_t len;
+};
+
+// one counting thread and its queue. the owner takes from the head, thieves too, so a
+// plain mutex per queue is all the locking (the queues are short and rarely contended)
+struct pool_thread {
+    _Alignas(64) pthread_mutex_t lock;
+    struct task q[QUEUE_SLOTS];
+    size_t head, tail; // tail - head tasks queued
+    pthread_t thread;
+    struct pcc_pool *pool;
+    int id;
+    _Atomic uint64_t chunks, stolen;
+};
+
+struct pcc_pool {
+    int nthreads;
+    int started; // threads to join
+    size_t chunk;
+    struct pool_thread *threads;
+    _Atomic unsigned next; // round robin of submissions
+    _Atomic uint64_t queued; // tasks in all queues, sleepers wait for it
+    pthread_mutex_t wake_lock;
+    pthread_cond_t wake;
+    int sleepers;
+    int stop;
+};
+
+// the counts of one counting thread (or of the submitter, the last one) for one job
+struct partial {
+    _Alignas(64) uint64_t counts[PCC_NPRINTABLE];
+    uint64_t c;
+};
+
+struct pcc_pool_job {
+    struct pcc_pool *pool;
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // a buffer came back
+    int nbufs, nfree, pending; // pending: submitted and not counted yet
+    unsigned char **free_bufs;
+    unsigned char **bufs;
+    struct partial *partials; // nthreads + 1
+};
+
+static int queue_pop(struct pool_thread *t, struct task *task) {
+    int ok = 0;
+    pthread_mutex_lock(&t->lock);
+    if (t->tail != t->head) {
+        *task = t->q[t->head++ & (QUEUE_SLOTS - 1)];
+        ok = 1;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return ok;
+}
+
+static int queue_push(struct pool_thread *t, const struct task *task) {
+    int ok = 0;
+    pthread_mutex_lock(&t->lock);
+    if (t->tail - t->head < QUEUE_SLOTS) {
+        t->q[t->tail++ & (QUEUE_SLOTS - 1)] = *task;
+        ok = 1;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return ok;
+}
+
+// count a chunk into the partial histogram of slot, then hand its buffer back
+static void run_task(const struct task *task, int slot) {
+    struct pcc_pool_job *job = task->job;
+    struct partial *p = &job->partials[slot];
+    p->c += pcc_count(task->buf, task->len, p->counts);
+
+    pthread_mutex_lock(&job->lock);
+    job->free_bufs[job->nfree++] = task->buf;
+    job->pending--;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void *pool_thread_main(void *arg) {
+    struct pool_thread *t = arg;
+    struct pcc_pool *pool = t->pool;
+    struct task task;
+
+    for (;;) {
+        int got = queue_pop(t, &task), stolen = 0;
+        // own queue empty: steal, starting at the next thread so thieves spread out
+        for (int i = 1; !got && i < pool->nthreads; i++) {
+            got = stolen = queue_pop(&pool->threads[(t->id + i) % pool->nthreads], &task);
+        }
+        if (got) {
+            atomic_fetch_sub(&pool->queued, 1);
+            run_task(&task, t->id);
+            atomic_fetch_add_explicit(&t->chunks, 1, memory_order_relaxed);
+            if (stolen) atomic_fetch_add_explicit(&t->stolen, 1, memory_order_relaxed);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->wake_lock);
+        while (atomic_load(&pool->queued) == 0 && !pool->stop) {
+            pool->sleepers++;
+            pthread_cond_wait(&pool->wake, &pool->wake_lock);
+            pool->sleepers--;
+        }
+        int stop = pool->stop && atomic_load(&pool->queued) == 0;
+        pthread_mutex_unlock(&pool->wake_lock);
+        if (stop) return NULL;
+    }
+}
+
+struct pcc_pool *pcc_pool_new(int nthreads, size_t chunk) {
+    if (nthreads < 1 || nthreads > PCC_POOL_MAX_THREADS || chunk == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    struct pcc_pool *pool = calloc(1, sizeof(*pool));
+    if (pool == NULL || (pool->threads = aligned_alloc(64, nthreads * sizeof(*pool->threads))) == NULL) {
+        free(pool);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(pool->threads, 0, nthreads * sizeof(*pool->threads));
+    pool->nthreads = nthreads;
+    pool->chunk = chunk;
+    pthread_mutex_init(&pool->wake_lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+
+    // every queue exists before the first thread may steal from it
+    for (int i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&pool->threads[i].lock, NULL);
+        pool->threads[i].pool = pool;
+        pool->threads[i].id = i;
+    }
+    for (; pool->started < nthreads; pool->started++) {
+        struct pool_thread *t = &pool->threads[pool->started];
+        int err = pthread_create(&t->thread, NULL, pool_thread_main, t);
+        if (err != 0) {
+            pcc_pool_free(pool);
+            errno = err;
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void pcc_pool_free(struct pcc_pool *pool) {
+    if (pool == NULL) return;
+    pthread_mutex_lock(&pool->wake_lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->wake_lock);
+    for (int i = 0; i < pool->started; i++) pthread_join(pool->threads[i].thread, NULL);
+    free(pool->threads);
+    free(pool);
+}
+
+struct pcc_pool_job *pcc_pool_job_new(struct pcc_pool *pool) {
+    struct pcc_pool_job *job = calloc(1, sizeof(*job));
+    if (job == NULL) goto oom;
+    job->pool = pool;
+    job->nbufs = JOB_BUFS(pool);
+    job->bufs = calloc(job->nbufs, sizeof(*job->bufs));
+    job->free_bufs = calloc(job->nbufs, sizeof(*job->free_bufs));
+    job->partials = aligned_alloc(64, (pool->nthreads + 1) * sizeof(*job->partials));
+    if (job->bufs == NULL || job->free_bufs == NULL || job->partials == NULL) goto oom;
+    memset(job->partials, 0, (pool->nthreads + 1) * sizeof(*job->partials));
+    for (int i = 0; i < job->nbufs; i++) {
+        if ((job->bufs[i] = malloc(pool->chunk)) == NULL) goto oom;
+        job->free_bufs[job->nfree++] = job->bufs[i];
+    }
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->cond, NULL);
+    return job;
+
+oom:
+    if (job != NULL) {
+        for (int i = 0; job->bufs != NULL && i < job->nbufs; i++) free(job->bufs[i]);
+        free(job->bufs);
+        free(job->free_bufs);
+        free(job->partials);
+        free(job);
+    }
+    errno = ENOMEM;
+    return NULL;
+}
+
+void pcc_pool_job_free(struct pcc_pool_job *job) {
+    if (job == NULL) return;
+    pcc_pool_job_wait(job, NULL);
+    for (int i = 0; i < job->nbufs; i++) free(job->bufs[i]);
+    free(job->bufs);
+    free(job->free_bufs);
+    free(job->partials);
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->cond);
+    free(job);
+}
+
+unsigned char *pcc_pool_job_buf(struct pcc_pool_job *job) {
+    pthread_mutex_lock(&job->lock);
+    while (job->nfree == 0) pthread_cond_wait(&job->cond, &job->lock);
+    unsigned char *buf = job->free_bufs[--job->nfree];
+    pthread_mutex_unlock(&job->lock);
+    return buf;
+}
+
+void pcc_pool_job_drop(struct pcc_pool_job *job, unsigned char *buf) {
+    pthread_mutex_lock(&job->lock);
+    job->free_bufs[job->nfree++] = buf;
+    pthread_mutex_unlock(&job->lock);
+}
+
+void pcc_pool_job_submit(struct pcc_pool_job *job, unsigned char *buf, size_t len) {
+    struct pcc_pool *pool = job->pool;
+    struct task task = {.job = job, .buf = buf, .len = len};
+
+    pthread_mutex_lock(&job->lock);
+    job->pending++;
+    pthread_mutex_unlock(&job->lock);
+
+    // counted before it is queued, a thread that pops it right away must not take queued below 0
+    atomic_fetch_add(&pool->queued, 1);
+    unsigned first = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed);
+    for (int i = 0; i < pool->nthreads; i++) {
+        if (queue_push(&pool->threads[(first + i) % pool->nthreads], &task)) {
+            // a sleeper rechecks queued under wake_lock, taking it here means it either
+            // sees the task or is already waiting for this signal
+            pthread_mutex_lock(&pool->wake_lock);
+            if (pool->sleepers > 0) pthread_cond_signal(&pool->wake);
+            pthread_mutex_unlock(&pool->wake_lock);
+            return;
+        }
+    }
+    atomic_fetch_sub(&pool->queued, 1);
+    run_task(&task, pool->nthreads); // every queue is full, count it ourselves
+}
+
+uint64_t pcc_pool_job_wait(struct pcc_pool_job *job, uint64_t counts[PCC_NPRINTABLE]) {
+    int n = job->pool->nthreads + 1;
+    uint64_t c = 0;
+
+    pthread_mutex_lock(&job->lock);
+    while (job->pending > 0) pthread_cond_wait(&job->cond, &job->lock);
+    pthread_mutex_unlock(&job->lock);
+
+    // the counting threads wrote their partials before handing back the buffers under
+    // job->lock, so they are all visible here
+    for (int s = 0; s < n; s++) {
+        struct partial *p = &job->partials[s];
+        if (counts != NULL) {
+            for (int i = 0; i < PCC_NPRINTABLE; i++) counts[i] += p->counts[i];
+        }
+        c += p->c;
+        memset(p, 0, sizeof(*p));
+    }
+    return c;
+}
+
+size_t pcc_pool_chunk(const struct pcc_pool *pool) {
+    return pool->chunk;
+}
+
+size_t pcc_pool_job_bytes(const struct pcc_pool *pool) {
+    return sizeof(struct pcc_pool_job) + JOB_BUFS(pool) * (pool->chunk + 2 * sizeof(unsigned char *)) +
+           (pool->nthreads + 1) * sizeof(struct partial);
+}
+
+int pcc_pool_threads(const struct pcc_pool *pool) {
+    return pool->nthreads;
+}
+
+void pcc_pool_stats(const struct pcc_pool *pool, int i, uint64_t *chunks, uint64_t *stolen) {
+    *chunks = atomic_load_explicit(&pool->threads[i].chunks, memory_order_relaxed);
+    *stolen = atomic_load_explicit(&pool->threads[i].stolen, memory_order_relaxed);
+}
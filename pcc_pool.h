@@ -0,0 +1,59 @@
+#ifndef PCC_POOL_H
+#define PCC_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pcc_proto.h"
+
+/*
+    counting pool: counts the chunks of a big request in parallel while it is still being
+    received
+
+    a job belongs to one receiving thread (a server worker), which takes a free chunk
+    buffer from it, fills it from the socket and submits it, over and over, then waits for
+    the job and gets the counts. the counting threads each count into their own partial
+    histogram of the job, the wait reduces them. so receiving never stops for counting,
+    and a single stream is counted by as many cores as it needs.
+
+    work stealing: submitted chunks go round robin into the counting threads' queues, a
+    thread that ran out of its own takes from the others' queues. a chunk that finds every
+    queue full is counted by the submitter itself.
+
+    a job has a fixed number of buffers, a receiver that is faster than the counting waits
+    for one to come back. jobs are reused: after the wait the job is empty again.
+*/
+
+#define PCC_POOL_CHUNK (256 * 1024)
+#define PCC_POOL_MAX_THREADS 256
+
+struct pcc_pool;
+struct pcc_pool_job;
+
+// nthreads counting threads, each chunk at most chunk bytes. NULL with errno set
+struct pcc_pool *pcc_pool_new(int nthreads, size_t chunk);
+// stops the threads, every job must be freed already
+void pcc_pool_free(struct pcc_pool *pool);
+
+// NULL with errno set
+struct pcc_pool_job *pcc_pool_job_new(struct pcc_pool *pool);
+void pcc_pool_job_free(struct pcc_pool_job *job);
+
+// a free chunk buffer (pcc_pool_chunk bytes), waits until the counting gave one back
+unsigned char *pcc_pool_job_buf(struct pcc_pool_job *job);
+// count len bytes of buf, which the job takes back once they are counted
+void pcc_pool_job_submit(struct pcc_pool_job *job, unsigned char *buf, size_t len);
+// give back a buffer without counting anything in it
+void pcc_pool_job_drop(struct pcc_pool_job *job, unsigned char *buf);
+// wait until every submitted chunk is counted, add the job's counts to counts (not cleared
+// first, like pcc_count) and return its printable chars. the job is empty afterwards
+uint64_t pcc_pool_job_wait(struct pcc_pool_job *job, uint64_t counts[PCC_NPRINTABLE]);
+
+size_t pcc_pool_chunk(const struct pcc_pool *pool);
+// about what a job of this pool allocates, its chunk buffers and partial histograms
+size_t pcc_pool_job_bytes(const struct pcc_pool *pool);
+int pcc_pool_threads(const struct pcc_pool *pool);
+// chunks counting thread i counted so far, and how many of them it stole
+void pcc_pool_stats(const struct pcc_pool *pool, int i, uint64_t *chunks, uint64_t *stolen);
+
+#endif
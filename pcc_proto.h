@@ -0,0 +1,260 @@
+#ifndef PCC_PROTO_H
+#define PCC_PROTO_H
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+    wire protocol shared by pcc_server and pcc_client
+
+    basic frame (unchanged from the original assignment):
+        client -> server: N (u32, network order), then N bytes of payload
+        server -> client: C (u32, network order), the number of printable chars
+
+    extended frame:
+        a basic N equal to PCC_EXT_MARKER introduces an extended frame instead.
+        everything is in network byte order:
+
+        client -> server:
+            u32 marker      PCC_EXT_MARKER
+            u8  version     PCC_EXT_VERSION
+            u8  op          PCC_OP_*
+            u16 flags       PCC_FLAG_* (op specific)
+            u32 opt_len     bytes of options that follow the fixed header
+            u64 n           payload length
+            opts[opt_len]   op specific options
+            payload[n]
+
+        server -> client:
+            u8  version     PCC_EXT_VERSION
+            u8  status      PCC_STATUS_*
+            u16 flags       PCC_FLAG_KEEPALIVE or 0
+            u32 body_len    bytes of body that follow the fixed header
+            u64 c           number of printable chars (0 for non counting ops)
+            body[body_len]  op specific reply (text for PCC_OP_QUERY and PCC_OP_SAMPLE)
+
+        options are a list of TLVs, each one is:
+            u16 type        PCC_OPT_*
+            u16 len
+            value[len]
+        unknown option types are ignored.
+
+    sampling:
+        a PCC_OP_SAMPLE payload is k blocks of `block` bytes sampled from a stream of
+        true_n bytes, then its last true_n % block bytes (the tail). c of the reply is the
+        estimated count of the whole stream, the body is text:
+            # estimate <c> ci <half width> sampled <n> of <true_n> bytes in <k> of <K> blocks
+            char '<c>' : <estimate> +- <half width> times
+        the intervals are 95% confidence intervals, see pcc_sample.h
+
+    streams:
+        a PCC_OP_COUNT request with PCC_OPT_STREAM appends its payload to a stream the
+        server keeps, at the given offset (see pcc_stream.h). c of the reply is the count of
+        the whole stream up to the end of this payload, the body is text:
+            # stream <id> offset <end> appended <n> printable <count of this payload>
+        if the stream does not continue at that offset the status is
+        PCC_STATUS_STREAM_OFFSET and c is the offset it does continue at. the payload is
+        not read then, the connection is closed after the reply.
+
+    n-grams:
+        a PCC_OP_COUNT request with PCC_OPT_NGRAM also counts the printable bigrams of its
+        payload, and with PCC_NGRAM_TRIGRAMS its trigrams in a count-min sketch (see
+        pcc_ngram.h). the body is text, after the stream line if there is one:
+            # bigrams <number of bigrams>
+            bigram '<a><b>' : <count> times             every non zero one, PCC_NGRAM_BIGRAMS
+            # trigrams <number of trigrams> sketch <depth>x<width>
+            sketch <row> <cell>:<count> ...             non zero cells, PCC_NGRAM_TRIGRAMS
+
+    checksums:
+        a PCC_OP_COUNT request with PCC_OPT_CHECKSUM is followed by a trailer after its n
+        payload bytes: the CRC32C (see pcc_crc.h) of the payload, PCC_CHECKSUM_LEN bytes
+        in network order. the server checks it in the same pass over the payload as it
+        counts it. if it doesn't match, the status is PCC_STATUS_CHECKSUM, c is 0 and
+        nothing was counted (nor appended to a stream), the body is an error line. the whole
+        frame was read then, a kept connection stays open and the request may be sent
+        again.
+
+    shared memory ring:
+        a PCC_OP_RING request (n = 0) on a UNIX socket carries, as SCM_RIGHTS on its
+        first byte, a memfd with a ring and its two eventfds (see pcc_ring.h). after the OK
+        reply the connection only tells the server the client is still there: requests and
+        replies go through the ring, with the same N/C semantics, until the client closes
+        it. anywhere else the request is refused.
+
+    keep-alive:
+        a request with PCC_FLAG_KEEPALIVE asks the server to keep the connection for more
+        extended frames after the reply. the reply has the flag too if the server does,
+        otherwise it closes the connection after the reply like for any other frame.
+        the client may write further requests before earlier replies arrived (pipelining),
+        they are processed and answered in order. a server closes a kept connection that
+        stays idle between frames, without reading a frame that raced with the close, so
+        requests without a reply when the connection ends at a frame boundary were not
+        processed.
+
+    busy:
+        a server with a resource budget (see pcc_budget.h) that can't take a request
+        without going over it replies PCC_STATUS_BUSY, with an error line as the body.
+        nothing was counted, a payload is not read (the connection is closed after the
+        reply), the request may be sent again later or to another server. a connection it
+        can't take at all is closed right after accept(), before anything is read.
+
+    NOTICE:
+        a plain client can't send a payload of exactly PCC_EXT_MARKER bytes with
+        the basic frame, such payloads have to go through the extended frame.
+*/
+
+#define PCC_FIRST_PRINTABLE 32
+#define PCC_LAST_PRINTABLE 126
+#define PCC_NPRINTABLE (PCC_LAST_PRINTABLE - PCC_FIRST_PRINTABLE + 1)
+
+#define PCC_EXT_MARKER 0xFFFFFFFFu
+#define PCC_EXT_VERSION 1
+
+#define PCC_EXT_REQ_HDR_LEN 16 // fixed request header, not counting the marker
+#define PCC_EXT_REP_HDR_LEN 16 // fixed reply header
+
+// ops
+#define PCC_OP_COUNT 1 // count the payload, same semantics as the basic frame
+#define PCC_OP_QUERY 2 // payload is a text command, reply body is text
+#define PCC_OP_SAMPLE 3 // payload is sampled blocks of a bigger stream, needs PCC_OPT_SAMPLE (pcc_sample.h)
+#define PCC_OP_RING 4 // no payload, switch a UNIX socket connection to the shared memory ring (pcc_ring.h)
+
+// flags
+#define PCC_FLAG_KEEPALIVE 0x0001 // request: keep the connection after the reply. reply: kept
+
+// options
+#define PCC_OPT_TENANT 1 // tenant id (text, at most PCC_TENANT_ID_MAX bytes) to account the request to
+#define PCC_OPT_SAMPLE 2 // u64 true_n, u32 block, u32 tail: the stream the PCC_OP_SAMPLE payload came from
+#define PCC_OPT_SAMPLE_LEN 16
+#define PCC_OPT_STREAM 3 // u64 offset, then the stream id (text, at most PCC_STREAM_ID_MAX bytes)
+#define PCC_OPT_NGRAM 4 // u8 PCC_NGRAM_* flags: n-grams a PCC_OP_COUNT request also counts (pcc_ngram.h)
+#define PCC_OPT_CHECKSUM 5 // u8 PCC_CHECKSUM_*: a PCC_OP_COUNT payload is followed by its checksum
+
+#define PCC_OPT_HDR_LEN 4
+#define PCC_MAX_OPT_LEN 4096 // longest option list the server accepts
+
+// PCC_OPT_NGRAM flags
+#define PCC_NGRAM_BIGRAMS 0x01
+#define PCC_NGRAM_TRIGRAMS 0x02
+
+// PCC_OPT_CHECKSUM algorithms
+#define PCC_CHECKSUM_CRC32C 1
+#define PCC_CHECKSUM_LEN 4 // bytes of the trailer
+
+// reply status
+#define PCC_STATUS_OK 0
+#define PCC_STATUS_BAD_REQUEST 1 // malformed or unknown op / query
+#define PCC_STATUS_STREAM_OFFSET 2 // PCC_OPT_STREAM offset is not where the stream continues, c is
+#define PCC_STATUS_BUSY 3 // shed, the server is at one of its resource budgets. nothing was counted
+#define PCC_STATUS_CHECKSUM 4 // the payload doesn't match its PCC_OPT_CHECKSUM trailer. nothing was counted
+
+#define PCC_MAX_QUERY_LEN 1024 // longest query command the server accepts
+
+struct pcc_ext_req {
+    uint8_t version;
+    uint8_t op;
+    uint16_t flags;
+    uint32_t opt_len;
+    uint64_t n;
+};
+
+struct pcc_ext_rep {
+    uint8_t version;
+    uint8_t status;
+    uint16_t flags;
+    uint32_t body_len;
+    uint64_t c;
+};
+
+// 64-bit network order helpers, there is no htonll in libc
+static inline uint64_t pcc_hton64(uint64_t x) {
+    return htobe64(x);
+}
+
+static inline uint64_t pcc_ntoh64(uint64_t x) {
+    return be64toh(x);
+}
+
+// append one option TLV to buf, returns the new length of buf
+static inline size_t pcc_opt_put(unsigned char *buf, size_t len, uint16_t type, const void *val, uint16_t val_len) {
+    uint16_t t = htons(type);
+    uint16_t l = htons(val_len);
+    memcpy(buf + len, &t, sizeof(t));
+    memcpy(buf + len + 2, &l, sizeof(l));
+    memcpy(buf + len + PCC_OPT_HDR_LEN, val, val_len);
+    return len + PCC_OPT_HDR_LEN + val_len;
+}
+
+// iterate the option TLVs in buf. *pos is the cursor, start it at 0.
+// returns 1 and fills type/val/val_len for every option, 0 at the end, -1 if malformed
+static inline int pcc_opt_next(const unsigned char *buf, size_t len, size_t *pos,
+                               uint16_t *type, const unsigned char **val, uint16_t *val_len) {
+    uint16_t t, l;
+    if (*pos == len) return 0;
+    if (len - *pos < PCC_OPT_HDR_LEN) return -1;
+    memcpy(&t, buf + *pos, sizeof(t));
+    memcpy(&l, buf + *pos + 2, sizeof(l));
+    t = ntohs(t);
+    l = ntohs(l);
+    if (len - *pos - PCC_OPT_HDR_LEN < l) return -1;
+    *type = t;
+    *val = buf + *pos + PCC_OPT_HDR_LEN;
+    *val_len = l;
+    *pos += PCC_OPT_HDR_LEN + l;
+    return 1;
+}
+
+// (de)serialize the fixed part of the extended headers
+static inline void pcc_ext_req_pack(const struct pcc_ext_req *req, unsigned char buf[PCC_EXT_REQ_HDR_LEN]) {
+    uint16_t flags = htons(req->flags);
+    uint32_t opt_len = htonl(req->opt_len);
+    uint64_t n = pcc_hton64(req->n);
+    buf[0] = req->version;
+    buf[1] = req->op;
+    memcpy(buf + 2, &flags, sizeof(flags));
+    memcpy(buf + 4, &opt_len, sizeof(opt_len));
+    memcpy(buf + 8, &n, sizeof(n));
+}
+
+static inline void pcc_ext_req_unpack(struct pcc_ext_req *req, const unsigned char buf[PCC_EXT_REQ_HDR_LEN]) {
+    uint16_t flags;
+    uint32_t opt_len;
+    uint64_t n;
+    memcpy(&flags, buf + 2, sizeof(flags));
+    memcpy(&opt_len, buf + 4, sizeof(opt_len));
+    memcpy(&n, buf + 8, sizeof(n));
+    req->version = buf[0];
+    req->op = buf[1];
+    req->flags = ntohs(flags);
+    req->opt_len = ntohl(opt_len);
+    req->n = pcc_ntoh64(n);
+}
+
+static inline void pcc_ext_rep_pack(const struct pcc_ext_rep *rep, unsigned char buf[PCC_EXT_REP_HDR_LEN]) {
+    uint16_t flags = htons(rep->flags);
+    uint32_t body_len = htonl(rep->body_len);
+    uint64_t c = pcc_hton64(rep->c);
+    buf[0] = rep->version;
+    buf[1] = rep->status;
+    memcpy(buf + 2, &flags, sizeof(flags));
+    memcpy(buf + 4, &body_len, sizeof(body_len));
+    memcpy(buf + 8, &c, sizeof(c));
+}
+
+static inline void pcc_ext_rep_unpack(struct pcc_ext_rep *rep, const unsigned char buf[PCC_EXT_REP_HDR_LEN]) {
+    uint16_t flags;
+    uint32_t body_len;
+    uint64_t c;
+    memcpy(&flags, buf + 2, sizeof(flags));
+    memcpy(&body_len, buf + 4, sizeof(body_len));
+    memcpy(&c, buf + 8, sizeof(c));
+    rep->version = buf[0];
+    rep->status = buf[1];
+    rep->flags = ntohs(flags);
+    rep->body_len = ntohl(body_len);
+    rep->c = pcc_ntoh64(c);
+}
+
+#endif
@@ -0,0 +1,507 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pcc_crc.h"
+#include "pcc_net.h"
+#include "pcc_proto.h"
+#include "pcc_trace.h"
+
+/*
+    pcc_replay [-f] [-s speed] [-j connections] <trace> <server IP> <server port>
+
+    send the connections of a trace (pcc_trace.h, pcc_server --capture) to a server again,
+    over TCP, and compare its replies with the ones in the trace. for bisecting a
+    performance regression: capture once, replay against every build.
+
+    -f              as fast as possible: every connection and frame right after the
+                    previous one, no waiting for their time in the trace
+    -s speed        the original pace speed times faster (default 1), connections are
+                    opened, frames sent and connections closed at their trace time / speed
+    -j connections  at most that many connections at once (default 64), taken in the order
+                    they were opened. with fewer than the trace had at once some start late
+
+    a payload that is not in the trace (captured without --capture-payloads, or beyond
+    PCC_TRACE_MAX_DATA) is made up of pseudo random bytes seeded with its connection and
+    frame, the same in every replay. a frame the client didn't finish is sent as far as the
+    trace has it, then the connection is dropped like the client did. rings are not
+    replayed, nor anything after one on its connection (skipped frames).
+
+    appends to streams (PCC_OPT_STREAM) depend on the order of connections: they are sent
+    in the order of the trace, each one waits until the ones before it were answered, or
+    for at most SEQ_WAIT_MS (their connection may be waiting for a free -j slot).
+
+    the trailer of a PCC_OPT_CHECKSUM request is not in the trace, it is the CRC32C of the
+    payload as sent again. one the traced server found damaged (PCC_STATUS_CHECKSUM) gets
+    a wrong one, so the replayed server rejects it too.
+
+    a reply differs if its status isn't the traced one, or if it counted a payload that is
+    wholly in the trace to another c. against a server in the state the traced one started
+    in (streams continue at their offsets) there are none. prints
+
+        replayed <n> connections, <n> frames (<n> skipped), <n> bytes in <s> s
+        <n> replies differ, <n> errors, <n> late
+        latency traced p50 <us> p99 <us> max <us>, replayed p50 <us> p99 <us> max <us>
+
+    late frames were sent more than LATE_NS after their time. traced latencies are the
+    server's, from a frame's first byte to its reply, the replayed ones are round trips
+    seen here. exits 1 if the trace can't be read or the server not reached, 0 otherwise.
+*/
+
+#define LATE_NS 1000000
+#define RECV_TIMEOUT_S 30
+#define SYNTH_BUF (64 * 1024)
+#define SEQ_WAIT_MS 1000
+
+struct frame {
+    struct pcc_trace_rec rec;
+    const unsigned char *opts, *data;
+    size_t seq; // 1 + place among the stream appends, 0 for other frames
+};
+
+struct conn {
+    uint32_t id;
+    uint64_t open_t, close_t;
+    int opened, closed;
+    struct frame *frames;
+    size_t nframes, cap;
+};
+
+static struct sockaddr_storage serv_addr;
+static socklen_t serv_addr_len;
+static int fast;
+static double speed = 1.0;
+static uint64_t start_ns;
+
+static struct conn **order; // connections by open time
+static size_t nconns;
+static _Atomic size_t next_conn;
+
+// stream appends in trace order: seq_next is the first one not answered yet
+static pthread_mutex_t seq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t seq_cond = PTHREAD_COND_INITIALIZER;
+static unsigned char *seq_done;
+static size_t nseq, seq_next;
+
+static _Atomic uint64_t replayed_frames, skipped, bytes_sent, differ, errors, late;
+static double *lat_traced, *lat_replayed; // us, one per answered frame
+static _Atomic size_t nlat;
+
+static void usage(void) {
+    fprintf(stderr, "usage: pcc_replay [-f] [-s speed] [-j connections] <trace> <server IP> <server port>\n");
+    exit(1);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// sleep until trace time t, scaled by speed. returns how late we are then, in ns
+static uint64_t wait_until(uint64_t t) {
+    if (fast) return 0;
+    uint64_t due = start_ns + (uint64_t)(t / speed);
+    struct timespec ts = {.tv_sec = due / 1000000000u, .tv_nsec = due % 1000000000u};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+    uint64_t now = now_ns();
+    return now > due ? now - due : 0;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int cmp_open(const void *a, const void *b) {
+    const struct conn *x = *(struct conn *const *)a, *y = *(struct conn *const *)b;
+    if (x->open_t != y->open_t) return x->open_t < y->open_t ? -1 : 1;
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+// wait until the stream appends before seq were answered, or SEQ_WAIT_MS passed
+static void seq_wait(size_t seq) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += SEQ_WAIT_MS / 1000;
+    pthread_mutex_lock(&seq_lock);
+    while (seq_next < seq && pthread_cond_timedwait(&seq_cond, &seq_lock, &until) == 0) {
+    }
+    pthread_mutex_unlock(&seq_lock);
+}
+
+// append seq was answered, or won't be sent
+static void seq_finish(size_t seq) {
+    pthread_mutex_lock(&seq_lock);
+    seq_done[seq] = 1;
+    while (seq_next <= nseq && seq_done[seq_next]) seq_next++;
+    pthread_cond_broadcast(&seq_cond);
+    pthread_mutex_unlock(&seq_lock);
+}
+
+static int send_all(int fd, const void *buf, size_t len, int flags) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t r = send(fd, (const char *)buf + sent, len - sent, flags | MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return -1;
+        sent += r;
+    }
+    atomic_fetch_add_explicit(&bytes_sent, len, memory_order_relaxed);
+    return 0;
+}
+
+static int recv_all(int fd, void *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t r = read(fd, (char *)buf + got, len - got);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        got += r;
+    }
+    return 0;
+}
+
+static uint64_t splitmix64(uint64_t *s) {
+    uint64_t z = (*s += 0x9e3779b97f4a7c15u);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+    return z ^ (z >> 31);
+}
+
+// a PCC_OP_COUNT frame with an option of that type
+static int has_opt(const struct frame *f, uint16_t opt) {
+    size_t pos = 0;
+    uint16_t type, len;
+    const unsigned char *val;
+    if (f->rec.type != PCC_TRACE_EXT || f->rec.op != PCC_OP_COUNT) return 0;
+    while (pcc_opt_next(f->opts, f->rec.opt_bytes, &pos, &type, &val, &len) == 1) {
+        if (type == opt) return 1;
+    }
+    return 0;
+}
+
+// n bytes of the payload of frame k of c: what the trace has of it, then made up bytes.
+// *crc gets their CRC32C
+static int send_payload(int fd, const struct conn *c, size_t k, uint64_t n, unsigned char *synth, uint32_t *crc) {
+    const struct frame *f = &c->frames[k];
+    uint64_t seed = (uint64_t)c->id << 32 | k;
+
+    *crc = pcc_crc32c(0, f->data, f->rec.data_len);
+    if (f->rec.data_len > 0 && send_all(fd, f->data, f->rec.data_len, 0) < 0) return -1;
+    for (uint64_t left = n - f->rec.data_len; left > 0;) {
+        size_t len = left < SYNTH_BUF ? (size_t)left : SYNTH_BUF;
+        for (size_t i = 0; i < len; i += 8) {
+            uint64_t r = splitmix64(&seed);
+            memcpy(synth + i, &r, 8); // SYNTH_BUF has room for the last partial word
+        }
+        *crc = pcc_crc32c(*crc, synth, len);
+        if (send_all(fd, synth, len, 0) < 0) return -1;
+        left -= len;
+    }
+    return 0;
+}
+
+// send frame k of c and read its reply. returns 1 if the connection goes on, 0 if the
+// server closes it after this frame (or the client dropped it here), -1 on an error
+static int replay_frame(int fd, const struct conn *c, size_t k, unsigned char *synth) {
+    const struct frame *f = &c->frames[k];
+    const struct pcc_trace_rec *rec = &f->rec;
+    unsigned char head[4 + PCC_EXT_REQ_HDR_LEN + PCC_MAX_OPT_LEN];
+    size_t head_len;
+    int gone = rec->status == PCC_TRACE_GONE;
+    // only what the server read: a frame it rejected before its options or its payload
+    // ends there (the query of a rejected query was read, it is in the trace)
+    int payload = rec->type == PCC_TRACE_BASIC || rec->status == PCC_STATUS_OK || rec->status == PCC_STATUS_CHECKSUM ||
+                  gone || rec->data_len == rec->n;
+    if (rec->opt_bytes != rec->opt_len) payload = 0;
+    uint64_t n = !payload ? 0 : gone ? rec->data_len : rec->n;
+    // a cut frame never got to its trailer
+    int trailer = payload && !gone && has_opt(f, PCC_OPT_CHECKSUM);
+
+    if (rec->type == PCC_TRACE_BASIC) {
+        uint32_t N = htonl((uint32_t)rec->n);
+        memcpy(head, &N, 4);
+        head_len = 4;
+    } else {
+        struct pcc_ext_req req = {
+            .version = rec->version, .op = rec->op, .flags = rec->flags, .opt_len = rec->opt_len, .n = rec->n};
+        uint32_t marker = htonl(PCC_EXT_MARKER);
+        memcpy(head, &marker, 4);
+        pcc_ext_req_pack(&req, head + 4);
+        memcpy(head + 4 + PCC_EXT_REQ_HDR_LEN, f->opts, rec->opt_bytes);
+        head_len = 4 + PCC_EXT_REQ_HDR_LEN + rec->opt_bytes;
+    }
+
+    uint64_t lateness = wait_until(rec->t);
+    if (lateness > LATE_NS) atomic_fetch_add_explicit(&late, 1, memory_order_relaxed);
+    if (f->seq > 0) seq_wait(f->seq);
+    uint64_t t0 = now_ns();
+    // a server that already answered may stop reading the payload, the reply still counts
+    uint32_t crc = 0;
+    int sent = send_all(fd, head, head_len, n > 0 || trailer ? MSG_MORE : 0) == 0 &&
+               (n == 0 || send_payload(fd, c, k, n, synth, &crc) == 0);
+    if (sent && trailer) {
+        if (rec->status == PCC_STATUS_CHECKSUM) crc ^= 1;
+        crc = htonl(crc);
+        sent = send_all(fd, &crc, sizeof(crc), 0) == 0;
+    }
+    atomic_fetch_add_explicit(&replayed_frames, 1, memory_order_relaxed);
+    if (gone) return 0;
+
+    uint64_t got_c;
+    int kept = 0;
+    if (rec->type == PCC_TRACE_BASIC) {
+        uint32_t C;
+        if (recv_all(fd, &C, sizeof(C)) < 0) return -1;
+        got_c = ntohl(C);
+    } else {
+        unsigned char rep_hdr[PCC_EXT_REP_HDR_LEN], drain[4096];
+        struct pcc_ext_rep rep;
+        if (recv_all(fd, rep_hdr, sizeof(rep_hdr)) < 0) return -1;
+        pcc_ext_rep_unpack(&rep, rep_hdr);
+        for (uint32_t left = rep.body_len; left > 0;) {
+            uint32_t len = left < sizeof(drain) ? left : sizeof(drain);
+            if (recv_all(fd, drain, len) < 0) return -1;
+            left -= len;
+        }
+        if (rep.status != rec->status) atomic_fetch_add_explicit(&differ, 1, memory_order_relaxed);
+        got_c = rep.c;
+        kept = (rep.flags & PCC_FLAG_KEEPALIVE) != 0;
+        if (rec->op != PCC_OP_COUNT && rec->op != PCC_OP_SAMPLE) got_c = rec->c; // queries: only the status
+    }
+    uint64_t t1 = now_ns();
+
+    if (rec->data_len == rec->n && got_c != rec->c) atomic_fetch_add_explicit(&differ, 1, memory_order_relaxed);
+    size_t i = atomic_fetch_add_explicit(&nlat, 1, memory_order_relaxed);
+    lat_traced[i] = rec->dur / 1e3;
+    lat_replayed[i] = (t1 - t0) / 1e3;
+    return sent ? kept : 0;
+}
+
+static void replay_conn(struct conn *c, unsigned char *synth) {
+    size_t k = 0;
+    wait_until(c->open_t);
+
+    int fd = socket(serv_addr.ss_family, SOCK_STREAM, 0);
+    struct timeval tv = {.tv_sec = RECV_TIMEOUT_S};
+    int one = 1;
+    if (fd < 0 || connect(fd, (struct sockaddr *)&serv_addr, serv_addr_len) < 0) {
+        fprintf(stderr, "Error connecting to server: %s\n", strerror(errno));
+        exit(1);
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    for (; k < c->nframes; k++) {
+        if (c->frames[k].rec.type == PCC_TRACE_EXT && c->frames[k].rec.op == PCC_OP_RING) break;
+        int r = replay_frame(fd, c, k, synth);
+        if (c->frames[k].seq > 0) seq_finish(c->frames[k].seq);
+        if (r < 0) atomic_fetch_add_explicit(&errors, 1, memory_order_relaxed);
+        if (r <= 0) {
+            k++;
+            break;
+        }
+    }
+    atomic_fetch_add_explicit(&skipped, c->nframes - k, memory_order_relaxed);
+    for (; k < c->nframes; k++) {
+        if (c->frames[k].seq > 0) seq_finish(c->frames[k].seq);
+    }
+    if (c->closed) wait_until(c->close_t);
+    close(fd);
+}
+
+static void *replay_main(void *arg) {
+    (void)arg;
+    unsigned char *synth = malloc(SYNTH_BUF + 8);
+    if (synth == NULL) {
+        fprintf(stderr, "Error allocating payload buffer: %s\n", strerror(errno));
+        exit(1);
+    }
+    for (size_t i; (i = atomic_fetch_add(&next_conn, 1)) < nconns;) replay_conn(order[i], synth);
+    free(synth);
+    return NULL;
+}
+
+// group the records of the trace by connection. returns the number of frames
+static size_t load_trace(struct pcc_trace_reader *r, struct conn **conns, size_t *nids) {
+    struct pcc_trace_rec rec;
+    const unsigned char *opts, *data;
+    size_t frames = 0;
+
+    *conns = NULL;
+    *nids = 0;
+    while (pcc_trace_next(r, &rec, &opts, &data) == 1) {
+        if (rec.conn >= *nids) {
+            size_t n = *nids ? *nids : 64;
+            while (n <= rec.conn) n *= 2;
+            struct conn *p = realloc(*conns, n * sizeof(*p));
+            if (p == NULL) {
+                fprintf(stderr, "Error allocating connections: %s\n", strerror(errno));
+                exit(1);
+            }
+            memset(p + *nids, 0, (n - *nids) * sizeof(*p));
+            *conns = p;
+            *nids = n;
+        }
+        // the server never writes these, the records can't be trusted after one
+        if (rec.opt_bytes > PCC_MAX_OPT_LEN || rec.data_len > rec.n) {
+            fprintf(stderr, "Error reading trace: %s\n", strerror(EBADMSG));
+            exit(1);
+        }
+        struct conn *c = &(*conns)[rec.conn];
+        c->id = rec.conn;
+        if (rec.type == PCC_TRACE_OPEN) {
+            c->opened = 1;
+            c->open_t = rec.t;
+        } else if (rec.type == PCC_TRACE_CLOSE) {
+            c->closed = 1;
+            c->close_t = rec.t;
+        } else if ((rec.type == PCC_TRACE_BASIC || rec.type == PCC_TRACE_EXT) && !c->closed) {
+            if (c->nframes == c->cap) {
+                c->cap = c->cap ? 2 * c->cap : 4;
+                if ((c->frames = realloc(c->frames, c->cap * sizeof(*c->frames))) == NULL) {
+                    fprintf(stderr, "Error allocating frames: %s\n", strerror(errno));
+                    exit(1);
+                }
+            }
+            c->frames[c->nframes++] = (struct frame){.rec = rec, .opts = opts, .data = data};
+            frames++;
+        }
+    }
+    return frames;
+}
+
+
+static int cmp_frame_t(const void *a, const void *b) {
+    const struct frame *x = *(struct frame *const *)a, *y = *(struct frame *const *)b;
+    return x->rec.t < y->rec.t ? -1 : x->rec.t > y->rec.t;
+}
+
+// number the stream appends of every connection in the order the traced server began them
+static void order_streams(struct conn *conns, size_t nids) {
+    struct frame **appends = NULL;
+    size_t cap = 0;
+    for (size_t i = 0; i < nids; i++) {
+        for (size_t k = 0; k < conns[i].nframes; k++) {
+            if (!has_opt(&conns[i].frames[k], PCC_OPT_STREAM)) continue;
+            if (nseq == cap && (appends = realloc(appends, (cap = cap ? 2 * cap : 64) * sizeof(*appends))) == NULL) {
+                fprintf(stderr, "Error allocating: %s\n", strerror(errno));
+                exit(1);
+            }
+            appends[nseq++] = &conns[i].frames[k];
+        }
+    }
+    qsort(appends, nseq, sizeof(*appends), cmp_frame_t);
+    for (size_t i = 0; i < nseq; i++) appends[i]->seq = i + 1;
+    free(appends);
+
+    if ((seq_done = calloc(nseq + 1, 1)) == NULL) { // indexed by seq
+        fprintf(stderr, "Error allocating: %s\n", strerror(errno));
+        exit(1);
+    }
+    seq_next = 1;
+}
+
+static double pct(const double *v, size_t n, size_t p) {
+    return n == 0 ? 0 : v[p == 100 ? n - 1 : n * p / 100];
+}
+
+int main(int argc, char *argv[]) {
+    int nthreads = 64, opt;
+    while ((opt = getopt(argc, argv, "fs:j:")) != -1) {
+        switch (opt) {
+        case 'f':
+            fast = 1;
+            break;
+        case 's':
+            speed = atof(optarg);
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (argc - optind != 3 || speed <= 0 || nthreads < 1) usage();
+    const char *path = argv[optind];
+
+    if (pcc_net_addr(argv[optind + 1], atoi(argv[optind + 2]), &serv_addr, &serv_addr_len) < 0) {
+        fprintf(stderr, "Error converting IP address: %s\n", strerror(EINVAL));
+        exit(1);
+    }
+
+    struct pcc_trace_reader r;
+    if (pcc_trace_map(path, &r) < 0) {
+        fprintf(stderr, "Error reading %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    struct conn *conns;
+    size_t nids;
+    size_t frames = load_trace(&r, &conns, &nids);
+    if (r.truncated) fprintf(stderr, "Warning: %s ends in the middle of a record, replaying what is before\n", path);
+    order_streams(conns, nids);
+
+    if ((order = malloc((nids + 1) * sizeof(*order))) == NULL || (lat_traced = malloc((frames + 1) * sizeof(double))) == NULL ||
+        (lat_replayed = malloc((frames + 1) * sizeof(double))) == NULL) {
+        fprintf(stderr, "Error allocating: %s\n", strerror(errno));
+        exit(1);
+    }
+    for (size_t i = 0; i < nids; i++) {
+        if (conns[i].opened) order[nconns++] = &conns[i];
+    }
+    qsort(order, nconns, sizeof(*order), cmp_open);
+
+    if (nthreads > (int)nconns) nthreads = nconns > 0 ? (int)nconns : 1;
+    pthread_t *threads = malloc(nthreads * sizeof(*threads));
+    if (threads == NULL) {
+        fprintf(stderr, "Error allocating: %s\n", strerror(errno));
+        exit(1);
+    }
+    // paced from the first connection on, not from when the traced server started
+    start_ns = now_ns() - (uint64_t)((nconns > 0 ? order[0]->open_t : 0) / speed);
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < nthreads; i++) {
+        int err = pthread_create(&threads[i], NULL, replay_main, NULL);
+        if (err != 0) {
+            fprintf(stderr, "Error creating thread: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+    for (int i = 0; i < nthreads; i++) pthread_join(threads[i], NULL);
+    double elapsed = (now_ns() - t0) / 1e9;
+
+    size_t n = atomic_load(&nlat);
+    qsort(lat_traced, n, sizeof(double), cmp_double);
+    qsort(lat_replayed, n, sizeof(double), cmp_double);
+    printf("replayed %zu connections, %" PRIu64 " frames (%" PRIu64 " skipped), %" PRIu64 " bytes in %.3f s\n", nconns,
+           atomic_load(&replayed_frames), atomic_load(&skipped), atomic_load(&bytes_sent), elapsed);
+    printf("%" PRIu64 " replies differ, %" PRIu64 " errors, %" PRIu64 " late\n", atomic_load(&differ),
+           atomic_load(&errors), atomic_load(&late));
+    printf("latency traced p50 %.1f us p99 %.1f us max %.1f us, replayed p50 %.1f us p99 %.1f us max %.1f us\n",
+           pct(lat_traced, n, 50), pct(lat_traced, n, 99), pct(lat_traced, n, 100), pct(lat_replayed, n, 50),
+           pct(lat_replayed, n, 99), pct(lat_replayed, n, 100));
+
+    for (size_t i = 0; i < nids; i++) free(conns[i].frames);
+    free(conns);
+    free(order);
+    free(threads);
+    free(lat_traced);
+    free(lat_replayed);
+    free(seq_done);
+    pcc_trace_unmap(&r);
+    return 0;
+}
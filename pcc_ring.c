@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pcc_ring.h"
+
+static void ring_init_ends(struct pcc_ring *r, int server) {
+    r->server = server;
+    r->data = (unsigned char *)r->hdr + PCC_RING_HDR_SIZE;
+    r->me = server ? &r->hdr->server : &r->hdr->client;
+    r->peer = server ? &r->hdr->client : &r->hdr->server;
+    r->pos = r->rep = 0;
+    atomic_store(&r->me->pos, 0);
+    atomic_store(&r->me->rep, 0);
+    atomic_store(&r->me->sleeping, 0);
+}
+
+int pcc_ring_create(struct pcc_ring *r, size_t data_size) {
+    size_t size = PCC_RING_MIN_SIZE;
+    while (size < data_size && size < PCC_RING_MAX_SIZE) size <<= 1;
+
+    memset(r, 0, sizeof(*r));
+    r->efd[0] = r->efd[1] = -1;
+    r->memfd = memfd_create("pcc-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (r->memfd < 0) return -1;
+    if (ftruncate(r->memfd, PCC_RING_HDR_SIZE + size) < 0 ||
+        fcntl(r->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        goto fail;
+    }
+    r->hdr = mmap(NULL, PCC_RING_HDR_SIZE + size, PROT_READ | PROT_WRITE, MAP_SHARED, r->memfd, 0);
+    if (r->hdr == MAP_FAILED) {
+        r->hdr = NULL;
+        goto fail;
+    }
+    r->data_size = size;
+    r->hdr->magic = PCC_RING_MAGIC;
+    r->hdr->version = PCC_RING_VERSION;
+    r->hdr->data_size = size;
+    ring_init_ends(r, 0);
+    for (int i = 0; i < 2; i++) {
+        if ((r->efd[i] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) goto fail;
+    }
+    return 0;
+
+fail:;
+    int err = errno;
+    pcc_ring_free(r);
+    errno = err;
+    return -1;
+}
+
+// a doorbell the client passed must be an eventfd, made non-blocking here: a pipe or a
+// blocking eventfd would leave the server stuck in a read or write of it
+static int check_doorbell(int fd) {
+    struct stat st;
+    char proc[64], link[64];
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+    if (fstat(fd, &st) < 0) return -1;
+    ssize_t n = readlink(proc, link, sizeof(link) - 1);
+    if (n < 0) return -1;
+    link[n] = '\0';
+    // anon inodes have no file type
+    if ((st.st_mode & S_IFMT) != 0 || strcmp(link, "anon_inode:[eventfd]") != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+    return 0;
+}
+
+int pcc_ring_attach(struct pcc_ring *r, int memfd, int efd_server, int efd_client) {
+    struct stat st;
+    memset(r, 0, sizeof(*r));
+    r->memfd = memfd;
+    r->efd[0] = efd_server;
+    r->efd[1] = efd_client;
+
+    if (check_doorbell(efd_server) < 0 || check_doorbell(efd_client) < 0) goto fail;
+    int seals = fcntl(memfd, F_GET_SEALS);
+    if (fstat(memfd, &st) < 0 || seals < 0) goto fail;
+    if (!(seals & F_SEAL_SHRINK) || st.st_size < PCC_RING_HDR_SIZE + PCC_RING_MIN_SIZE) {
+        errno = EINVAL;
+        goto fail;
+    }
+    // the size is read once from the header, later changes to it don't reach us
+    const struct pcc_ring_hdr *h = mmap(NULL, PCC_RING_HDR_SIZE, PROT_READ, MAP_SHARED, memfd, 0);
+    if (h == MAP_FAILED) goto fail;
+    uint64_t size = h->data_size;
+    int ok = h->magic == PCC_RING_MAGIC && h->version == PCC_RING_VERSION && size >= PCC_RING_MIN_SIZE &&
+             size <= PCC_RING_MAX_SIZE && (size & (size - 1)) == 0 &&
+             (uint64_t)st.st_size >= PCC_RING_HDR_SIZE + size;
+    munmap((void *)h, PCC_RING_HDR_SIZE);
+    if (!ok) {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    r->hdr = mmap(NULL, PCC_RING_HDR_SIZE + size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (r->hdr == MAP_FAILED) {
+        r->hdr = NULL;
+        goto fail;
+    }
+    r->data_size = size;
+    ring_init_ends(r, 1);
+    return 0;
+
+fail:;
+    int err = errno;
+    pcc_ring_free(r);
+    errno = err;
+    return -1;
+}
+
+void pcc_ring_free(struct pcc_ring *r) {
+    if (r->hdr != NULL) munmap(r->hdr, PCC_RING_HDR_SIZE + r->data_size);
+    if (r->memfd >= 0) close(r->memfd);
+    for (int i = 0; i < 2; i++) {
+        if (r->efd[i] >= 0) close(r->efd[i]);
+    }
+    memset(r, 0, sizeof(*r));
+    r->memfd = r->efd[0] = r->efd[1] = -1;
+}
+
+// tell the peer we moved, ringing its doorbell only if it is asleep
+static void ring_progress(struct pcc_ring *r) {
+    atomic_fetch_add(&r->me->seq, 1);
+    if (atomic_load(&r->peer->sleeping)) {
+        uint64_t one = 1;
+        ssize_t w = write(r->efd[r->server ? 1 : 0], &one, sizeof(one));
+        (void)w; // EAGAIN means the counter is already full of wakeups
+    }
+}
+
+size_t pcc_ring_reserve(struct pcc_ring *r, unsigned char **p) {
+    uint64_t used = r->pos - atomic_load_explicit(&r->peer->pos, memory_order_acquire);
+    if (used > r->data_size) return 0; // the server is confused, it will get EPROTO
+    size_t off = r->pos & (r->data_size - 1);
+    size_t len = r->data_size - used;
+    if (len > r->data_size - off) len = r->data_size - off;
+    *p = r->data + off;
+    return len;
+}
+
+void pcc_ring_produce(struct pcc_ring *r, size_t len) {
+    r->pos += len;
+    atomic_store_explicit(&r->me->pos, r->pos, memory_order_release);
+    ring_progress(r);
+}
+
+ssize_t pcc_ring_peek(struct pcc_ring *r, const unsigned char **p) {
+    uint64_t avail = atomic_load_explicit(&r->peer->pos, memory_order_acquire) - r->pos;
+    if (avail > r->data_size) {
+        errno = EPROTO;
+        return -1;
+    }
+    size_t off = r->pos & (r->data_size - 1);
+    if (avail > r->data_size - off) avail = r->data_size - off;
+    *p = r->data + off;
+    return (ssize_t)avail;
+}
+
+void pcc_ring_consume(struct pcc_ring *r, size_t len) {
+    r->pos += len;
+    atomic_store_explicit(&r->me->pos, r->pos, memory_order_release);
+    ring_progress(r);
+}
+
+int pcc_ring_reply(struct pcc_ring *r, uint64_t c) {
+    uint64_t queued = r->rep - atomic_load_explicit(&r->peer->rep, memory_order_acquire);
+    if (queued >= PCC_RING_REPLIES) {
+        errno = queued == PCC_RING_REPLIES ? EAGAIN : EPROTO;
+        return -1;
+    }
+    r->hdr->replies[r->rep % PCC_RING_REPLIES] = c;
+    r->rep++;
+    atomic_store_explicit(&r->me->rep, r->rep, memory_order_release);
+    ring_progress(r);
+    return 0;
+}
+
+int pcc_ring_take_reply(struct pcc_ring *r, uint64_t *c) {
+    if (atomic_load_explicit(&r->peer->rep, memory_order_acquire) == r->rep) {
+        errno = EAGAIN;
+        return -1;
+    }
+    *c = r->hdr->replies[r->rep % PCC_RING_REPLIES];
+    r->rep++;
+    atomic_store_explicit(&r->me->rep, r->rep, memory_order_release);
+    ring_progress(r);
+    return 0;
+}
+
+uint32_t pcc_ring_peer_seq(const struct pcc_ring *r) {
+    return atomic_load(&r->peer->seq);
+}
+
+int pcc_ring_wait(struct pcc_ring *r, uint32_t seen, int sock_fd, int timeout_ms) {
+    int efd = r->efd[r->server ? 0 : 1];
+    struct pollfd pfd[2] = {{.fd = efd, .events = POLLIN}, {.fd = sock_fd, .events = POLLIN}};
+    uint64_t drain;
+    int ret = 1;
+
+    atomic_store(&r->me->sleeping, 1);
+    if (atomic_load(&r->peer->seq) == seen) {
+        int n = poll(pfd, sock_fd >= 0 ? 2 : 1, timeout_ms);
+        if (n == 0 || (n < 0 && errno == EINTR)) ret = 0;
+        else if (n > 0 && (pfd[1].revents & (POLLIN | POLLHUP | POLLERR))) ret = -1;
+        if (n > 0 && (pfd[0].revents & POLLIN)) {
+            ssize_t rd = read(efd, &drain, sizeof(drain));
+            (void)rd;
+        }
+    }
+    atomic_store(&r->me->sleeping, 0);
+    if (ret == 0 && atomic_load(&r->peer->seq) != seen) ret = 1;
+    return ret;
+}
@@ -0,0 +1,106 @@
+#ifndef PCC_RING_H
+#define PCC_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    shared memory transport for clients on the server's host
+
+    a single producer single consumer ring in a memfd that the client creates and passes
+    to the server over the UNIX socket (SCM_RIGHTS, with a PCC_OP_RING frame, see
+    pcc_proto.h), together with two eventfds, one doorbell per side. the client writes its
+    payload straight into the shared pages (read() from the file into the ring) and the
+    server counts it where it lies, no socket copies in between.
+
+    layout of the memfd: a header page, then data_size bytes of data (a power of two) the
+    positions wrap around in. every request is a u64 n in host byte order followed by n
+    bytes of payload, both may wrap. requests are answered in order through a ring of
+    PCC_RING_REPLIES u64 counts in the header page, same semantics as C of the basic frame
+    (the count is only part of the totals once it was written to the reply ring).
+
+    the positions only ever grow: head - tail bytes are waiting, rep_head - rep_tail replies.
+    every side writes its own positions and only reads the other side's, and keeps its
+    own in private memory too, a misbehaving peer can't make us read outside the ring.
+
+    doorbells: each side bumps its seq after any progress (produced, consumed, replied, took
+    a reply) and writes its peer's eventfd only if the peer said it is going to sleep.
+    pcc_ring_wait sets our sleeping flag and rechecks the peer's seq before it blocks, with
+    both sides seq_cst nothing is missed. a busy ring never makes a system call.
+
+    the server requires the memfd to be sealed against shrinking (F_SEAL_SHRINK), so the
+    client can't take pages away under it.
+*/
+
+#define PCC_RING_MAGIC 0x50434352u // "PCCR"
+#define PCC_RING_VERSION 1
+#define PCC_RING_HDR_SIZE 4096
+#define PCC_RING_REPLIES 256
+#define PCC_RING_MIN_SIZE 4096
+#define PCC_RING_MAX_SIZE (1u << 30)
+#define PCC_RING_DEFAULT_SIZE (4u << 20)
+
+// what one side writes. on its own cache line, the other side only reads it
+struct pcc_ring_side {
+    _Alignas(64) _Atomic uint64_t pos; // client: head, bytes produced. server: tail, bytes consumed
+    _Atomic uint64_t rep; // client: rep_tail, replies taken. server: rep_head, replies written
+    _Atomic uint32_t seq; // bumped after every progress
+    _Atomic uint32_t sleeping; // set while blocked in pcc_ring_wait
+};
+
+struct pcc_ring_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t data_size;
+    struct pcc_ring_side client, server;
+    _Alignas(64) uint64_t replies[PCC_RING_REPLIES];
+};
+
+_Static_assert(sizeof(struct pcc_ring_hdr) <= PCC_RING_HDR_SIZE, "ring header must fit its page");
+
+// one end of a ring
+struct pcc_ring {
+    int server; // which end we are
+    int memfd;
+    int efd[2]; // doorbells: [0] wakes the server, [1] the client
+    size_t data_size; // our copy, the header's may be changed by the peer
+    struct pcc_ring_hdr *hdr;
+    unsigned char *data;
+    struct pcc_ring_side *me, *peer;
+    uint64_t pos, rep; // our positions, what we last stored in me
+};
+
+// client end: a new memfd of data_size bytes of data (rounded up to a power of two) and
+// its doorbells. returns 0, or -1 with errno set
+int pcc_ring_create(struct pcc_ring *r, size_t data_size);
+// server end: map a ring the client passed. returns 0, or -1 with errno set (EINVAL for
+// a memfd that is not a sealed, consistent ring, or doorbells that are not eventfds, they
+// are made non-blocking). the fds belong to the ring then, also on failure
+int pcc_ring_attach(struct pcc_ring *r, int memfd, int efd_server, int efd_client);
+void pcc_ring_free(struct pcc_ring *r);
+
+// producer (client). the free space at head, contiguous: *p and up to the returned length
+size_t pcc_ring_reserve(struct pcc_ring *r, unsigned char **p);
+// publish len bytes written at *p
+void pcc_ring_produce(struct pcc_ring *r, size_t len);
+
+// consumer (server). the waiting bytes at tail, contiguous. -1 with EPROTO if the producer's
+// head makes no sense
+ssize_t pcc_ring_peek(struct pcc_ring *r, const unsigned char **p);
+void pcc_ring_consume(struct pcc_ring *r, size_t len);
+
+// server: answer the oldest request. returns 0, or -1 with EAGAIN if the reply ring is
+// full (or EPROTO if the client's rep_tail makes no sense)
+int pcc_ring_reply(struct pcc_ring *r, uint64_t c);
+// client: take the oldest reply. returns 0, or -1 with EAGAIN if there is none yet
+int pcc_ring_take_reply(struct pcc_ring *r, uint64_t *c);
+
+// snapshot to pass to pcc_ring_wait, take it before checking whether to wait
+uint32_t pcc_ring_peer_seq(const struct pcc_ring *r);
+// block until the peer makes progress after seen, sock_fd (if >= 0) becomes readable or
+// timeout_ms passes. returns 1 on progress, 0 on timeout, -1 when sock_fd is readable,
+// which here means the other end closed it
+int pcc_ring_wait(struct pcc_ring *r, uint32_t seen, int sock_fd, int timeout_ms);
+
+#endif
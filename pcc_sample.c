@@ -0,0 +1,87 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcc_sample.h"
+
+#define Z95 1.96
+
+void pcc_sample_init(struct pcc_sample_acc *acc) {
+    memset(acc, 0, sizeof(*acc));
+}
+
+void pcc_sample_add_block(struct pcc_sample_acc *acc, const uint64_t counts[PCC_NPRINTABLE], uint64_t c) {
+    for (int i = 0; i < PCC_NPRINTABLE; i++) {
+        double x = (double)counts[i];
+        acc->sum[i] += x;
+        acc->sumsq[i] += x * x;
+    }
+    acc->sum_c += (double)c;
+    acc->sumsq_c += (double)c * (double)c;
+    acc->blocks++;
+}
+
+void pcc_sample_add_tail(struct pcc_sample_acc *acc, const uint64_t counts[PCC_NPRINTABLE], uint64_t c) {
+    for (int i = 0; i < PCC_NPRINTABLE; i++) acc->tail[i] += counts[i];
+    acc->tail_c += c;
+}
+
+// estimate K times the mean block of k, with the half width of its confidence interval
+static void estimate_one(double sum, double sumsq, double k, double K, uint32_t block, uint64_t *est, uint64_t *ci) {
+    double bound = (K - k) * block; // the bytes that were not sent
+    if (k == 0) {
+        *est = 0;
+        *ci = (uint64_t)bound;
+        return;
+    }
+    double mean = sum / k;
+    double half = bound;
+    if (k >= 2) {
+        double var = (sumsq - k * mean * mean) / (k - 1);
+        if (var < 0) var = 0; // rounding
+        half = Z95 * K * sqrt((1 - k / K) * var / k);
+        if (half > bound) half = bound;
+    }
+    *est = (uint64_t)llround(K * mean);
+    *ci = (uint64_t)ceil(half);
+}
+
+void pcc_sample_estimate(const struct pcc_sample_acc *acc, uint64_t true_n, uint32_t block, struct pcc_sample_est *est) {
+    double k = (double)acc->blocks;
+    double K = (double)(true_n / block);
+
+    estimate_one(acc->sum_c, acc->sumsq_c, k, K, block, &est->c, &est->c_ci);
+    est->c += acc->tail_c;
+    for (int i = 0; i < PCC_NPRINTABLE; i++) {
+        estimate_one(acc->sum[i], acc->sumsq[i], k, K, block, &est->counts[i], &est->ci[i]);
+        est->counts[i] += acc->tail[i];
+    }
+}
+
+ssize_t pcc_sample_pick(uint64_t true_n, uint32_t block, double rate, int mode, unsigned *seed, uint64_t **blocks) {
+    uint64_t K = true_n / block;
+    uint64_t k = (uint64_t)ceil(K * rate);
+    if (k < 2) k = 2;
+    if (k > K) k = K;
+
+    uint64_t *out = malloc((k > 0 ? k : 1) * sizeof(*out));
+    if (out == NULL) return -1;
+
+    if (k == K) {
+        for (uint64_t i = 0; i < K; i++) out[i] = i;
+    } else if (mode == PCC_SAMPLE_RANDOM) {
+        // selection sampling (Knuth's algorithm S): every k-subset is equally likely and
+        // the indices come out sorted, so the file is read front to back
+        uint64_t chosen = 0;
+        for (uint64_t i = 0; i < K && chosen < k; i++) {
+            double u = rand_r(seed) / ((double)RAND_MAX + 1);
+            if ((K - i) * u < k - chosen) out[chosen++] = i;
+        }
+    } else {
+        double stride = (double)K / k;
+        double start = rand_r(seed) / ((double)RAND_MAX + 1) * stride;
+        for (uint64_t i = 0; i < k; i++) out[i] = (uint64_t)(start + i * stride);
+    }
+    *blocks = out;
+    return (ssize_t)k;
+}
@@ -0,0 +1,62 @@
+#ifndef PCC_SAMPLE_H
+#define PCC_SAMPLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "pcc_proto.h"
+
+/*
+    sampled counting (PCC_OP_SAMPLE)
+
+    the stream of true_n bytes is cut into blocks of block bytes plus a tail of
+    true_n % block bytes. the client sends k of the K = true_n / block blocks, picked
+    with a fixed stride from a random start or as a simple random sample, followed by
+    the whole tail. the server counts every block on its own and estimates the totals
+    of the stream as K times the mean block, plus the exact tail.
+
+    the confidence interval is the usual one for the mean of a sample without
+    replacement: 1.96 * K * sqrt((1 - k/K) * s^2 / k), s^2 being the variance of the
+    per block counts, so it shrinks with the square root of k and is 0 when every block
+    was sent. it is never wider than the bytes that were not sent. with k < 2 there is
+    no variance to go on and the interval is that bound. a stride sample is treated
+    like a random one, which is fine unless the data repeats with the stride's period.
+
+    the client side (pcc_sample_pick) and the estimator are both here so they agree on
+    the block layout.
+*/
+
+#define PCC_SAMPLE_MAX_BLOCK (16u << 20)
+#define PCC_SAMPLE_DEFAULT_BLOCK 65536
+
+// how the client picks blocks
+#define PCC_SAMPLE_STRIDE 0
+#define PCC_SAMPLE_RANDOM 1
+
+struct pcc_sample_acc {
+    uint64_t blocks; // sampled blocks seen, k
+    double sum[PCC_NPRINTABLE], sumsq[PCC_NPRINTABLE]; // per char count of each block
+    double sum_c, sumsq_c; // printable count of each block
+    uint64_t tail[PCC_NPRINTABLE]; // exact counts of the tail
+    uint64_t tail_c;
+};
+
+struct pcc_sample_est {
+    uint64_t c; // estimated printable chars of the whole stream
+    uint64_t c_ci; // half width of its 95% confidence interval
+    uint64_t counts[PCC_NPRINTABLE];
+    uint64_t ci[PCC_NPRINTABLE];
+};
+
+void pcc_sample_init(struct pcc_sample_acc *acc);
+void pcc_sample_add_block(struct pcc_sample_acc *acc, const uint64_t counts[PCC_NPRINTABLE], uint64_t c);
+void pcc_sample_add_tail(struct pcc_sample_acc *acc, const uint64_t counts[PCC_NPRINTABLE], uint64_t c);
+void pcc_sample_estimate(const struct pcc_sample_acc *acc, uint64_t true_n, uint32_t block, struct pcc_sample_est *est);
+
+// pick the blocks of a true_n byte stream to send for a sample of about rate (0 < rate <= 1)
+// of it, at least 2 blocks when there are that many. *blocks gets the malloc'ed ascending
+// block indices. returns k, -1 on allocation failure
+ssize_t pcc_sample_pick(uint64_t true_n, uint32_t block, double rate, int mode, unsigned *seed, uint64_t **blocks);
+
+#endif
@@ -1,8 +1,10 @@
 #define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <assert.h>
+#include <dirent.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,7 +15,36 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <linux/filter.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
+#include "pcc_budget.h"
+#include "pcc_count.h"
+#include "pcc_crc.h"
+#include "pcc_frame.h"
+#include "pcc_io.h"
+#include "pcc_net.h"
+#include "pcc_ngram.h"
+#include "pcc_pool.h"
+#include "pcc_proto.h"
+#include "pcc_ring.h"
+#include "pcc_sample.h"
+#include "pcc_sm.h"
+#include "pcc_snap.h"
+#include "pcc_stream.h"
+#include "pcc_tenant.h"
+#include "pcc_tls.h"
+#include "pcc_trace.h"
+#include "pcc_window.h"
 
 
 /*
@@ -46,253 +77,2176 @@
         handling of SIGINT should be atomic with respect to processing of client requests
         processing of a client is defind as the period between returning from accept() until closing its socket.
 
+    EXTENSIONS (see pcc_proto.h for the wire format):
+        every completed request is also added to time-series histograms (pcc_window.h),
+        1s/1m/1h tiers with bounded memory. they can be queried at runtime with an
+        extended frame carrying a PCC_OP_QUERY text command:
+            window <from> <to>      sum of [from, to), unix seconds.
+                                    values <= 0 are relative to now, "window -3600 0" is the last hour
+            tenants [k]             the k (default 20) tenants with the most bytes
+            tenant <id>             counters and histogram of one tenant
+            stream <id>             offset and histogram of one stream
+            listeners               the addresses listened on, with their accepted connections
+            bigrams [k]             the k (default 20) most frequent bigrams of PCC_OPT_NGRAM requests
+            trigram <abc>           count-min estimate of a trigram of PCC_OPT_NGRAM requests
+            snapshot                save a snapshot now (needs --snapshot, see SNAPSHOTS)
+            budget                  usage against every resource budget (see BUDGETS)
+
+        requests are also accounted per tenant (pcc_tenant.h). the tenant is the id sent in
+        a PCC_OPT_TENANT option of an extended PCC_OP_COUNT frame, or the peer IP otherwise.
+
         a tcp error occurs iff a system call sending/rec data to/from a client returns an error with errno being EPIPE or ECONNRESET or ETIMEDOUT.
 
+    STREAMS:
+        a PCC_OP_COUNT request with a PCC_OPT_STREAM option appends to a stream (see
+        pcc_stream.h), the reply has the count of the whole stream so far. the payload is
+        still a regular request for pcc_total, the windows and the tenants. the stream is
+        advanced before the reply goes out, a client that lost the reply learns where the
+        stream is from its next append.
+
+    SAMPLING:
+        a PCC_OP_SAMPLE request (see pcc_sample.h) is answered with an estimate of the count
+        of the whole stream and of every char, with 95% confidence intervals. estimates are
+        kept apart from pcc_total: the "estimated" query returns their sums, and after the
+        pcc_total lines SIGINT prints them as "estimated '%c' : %llu times" lines.
+
+    N-GRAMS:
+        a PCC_OP_COUNT request with a PCC_OPT_NGRAM option is received in the same
+        RECV_BUFF_SIZE chunks, and every chunk goes once through pcc_ngram (pcc_ngram.h),
+        which counts its chars, its bigrams and, if asked, its trigrams, carrying the last
+        two bytes over to the next chunk. its reply body has the n-grams, they are added
+        to the worker's after the reply like its chars to pcc_total. such a request is
+        never split over the counting pool. n-grams are not in snapshots.
+
+    THREADS AND PLACEMENT:
+        pcc_server [-w workers] [-c cpus] [-i] [-b usec] [-k ms] <port>
+
+        -w workers  number of worker threads (default 1), each one accepts and serves clients
+                    on its own. SIGINT is taken by the main thread only: it stops the workers'
+                    accept()s, waits for every worker to finish the client it is processing,
+                    then prints pcc_total, so SIGINT stays atomic with respect to clients.
+        -c cpus     pin worker i to the i-th cpu of the list (like "0-3,8", reused round robin).
+                    a worker allocates its counters and receive buffer after it is pinned, so
+                    they are first touched, and placed, on the worker's own NUMA node
+        -i          give every worker its own SO_REUSEPORT listener with SO_INCOMING_CPU set to
+                    its cpu, plus a reuseport BPF program that hands a new connection to the
+                    worker pinned on the cpu that received it. uses -c, or cpus 0..workers-1
+        -b usec     SO_BUSY_POLL on the listeners and connections (raising it above
+                    net.core.busy_read needs CAP_NET_ADMIN)
+        -k ms       how long a keep-alive connection (see pcc_proto.h) may stay idle between
+                    frames, default 1000, 0 turns keep-alive off. a worker serves one
+                    connection at a time, so clients should not keep more connections open
+                    than there are workers
+
+        pcc_total is per worker while running and summed when printed. the "workers" query
+        shows every worker's cpu, node, requests and how many of its connections arrived on
+        its own cpu.
+
+    BIG REQUESTS:
+        pcc_server -p <threads> ... <port>
+
+        a counting pool of that many threads (pcc_pool.h). the payload of a request of at
+        least POOL_MIN_BYTES is received in PCC_POOL_CHUNK chunks that the pool counts
+        while the worker receives the next ones, each counting thread into its own partial
+        histogram, reduced once the last chunk is in. one stream is then counted on as
+        many cores as it takes to keep up with the network, the worker only receives.
+        the reply and the commit happen after the reduction, so a request is still counted
+        entirely or not at all. the "workers" query adds a line per counting thread with
+        the chunks it counted and how many of those it stole from another one's queue.
+
+    FRAME STATE MACHINE:
+        a basic frame is a pcc_sm (pcc_sm.h): header, payload and reply as one resumable
+        machine that says which read or write it waits for and takes its outcome. short
+        reads and writes resume, EINTR retries, and whether an errno means the client went
+        away (a tcp error) is decided in one place, pcc_sm_errno, which recv_all and
+        send_all of the extended frames use too. the worker drives it over its blocking
+        socket, a big payload reaches the counting pool through the machine's sink.
+
+        pcc_server --io <blocking|epoll|io_uring> ... <port>
+
+        runs the basic frames of plain TCP connections on that backend of pcc_io.h instead
+        (default blocking), each worker with its own for its one connection. TLS and UNIX
+        socket connections stay on the blocking socket, and so does an extended frame after
+        its marker. the sink and the trace come in through the machine's header hook, so
+        the frame is counted the same on every backend. "bench_pcc backends" compares the
+        three with many connections on one thread.
+
+    CHECKSUMS:
+        a PCC_OP_COUNT request with PCC_OPT_CHECKSUM (see pcc_proto.h) has the CRC32C of
+        its payload after it. the worker takes the crc of every chunk in the same pass as
+        it counts it (pcc_count_crc, the crc32 instruction between the table increments,
+        or pcc_ngram_update_crc with PCC_OPT_NGRAM), so verifying costs no second read of
+        the payload, and compares it with the trailer
+        before the reply. a mismatch is answered PCC_STATUS_CHECKSUM and its counts are
+        dropped like those of a client that went away, nothing reaches pcc_total, the
+        tenants or the stream. the "workers" query shows every worker's corrupt requests.
+        these requests never go to the counting pool.
+
+    SMALL MESSAGES:
+        pcc_server [-n nagle|nodelay|cork|more] [-Q] [-D seconds] ... <port>
+
+        -n mode     how the header and body of an extended reply leave a TCP connection
+                    (pcc_net.h), default more: TCP_NODELAY, and MSG_MORE on the header so
+                    both go out in one segment. nagle is the old behaviour of two plain
+                    writes, whose second one can wait for a delayed ack. over TLS more is
+                    cork
+        -Q          TCP_QUICKACK after accept() and after the start of every frame, a
+                    client that waits for our ack (Nagle) to send the rest of its request
+                    gets it right away
+        -D seconds  TCP_DEFER_ACCEPT on the listeners: a connection is only accepted once
+                    its first bytes arrived (or the seconds passed)
+        TESTER/bench_rtt.sh compares the round trips of small requests under each mode.
+
+    TLS:
+        pcc_server -C <cert file> -K <key file> ... <port>
+
+        every connection is TLS (pcc_tls.h), the handshake runs in the worker right after
+        accept() and may take TLS_HANDSHAKE_MS. with kTLS the kernel does the record crypto
+        after the handshake and the worker's reads stay single copy. the "workers" query
+        adds how many handshakes a worker did and how many got kTLS for sending and
+        receiving.
+
+    LISTENERS:
+        pcc_server [-l <address>]... [-u <socket path>] ... [<port>]
+
+        -l (--listen) one more address to listen on, up to MAX_LISTENERS of them:
+            10.0.0.1:5000   IPv4, 0.0.0.0:5000 any (what a bare <port> is)
+            [::1]:5000      IPv6 only, [::]:5000 any
+            *:5000          dual-stack: [::] that takes IPv4 connections too
+            unix:<path>     a UNIX socket, like -u
+        every listener has its own socket and accept queue, every worker polls all of them
+        and accepts from whichever is ready, starting after the one it took last so a busy
+        port doesn't starve the others. with -i each TCP listener gets a socket per worker.
+        whatever port a connection came in on, its requests go into the same pcc_total,
+        windows and tenants. an IPv6 peer's tenant is its IPv6 address, an IPv4 peer of a
+        dual-stack listener's its IPv4 address. the "listeners" query shows what every
+        listener accepted so far.
+
+    LOCAL CLIENTS:
+        pcc_server -u <socket path> ... <port>
+
+        also listen on a UNIX socket, every worker accepts from both. frames and replies are
+        the same as over TCP (without TLS, the socket file's permissions guard it), the
+        tenant of a request without a tenant id is "uid:<uid>" of the peer. a client there
+        can also switch its connection to a shared memory ring (PCC_OP_RING, pcc_ring.h)
+        and hand its payload over in the ring's pages, without socket copies. a ring is
+        served like a kept connection: requests are counted and answered in order, and
+        SIGINT ends it between two requests.
+
+    SNAPSHOTS:
+        pcc_server [--snapshot <file>] [--load <file>] ... <port>
+
+        --snapshot (-S) saves pcc_total, the estimated totals, the windows, the tenants and
+        the streams to the file (pcc_snap.h) after the SIGINT output, and whenever the
+        "snapshot" query asks for it. the file is replaced atomically, a crash in between
+        leaves the previous one. a snapshot taken while clients are served is consistent
+        per section, not across them.
+        --load (-L) starts from a snapshot: its counters are the seed every later count
+        adds to, and its intervals, tenants and streams go back into their tables before
+        the first client is accepted. a broken snapshot (checksum, lengths, version) is
+        an error, the server doesn't start on half of one. pcc_dump prints a snapshot as
+        text, CSV or JSON.
+
+    CAPTURE AND REPLAY:
+        pcc_server [--capture <file>] [--capture-payloads] ... <port>
+
+        --capture (-T) writes a trace (pcc_trace.h) of every connection: when it was
+        accepted and closed, and for every frame when it began, how long it took until the
+        reply was sent, its header, options and reply. query commands are in it, payloads
+        only with --capture-payloads (-P), then up to PCC_TRACE_MAX_DATA bytes a frame.
+        requests inside a ring are not traced. records go through one buffered writer, the
+        trace is complete once SIGINT is done. pcc_replay sends a trace to a server again,
+        at its original pace or as fast as it can, and compares the replies and latencies.
+
+    BUDGETS:
+        pcc_server [--max-mem <bytes>] [--max-fds <n>] [--max-entries <n>] ... <port>
+
+        --max-mem (-M) bytes (K, M, G suffixes) of memory the server's state and buffers
+            may take (pcc_budget.h). the startup state (workers, windows, tables) is
+            charged first, a budget below it is an error. then every connection takes
+            CONN_MEM (plus TLS_CONN_MEM over TLS) when it is accepted, and a worker takes
+            its scratch buffers (counting pool chunks, n-gram tables) and every ring when it
+            needs them. what doesn't fit is shed: a connection is closed right after
+            accept(), an n-gram request or a ring is answered PCC_STATUS_BUSY, a big request
+            is counted by the worker instead of the pool. the --capture payload buffer of a
+            worker grows out of the budget too, a frame whose payload doesn't fit is traced
+            without the rest of it. once the budget is near, workers give their scratch
+            buffers (and capture buffers) back after every request instead of keeping them.
+            not charged: the reply body of an extended frame while it is built and sent
+            (a few hundred KiB for an n-gram reply or a "bigrams" answer of 9025 lines,
+            one per worker at a time), the temporaries of a query or a snapshot (the
+            "bigrams" sort array, the "tenants" list, the encoded snapshot) until they
+            return, and buffers of fixed size made once (the trace writer's 1 MiB, the
+            counting pool's queues, the --io backends).
+        --max-fds (-F) fds the server may have open, also set as its RLIMIT_NOFILE. the
+            fds open at startup and FD_SPARE more (snapshots, /proc) are charged first,
+            then every connection takes one, and three more on the UNIX socket for the
+            memfd and eventfds of a ring. a connection that doesn't fit is closed right
+            after accept(), one accept() fails with EMFILE for anyway is taken on a spare
+            fd and closed, instead of staying in the queue.
+        --max-entries (-E) tenants, and streams, the tables keep (each). they get twice
+            as many slots, a new one beyond the budget evicts like a full probe window does.
+        the "budget" query shows used, limit (0 for none), peak and refused of every
+        budget, with the RSS and the fds actually open next to them.
+
 */
 
-static volatile sig_atomic_t interrupted = 0; // flag to indicate if the server was interrupted by a signal
-static volatile int conn_fd = -1; // connection file descriptor, initialized to -1
-static uint32_t pcc_total[95] = {0}; // global array to hold the counts of printable characters, initialized to 0
+static atomic_int interrupted = 0; // set by the main thread once SIGINT arrived
+static uint32_t pcc_total[95] = {0}; // global array to hold the counts of printable characters, filled from the workers on exit
+static struct pcc_window pcc_win; // per interval histograms, same counts as pcc_total but bucketed by time
+static struct pcc_tenant_table pcc_tenants; // per tenant histograms and byte counters
+static pthread_mutex_t pcc_tenants_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pcc_stream_table pcc_streams; // where every followed stream continues, with its histogram
+static pthread_mutex_t pcc_streams_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pcc_snap pcc_seed; // counters of the --load snapshot, the workers' counts add to them
+static struct pcc_budget mem_budget; // --max-mem, bytes
+static struct pcc_budget fd_budget; // --max-fds
 
+#define RECV_BUFF_SIZE 1024
+#define MAX_LISTENERS 16
 
-void handle_sigint(int sig) {
-    // this function will be called when the server receives a SIGINT signal
-    interrupted = 1; // set the interrupted flag to indicate that the server was interrupted
-    if (conn_fd == -1) {
-        // if there is no active connection print the counts and exit
-        // print the counts of printable characters in pcc_total
-        for (size_t i = 0; i < 95; i++) {
-            if (pcc_total[i] > 0) {
-                printf("char '%c' : %u times\n", (char)(i + 32), pcc_total[i]);
-            }
+// worker state that lives on the worker's NUMA node
+struct worker_local {
+    _Atomic uint64_t totals[PCC_NPRINTABLE]; // this worker's share of pcc_total, only it writes them
+    _Atomic uint64_t est_totals[PCC_NPRINTABLE]; // estimated counts of sampled requests, kept out of pcc_total
+    _Atomic uint64_t sampled; // sampled requests
+    _Atomic uint64_t requests;
+    _Atomic uint64_t accepted;
+    _Atomic uint64_t steered; // connections whose packets arrived on this worker's cpu
+    _Atomic uint64_t tls, ktls_tx, ktls_rx; // TLS handshakes, and how many of them got kTLS
+    _Atomic uint64_t accepted_on[MAX_LISTENERS]; // per listener
+    _Atomic uint64_t bigrams[PCC_NBIGRAMS]; // n-grams of the PCC_OPT_NGRAM requests, summed
+    _Atomic uint64_t trigrams[PCC_NGRAM_DEPTH][PCC_NGRAM_WIDTH];
+    _Atomic uint64_t nbigrams, ntrigrams;
+    _Atomic uint64_t released; // times its scratch buffers were given back to mem_budget
+    _Atomic uint64_t corrupt; // PCC_OPT_CHECKSUM requests whose payload didn't match the trailer
+    unsigned char recv_buff[RECV_BUFF_SIZE];
+};
+
+struct worker {
+    int id;
+    int cpu; // -1 if not pinned
+    int node;
+    int listen_fds[MAX_LISTENERS]; // its socket of every listener, the same for all workers but with -i
+    int next_listener; // where accept_any starts looking
+    pthread_t thread;
+    struct pcc_pool_job *pool_job; // chunk buffers of this worker's big requests, made on first use
+    struct pcc_ngram *ngram; // n-gram tables of its PCC_OPT_NGRAM requests, made on first use
+    struct pcc_io *io; // --io backend of its basic frames, NULL for blocking
+    struct worker_local *_Atomic local; // set by the worker once it is pinned
+};
+
+static struct {
+    int workers;
+    int cpus[CPU_SETSIZE];
+    int ncpus;
+    int incoming_cpu;
+    int busy_poll;
+    int keepalive_ms; // idle time before a kept connection is closed, 0 disables keep-alive
+    const char *tls_cert, *tls_key; // -C/-K, TLS on every connection
+    const char *listen_specs[MAX_LISTENERS]; // -l, and -u as "unix:<path>"
+    int nlisten_specs;
+    int pool_threads; // -p, counting pool for big requests, 0 for none
+    int net_mode; // -n, how replies leave TCP connections (pcc_net.h)
+    int io; // --io, the pcc_io backend of basic frames on plain TCP connections
+    int quickack; // -Q, TCP_QUICKACK after every request read
+    int defer_accept; // -D, seconds of TCP_DEFER_ACCEPT on the listeners
+    const char *snapshot_path; // --snapshot, where snapshots are saved
+    const char *load_path; // --load, the snapshot to start from
+    const char *capture_path; // --capture, where the trace goes
+    int capture_payloads; // --capture-payloads, payloads go into the trace too
+    uint64_t max_mem; // --max-mem, 0 for no budget
+    int max_fds; // --max-fds, 0 for no budget
+    size_t max_entries; // --max-entries, 0 for the default table sizes
+} cfg = {.workers = 1, .keepalive_ms = 1000, .net_mode = PCC_NET_DEFAULT, .io = PCC_IO_BLOCKING};
+
+static struct worker *workers;
+static struct pcc_tls_ctx *tls_ctx; // NULL without -C/-K
+
+// an address to listen on
+static struct listener {
+    const char *name; // as given
+    int family; // AF_INET, AF_INET6 or AF_UNIX
+    struct sockaddr_storage addr; // TCP ones
+    socklen_t addr_len;
+    int v6only;
+    const char *path; // AF_UNIX
+} listeners[MAX_LISTENERS];
+static int nlisteners;
+static struct pcc_pool *count_pool; // -p, NULL without
+static struct pcc_trace *trace; // --capture, NULL without
+
+#define POOL_MIN_BYTES (4 * PCC_POOL_CHUNK) // smaller requests are counted by the worker
+
+#define RING_WAIT_MS 100 // slices of waiting for a ring, to notice SIGINT
+
+#define TLS_HANDSHAKE_MS 5000
+
+#define CONN_MEM (16 * 1024) // what a connection costs beyond the worker's state, its reply body and the like
+#define TLS_CONN_MEM (64 * 1024) // and a TLS session, its record buffers
+#define FD_SPARE 8 // fds kept out of the connections' share of --max-fds
+#define RING_FDS 3 // memfd and eventfds a ring request passes
+
+static int spare_fd = -1; // with --max-fds, closed to accept a connection that accept() had no fd for
+static pthread_mutex_t spare_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// TLS session of the connection this worker thread is serving, NULL for plain TCP. a worker
+// serves one connection at a time, and this way the byte level helpers below route through
+// it without every caller passing the session around
+static __thread struct pcc_tls *conn_tls;
+// the pcc_net.h mode of the connection being served: cfg.net_mode, cork instead of more
+// over TLS, and nodelay (nothing to do) on the UNIX socket
+static __thread int conn_net_mode;
+// what the connection being served took from the budgets
+static __thread uint64_t conn_mem;
+static __thread int conn_fds;
+
+// read(2)/send(2) on the connection being served, TLS takes no send flags
+static ssize_t conn_read(int fd, void *buf, size_t len) {
+    return conn_tls != NULL ? pcc_tls_read(conn_tls, buf, len) : read(fd, buf, len);
+}
+
+static ssize_t conn_send(int fd, const void *buf, size_t len, int flags) {
+    return conn_tls != NULL ? pcc_tls_write(conn_tls, buf, len) : send(fd, buf, len, flags);
+}
+
+// fds the client of the connection being served passed along (SCM_RIGHTS), until a
+// PCC_OP_RING request takes them
+static __thread int conn_passed[3];
+static __thread int conn_npassed;
+
+// conn_read on a UNIX socket, keeping the fds that come with the bytes
+static ssize_t conn_read_fds(int fd, void *buf, size_t len) {
+    union {
+        char buf[CMSG_SPACE(sizeof(conn_passed))];
+        struct cmsghdr align;
+    } ctrl;
+    struct iovec iov = {.iov_base = buf, .iov_len = len};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf)};
+
+    ssize_t r = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    for (struct cmsghdr *cm = r >= 0 ? CMSG_FIRSTHDR(&msg) : NULL; cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        for (size_t i = 0; i < (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++) {
+            int pfd;
+            memcpy(&pfd, CMSG_DATA(cm) + i * sizeof(int), sizeof(pfd));
+            if (conn_npassed < 3) conn_passed[conn_npassed++] = pfd;
+            else close(pfd);
         }
-        exit(0); // exit with code 0
-        
     }
-    
+    return r;
+}
 
+static void drop_passed_fds(void) {
+    while (conn_npassed > 0) close(conn_passed[--conn_npassed]);
 }
 
+// --capture: the number of the connection being served in the trace, when its current
+// frame began, and as much of the frame's payload as goes into the trace
+static __thread uint32_t conn_trace_id;
+static __thread uint64_t frame_start;
+static __thread struct {
+    unsigned char *buf;
+    size_t len, cap;
+    int full; // no more of this frame fits, the replay makes up the rest
+} frame_data;
 
+// OPEN or CLOSE record of the connection being served
+static void trace_conn(uint8_t type, uint16_t flags) {
+    if (trace == NULL) return;
+    struct pcc_trace_rec rec = {.type = type, .flags = flags, .conn = conn_trace_id, .t = pcc_trace_now(trace)};
+    pcc_trace_write(trace, &rec, NULL, NULL);
+}
 
-int main(int argc, char *argv[]) {
-    // TODO: maybe fix prints when r == 0, r < 0 for reads/writes
-    // EINTR handling?
-    // r==0 r< 0 in pcc_client.c !!!!!!
-    // retry on EINTR for read/write, accept should not retry on EINTR
-    
-    // register the signal handler for SIGINT
-    struct sigaction sa;
-    sa.sa_handler = handle_sigint; // set the handler function
-    sa.sa_flags = 0; // no special flags
-    sigemptyset(&sa.sa_mask); // no additional signals to block while handling SIGINT
-    if (sigaction(SIGINT, &sa, NULL) < 0) {
-        fprintf(stderr, "Error setting up signal handler: %s\n", strerror(errno));
+static void trace_frame_begin(void) {
+    if (trace == NULL) return;
+    frame_start = pcc_trace_now(trace);
+    frame_data.len = 0;
+    frame_data.full = 0;
+}
+
+// payload bytes of the current frame as they are read, kept with --capture-payloads, or
+// always for the ones that are the request itself (query commands)
+static void trace_data(const void *buf, size_t len, int always) {
+    if (trace == NULL || (!cfg.capture_payloads && !always) || frame_data.full) return;
+    if (len > PCC_TRACE_MAX_DATA - frame_data.len) {
+        len = PCC_TRACE_MAX_DATA - frame_data.len;
+        frame_data.full = 1;
+    }
+    if (frame_data.len + len > frame_data.cap) {
+        size_t cap = frame_data.cap ? frame_data.cap : 64 * 1024;
+        while (cap < frame_data.len + len) cap *= 2;
+        // the growth comes from mem_budget, what doesn't fit is left to the replay
+        if (pcc_budget_take(&mem_budget, cap - frame_data.cap) < 0) {
+            frame_data.full = 1;
+            return;
+        }
+        unsigned char *b = realloc(frame_data.buf, cap);
+        if (b == NULL) {
+            pcc_budget_give(&mem_budget, cap - frame_data.cap);
+            frame_data.full = 1;
+            return;
+        }
+        frame_data.buf = b;
+        frame_data.cap = cap;
+    }
+    memcpy(frame_data.buf + frame_data.len, buf, len);
+    frame_data.len += len;
+}
+
+// the record of the frame since trace_frame_begin: req is NULL for a basic frame, opts
+// the options the server read. status PCC_TRACE_GONE if the client went away
+static void trace_frame(const struct pcc_ext_req *req, const void *opts, uint16_t opt_bytes, uint64_t n,
+                        uint8_t status, uint64_t c) {
+    if (trace == NULL) return;
+    struct pcc_trace_rec rec = {
+        .type = req != NULL ? PCC_TRACE_EXT : PCC_TRACE_BASIC,
+        .op = req != NULL ? req->op : PCC_OP_COUNT,
+        .status = status,
+        .opt_bytes = opt_bytes,
+        .conn = conn_trace_id,
+        .data_len = (uint32_t)frame_data.len,
+        .t = frame_start,
+        .dur = pcc_trace_now(trace) - frame_start,
+        .n = n,
+        .c = c,
+    };
+    if (req != NULL) {
+        rec.version = req->version;
+        rec.flags = req->flags;
+        rec.opt_len = req->opt_len;
+    }
+    pcc_trace_write(trace, &rec, opts, frame_data.buf);
+    frame_data.len = 0; // between frames, release_scratch may take the buffer
+}
+
+// take what a new connection costs from the budgets, local for the UNIX socket (room for
+// the fds of a ring). returns -1 if it doesn't fit, nothing is taken then and it is shed
+static int conn_take(int local) {
+    uint64_t mem = CONN_MEM + (tls_ctx != NULL && !local ? TLS_CONN_MEM : 0);
+    int fds = 1 + (local ? RING_FDS : 0);
+    if (pcc_budget_take(&fd_budget, fds) < 0) return -1;
+    if (pcc_budget_take(&mem_budget, mem) < 0) {
+        pcc_budget_give(&fd_budget, fds);
+        return -1;
+    }
+    conn_mem = mem;
+    conn_fds = fds;
+    return 0;
+}
+
+// give it back once the connection is closed
+static void conn_give(void) {
+    pcc_budget_give(&mem_budget, conn_mem);
+    pcc_budget_give(&fd_budget, conn_fds);
+    conn_mem = 0;
+    conn_fds = 0;
+}
+
+// close the connection being served, dropping its TLS session without a close_notify: over
+// TLS it is only used when the client is gone or misbehaved
+static void close_conn(int fd) {
+    trace_conn(PCC_TRACE_CLOSE, 0);
+    pcc_tls_free(conn_tls, 0);
+    conn_tls = NULL;
+    close(fd);
+    conn_give();
+}
+
+
+// a read or write of the connection being served failed with err, 0 for an end of file
+// (eof says what the client didn't send then). returns -1 if the client is gone, exits on
+// any other error
+static int conn_failed(int fd, int err, int sending, const char *eof) {
+    const char *dir = sending ? "sending to" : "reading from";
+    if (err == 0) {
+        fprintf(stderr, "Client disconnected before %s\n", eof);
+        return -1;
+    }
+    if (pcc_sm_errno(err) == PCC_SM_ERR_GONE) {
+        fprintf(stderr, "TCP error occurred while %s client: %s\n", dir, strerror(err));
+        return -1;
+    }
+    fprintf(stderr, "Error %s client: %s\n", dir, strerror(err));
+    close(fd);
+    exit(1);
+}
+
+// read exactly len bytes from the client.
+// returns 0 on success, -1 if the client is gone (tcp error or disconnect), exits on any other error
+static int recv_all(int fd, void *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t r = conn_read(fd, (char *)buf + got, len - got);
+        if (r < 0 && pcc_sm_errno(errno) == PCC_SM_ERR_RETRY) continue;
+        if (r <= 0) return conn_failed(fd, r < 0 ? errno : 0, 0, "sending all data");
+        got += r;
+    }
+    return 0;
+}
+
+// write exactly len bytes to the client with send(2) flags, same return values as recv_all
+static int send_all(int fd, const void *buf, size_t len, int flags) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t r = conn_send(fd, (const char *)buf + sent, len - sent, flags);
+        if (r < 0 && pcc_sm_errno(errno) == PCC_SM_ERR_RETRY) continue;
+        if (r < 0) return conn_failed(fd, errno, 1, NULL);
+        sent += r;
+    }
+    return 0;
+}
+
+
+// single writer add, see commit_request
+static void local_add(_Atomic uint64_t *counter, uint64_t v) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+// give the worker's scratch buffers back to mem_budget, the next request that needs them
+// makes them again
+static void release_scratch(struct worker *w) {
+    // the capture buffer only between frames, a frame's payload may be in it
+    int capture = frame_data.buf != NULL && frame_data.len == 0;
+    if (w->pool_job == NULL && w->ngram == NULL && !capture) return;
+    if (w->pool_job != NULL) {
+        pcc_pool_job_free(w->pool_job);
+        pcc_budget_give(&mem_budget, pcc_pool_job_bytes(count_pool));
+        w->pool_job = NULL;
+    }
+    if (w->ngram != NULL) {
+        free(w->ngram);
+        pcc_budget_give(&mem_budget, sizeof(*w->ngram));
+        w->ngram = NULL;
+    }
+    if (capture) {
+        free(frame_data.buf);
+        pcc_budget_give(&mem_budget, frame_data.cap);
+        frame_data.buf = NULL;
+        frame_data.cap = 0;
+    }
+    local_add(&w->local->released, 1);
+}
+
+// take n bytes for a scratch buffer of w, near the limit after giving back the ones it has.
+// returns -1 if they don't fit
+static int scratch_take(struct worker *w, uint64_t n) {
+    if (pcc_budget_near(&mem_budget)) release_scratch(w);
+    return pcc_budget_take(&mem_budget, n);
+}
+
+// w->pool_job, made if needed. returns 0 if the budget has no room for one
+static int pool_job_ready(struct worker *w) {
+    if (w->pool_job != NULL) return 1;
+    if (scratch_take(w, pcc_pool_job_bytes(count_pool)) < 0) return 0;
+    if ((w->pool_job = pcc_pool_job_new(count_pool)) == NULL) {
+        fprintf(stderr, "Error allocating counting buffers: %s\n", strerror(errno));
         exit(1);
     }
-    
-    
+    return 1;
+}
 
-    // check if the number of cmd args is correct
-    if (argc != 2){
-        fprintf(stderr, "Error: %s\n", strerror(EINVAL));
+// w->ngram, the same way
+static int ngram_ready(struct worker *w) {
+    if (w->ngram != NULL) return 1;
+    if (scratch_take(w, sizeof(*w->ngram)) < 0) return 0;
+    if ((w->ngram = malloc(sizeof(*w->ngram))) == NULL) {
+        fprintf(stderr, "Error allocating n-gram tables: %s\n", strerror(errno));
         exit(1);
     }
+    return 1;
+}
 
-    
+// recv_count of a big request with the counting pool: the worker only receives, chunk
+// after chunk, and the pool counts them meanwhile. the chunks in flight are waited for also
+// when the client is gone, their counts are dropped then
+static int recv_count_pooled(struct worker *w, int fd, uint64_t n, uint64_t counts[PCC_NPRINTABLE], uint64_t *C) {
+    size_t chunk = pcc_pool_chunk(count_pool);
+    int ret = 0;
 
-    // create a TCP socket and bind it to the specified port number
-    struct sockaddr_in serv_addr; // server address structure
-    struct sockaddr_in peer_addr; // client address structure
-    socklen_t addrsize = sizeof(struct sockaddr_in);
-    int sock_fd = -1;
-    char recv_buff[1024]; // buffer for receiving data from server
-    char send_buff[sizeof(uint32_t)]; // buffer for sending data to server
+    for (uint64_t got = 0; got < n;) {
+        size_t want = n - got < chunk ? (size_t)(n - got) : chunk;
+        unsigned char *buf = pcc_pool_job_buf(w->pool_job);
+        if (recv_all(fd, buf, want) < 0) {
+            pcc_pool_job_drop(w->pool_job, buf);
+            ret = -1;
+            break;
+        }
+        trace_data(buf, want, 0);
+        pcc_pool_job_submit(w->pool_job, buf, want);
+        got += want;
+    }
+    *C = pcc_pool_job_wait(w->pool_job, counts);
+    return ret;
+}
 
-    memset(recv_buff, 0, sizeof(recv_buff));
-    memset(send_buff, 0, sizeof(send_buff));
-    
+// read n payload bytes from the client and count the printable chars in them.
+// returns 0 on success, -1 if the client is gone, exits on any other error
+static int recv_count(struct worker *w, int fd, uint64_t n, uint64_t counts[PCC_NPRINTABLE], uint64_t *C) {
+    unsigned char *recv_buff = w->local->recv_buff; // buffer for receiving data from the client
+    uint64_t bytes_received = 0;
 
-    if ((sock_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        fprintf(stderr, "Error creating socket: %s\n", strerror(errno));
+    memset(counts, 0, PCC_NPRINTABLE * sizeof(counts[0])); // initialize counts for this client to 0
+    *C = 0;
+    // without room for the pool's buffers the worker counts it itself
+    if (count_pool != NULL && n >= POOL_MIN_BYTES && pool_job_ready(w)) return recv_count_pooled(w, fd, n, counts, C);
+
+    while (bytes_received < n) {
+        size_t want = RECV_BUFF_SIZE;
+        if (n - bytes_received < want) want = n - bytes_received; // never read past the frame
+        if (recv_all(fd, recv_buff, want) < 0) return -1;
+        trace_data(recv_buff, want, 0);
+
+        *C += pcc_count(recv_buff, want, counts);
+        bytes_received += want;
+    }
+    return 0;
+}
+
+// recv_count of a PCC_OPT_CHECKSUM request: every chunk is counted and checksummed in one
+// pass (pcc_count_crc), *crc is the CRC32C of the payload then. never on the pool, its
+// chunks are counted out of order. same return values as recv_count
+static int recv_count_crc(struct worker *w, int fd, uint64_t n, uint64_t counts[PCC_NPRINTABLE], uint64_t *C,
+                          uint32_t *crc) {
+    unsigned char *recv_buff = w->local->recv_buff;
+
+    memset(counts, 0, PCC_NPRINTABLE * sizeof(counts[0]));
+    *C = 0;
+    *crc = 0;
+    for (uint64_t got = 0; got < n;) {
+        size_t want = n - got < RECV_BUFF_SIZE ? (size_t)(n - got) : RECV_BUFF_SIZE;
+        if (recv_all(fd, recv_buff, want) < 0) return -1;
+        trace_data(recv_buff, want, 0);
+        *C += pcc_count_crc(recv_buff, want, counts, crc);
+        got += want;
+    }
+    return 0;
+}
+
+// read the PCC_OPT_CHECKSUM trailer after a payload whose CRC32C is crc.
+// returns 1 if it matches, 0 if not (*trailer is what came), -1 if the client is gone
+static int recv_trailer(int fd, uint32_t crc, uint32_t *trailer) {
+    unsigned char buf[PCC_CHECKSUM_LEN];
+    if (recv_all(fd, buf, sizeof(buf)) < 0) return -1;
+    memcpy(trailer, buf, sizeof(*trailer));
+    *trailer = ntohl(*trailer);
+    return *trailer == crc;
+}
+
+// sinks of a basic frame's pcc_sm, so the payload lands in the trace: the worker counts
+// it in its recv_buff (arg is the machine), or the counting pool does (arg is the worker)
+static unsigned char *plain_buf(void *arg, size_t *len) {
+    struct pcc_sm *sm = arg;
+    if (*len > sm->buf_size) *len = sm->buf_size;
+    return sm->buf;
+}
+
+static void plain_data(void *arg, unsigned char *buf, size_t len) {
+    struct pcc_sm *sm = arg;
+    trace_data(buf, len, 0);
+    sm->c += pcc_count(buf, len, sm->counts);
+}
+
+static uint64_t plain_end(void *arg, unsigned char *unused, uint64_t counts[PCC_NPRINTABLE]) {
+    (void)unused;
+    (void)counts; // they are the machine's own
+    return ((struct pcc_sm *)arg)->c;
+}
+
+static const struct pcc_sm_sink plain_sink = {plain_buf, plain_data, plain_end};
+
+static unsigned char *pooled_buf(void *arg, size_t *len) {
+    struct worker *w = arg;
+    if (*len > pcc_pool_chunk(count_pool)) *len = pcc_pool_chunk(count_pool);
+    return pcc_pool_job_buf(w->pool_job);
+}
+
+static void pooled_data(void *arg, unsigned char *buf, size_t len) {
+    struct worker *w = arg;
+    trace_data(buf, len, 0);
+    pcc_pool_job_submit(w->pool_job, buf, len);
+}
+
+// the chunks in flight are waited for also when the client is gone
+static uint64_t pooled_end(void *arg, unsigned char *unused, uint64_t counts[PCC_NPRINTABLE]) {
+    struct worker *w = arg;
+    if (unused != NULL) pcc_pool_job_drop(w->pool_job, unused);
+    return pcc_pool_job_wait(w->pool_job, counts);
+}
+
+static const struct pcc_sm_sink pooled_sink = {pooled_buf, pooled_data, pooled_end};
+
+// what sm does once N is in, on every backend (pcc_sm_set_header)
+static void basic_header(struct pcc_sm *sm, void *arg) {
+    struct worker *w = arg;
+    // an N of 0 goes right on to the reply
+    trace_frame_begin();
+    if (sm->phase != PCC_SM_PAYLOAD) return;
+    // without room for the pool's buffers the worker counts it itself
+    if (count_pool != NULL && sm->n >= POOL_MIN_BYTES && pool_job_ready(w)) {
+        pcc_sm_set_sink(sm, &pooled_sink, w);
+    } else {
+        pcc_sm_set_sink(sm, &plain_sink, sm);
+    }
+}
+
+static void basic_done(struct pcc_sm *sm, void *arg) {
+    (void)sm;
+    *(int *)arg = 1;
+}
+
+// run sm over fd on the worker's --io backend
+static void serve_basic_io(struct worker *w, int fd, struct pcc_sm *sm) {
+    int ended = 0;
+
+    if (pcc_io_add(w->io, fd, sm, basic_done, &ended) < 0) {
+        fprintf(stderr, "Error adding connection to %s backend: %s\n", pcc_io_name(cfg.io), strerror(errno));
         exit(1);
     }
+    while (!ended) {
+        if (pcc_io_run(w->io, -1) < 0) {
+            fprintf(stderr, "Error running %s backend: %s\n", pcc_io_name(cfg.io), strerror(errno));
+            exit(1);
+        }
+    }
+    // the extended frame after the marker is read with blocking recv_all
+    if (sm->result == PCC_SM_EXT && cfg.io == PCC_IO_EPOLL) {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) < 0) {
+            fprintf(stderr, "Error making connection blocking: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+}
 
-    memset(&serv_addr, 0, addrsize);
-    serv_addr.sin_family = AF_INET; // IPv4
-    serv_addr.sin_addr.s_addr = htonl(INADDR_ANY); // bind to any local address
-    serv_addr.sin_port = htons(atoi(argv[1])); // convert port number to network byte order
+// serve the frame a new connection starts with as far as it is a basic one: sm runs until
+// it ends, its result says how. plain TCP connections run on the --io backend, TLS and the
+// UNIX socket (whose header may come with fds) over the blocking socket. PCC_SM_EXT leaves
+// the rest to handle_ext_frame, PCC_SM_GONE was logged. returns the phase sm ended in,
+// exits on any other error like recv_all
+static int serve_basic(struct worker *w, int fd, int local, struct pcc_sm *sm) {
+    unsigned char *p;
+    size_t len;
+    int op;
 
-    int optval = 1;
-    setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    pcc_sm_init(sm, w->local->recv_buff, RECV_BUFF_SIZE);
+    pcc_sm_set_header(sm, basic_header, w);
+    if (w->io != NULL && !local && conn_tls == NULL) {
+        serve_basic_io(w, fd, sm);
+    } else {
+        while ((op = pcc_sm_next(sm, &p, &len)) != PCC_SM_DONE) {
+            ssize_t r;
+            if (op == PCC_SM_WRITE) r = conn_send(fd, p, len, 0);
+            else if (local && sm->phase == PCC_SM_HEADER) r = conn_read_fds(fd, p, len); // a ring's fds come with N
+            else r = conn_read(fd, p, len);
+            pcc_sm_done(sm, r < 0 ? -errno : r);
+        }
+    }
+    if (sm->result == PCC_SM_GONE || sm->result == PCC_SM_FAILED) {
+        conn_failed(fd, sm->err, sm->ended_in == PCC_SM_REPLY,
+                    sm->ended_in == PCC_SM_HEADER ? "sending data" : "sending all data");
+    }
+    return sm->ended_in;
+}
 
-    if (bind(sock_fd, (struct sockaddr *)&serv_addr, addrsize) < 0) {
-        fprintf(stderr, "Error binding socket: %s\n", strerror(errno));
-        close(sock_fd);
+// recv_count of a PCC_OPT_NGRAM request: its chars and n-grams are counted together, in
+// one pass over every chunk, into w->ngram (ngram_ready). never on the pool, the bigrams of
+// a stream need its bytes in order. with crc not NULL the chunks are also checksummed in the
+// same pass (pcc_ngram_update_crc), like recv_count_crc. same return values as recv_count
+static int recv_count_ngram(struct worker *w, int fd, uint64_t n, int flags, uint64_t counts[PCC_NPRINTABLE],
+                            uint64_t *C, uint32_t *crc) {
+    unsigned char *recv_buff = w->local->recv_buff;
+
+    pcc_ngram_init(w->ngram, flags);
+    if (crc != NULL) *crc = 0;
+    for (uint64_t got = 0; got < n;) {
+        size_t want = n - got < RECV_BUFF_SIZE ? (size_t)(n - got) : RECV_BUFF_SIZE;
+        if (recv_all(fd, recv_buff, want) < 0) return -1;
+        trace_data(recv_buff, want, 0);
+        if (crc != NULL) pcc_ngram_update_crc(w->ngram, recv_buff, want, crc);
+        else pcc_ngram_update(w->ngram, recv_buff, want);
+        got += want;
+    }
+    pcc_ngram_finish(w->ngram);
+    memcpy(counts, w->ngram->counts, PCC_NPRINTABLE * sizeof(counts[0]));
+    *C = w->ngram->c;
+    return 0;
+}
+
+// merge a completed request into the global counters.
+// only called once the reply was sent, a request that failed half way is not counted anywhere
+static void commit_request(struct worker *w, const char *tenant, uint64_t n, const uint64_t counts[PCC_NPRINTABLE]) {
+    struct worker_local *l = w->local;
+    for (size_t i = 0; i < 95; i++) {
+        // single writer, so a plain load and store is enough, readers only need untorn values
+        uint64_t cur = atomic_load_explicit(&l->totals[i], memory_order_relaxed);
+        atomic_store_explicit(&l->totals[i], cur + counts[i], memory_order_relaxed); // add the counts from this client
+    }
+    atomic_store_explicit(&l->requests, atomic_load_explicit(&l->requests, memory_order_relaxed) + 1, memory_order_relaxed);
+    pcc_window_add(&pcc_win, time(NULL), counts);
+
+    pthread_mutex_lock(&pcc_tenants_lock);
+    pcc_tenant_add(&pcc_tenants, tenant, n, counts);
+    pthread_mutex_unlock(&pcc_tenants_lock);
+}
+
+
+// read a PCC_OP_SAMPLE payload, counting every block on its own and then the tail, and
+// estimate the whole stream. same return values as recv_count
+static int recv_sample(struct worker *w, int fd, uint64_t n, const struct pcc_req_opts *opts,
+                       struct pcc_sample_est *est) {
+    struct pcc_sample_acc acc;
+    uint64_t counts[PCC_NPRINTABLE], c;
+    uint32_t block = opts->sample_block;
+
+    pcc_sample_init(&acc);
+    for (uint64_t left = n - opts->sample_tail; left > 0; left -= block) {
+        if (recv_count(w, fd, block, counts, &c) < 0) return -1;
+        pcc_sample_add_block(&acc, counts, c);
+    }
+    if (recv_count(w, fd, opts->sample_tail, counts, &c) < 0) return -1;
+    pcc_sample_add_tail(&acc, counts, c);
+    pcc_sample_estimate(&acc, opts->sample_n, block, est);
+    return 0;
+}
+
+static void print_estimate(FILE *out, const struct pcc_sample_est *est, uint64_t n, const struct pcc_req_opts *opts) {
+    uint32_t block = opts->sample_block;
+    fprintf(out, "# estimate %" PRIu64 " ci %" PRIu64 " sampled %" PRIu64 " of %" PRIu64 " bytes in %" PRIu64 " of %" PRIu64
+            " blocks\n", est->c, est->c_ci, n, opts->sample_n, (n - opts->sample_tail) / block, opts->sample_n / block);
+    for (int i = 0; i < PCC_NPRINTABLE; i++) {
+        if (est->counts[i] > 0 || est->ci[i] > 0) {
+            fprintf(out, "char '%c' : %" PRIu64 " +- %" PRIu64 " times\n", i + PCC_FIRST_PRINTABLE, est->counts[i], est->ci[i]);
+        }
+    }
+}
+
+// estimates of sampled requests only go to their own totals, never to pcc_total, the
+// window histograms or the tenants, all of which stay exact
+static void commit_estimate(struct worker *w, const struct pcc_sample_est *est) {
+    for (int i = 0; i < PCC_NPRINTABLE; i++) local_add(&w->local->est_totals[i], est->counts[i]);
+    local_add(&w->local->sampled, 1);
+}
+
+// sum of every worker's estimated totals and the seed's, returns the number of sampled requests
+static uint64_t sum_estimated(uint64_t counts[PCC_NPRINTABLE]) {
+    uint64_t sampled = pcc_seed.sampled;
+    memcpy(counts, pcc_seed.est_totals, PCC_NPRINTABLE * sizeof(counts[0]));
+    for (int i = 0; i < cfg.workers; i++) {
+        struct worker_local *l = atomic_load(&workers[i].local);
+        if (l == NULL) continue;
+        for (int j = 0; j < PCC_NPRINTABLE; j++) counts[j] += atomic_load(&l->est_totals[j]);
+        sampled += atomic_load(&l->sampled);
+    }
+    return sampled;
+}
+
+// the n-gram part of a PCC_OPT_NGRAM reply body, see pcc_proto.h
+static void print_ngrams(FILE *out, const struct pcc_ngram *g) {
+    if (g->flags & PCC_NGRAM_BIGRAMS) {
+        fprintf(out, "# bigrams %" PRIu64 "\n", g->nbigrams);
+        for (int i = 0; i < PCC_NBIGRAMS; i++) {
+            if (g->bigrams[i] == 0) continue;
+            fprintf(out, "bigram '%c%c' : %" PRIu64 " times\n", i / PCC_NPRINTABLE + PCC_FIRST_PRINTABLE,
+                    i % PCC_NPRINTABLE + PCC_FIRST_PRINTABLE, g->bigrams[i]);
+        }
+    }
+    if (g->flags & PCC_NGRAM_TRIGRAMS) {
+        fprintf(out, "# trigrams %" PRIu64 " sketch %dx%u\n", g->ntrigrams, PCC_NGRAM_DEPTH, PCC_NGRAM_WIDTH);
+        for (int r = 0; r < PCC_NGRAM_DEPTH; r++) {
+            fprintf(out, "sketch %d", r);
+            for (uint32_t j = 0; j < PCC_NGRAM_WIDTH; j++) {
+                if (g->sketch[r][j] > 0) fprintf(out, " %u:%" PRIu64, j, g->sketch[r][j]);
+            }
+            fputc('\n', out);
+        }
+    }
+}
+
+// add a replied PCC_OPT_NGRAM request's n-grams to the worker's, like commit_request
+static void commit_ngrams(struct worker *w, const struct pcc_ngram *g) {
+    struct worker_local *l = w->local;
+    for (int i = 0; i < PCC_NBIGRAMS; i++) {
+        if (g->bigrams[i] > 0) local_add(&l->bigrams[i], g->bigrams[i]);
+    }
+    local_add(&l->nbigrams, g->nbigrams);
+    if (!(g->flags & PCC_NGRAM_TRIGRAMS)) return;
+    for (int r = 0; r < PCC_NGRAM_DEPTH; r++) {
+        for (uint32_t j = 0; j < PCC_NGRAM_WIDTH; j++) {
+            if (g->sketch[r][j] > 0) local_add(&l->trigrams[r][j], g->sketch[r][j]);
+        }
+    }
+    local_add(&l->ntrigrams, g->ntrigrams);
+}
+
+struct bigram_count {
+    uint64_t count;
+    int i; // a * 95 + b
+};
+
+static int bigram_cmp(const void *a, const void *b) {
+    const struct bigram_count *x = a, *y = b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return x->i - y->i;
+}
+
+// save everything counted so far, with the seed, to cfg.snapshot_path. the tables are
+// only locked while they are encoded, the file is written after. saves run one at a time
+// from encode to rename, so the file always ends up with the snapshot encoded last.
+// returns the size of the snapshot, or -1 with errno set
+static ssize_t save_snapshot(void) {
+    static pthread_mutex_t save_lock = PTHREAD_MUTEX_INITIALIZER;
+    struct pcc_snap s = {.win = &pcc_win, .tenants = &pcc_tenants, .streams = &pcc_streams};
+
+    pthread_mutex_lock(&save_lock);
+    s.created = time(NULL);
+    s.requests = pcc_seed.requests;
+    memcpy(s.totals, pcc_seed.totals, sizeof(s.totals));
+    for (int i = 0; i < cfg.workers; i++) {
+        struct worker_local *l = atomic_load(&workers[i].local);
+        if (l == NULL) continue;
+        for (int j = 0; j < PCC_NPRINTABLE; j++) s.totals[j] += atomic_load(&l->totals[j]);
+        s.requests += atomic_load(&l->requests);
+    }
+    s.sampled = sum_estimated(s.est_totals);
+
+    unsigned char *buf;
+    size_t len;
+    pthread_mutex_lock(&pcc_tenants_lock);
+    pthread_mutex_lock(&pcc_streams_lock);
+    int r = pcc_snap_encode(&s, &buf, &len);
+    pthread_mutex_unlock(&pcc_streams_lock);
+    pthread_mutex_unlock(&pcc_tenants_lock);
+    if (r == 0) {
+        r = pcc_snap_write(cfg.snapshot_path, buf, len);
+        free(buf);
+    }
+    int err = errno;
+    pthread_mutex_unlock(&save_lock);
+    errno = err;
+    return r < 0 ? -1 : (ssize_t)len;
+}
+
+// seed the counters and tables from cfg.load_path, before any worker runs. exits on failure
+static void load_snapshot(void) {
+    struct timespec t0, t1;
+    const unsigned char *buf;
+    size_t len;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pcc_seed.win = &pcc_win;
+    pcc_seed.tenants = &pcc_tenants;
+    pcc_seed.streams = &pcc_streams;
+    if (pcc_snap_map(cfg.load_path, &buf, &len) < 0 || pcc_snap_decode(buf, len, &pcc_seed) < 0) {
+        fprintf(stderr, "Error loading snapshot %s: %s\n", cfg.load_path, strerror(errno));
         exit(1);
     }
+    pcc_snap_unmap(buf, len);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
 
-    if (listen(sock_fd, 10) < 0) {
-        fprintf(stderr, "Error listening on socket: %s\n", strerror(errno));
-        close(sock_fd);
+    long us = (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_nsec - t0.tv_nsec) / 1000;
+    fprintf(stderr, "loaded snapshot %s: %" PRIu64 " requests, %zu tenants, %zu streams, %zu bytes in %ld us\n",
+            cfg.load_path, pcc_seed.requests, pcc_tenants.tab.used, pcc_streams.tab.used, len, us);
+}
+
+// fds the process has open, -1 if /proc doesn't say
+static int count_open_fds(void) {
+    DIR *d = opendir("/proc/self/fd");
+    int n = 0;
+    if (d == NULL) return -1;
+    for (struct dirent *e; (e = readdir(d)) != NULL;) {
+        if (e->d_name[0] != '.') n++;
+    }
+    closedir(d);
+    return n - 1; // not the one reading it
+}
+
+// resident set size in bytes, 0 if /proc doesn't say
+static uint64_t rss_bytes(void) {
+    unsigned long long size, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "re");
+    if (f == NULL) return 0;
+    if (fscanf(f, "%llu %llu", &size, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+static void print_budget(FILE *out, const char *name, const struct pcc_budget *b) {
+    fprintf(out, "budget %s used %" PRIu64 " limit %" PRIu64 " peak %" PRIu64 " refused %" PRIu64, name,
+            atomic_load(&b->used), b->limit, atomic_load(&b->peak), atomic_load(&b->refused));
+}
+
+// run a text query, writing its answer to out. returns a PCC_STATUS_* code
+static int run_query(char *cmd, FILE *out) {
+    char *save = NULL;
+    char *verb = strtok_r(cmd, " \t\n", &save);
+    if (verb == NULL) {
+        fprintf(out, "error: empty query\n");
+        return PCC_STATUS_BAD_REQUEST;
+    }
+
+    if (strcmp(verb, "window") == 0) {
+        char *from_s = strtok_r(NULL, " \t\n", &save);
+        char *to_s = strtok_r(NULL, " \t\n", &save);
+        char *end1 = NULL, *end2 = NULL;
+        if (from_s == NULL || to_s == NULL) {
+            fprintf(out, "error: usage: window <from> <to>\n");
+            return PCC_STATUS_BAD_REQUEST;
+        }
+        long long from = strtoll(from_s, &end1, 10);
+        long long to = strtoll(to_s, &end2, 10);
+        if (*end1 != '\0' || *end2 != '\0') {
+            fprintf(out, "error: window bounds must be integers\n");
+            return PCC_STATUS_BAD_REQUEST;
+        }
+
+        // non positive bounds are relative to now
+        time_t now = time(NULL);
+        if (from <= 0) from += now;
+        if (to <= 0) to += now;
+        if (to == now) to = now + 1; // "up to now" includes the current second
+
+        struct pcc_window_result res;
+        pcc_window_query(&pcc_win, now, (time_t)from, (time_t)to, &res);
+        fprintf(out, "# window %lld %lld resolution %us\n", (long long)res.from, (long long)res.to, res.resolution);
+        for (size_t i = 0; i < PCC_NPRINTABLE; i++) {
+            if (res.counts[i] > 0) {
+                fprintf(out, "char '%c' : %" PRIu64 " times\n", (char)(i + PCC_FIRST_PRINTABLE), res.counts[i]);
+            }
+        }
+        return PCC_STATUS_OK;
+    }
+
+    if (strcmp(verb, "estimated") == 0) {
+        uint64_t counts[PCC_NPRINTABLE];
+        fprintf(out, "# estimated from %" PRIu64 " sampled requests\n", sum_estimated(counts));
+        for (int i = 0; i < PCC_NPRINTABLE; i++) {
+            if (counts[i] > 0) fprintf(out, "char '%c' : %" PRIu64 " times\n", i + PCC_FIRST_PRINTABLE, counts[i]);
+        }
+        return PCC_STATUS_OK;
+    }
+
+    if (strcmp(verb, "bigrams") == 0) {
+        char *k_s = strtok_r(NULL, " \t\n", &save);
+        char *end = NULL;
+        errno = 0;
+        unsigned long long k = k_s != NULL ? strtoull(k_s, &end, 10) : 20;
+        if (k_s != NULL && (k_s[0] < '0' || k_s[0] > '9' || *end != '\0' || errno == ERANGE)) {
+            fprintf(out, "error: usage: bigrams [<count>]\n");
+            return PCC_STATUS_BAD_REQUEST;
+        }
+        if (k > PCC_NBIGRAMS) k = PCC_NBIGRAMS;
+        struct bigram_count *all = calloc(PCC_NBIGRAMS, sizeof(*all));
+        if (all == NULL) {
+            fprintf(out, "error: out of memory\n");
+            return PCC_STATUS_BAD_REQUEST;
+        }
+        uint64_t total = 0;
+        for (int i = 0; i < cfg.workers; i++) {
+            struct worker_local *l = atomic_load(&workers[i].local);
+            if (l == NULL) continue;
+            for (int j = 0; j < PCC_NBIGRAMS; j++) all[j].count += atomic_load(&l->bigrams[j]);
+            total += atomic_load(&l->nbigrams);
+        }
+        for (int j = 0; j < PCC_NBIGRAMS; j++) all[j].i = j;
+        qsort(all, PCC_NBIGRAMS, sizeof(*all), bigram_cmp);
+        fprintf(out, "# bigrams %" PRIu64 "\n", total);
+        for (size_t j = 0; j < k && all[j].count > 0; j++) {
+            fprintf(out, "bigram '%c%c' : %" PRIu64 " times\n", all[j].i / PCC_NPRINTABLE + PCC_FIRST_PRINTABLE,
+                    all[j].i % PCC_NPRINTABLE + PCC_FIRST_PRINTABLE, all[j].count);
+        }
+        free(all);
+        return PCC_STATUS_OK;
+    }
+
+    if (strcmp(verb, "trigram") == 0) {
+        char *t = strtok_r(NULL, "\n", &save); // may start with or contain a space
+        if (t == NULL || strlen(t) != 3 || (unsigned char)(t[0] - PCC_FIRST_PRINTABLE) >= PCC_NPRINTABLE ||
+            (unsigned char)(t[1] - PCC_FIRST_PRINTABLE) >= PCC_NPRINTABLE ||
+            (unsigned char)(t[2] - PCC_FIRST_PRINTABLE) >= PCC_NPRINTABLE) {
+            fprintf(out, "error: usage: trigram <3 printable chars>\n");
+            return PCC_STATUS_BAD_REQUEST;
+        }
+        // the sum of the sketches is the sketch of the sum, only the cells of t are needed
+        uint64_t est = UINT64_MAX, total = 0;
+        for (int r = 0; r < PCC_NGRAM_DEPTH; r++) {
+            uint32_t j = pcc_ngram_cell(r, t[0], t[1], t[2]);
+            uint64_t v = 0;
+            for (int i = 0; i < cfg.workers; i++) {
+                struct worker_local *l = atomic_load(&workers[i].local);
+                if (l != NULL) v += atomic_load(&l->trigrams[r][j]);
+            }
+            if (v < est) est = v;
+        }
+        for (int i = 0; i < cfg.workers; i++) {
+            struct worker_local *l = atomic_load(&workers[i].local);
+            if (l != NULL) total += atomic_load(&l->ntrigrams);
+        }
+        fprintf(out, "# trigrams %" PRIu64 " sketch %dx%u\n", total, PCC_NGRAM_DEPTH, PCC_NGRAM_WIDTH);
+        fprintf(out, "trigram '%s' : %" PRIu64 " times at most\n", t, est);
+        return PCC_STATUS_OK;
+    }
+
+    if (strcmp(verb, "listeners") == 0) {
+        for (int j = 0; j < nlisteners; j++) {
+            uint64_t accepted = 0;
+            for (int i = 0; i < cfg.workers; i++) {
+                struct worker_local *l = atomic_load(&workers[i].local);
+                if (l != NULL) accepted += atomic_load(&l->accepted_on[j]);
+            }
+            fprintf(out, "listener %d %s accepted %" PRIu64 "\n", j, listeners[j].name, accepted);
+        }
+        return PCC_STATUS_OK;
+    }
+
+    if (strcmp(verb, "budget") == 0) {
+        uint64_t released = 0;
+        for (int i = 0; i < cfg.workers; i++) {
+            struct worker_local *l = atomic_load(&workers[i].local);
+            if (l != NULL) released += atomic_load(&l->released);
+        }
+        print_budget(out, "memory", &mem_budget);
+        fprintf(out, " released %" PRIu64 " rss %" PRIu64 "\n", released, rss_bytes());
+        print_budget(out, "fds", &fd_budget);
+        fprintf(out, " open %d\n", count_open_fds());
+        pthread_mutex_lock(&pcc_tenants_lock);
+        fprintf(out, "budget tenants used %zu limit %zu evictions %" PRIu64 "\n", pcc_tenants.tab.used,
+                pcc_tenants.tab.max_used, pcc_tenants.tab.evictions);
+        pthread_mutex_unlock(&pcc_tenants_lock);
+        pthread_mutex_lock(&pcc_streams_lock);
+        fprintf(out, "budget streams used %zu limit %zu evictions %" PRIu64 "\n", pcc_streams.tab.used,
+                pcc_streams.tab.max_used, pcc_streams.tab.evictions);
+        pthread_mutex_unlock(&pcc_streams_lock);
+        return PCC_STATUS_OK;
+    }
+
+    if (strcmp(verb, "workers") == 0) {
+        for (int i = 0; i < cfg.workers; i++) {
+            struct worker_local *l = atomic_load(&workers[i].local);
+            if (l == NULL) continue; // still starting
+            fprintf(out, "worker %d cpu %d node %d requests %" PRIu64 " accepted %" PRIu64 " steered %" PRIu64
+                    " corrupt %" PRIu64, i, workers[i].cpu, workers[i].node, atomic_load(&l->requests),
+                    atomic_load(&l->accepted), atomic_load(&l->steered), atomic_load(&l->corrupt));
+            if (tls_ctx != NULL) {
+                fprintf(out, " tls %" PRIu64 " ktls_tx %" PRIu64 " ktls_rx %" PRIu64, atomic_load(&l->tls),
+                        atomic_load(&l->ktls_tx), atomic_load(&l->ktls_rx));
+            }
+            fputc('\n', out);
+        }
+        for (int i = 0; count_pool != NULL && i < pcc_pool_threads(count_pool); i++) {
+            uint64_t chunks, stolen;
+            pcc_pool_stats(count_pool, i, &chunks, &stolen);
+            fprintf(out, "counter %d chunks %" PRIu64 " stolen %" PRIu64 "\n", i, chunks, stolen);
+        }
+        return PCC_STATUS_OK;
+    }
+
+    if (strcmp(verb, "tenants") == 0) {
+        char *k_s = strtok_r(NULL, " \t\n", &save);
+        char *end = NULL;
+        errno = 0;
+        unsigned long long k = k_s != NULL ? strtoull(k_s, &end, 10) : 20;
+        if (k_s != NULL && (k_s[0] < '0' || k_s[0] > '9' || *end != '\0' || errno == ERANGE)) {
+            fprintf(out, "error: usage: tenants [<count>]\n");
+            return PCC_STATUS_BAD_REQUEST;
+        }
+        // never more than the table has, k sizes the buffer
+        if (k > pcc_tenants.tab.nslots) k = pcc_tenants.tab.nslots;
+        const struct pcc_tenant **top = malloc((k + 1) * sizeof(*top));
+        if (top == NULL) {
+            fprintf(out, "error: out of memory\n");
+            return PCC_STATUS_BAD_REQUEST;
+        }
+        pthread_mutex_lock(&pcc_tenants_lock);
+        size_t n = pcc_tenant_top(&pcc_tenants, top, k);
+        fprintf(out, "# tenants %zu of %zu slots, %" PRIu64 " evictions\n", pcc_tenants.tab.used, pcc_tenants.tab.nslots,
+                pcc_tenants.tab.evictions);
+        for (size_t i = 0; i < n; i++) {
+            fprintf(out, "tenant %s requests %" PRIu64 " bytes %" PRIu64 " printable %" PRIu64 " error %" PRIu64 "\n",
+                    top[i]->id, top[i]->requests, top[i]->bytes, top[i]->printable, top[i]->error);
+        }
+        pthread_mutex_unlock(&pcc_tenants_lock);
+        free(top);
+        return PCC_STATUS_OK;
+    }
+
+    if (strcmp(verb, "tenant") == 0) {
+        char *id = strtok_r(NULL, " \t\n", &save);
+        struct pcc_tenant t_copy; // copied under the lock, a worker may update the entry meanwhile
+        const struct pcc_tenant *t = NULL;
+        pthread_mutex_lock(&pcc_tenants_lock);
+        if (id != NULL && (t = pcc_tenant_find(&pcc_tenants, id)) != NULL) {
+            t_copy = *t;
+            t = &t_copy;
+        }
+        pthread_mutex_unlock(&pcc_tenants_lock);
+        if (t == NULL) {
+            fprintf(out, "error: no such tenant\n");
+            return PCC_STATUS_BAD_REQUEST;
+        }
+        fprintf(out, "# tenant %s requests %" PRIu64 " bytes %" PRIu64 " printable %" PRIu64 " error %" PRIu64 "\n",
+                t->id, t->requests, t->bytes, t->printable, t->error);
+        for (size_t i = 0; i < PCC_NPRINTABLE; i++) {
+            if (t->counts[i] > 0) {
+                fprintf(out, "char '%c' : %" PRIu64 " times\n", (char)(i + PCC_FIRST_PRINTABLE), t->counts[i]);
+            }
+        }
+        return PCC_STATUS_OK;
+    }
+
+    if (strcmp(verb, "stream") == 0) {
+        char *id = strtok_r(NULL, " \t\n", &save);
+        struct pcc_stream st_copy; // copied under the lock like a tenant
+        const struct pcc_stream *st = NULL;
+        pthread_mutex_lock(&pcc_streams_lock);
+        if (id != NULL && (st = pcc_stream_find(&pcc_streams, id)) != NULL) {
+            st_copy = *st;
+            st = &st_copy;
+        }
+        pthread_mutex_unlock(&pcc_streams_lock);
+        if (st == NULL) {
+            fprintf(out, "error: no such stream\n");
+            return PCC_STATUS_BAD_REQUEST;
+        }
+        fprintf(out, "# stream %s offset %" PRIu64 " printable %" PRIu64 " appends %" PRIu64 " restarts %" PRIu64 "\n",
+                st->id, st->offset, st->printable, st->appends, st->restarts);
+        for (size_t i = 0; i < PCC_NPRINTABLE; i++) {
+            if (st->counts[i] > 0) {
+                fprintf(out, "char '%c' : %" PRIu64 " times\n", (char)(i + PCC_FIRST_PRINTABLE), st->counts[i]);
+            }
+        }
+        return PCC_STATUS_OK;
+    }
+
+    if (strcmp(verb, "snapshot") == 0) {
+        // only ever to the configured file, a client doesn't get to pick paths on our host
+        if (cfg.snapshot_path == NULL) {
+            fprintf(out, "error: no snapshot file, start the server with --snapshot\n");
+            return PCC_STATUS_BAD_REQUEST;
+        }
+        ssize_t len = save_snapshot();
+        if (len < 0) {
+            fprintf(out, "error: saving snapshot: %s\n", strerror(errno));
+            return PCC_STATUS_BAD_REQUEST;
+        }
+        fprintf(out, "# snapshot %s %zd bytes\n", cfg.snapshot_path, len);
+        return PCC_STATUS_OK;
+    }
+
+    fprintf(out, "error: unknown query '%s'\n", verb);
+    return PCC_STATUS_BAD_REQUEST;
+}
+
+// a stream append can only go where the stream continues (or restart it at 0), checked
+// before the payload is read so a client that is off does not upload it for nothing.
+// returns 1 if it may go on, otherwise 0 with *at set to where the stream is
+static int stream_check(const struct pcc_req_opts *opts, uint64_t *at) {
+    if (opts->stream_off == 0) return 1;
+    pthread_mutex_lock(&pcc_streams_lock);
+    *at = pcc_stream_offset(&pcc_streams, opts->stream);
+    pthread_mutex_unlock(&pcc_streams_lock);
+    return *at == opts->stream_off;
+}
+
+// append a counted payload to its stream and write the reply for it. the stream may have
+// moved since stream_check (another client appending to it), then the append is refused
+// and 0 returned, the counts are dropped
+static int stream_append(const struct pcc_req_opts *opts, uint64_t n, const uint64_t counts[PCC_NPRINTABLE],
+                         struct pcc_ext_rep *rep, FILE *out) {
+    pthread_mutex_lock(&pcc_streams_lock);
+    const struct pcc_stream *st = pcc_stream_append(&pcc_streams, opts->stream, opts->stream_off, n, counts);
+    uint64_t at = st != NULL ? st->offset : pcc_stream_offset(&pcc_streams, opts->stream);
+    uint64_t total = st != NULL ? st->printable : 0;
+    pthread_mutex_unlock(&pcc_streams_lock);
+
+    if (st == NULL) {
+        fprintf(out, "error: stream %s is at offset %" PRIu64 "\n", opts->stream, at);
+        rep->status = PCC_STATUS_STREAM_OFFSET;
+        rep->c = at;
+        return 0;
+    }
+    fprintf(out, "# stream %s offset %" PRIu64 " appended %" PRIu64 " printable %" PRIu64 "\n", opts->stream, at, n,
+            rep->c);
+    rep->c = total;
+    return 1;
+}
+
+// take len bytes from the ring, into buf, or counted into counts and *c if buf is NULL.
+// between is set when this starts a request, then SIGINT or the client closing its socket
+// end the ring cleanly. returns 1 once it has them, 0 if the ring ended between requests,
+// -1 if the client is gone halfway or broke the ring
+static int ring_take(struct pcc_ring *ring, int fd, void *buf, uint64_t len, uint64_t counts[PCC_NPRINTABLE],
+                     uint64_t *c, int between) {
+    uint64_t got = 0;
+    while (got < len) {
+        uint32_t seen = pcc_ring_peer_seq(ring);
+        const unsigned char *p;
+        ssize_t avail = pcc_ring_peek(ring, &p);
+        if (avail < 0) {
+            fprintf(stderr, "Error serving ring: %s\n", strerror(errno));
+            return -1;
+        }
+        if (avail == 0) {
+            if (between && got == 0 && interrupted) return 0;
+            if (pcc_ring_wait(ring, seen, fd, RING_WAIT_MS) < 0) {
+                if (between && got == 0) return 0;
+                fprintf(stderr, "Client disconnected before sending all data\n");
+                return -1;
+            }
+            continue;
+        }
+        size_t take = (uint64_t)avail < len - got ? (size_t)avail : (size_t)(len - got);
+        if (buf != NULL) memcpy((char *)buf + got, p, take);
+        else *c += pcc_count(p, take, counts);
+        pcc_ring_consume(ring, take);
+        got += take;
+    }
+    return 1;
+}
+
+// serve the requests of a ring until the client closes its socket, or SIGINT between two
+// requests. every request is counted in place and answered in the reply ring, then
+// committed like a basic frame. returns 0 when done, -1 if the client is gone
+static int serve_ring(struct worker *w, int fd, struct pcc_ring *ring, const char *tenant) {
+    uint64_t counts[PCC_NPRINTABLE];
+    for (;;) {
+        uint64_t n, c = 0;
+        int r = ring_take(ring, fd, &n, sizeof(n), NULL, NULL, 1);
+        if (r <= 0) return r;
+        memset(counts, 0, sizeof(counts));
+        if (ring_take(ring, fd, NULL, n, counts, &c, 0) < 0) return -1;
+
+        for (;;) {
+            uint32_t seen = pcc_ring_peer_seq(ring);
+            if (pcc_ring_reply(ring, c) == 0) break;
+            if (errno != EAGAIN || pcc_ring_wait(ring, seen, fd, RING_WAIT_MS) < 0) return -1;
+        }
+        commit_request(w, tenant, n, counts);
+    }
+}
+
+// serve an extended frame, the marker was already read.
+// returns 1 if the connection is kept for another frame (PCC_FLAG_KEEPALIVE), 0 when done,
+// -1 if the client is gone. the caller closes the connection unless it is kept
+static int handle_ext_frame(struct worker *w, int fd, const char *peer_name) {
+    unsigned char hdr[PCC_EXT_REQ_HDR_LEN];
+    unsigned char opt_buf[PCC_MAX_OPT_LEN];
+    struct pcc_ext_req req;
+    struct pcc_ext_rep rep;
+    struct pcc_req_opts opts;
+    const char *err = NULL;
+    uint64_t counts[PCC_NPRINTABLE];
+    int counted = 0; // set once a COUNT request read its whole payload
+    int consumed = 0; // set once the whole frame was read, only then the connection can be kept
+    int estimated = 0; // a PCC_OP_SAMPLE request got its estimate
+    int ringed = 0; // a PCC_OP_RING request attached its ring
+    struct pcc_ring ring;
+    uint64_t ring_bytes = 0; // what the ring took from mem_budget
+    struct pcc_sample_est est;
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *out;
+    uint16_t opt_bytes = 0; // options read, for the trace
+
+    trace_frame_begin();
+    if (recv_all(fd, hdr, sizeof(hdr)) < 0) return -1;
+    pcc_ext_req_unpack(&req, hdr);
+
+    if ((out = open_memstream(&body, &body_len)) == NULL) {
+        fprintf(stderr, "Error allocating reply: %s\n", strerror(errno));
+        close(fd);
         exit(1);
     }
-    
+
+    memset(&rep, 0, sizeof(rep));
+    rep.version = PCC_EXT_VERSION;
+    rep.status = PCC_STATUS_BAD_REQUEST;
+
+    // on a bad request the rest of the frame is left unread, the connection is closed after the reply
+    int hdr_ok = pcc_frame_check(&req, &err) == 0;
+    if (hdr_ok) {
+        if (recv_all(fd, opt_buf, req.opt_len) < 0) goto gone;
+        opt_bytes = req.opt_len;
+    }
+    if (!hdr_ok) {
+        fprintf(out, "error: %s (op %u)\n", err, req.op);
+    } else if (pcc_frame_parse_opts(opt_buf, req.opt_len, &opts, &err) < 0 ||
+               pcc_frame_check_opts(&req, &opts, &err) < 0) {
+        fprintf(out, "error: %s\n", err);
+    } else if (req.op == PCC_OP_SAMPLE) {
+        if (recv_sample(w, fd, req.n, &opts, &est) < 0) goto gone;
+        print_estimate(out, &est, req.n, &opts);
+        rep.c = est.c;
+        rep.status = PCC_STATUS_OK;
+        estimated = consumed = 1;
+    } else if (req.op == PCC_OP_COUNT && opts.stream[0] != '\0' && !stream_check(&opts, &rep.c)) {
+        fprintf(out, "error: stream %s is at offset %" PRIu64 "\n", opts.stream, rep.c);
+        rep.status = PCC_STATUS_STREAM_OFFSET;
+    } else if (req.op == PCC_OP_COUNT && opts.ngram != 0 && !ngram_ready(w)) {
+        fprintf(out, "error: no room for n-gram tables in the memory budget\n");
+        rep.status = PCC_STATUS_BUSY;
+    } else if (req.op == PCC_OP_COUNT) {
+        uint32_t crc = 0, trailer;
+        if (opts.ngram != 0) {
+            if (recv_count_ngram(w, fd, req.n, opts.ngram, counts, &rep.c, opts.checksum ? &crc : NULL) < 0) goto gone;
+        } else if (opts.checksum) {
+            if (recv_count_crc(w, fd, req.n, counts, &rep.c, &crc) < 0) goto gone;
+        } else if (recv_count(w, fd, req.n, counts, &rep.c) < 0) {
+            goto gone;
+        }
+        int intact = opts.checksum ? recv_trailer(fd, crc, &trailer) : 1;
+        if (intact < 0) goto gone;
+        consumed = 1;
+        if (!intact) {
+            // counted already, but none of it goes anywhere
+            fprintf(out, "error: payload checksum mismatch (crc32c %08" PRIx32 ", trailer %08" PRIx32 ")\n", crc,
+                    trailer);
+            rep.status = PCC_STATUS_CHECKSUM;
+            rep.c = 0;
+            local_add(&w->local->corrupt, 1);
+        } else {
+            rep.status = PCC_STATUS_OK;
+            counted = 1;
+            if (opts.stream[0] != '\0') counted = stream_append(&opts, req.n, counts, &rep, out);
+            if (counted && opts.ngram != 0) print_ngrams(out, w->ngram);
+        }
+    } else if (req.op == PCC_OP_RING) {
+        consumed = 1;
+        if (conn_npassed != 3) {
+            fprintf(out, "error: a ring needs a UNIX socket connection with its memfd and eventfds\n");
+        } else {
+            conn_npassed = 0; // the ring owns them now, also when it is refused
+            if (pcc_ring_attach(&ring, conn_passed[0], conn_passed[1], conn_passed[2]) < 0) {
+                fprintf(out, "error: bad ring: %s\n", strerror(errno));
+            } else if (pcc_budget_take(&mem_budget, PCC_RING_HDR_SIZE + ring.data_size) < 0) {
+                fprintf(out, "error: no room for a ring of %zu bytes in the memory budget\n", ring.data_size);
+                pcc_ring_free(&ring);
+                rep.status = PCC_STATUS_BUSY;
+            } else {
+                ring_bytes = PCC_RING_HDR_SIZE + ring.data_size;
+                rep.status = PCC_STATUS_OK;
+                ringed = 1;
+            }
+        }
+    } else {
+        char cmd[PCC_MAX_QUERY_LEN + 1]; // pcc_frame_check bounded n
+        if (recv_all(fd, cmd, req.n) < 0) goto gone;
+        trace_data(cmd, req.n, 1);
+        cmd[req.n] = '\0';
+        rep.status = run_query(cmd, out);
+        consumed = 1;
+    }
+    fclose(out);
+
+    if (consumed && !ringed && (req.flags & PCC_FLAG_KEEPALIVE) && cfg.keepalive_ms > 0 && !interrupted) {
+        rep.flags |= PCC_FLAG_KEEPALIVE;
+    }
+
+    rep.body_len = (uint32_t)body_len;
+    unsigned char rep_hdr[PCC_EXT_REP_HDR_LEN];
+    pcc_ext_rep_pack(&rep, rep_hdr);
+    int ret = 0;
+    // header and body in as few segments as the mode makes them
+    pcc_net_begin(fd, conn_net_mode);
+    if (send_all(fd, rep_hdr, sizeof(rep_hdr), body_len > 0 ? pcc_net_more(conn_net_mode) : 0) < 0 ||
+        send_all(fd, body, body_len, 0) < 0) {
+        ret = -1;
+    }
+    pcc_net_end(fd, conn_net_mode);
+    free(body);
+    trace_frame(&req, opt_buf, opt_bytes, req.n, ret == 0 ? rep.status : PCC_TRACE_GONE, rep.c);
+
+    // like basic frames, counts only become part of the totals once the client got its reply
+    if (ret == 0 && counted) {
+        commit_request(w, opts.tenant[0] != '\0' ? opts.tenant : peer_name, req.n, counts);
+        if (opts.ngram != 0) commit_ngrams(w, w->ngram);
+    }
+    if (ret == 0 && estimated) commit_estimate(w, &est);
+    if (ringed) {
+        if (ret == 0) ret = serve_ring(w, fd, &ring, opts.tenant[0] != '\0' ? opts.tenant : peer_name);
+        pcc_ring_free(&ring);
+        pcc_budget_give(&mem_budget, ring_bytes);
+    }
+    return ret == 0 && (rep.flags & PCC_FLAG_KEEPALIVE) ? 1 : ret;
+
+gone:
+    fclose(out);
+    free(body);
+    trace_frame(&req, opt_buf, opt_bytes, req.n, PCC_TRACE_GONE, 0);
+    return -1;
+}
+
+
+
+// mmap'ed and written by the calling thread, so with the default first touch policy the
+// pages come from the NUMA node the thread runs on
+static void *alloc_local(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Error allocating worker state: %s\n", strerror(errno));
+        exit(1);
+    }
+    memset(p, 0, size);
+    return p;
+}
+
+static void set_busy_poll(int fd) {
+    if (cfg.busy_poll > 0 && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &cfg.busy_poll, sizeof(cfg.busy_poll)) < 0) {
+        fprintf(stderr, "Warning: SO_BUSY_POLL: %s\n", strerror(errno));
+        cfg.busy_poll = 0; // don't repeat the warning for every connection
+    }
+}
+
+// per connection bookkeeping right after accept, local for the UNIX socket
+static void note_accepted(struct worker *w, int conn_fd, int local) {
+    struct worker_local *l = w->local;
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+
+    conn_net_mode = PCC_NET_NODELAY;
+    if (!local) {
+        set_busy_poll(conn_fd);
+        conn_net_mode = tls_ctx != NULL ? pcc_net_mode_tls(cfg.net_mode) : cfg.net_mode;
+        pcc_net_setup(conn_fd, conn_net_mode);
+        if (cfg.quickack) pcc_net_quickack(conn_fd);
+    }
+    atomic_store_explicit(&l->accepted, atomic_load_explicit(&l->accepted, memory_order_relaxed) + 1, memory_order_relaxed);
+    if (!local && w->cpu >= 0 && getsockopt(conn_fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 && cpu == w->cpu) {
+        atomic_store_explicit(&l->steered, atomic_load_explicit(&l->steered, memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+}
+
+// close an answered connection without resetting it: a request that raced with the close,
+// or the payload of a rejected one, must not make the kernel send a RST, which could
+// discard replies the client did not read yet
+static void close_kept(int fd) {
+    char drain[16384];
+    trace_conn(PCC_TRACE_CLOSE, 0);
+    pcc_tls_free(conn_tls, 1);
+    conn_tls = NULL;
+    shutdown(fd, SHUT_WR);
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    // until the client closes its side too, bounded so a client that keeps sending can't hold
+    // us. enough for what a client already had in flight when a rejection reached it
+    for (int i = 0; i < 256 && poll(&pfd, 1, 100) > 0 && read(fd, drain, sizeof(drain)) > 0; i++) {
+    }
+    close(fd);
+    conn_give();
+}
+
+// wait for the marker of the next frame on a kept connection.
+// returns 0 once it was read, -1 if the connection should be closed: idle for cfg.keepalive_ms,
+// closed by the client, SIGINT, or a frame that is not an extended one
+static int next_frame(int fd) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    int idle = 0, r;
+    uint32_t marker;
+
+    // short slices so a SIGINT doesn't wait for the idle timeout. a frame that TLS already
+    // decrypted into its buffer doesn't show up in poll
+    if (conn_tls == NULL || !pcc_tls_pending(conn_tls)) {
+        while ((r = poll(&pfd, 1, 100)) == 0 || (r < 0 && errno == EINTR)) {
+            if (interrupted || (idle += 100) >= cfg.keepalive_ms) return -1;
+        }
+        if (r < 0) return -1;
+    }
+
+    ssize_t got;
+    do {
+        got = conn_read(fd, &marker, sizeof(marker));
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) return -1; // closed between frames, nothing to report
+    if (got < (ssize_t)sizeof(marker) && recv_all(fd, (char *)&marker + got, sizeof(marker) - got) < 0) return -1;
+    // the client may be waiting for this ack to send the rest of the frame (Nagle). a no-op
+    // error on the UNIX socket
+    if (cfg.quickack) pcc_net_quickack(fd);
+    return ntohl(marker) == PCC_EXT_MARKER ? 0 : -1;
+}
+
+// TLS handshake of a new connection, sets conn_tls. returns -1 if it failed (logged)
+static int start_tls(struct worker *w, int conn_fd) {
+    struct worker_local *l = w->local;
+    if ((conn_tls = pcc_tls_accept(tls_ctx, conn_fd, TLS_HANDSHAKE_MS)) == NULL) {
+        fprintf(stderr, "TLS handshake failed: %s\n", pcc_tls_error());
+        return -1;
+    }
+    int ktls = pcc_tls_ktls(conn_tls);
+    local_add(&l->tls, 1);
+    if (ktls & PCC_KTLS_TX) local_add(&l->ktls_tx, 1);
+    if (ktls & PCC_KTLS_RX) local_add(&l->ktls_rx, 1);
+    return 0;
+}
+
+// accept the next connection from any listener, *which is its index. with more than one
+// they are non-blocking and polled, another worker may have taken it: EAGAIN
+static int accept_any(struct worker *w, struct sockaddr_storage *peer_addr, int *which) {
+    socklen_t addrsize = sizeof(*peer_addr);
+    *which = 0;
+    if (nlisteners == 1) return accept(w->listen_fds[0], (struct sockaddr *)peer_addr, &addrsize);
+
+    struct pollfd pfd[MAX_LISTENERS];
+    for (int i = 0; i < nlisteners; i++) pfd[i] = (struct pollfd){.fd = w->listen_fds[i], .events = POLLIN};
+    if (poll(pfd, nlisteners, -1) < 0) return -1;
+    for (int k = 0; k < nlisteners; k++) {
+        int i = (w->next_listener + k) % nlisteners;
+        if (pfd[i].revents == 0) continue;
+        w->next_listener = i + 1;
+        *which = i;
+        return accept(w->listen_fds[i], (struct sockaddr *)peer_addr, &addrsize);
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+// accept() had no fd for a connection (EMFILE, ENFILE): it would stay in the queue, and
+// every poll say so. accept it on the spare fd's number and close it right away
+static void shed_pending(struct worker *w, int which) {
+    pthread_mutex_lock(&spare_lock);
+    if (spare_fd >= 0) close(spare_fd);
+    int fd = accept(w->listen_fds[which], NULL, NULL);
+    if (fd >= 0) close(fd);
+    spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    pthread_mutex_unlock(&spare_lock);
+    atomic_fetch_add_explicit(&fd_budget.refused, 1, memory_order_relaxed);
+}
+
+static void serve_loop(struct worker *w) {
+    struct sockaddr_storage peer_addr; // client address structure
+    int which; // index of the listener it came from
 
     // enter a loop to accept and process client connections
     while (!interrupted) {
-        
+        drop_passed_fds(); // passed by the previous client without a ring request
+        if (pcc_budget_near(&mem_budget)) release_scratch(w);
+
         // Accept a connection
-        conn_fd = accept(sock_fd, (struct sockaddr *)&peer_addr, &addrsize);
+        int conn_fd = accept_any(w, &peer_addr, &which);
         //printf("Accepted connection from %s:%d\n", inet_ntoa(peer_addr.sin_addr), ntohs(peer_addr.sin_port));
         if (conn_fd < 0) {
+            if (interrupted) break; // the main thread shut the listener down
+            if (errno == ECONNABORTED || errno == EINTR || errno == EAGAIN) continue;
+            if ((errno == EMFILE || errno == ENFILE) && cfg.max_fds > 0) {
+                shed_pending(w, which);
+                continue;
+            }
             fprintf(stderr, "Error accepting connection: %s\n", strerror(errno));
-            close(sock_fd);
             exit(1);
         }
+        int local = listeners[which].family == AF_UNIX; // connection came from a UNIX socket
+        // shed before anything is read, the client sees the connection closed
+        if (conn_take(local) < 0) {
+            close(conn_fd);
+            continue;
+        }
+        note_accepted(w, conn_fd, local);
+        local_add(&w->local->accepted_on[which], 1);
+        if (tls_ctx != NULL && !local && start_tls(w, conn_fd) < 0) {
+            close(conn_fd);
+            conn_give();
+            continue;
+        }
+        if (trace != NULL) {
+            conn_trace_id = pcc_trace_conn(trace);
+            trace_conn(PCC_TRACE_OPEN, (local ? PCC_TRACE_LOCAL : 0) | (conn_tls != NULL ? PCC_TRACE_TLS : 0));
+        }
         //printf("Accepted connection from %s:%d\n", inet_ntoa(peer_addr.sin_addr), ntohs(peer_addr.sin_port));
-        
-        // Read data from the client
-
-        // first get N from the client
-        uint32_t N = 0; // to store the size of the stream
-        ssize_t r;
-        ssize_t bytes_received = 0;
-        while (bytes_received < sizeof(N)) {
-            
-            do {
-                r = read(conn_fd, ((char *)&N) + bytes_received, sizeof(N) - bytes_received);
-            } while (r < 0 && errno == EINTR);
-
-            if (r < 0) {
-                if (errno == ETIMEDOUT || errno == ECONNRESET || errno == EPIPE) {
-                    fprintf(stderr, "TCP error occurred while reading from client: %s\n", strerror(errno));
-                    close(conn_fd);
-                    conn_fd = -1; // reset the connection fd for the next iteration
-                    break; // exit the loop to handle the next client
-                }
-                else {
-                    // if the error is not a TCP error, print the error and exit
-                    fprintf(stderr, "Error reading from client: %s\n", strerror(errno));
-                    close(conn_fd);
-                    exit(1);
-                }
-            } 
-            // if r == 0, it means the client disconnected before sending data
-            else if (r == 0) {
-                fprintf(stderr, "Client disconnected before sending data\n");
-                close(conn_fd);
-                break;
+
+        // the peer IP is the tenant of requests that don't carry a tenant id, on the UNIX
+        // socket the peer's uid
+        char peer_name[INET6_ADDRSTRLEN];
+        if (local) {
+            struct ucred cred;
+            socklen_t len = sizeof(cred);
+            if (getsockopt(conn_fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) {
+                snprintf(peer_name, sizeof(peer_name), "uid:%u", (unsigned)cred.uid);
+            } else {
+                snprintf(peer_name, sizeof(peer_name), "local");
             }
-            
-            bytes_received += r;
+        } else {
+            pcc_net_addr_name((struct sockaddr *)&peer_addr, peer_name, sizeof(peer_name));
         }
-        if (bytes_received < sizeof(N)) {
-            continue; // if we didn't receive enough bytes - this is because the client disconnected
+
+        // the basic frame's state machine, the extended frame from its marker on
+        struct pcc_sm sm;
+        int phase = serve_basic(w, conn_fd, local, &sm);
+
+        // extended frames are served by their own handler, one per connection like basic frames
+        // unless the client asked for keep-alive
+        if (sm.result == PCC_SM_EXT) {
+            int kept;
+            while ((kept = handle_ext_frame(w, conn_fd, peer_name)) > 0 && next_frame(conn_fd) == 0) {
+                if (pcc_budget_near(&mem_budget)) release_scratch(w);
+            }
+            // also after a rejected frame: its unread payload would turn close() into a RST
+            // that can destroy the reply before the client read it
+            if (kept >= 0) close_kept(conn_fd);
+            else close_conn(conn_fd);
+            continue;
+        }
+        if (sm.result != PCC_SM_OK) {
+            // the client went away, what it sent is not counted. before N there is no frame
+            if (phase != PCC_SM_HEADER) trace_frame(NULL, NULL, 0, sm.n, PCC_TRACE_GONE, 0);
+            close_conn(conn_fd);
+            continue;
         }
+        trace_frame(NULL, NULL, 0, sm.n, PCC_STATUS_OK, sm.c);
+
+        // Update the global pcc_total counts
+        commit_request(w, peer_name, sm.n, sm.counts);
 
-        N = ntohl(N); // convert from network byte order to host byte order
-        //printf("Received N from client: %u\n", N);
+        // Close the client connection, over TLS with a close_notify after the reply
+        if (conn_tls != NULL) close_kept(conn_fd);
+        else close_conn(conn_fd);
+    }
+}
 
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
 
-        // now read the stream of bytes from the client
-        
+    if (w->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            fprintf(stderr, "Error pinning worker %d to cpu %d: %s\n", w->id, w->cpu, strerror(err));
+            exit(1);
+        }
+    }
+    unsigned cpu, node;
+    w->node = getcpu(&cpu, &node) == 0 ? (int)node : -1;
+    atomic_store(&w->local, alloc_local(sizeof(struct worker_local)));
 
-        uint32_t curr_cnts[95];
-        memset(curr_cnts, 0, sizeof(curr_cnts)); // initialize counts for this client to 0
+    serve_loop(w);
+    return NULL;
+}
 
-        uint32_t C = 0; // to store the number of printable characters
-        ssize_t bytes_read=0;
-        bytes_received = 0;
+// parse a cpu list like "0-3,8" into cfg.cpus
+static int parse_cpus(const char *s) {
+    cfg.ncpus = 0;
+    while (*s != '\0') {
+        char *end;
+        long lo = strtol(s, &end, 10), hi = lo;
+        if (end == s) return -1;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s) return -1;
+        }
+        if (lo < 0 || hi < lo || hi >= CPU_SETSIZE) return -1;
+        for (long c = lo; c <= hi && cfg.ncpus < CPU_SETSIZE; c++) cfg.cpus[cfg.ncpus++] = (int)c;
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+        s = end;
+    }
+    return cfg.ncpus > 0 ? 0 : -1;
+}
 
-        while (bytes_received < N &&
-               ((bytes_read = read(conn_fd, recv_buff, sizeof(recv_buff))) >= 0 || errno == EINTR)) {
-            if (bytes_read < 0 && errno == EINTR) continue; // retry on EINTR
+// parse a -l address (see LISTENERS) into l
+static int parse_listener(const char *spec, struct listener *l) {
+    memset(l, 0, sizeof(*l));
+    l->name = spec;
+    if (strncmp(spec, "unix:", 5) == 0) {
+        l->family = AF_UNIX;
+        l->path = spec + 5;
+        return l->path[0] != '\0' ? 0 : -1;
+    }
+    if (strncmp(spec, "*:", 2) == 0) {
+        char any[INET6_ADDRSTRLEN + 16];
+        snprintf(any, sizeof(any), "[::]%s", spec + 1);
+        if (pcc_net_addr_port(any, &l->addr, &l->addr_len) < 0) return -1;
+        l->family = AF_INET6;
+        return 0;
+    }
+    if (pcc_net_addr_port(spec, &l->addr, &l->addr_len) < 0) return -1;
+    l->family = l->addr.ss_family;
+    l->v6only = 1;
+    return 0;
+}
 
-            // if bytes_read is 0, it means the client disconnected before sending all data
-            if (bytes_read == 0 && bytes_received < N) { 
-                fprintf(stderr, "Client disconnected before sending all data\n");
-                close(conn_fd);
-                conn_fd = -1;
-                break;
+static int open_unix_listener(const char *path);
+
+static int open_listener(const struct listener *l, int reuseport) {
+    if (l->family == AF_UNIX) return open_unix_listener(l->path);
+
+    // create a TCP socket and bind it to the listener's address
+    int sock_fd = -1;
+    if ((sock_fd = socket(l->family, SOCK_STREAM, 0)) < 0) {
+        fprintf(stderr, "Error creating socket: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    int optval = 1;
+    setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    // explicitly, the default is net.ipv6.bindv6only
+    if (l->family == AF_INET6 && setsockopt(sock_fd, IPPROTO_IPV6, IPV6_V6ONLY, &l->v6only, sizeof(l->v6only)) < 0) {
+        fprintf(stderr, "Error setting IPV6_V6ONLY: %s\n", strerror(errno));
+        exit(1);
+    }
+    if (reuseport && setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
+        fprintf(stderr, "Error setting SO_REUSEPORT: %s\n", strerror(errno));
+        exit(1);
+    }
+    set_busy_poll(sock_fd);
+    // accept() only once the request's first bytes arrived, so a worker never blocks on a
+    // connection that has nothing to say yet
+    if (cfg.defer_accept > 0 &&
+        setsockopt(sock_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &cfg.defer_accept, sizeof(cfg.defer_accept)) < 0) {
+        fprintf(stderr, "Warning: TCP_DEFER_ACCEPT: %s\n", strerror(errno));
+    }
+
+    if (bind(sock_fd, (struct sockaddr *)&l->addr, l->addr_len) < 0) {
+        fprintf(stderr, "Error binding socket to %s: %s\n", l->name, strerror(errno));
+        close(sock_fd);
+        exit(1);
+    }
+
+    if (listen(sock_fd, 10) < 0) {
+        fprintf(stderr, "Error listening on socket: %s\n", strerror(errno));
+        close(sock_fd);
+        exit(1);
+    }
+    return sock_fd;
+}
+
+static int open_unix_listener(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    struct stat st;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", strerror(ENAMETOOLONG));
+        exit(1);
+    }
+    strcpy(addr.sun_path, path);
+    // a socket left over from an earlier run would make bind fail, anything else is not ours
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+    int sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock_fd < 0) {
+        fprintf(stderr, "Error creating socket: %s\n", strerror(errno));
+        exit(1);
+    }
+    if (bind(sock_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Error binding socket to %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    if (listen(sock_fd, 10) < 0) {
+        fprintf(stderr, "Error listening on socket: %s\n", strerror(errno));
+        exit(1);
+    }
+    return sock_fd;
+}
+
+// reuseport program for -i: a connection goes to the listener of the worker pinned on the
+// cpu that is processing it, listeners are indexed in the order they joined the group.
+// cpus without a worker fall through to the kernel's hash
+static void attach_cpu_steering(int fd) {
+    struct sock_filter code[2 * CPU_SETSIZE + 2];
+    int n = 0;
+
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+    for (int i = 0; i < cfg.workers; i++) {
+        code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, workers[i].cpu, 0, 1);
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, i);
+    }
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff); // out of range: hash
+    struct sock_fprog prog = {.len = n, .filter = code};
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        fprintf(stderr, "Warning: SO_ATTACH_REUSEPORT_CBPF: %s, connections are spread by hash\n", strerror(errno));
+    }
+}
+
+// charge what exists before the first client to the budgets, and make --max-fds the
+// RLIMIT_NOFILE. exits if a budget is below it
+static void start_budgets(void) {
+    uint64_t mem = cfg.workers * (sizeof(struct worker) + sizeof(struct worker_local)) + sizeof(pcc_win) +
+                   pcc_tenants.tab.nslots * (sizeof(*pcc_tenants.tab.hashes) + sizeof(*pcc_tenants.entries)) +
+                   pcc_streams.tab.nslots * (sizeof(*pcc_streams.tab.hashes) + sizeof(*pcc_streams.entries));
+    pcc_budget_init(&mem_budget, cfg.max_mem);
+    pcc_budget_charge(&mem_budget, mem);
+    if (cfg.max_mem > 0 && mem > cfg.max_mem) {
+        fprintf(stderr, "Error: the server needs %" PRIu64 " bytes before its first client, more than --max-mem: %s\n",
+                mem, strerror(ENOBUFS));
+        exit(1);
+    }
+
+    pcc_budget_init(&fd_budget, cfg.max_fds);
+    if (cfg.max_fds > 0 && (spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0) {
+        fprintf(stderr, "Error opening spare fd: %s\n", strerror(errno));
+        exit(1);
+    }
+    int open_fds = count_open_fds();
+    if (open_fds < 0) {
+        fprintf(stderr, "Error counting open fds: %s\n", strerror(errno));
+        exit(1);
+    }
+    pcc_budget_charge(&fd_budget, open_fds + FD_SPARE);
+    if (cfg.max_fds == 0) return;
+    if (open_fds + FD_SPARE >= cfg.max_fds) {
+        fprintf(stderr, "Error: the server needs %d fds before its first client, not below --max-fds: %s\n",
+                open_fds + FD_SPARE, strerror(ENOBUFS));
+        exit(1);
+    }
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || (rl.rlim_cur = cfg.max_fds) > rl.rlim_max ||
+        setrlimit(RLIMIT_NOFILE, &rl) < 0) {
+        fprintf(stderr, "Error: --max-fds above the hard RLIMIT_NOFILE: %s\n", strerror(EINVAL));
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option long_opts[] = {
+        {"snapshot", required_argument, NULL, 'S'},
+        {"load", required_argument, NULL, 'L'},
+        {"capture", required_argument, NULL, 'T'},
+        {"capture-payloads", no_argument, NULL, 'P'},
+        {"listen", required_argument, NULL, 'l'},
+        {"max-mem", required_argument, NULL, 'M'},
+        {"max-fds", required_argument, NULL, 'F'},
+        {"max-entries", required_argument, NULL, 'E'},
+        {"io", required_argument, NULL, 'O'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "w:c:ib:k:C:K:u:p:S:L:n:QD:T:Pl:M:F:E:O:", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'w':
+            cfg.workers = atoi(optarg);
+            break;
+        case 'c':
+            if (parse_cpus(optarg) < 0) {
+                fprintf(stderr, "Error: bad cpu list: %s\n", strerror(EINVAL));
+                exit(1);
+            }
+            break;
+        case 'i':
+            cfg.incoming_cpu = 1;
+            break;
+        case 'b':
+            cfg.busy_poll = atoi(optarg);
+            break;
+        case 'k':
+            cfg.keepalive_ms = atoi(optarg);
+            break;
+        case 'C':
+            cfg.tls_cert = optarg;
+            break;
+        case 'K':
+            cfg.tls_key = optarg;
+            break;
+        case 'u':
+        case 'l':
+            if (cfg.nlisten_specs == MAX_LISTENERS) {
+                fprintf(stderr, "Error: too many listeners: %s\n", strerror(EINVAL));
+                exit(1);
             }
-            // if bytes_read < 0, it means there was an error reading from the client
-            if (bytes_read < 0) {
-                if (errno == ETIMEDOUT || errno == ECONNRESET || errno == EPIPE) {
-                    fprintf(stderr, "TCP error occurred while reading from client: %s\n", strerror(errno));
-                    close(conn_fd);
-                    conn_fd = -1;
-                    break;
-                } else {
-                    fprintf(stderr, "Error reading from client: %s\n", strerror(errno));
-                    close(conn_fd);
+            if (opt == 'u') {
+                char *spec = malloc(strlen(optarg) + 6);
+                if (spec == NULL) {
+                    fprintf(stderr, "Error: %s\n", strerror(errno));
                     exit(1);
                 }
+                sprintf(spec, "unix:%s", optarg);
+                optarg = spec;
             }
-
-            for (size_t i = 0; i < bytes_read; i++) {
-                if (32 <= recv_buff[i] && recv_buff[i] <= 126) {
-                    curr_cnts[recv_buff[i] - 32]++; // increment the count for the printable character
-                    C++; // increment the total count of printable characters
-                }
+            cfg.listen_specs[cfg.nlisten_specs++] = optarg;
+            break;
+        case 'p':
+            cfg.pool_threads = atoi(optarg);
+            break;
+        case 'S':
+            cfg.snapshot_path = optarg;
+            break;
+        case 'L':
+            cfg.load_path = optarg;
+            break;
+        case 'n':
+            if ((cfg.net_mode = pcc_net_mode_parse(optarg)) < 0) {
+                fprintf(stderr, "Error: bad write mode: %s\n", strerror(EINVAL));
+                exit(1);
+            }
+            break;
+        case 'Q':
+            cfg.quickack = 1;
+            break;
+        case 'D':
+            cfg.defer_accept = atoi(optarg);
+            break;
+        case 'T':
+            cfg.capture_path = optarg;
+            break;
+        case 'P':
+            cfg.capture_payloads = 1;
+            break;
+        case 'M':
+            if (pcc_budget_parse(optarg, &cfg.max_mem) < 0) {
+                fprintf(stderr, "Error: bad memory budget: %s\n", strerror(EINVAL));
+                exit(1);
+            }
+            break;
+        case 'F':
+            cfg.max_fds = atoi(optarg);
+            break;
+        case 'E':
+            cfg.max_entries = strtoul(optarg, NULL, 10);
+            break;
+        case 'O':
+            if ((cfg.io = pcc_io_parse(optarg)) < 0) {
+                fprintf(stderr, "Error: bad I/O backend: %s\n", strerror(EINVAL));
+                exit(1);
             }
+            break;
+        default:
+            fprintf(stderr, "Error: %s\n", strerror(EINVAL));
+            exit(1);
+        }
+    }
 
-            bytes_received += bytes_read;
-        }
-
-        // if we didn't receive enough bytes, it means the client disconnected before sending all data
-        // so we skip to the next client
-        if (bytes_received < N) continue;
-        
-        
-        //printf("Received %zd bytes from client\n", bytes_received);
-
-
-        // Send C to the client
-        uint32_t C_net = htonl(C); // convert to network byte order
-        ssize_t sent = 0;
-        while (sent < sizeof(C_net)) {
-            do {
-                r = write(conn_fd, ((char *)&C_net) + sent, sizeof(C_net) - sent);
-            } while (r < 0 && errno == EINTR);
-            
-            if (r < 0) {
-                if (errno == ETIMEDOUT || errno == ECONNRESET || errno == EPIPE) {
-                    fprintf(stderr, "TCP error occurred while sending to client: %s\n", strerror(errno));
-                    close(conn_fd);
-                    conn_fd = -1; // reset the connection fd for the next iteration
-                    break; // exit the loop to handle the next client
-                }
-                else {
-                    // if the error is not a TCP error, print the error and exit
-                    fprintf(stderr, "Error sending to client: %s\n", strerror(errno));
-                    close(conn_fd);
-                    exit(1);
-                }
-            } 
-            // if r == 0, it means the client disconnected before reading data
-            else if (r == 0) {
-                fprintf(stderr, "Client disconnected before reading data\n");
-                close(conn_fd);
-                break;
+    // check if the number of cmd args is correct, the port is optional next to -l and -u
+    if (argc - optind > 1 || argc - optind + cfg.nlisten_specs == 0 || cfg.workers < 1 || cfg.workers > CPU_SETSIZE || (cfg.tls_cert == NULL) != (cfg.tls_key == NULL) ||
+        cfg.pool_threads < 0 || cfg.pool_threads > PCC_POOL_MAX_THREADS || cfg.max_fds < 0) {
+        fprintf(stderr, "Error: %s\n", strerror(EINVAL));
+        exit(1);
+    }
+    for (int i = 0; i < cfg.nlisten_specs; i++) {
+        if (parse_listener(cfg.listen_specs[i], &listeners[nlisteners++]) < 0) {
+            fprintf(stderr, "Error: bad listen address %s: %s\n", cfg.listen_specs[i], strerror(EINVAL));
+            exit(1);
+        }
+    }
+    if (optind < argc) {
+        struct listener *l = &listeners[nlisteners];
+        if (nlisteners == MAX_LISTENERS || pcc_net_addr("0.0.0.0", atoi(argv[optind]), &l->addr, &l->addr_len) < 0) {
+            fprintf(stderr, "Error: %s\n", strerror(EINVAL));
+            exit(1);
+        }
+        static char port_name[32];
+        snprintf(port_name, sizeof(port_name), "0.0.0.0:%d", atoi(argv[optind]));
+        l->name = port_name;
+        l->family = AF_INET;
+        nlisteners++;
+    }
+
+    // SIGINT is only ever handled by the main thread with sigwait, block it before any
+    // worker exists so they all inherit the mask
+    sigset_t sigint_set;
+    sigemptyset(&sigint_set);
+    sigaddset(&sigint_set, SIGINT);
+    if (pthread_sigmask(SIG_BLOCK, &sigint_set, NULL) != 0) {
+        fprintf(stderr, "Error blocking SIGINT: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    // a client that went away makes writes fail with EPIPE, handled like the other tcp
+    // errors, instead of killing us (OpenSSL writes with write(), not send(MSG_NOSIGNAL))
+    signal(SIGPIPE, SIG_IGN);
+
+    if (cfg.tls_cert != NULL && (tls_ctx = pcc_tls_server_ctx(cfg.tls_cert, cfg.tls_key)) == NULL) {
+        fprintf(stderr, "Error setting up TLS: %s\n", pcc_tls_error());
+        exit(1);
+    }
+
+    if (cfg.pool_threads > 0 && (count_pool = pcc_pool_new(cfg.pool_threads, PCC_POOL_CHUNK)) == NULL) {
+        fprintf(stderr, "Error creating counting pool: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    pcc_window_init(&pcc_win);
+    // with --max-entries the tables are sized for it, at most half full
+    if (pcc_tenant_init(&pcc_tenants, cfg.max_entries > 0 ? 2 * cfg.max_entries : PCC_TENANT_DEFAULT_SLOTS) < 0) {
+        fprintf(stderr, "Error allocating tenant table: %s\n", strerror(errno));
+        exit(1);
+    }
+    if (pcc_stream_init(&pcc_streams, cfg.max_entries > 0 ? 2 * cfg.max_entries : PCC_STREAM_DEFAULT_SLOTS) < 0) {
+        fprintf(stderr, "Error allocating stream table: %s\n", strerror(errno));
+        exit(1);
+    }
+    pcc_tenants.tab.max_used = pcc_streams.tab.max_used = cfg.max_entries;
+    if (cfg.load_path != NULL) load_snapshot();
+    if (cfg.capture_path != NULL &&
+        (trace = pcc_trace_create(cfg.capture_path, cfg.capture_payloads ? PCC_TRACE_PAYLOADS : 0)) == NULL) {
+        fprintf(stderr, "Error creating trace %s: %s\n", cfg.capture_path, strerror(errno));
+        exit(1);
+    }
+
+    if (cfg.incoming_cpu && cfg.ncpus == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int i = 0; i < cfg.workers; i++) cfg.cpus[cfg.ncpus++] = i % (online > 0 ? online : 1);
+    }
+
+    workers = calloc(cfg.workers, sizeof(*workers));
+    if (workers == NULL) {
+        fprintf(stderr, "Error allocating workers: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    for (int i = 0; i < cfg.workers; i++) {
+        workers[i].id = i;
+        workers[i].cpu = cfg.ncpus > 0 ? cfg.cpus[i % cfg.ncpus] : -1;
+        // before start_budgets, which charges its fds. a backend that is not there (io_uring
+        // on an old or locked down kernel) fails here, not with the first client
+        if (cfg.io != PCC_IO_BLOCKING && (workers[i].io = pcc_io_new(cfg.io, 1)) == NULL) {
+            fprintf(stderr, "Error creating %s backend: %s\n", pcc_io_name(cfg.io), strerror(errno));
+            exit(1);
+        }
+    }
+    // every listener shared, or one per worker with -i for TCP
+    for (int j = 0; j < nlisteners; j++) {
+        int own = cfg.incoming_cpu && listeners[j].family != AF_UNIX;
+        int shared_fd = own ? -1 : open_listener(&listeners[j], 0);
+        for (int i = 0; i < cfg.workers; i++) {
+            workers[i].listen_fds[j] = shared_fd;
+            if (own) {
+                workers[i].listen_fds[j] = open_listener(&listeners[j], 1);
+                setsockopt(workers[i].listen_fds[j], SOL_SOCKET, SO_INCOMING_CPU, &workers[i].cpu,
+                           sizeof(workers[i].cpu));
             }
-            sent += r;
+            // with more listeners the workers poll them all, and whoever loses the race for a
+            // connection must not block in accept
+            if (nlisteners > 1) fcntl(workers[i].listen_fds[j], F_SETFL, O_NONBLOCK);
         }
+        if (own) attach_cpu_steering(workers[0].listen_fds[j]);
+    }
 
-        if (sent < sizeof(C_net)) {
-            continue; // skip to the next client
+    start_budgets();
+    for (int i = 0; i < cfg.workers; i++) {
+        int err = pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+        if (err != 0) {
+            fprintf(stderr, "Error creating worker: %s\n", strerror(err));
+            exit(1);
         }
+    }
 
-        //printf("Sent C to client: %u\n", C);
+    int sig;
+    sigwait(&sigint_set, &sig);
+    interrupted = 1;
 
-        // Update the global pcc_total counts
-        for (size_t i = 0; i < 95; i++) {
-            pcc_total[i] += curr_cnts[i]; // add the counts from this client
+    // wake up the workers blocked in accept, the ones processing a client finish it first
+    for (int j = 0; j < nlisteners; j++) {
+        for (int i = 0; i < cfg.workers; i++) {
+            if (i == 0 || workers[i].listen_fds[j] != workers[0].listen_fds[j]) shutdown(workers[i].listen_fds[j], SHUT_RDWR);
         }
+    }
+    for (int i = 0; i < cfg.workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
 
-        // Close the client connection
-        close(conn_fd);
-        conn_fd = -1; // reset the connection fd for the next iteration
+    for (int j = 0; j < nlisteners; j++) {
+        if (listeners[j].family == AF_UNIX) unlink(listeners[j].path);
+    }
+    // every connection is closed and traced by now
+    if (trace != NULL && pcc_trace_finish(trace) < 0) {
+        fprintf(stderr, "Error writing trace %s: %s\n", cfg.capture_path, strerror(errno));
+    }
+
+    // sum up the seed and the workers' counts, pcc_total keeps its 32-bit semantics
+    for (size_t j = 0; j < 95; j++) pcc_total[j] = (uint32_t)pcc_seed.totals[j];
+    for (int i = 0; i < cfg.workers; i++) {
+        for (size_t j = 0; j < 95; j++) {
+            pcc_total[j] += (uint32_t)atomic_load(&workers[i].local->totals[j]);
+        }
     }
 
     // print the counts of printable characters in pcc_total when we stop processing clients
@@ -302,6 +2256,23 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    // estimates of sampled requests come after, in their own format so they are never
+    // mistaken for pcc_total
+    uint64_t est_counts[PCC_NPRINTABLE];
+    uint64_t sampled = sum_estimated(est_counts);
+    if (sampled > 0) {
+        printf("# estimated from %" PRIu64 " sampled requests\n", sampled);
+        for (int i = 0; i < PCC_NPRINTABLE; i++) {
+            if (est_counts[i] > 0) printf("estimated '%c' : %" PRIu64 " times\n", i + PCC_FIRST_PRINTABLE, est_counts[i]);
+        }
+    }
+
+    // after the output, whatever happens to the file the counts are on stdout
+    fflush(stdout);
+    if (cfg.snapshot_path != NULL && save_snapshot() < 0) {
+        fprintf(stderr, "Error saving snapshot %s: %s\n", cfg.snapshot_path, strerror(errno));
+    }
+
     exit(0);
 
 
@@ -0,0 +1,121 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+
+#include "pcc_count.h"
+#include "pcc_sm.h"
+
+void pcc_sm_init(struct pcc_sm *sm, unsigned char *buf, size_t buf_size) {
+    memset(sm, 0, sizeof(*sm));
+    sm->phase = PCC_SM_HEADER;
+    sm->buf = buf;
+    sm->buf_size = buf_size;
+}
+
+void pcc_sm_set_sink(struct pcc_sm *sm, const struct pcc_sm_sink *sink, void *arg) {
+    sm->sink = sink;
+    sm->sink_arg = arg;
+}
+
+void pcc_sm_set_header(struct pcc_sm *sm, void (*header)(struct pcc_sm *sm, void *arg), void *arg) {
+    sm->header = header;
+    sm->header_arg = arg;
+}
+
+int pcc_sm_errno(int err) {
+    if (err == EINTR || err == EAGAIN || err == EWOULDBLOCK) return PCC_SM_ERR_RETRY;
+    if (err == ETIMEDOUT || err == ECONNRESET || err == EPIPE) return PCC_SM_ERR_GONE;
+    return PCC_SM_ERR_OTHER;
+}
+
+// the payload is over, or was cut short with the chunk being read
+static void end_payload(struct pcc_sm *sm) {
+    unsigned char *unused = sm->chunk;
+    sm->chunk = NULL;
+    if (sm->sink != NULL) sm->c = sm->sink->end(sm->sink_arg, unused, sm->counts);
+}
+
+static void finish(struct pcc_sm *sm, int result, int err) {
+    if (sm->phase == PCC_SM_PAYLOAD) end_payload(sm);
+    sm->ended_in = sm->phase;
+    sm->phase = PCC_SM_END;
+    sm->result = result;
+    sm->err = err;
+}
+
+static void start_reply(struct pcc_sm *sm) {
+    end_payload(sm);
+    uint32_t c = htonl((uint32_t)sm->c); // C <= N fits in 32 bits
+    memcpy(sm->word, &c, sizeof(c));
+    sm->pos = 0;
+    sm->phase = PCC_SM_REPLY;
+}
+
+int pcc_sm_next(struct pcc_sm *sm, unsigned char **p, size_t *len) {
+    switch (sm->phase) {
+    case PCC_SM_HEADER:
+    case PCC_SM_REPLY:
+        *p = sm->word + sm->pos;
+        *len = sizeof(sm->word) - sm->pos;
+        return sm->phase == PCC_SM_HEADER ? PCC_SM_READ : PCC_SM_WRITE;
+    case PCC_SM_PAYLOAD:
+        if (sm->chunk == NULL) {
+            // never past the frame, the next one may already be behind it
+            uint64_t left = sm->n - sm->got;
+            if (sm->sink != NULL) {
+                sm->chunk_len = left;
+                sm->chunk = sm->sink->buf(sm->sink_arg, &sm->chunk_len);
+            } else {
+                sm->chunk_len = left < sm->buf_size ? (size_t)left : sm->buf_size;
+                sm->chunk = sm->buf;
+            }
+            sm->pos = 0;
+        }
+        *p = sm->chunk + sm->pos;
+        *len = sm->chunk_len - sm->pos;
+        return PCC_SM_READ;
+    default:
+        return PCC_SM_DONE;
+    }
+}
+
+void pcc_sm_done(struct pcc_sm *sm, ssize_t r) {
+    if (r < 0) {
+        int kind = pcc_sm_errno((int)-r);
+        if (kind != PCC_SM_ERR_RETRY) finish(sm, kind == PCC_SM_ERR_GONE ? PCC_SM_GONE : PCC_SM_FAILED, (int)-r);
+        return;
+    }
+    if (r == 0) {
+        finish(sm, PCC_SM_GONE, 0);
+        return;
+    }
+    sm->pos += r;
+
+    switch (sm->phase) {
+    case PCC_SM_HEADER:
+        if (sm->pos < sizeof(sm->word)) return;
+        uint32_t n;
+        memcpy(&n, sm->word, sizeof(n));
+        sm->n = ntohl(n);
+        if (sm->n == PCC_EXT_MARKER) {
+            finish(sm, PCC_SM_EXT, 0);
+            return;
+        }
+        sm->phase = PCC_SM_PAYLOAD;
+        sm->pos = 0;
+        if (sm->n == 0) start_reply(sm);
+        if (sm->header != NULL) sm->header(sm, sm->header_arg);
+        return;
+    case PCC_SM_PAYLOAD:
+        if (sm->pos < sm->chunk_len) return;
+        if (sm->sink != NULL) sm->sink->data(sm->sink_arg, sm->chunk, sm->chunk_len);
+        else sm->c += pcc_count(sm->chunk, sm->chunk_len, sm->counts);
+        sm->got += sm->chunk_len;
+        sm->chunk = NULL;
+        if (sm->got == sm->n) start_reply(sm);
+        return;
+    case PCC_SM_REPLY:
+        if (sm->pos == sizeof(sm->word)) finish(sm, PCC_SM_OK, 0);
+        return;
+    }
+}
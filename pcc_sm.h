@@ -0,0 +1,108 @@
+#ifndef PCC_SM_H
+#define PCC_SM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "pcc_proto.h"
+
+/*
+    a basic frame (N, payload, C) as a resumable state machine, apart from how its bytes
+    move
+
+    the machine never does I/O itself. pcc_sm_next says what it waits for: a read of up
+    to len bytes into p, a write of len bytes from p, or nothing more (done). whoever does
+    the I/O (the server's blocking sockets, or a backend of pcc_io.h: blocking, epoll,
+    io_uring) does it whenever it can and hands the outcome to pcc_sm_done: the bytes
+    moved, 0 for end of file, or -errno. short reads and writes continue where they
+    stopped, -EINTR and -EAGAIN change nothing, so the same machine runs unchanged on
+    every backend and a backend never needs a loop of its own per step.
+
+        HEADER      the 4 bytes of N. PCC_EXT_MARKER ends the machine with PCC_SM_EXT
+        PAYLOAD     N bytes, in chunks of at most buf_size bytes. a chunk is counted (or
+                    handed to the sink) once it is complete
+        REPLY       the 4 bytes of C
+        END         result says how it went
+
+    the payload goes through a sink if one is set (pcc_sm_set_sink, after the header):
+    buffers come from it, complete chunks go to it and it gives the count at the end, the
+    server uses that for its counting pool. without one the machine counts into counts
+    with pcc_count, in the buffer pcc_sm_init got. a header hook (pcc_sm_set_header) is
+    called inside pcc_sm_done once N is in, whatever backend moved it, which is where the
+    server picks the sink.
+
+    a client that goes away (end of file before the reply, ECONNRESET, EPIPE, ETIMEDOUT)
+    ends it with PCC_SM_GONE, any other error with PCC_SM_FAILED, err is the errno (0 for
+    an end of file). what the client sent is then not counted anywhere: committing a
+    PCC_SM_OK frame is up to the caller, like the reply the commit comes after.
+*/
+
+// what pcc_sm_next waits for
+#define PCC_SM_READ 1
+#define PCC_SM_WRITE 2
+#define PCC_SM_DONE 3
+
+// phases
+#define PCC_SM_HEADER 0
+#define PCC_SM_PAYLOAD 1
+#define PCC_SM_REPLY 2
+#define PCC_SM_END 3
+
+// results
+#define PCC_SM_OK 0 // counted and replied
+#define PCC_SM_EXT 1 // N was PCC_EXT_MARKER, the rest is an extended frame
+#define PCC_SM_GONE 2 // the client went away
+#define PCC_SM_FAILED 3 // any other error
+
+// what pcc_sm_errno makes of an errno
+#define PCC_SM_ERR_RETRY 0 // EINTR, EAGAIN: nothing happened, do it again
+#define PCC_SM_ERR_GONE 1 // ECONNRESET, EPIPE, ETIMEDOUT: the client is gone
+#define PCC_SM_ERR_OTHER 2
+
+struct pcc_sm_sink {
+    // a buffer for the next chunk of *len payload bytes, *len may be lowered
+    unsigned char *(*buf)(void *arg, size_t *len);
+    // a chunk of len bytes arrived in buf
+    void (*data)(void *arg, unsigned char *buf, size_t len);
+    // the payload is over, or the client gone (unused is then a buffer of buf that got no
+    // chunk, or NULL). sets the counts and returns the printable chars
+    uint64_t (*end)(void *arg, unsigned char *unused, uint64_t counts[PCC_NPRINTABLE]);
+};
+
+struct pcc_sm {
+    int phase;
+    int result; // PCC_SM_OK ... once phase is PCC_SM_END
+    int err; // errno of a PCC_SM_GONE / PCC_SM_FAILED, 0 for an end of file
+    int ended_in; // the phase it was in when it ended
+    uint32_t n; // N, once the header is in
+    uint64_t got; // payload bytes of the chunks so far
+    uint64_t counts[PCC_NPRINTABLE];
+    uint64_t c;
+    unsigned char word[4]; // N, then C in network order
+    size_t pos; // bytes of word, or of the chunk, moved so far
+    unsigned char *buf; // the machine's own chunk buffer
+    size_t buf_size;
+    unsigned char *chunk; // buffer of the chunk being read, NULL between chunks
+    size_t chunk_len;
+    const struct pcc_sm_sink *sink;
+    void *sink_arg;
+    void (*header)(struct pcc_sm *sm, void *arg);
+    void *header_arg;
+};
+
+// a machine at the start of a frame, counting in chunks of buf (not needed with a sink)
+void pcc_sm_init(struct pcc_sm *sm, unsigned char *buf, size_t buf_size);
+// let sink take the payload, from the start of the payload phase until the first read
+void pcc_sm_set_sink(struct pcc_sm *sm, const struct pcc_sm_sink *sink, void *arg);
+// have header called once N is in (not for PCC_EXT_MARKER), with the phase already
+// PCC_SM_PAYLOAD, or PCC_SM_REPLY for an N of 0. it may set the sink
+void pcc_sm_set_header(struct pcc_sm *sm, void (*header)(struct pcc_sm *sm, void *arg), void *arg);
+// the I/O the machine waits for, the same one again until pcc_sm_done took its outcome
+int pcc_sm_next(struct pcc_sm *sm, unsigned char **p, size_t *len);
+// the outcome of that I/O: bytes moved, 0 for end of file, or -errno
+void pcc_sm_done(struct pcc_sm *sm, ssize_t r);
+// PCC_SM_ERR_* of an errno, for I/O done outside a machine
+int pcc_sm_errno(int err);
+
+#endif
@@ -0,0 +1,420 @@
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pcc_crc.h"
+#include "pcc_snap.h"
+
+#define HDR_SIZE 24
+#define SECTION_HDR_SIZE 16
+#define TRAILER_SIZE 8
+#define ID_SIZE 72 // PCC_TENANT_ID_MAX / PCC_STREAM_ID_MAX + 1, padded to 8
+
+#define TOTALS_SIZE (8 + 8 * PCC_NPRINTABLE)
+#define WINDOW_RECORD (16 + 8 * PCC_NPRINTABLE)
+#define TABLE_HDR 16
+#define TENANT_RECORD (ID_SIZE + 32 + 8 * PCC_NPRINTABLE)
+#define STREAM_RECORD (ID_SIZE + 32 + 8 * PCC_NPRINTABLE)
+
+_Static_assert(PCC_TENANT_ID_MAX < ID_SIZE && PCC_STREAM_ID_MAX < ID_SIZE, "ids must fit their record");
+
+// a growing output buffer, a failed allocation sticks and is reported at the end
+struct out {
+    unsigned char *buf;
+    size_t len, cap;
+    int failed;
+};
+
+static unsigned char *out_reserve(struct out *o, size_t n) {
+    if (o->failed) return NULL;
+    if (o->len + n > o->cap) {
+        size_t cap = o->cap ? o->cap : 4096;
+        while (cap < o->len + n) cap *= 2;
+        unsigned char *b = realloc(o->buf, cap);
+        if (b == NULL) {
+            o->failed = 1;
+            return NULL;
+        }
+        o->buf = b;
+        o->cap = cap;
+    }
+    unsigned char *p = o->buf + o->len;
+    o->len += n;
+    return p;
+}
+
+static void put32(struct out *o, uint32_t v) {
+    unsigned char *p = out_reserve(o, 4);
+    v = htole32(v);
+    if (p != NULL) memcpy(p, &v, 4);
+}
+
+static void put64(struct out *o, uint64_t v) {
+    unsigned char *p = out_reserve(o, 8);
+    v = htole64(v);
+    if (p != NULL) memcpy(p, &v, 8);
+}
+
+static void put_counts(struct out *o, const uint64_t counts[PCC_NPRINTABLE]) {
+    for (int i = 0; i < PCC_NPRINTABLE; i++) put64(o, counts[i]);
+}
+
+static void put_id(struct out *o, const char *id) {
+    unsigned char *p = out_reserve(o, ID_SIZE);
+    if (p == NULL) return;
+    memset(p, 0, ID_SIZE);
+    memcpy(p, id, strnlen(id, ID_SIZE - 1));
+}
+
+// start a section, returns where its header is so section_end can fill in count and len
+static size_t section_begin(struct out *o, uint32_t type) {
+    size_t at = o->len;
+    put32(o, type);
+    put32(o, 0);
+    put64(o, 0);
+    return at;
+}
+
+static void section_end(struct out *o, size_t at, uint32_t count, uint32_t *nsections) {
+    if (o->failed) return;
+    uint32_t c = htole32(count);
+    uint64_t len = htole64(o->len - at - SECTION_HDR_SIZE);
+    memcpy(o->buf + at + 4, &c, 4);
+    memcpy(o->buf + at + 8, &len, 8);
+    (*nsections)++;
+}
+
+int pcc_snap_encode(const struct pcc_snap *s, unsigned char **buf, size_t *len) {
+    struct out o = {0};
+    uint32_t nsections = 0;
+    size_t at;
+
+    unsigned char *magic = out_reserve(&o, 8);
+    if (magic == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(magic, PCC_SNAP_MAGIC, 8);
+    put32(&o, PCC_SNAP_VERSION);
+    put32(&o, 0); // nsections, filled in below
+    put64(&o, s->created);
+
+    at = section_begin(&o, PCC_SNAP_TOTALS);
+    put64(&o, s->requests);
+    put_counts(&o, s->totals);
+    section_end(&o, at, 1, &nsections);
+
+    at = section_begin(&o, PCC_SNAP_ESTIMATED);
+    put64(&o, s->sampled);
+    put_counts(&o, s->est_totals);
+    section_end(&o, at, 1, &nsections);
+
+    if (s->win != NULL) {
+        uint32_t count = 0;
+        at = section_begin(&o, PCC_SNAP_WINDOW);
+        for (uint32_t k = 0; k < PCC_WIN_TIERS; k++) {
+            const struct pcc_window_tier *tier = &s->win->tiers[k];
+            for (uint32_t i = 0; i < tier->nslots; i++) {
+                struct pcc_window_slot *slot = &tier->slots[i];
+                uint64_t epoch = atomic_load_explicit(&slot->epoch, memory_order_acquire);
+                if (epoch == 0 || (epoch >> 63)) continue; // never used, or being recycled right now
+                put32(&o, k);
+                put32(&o, 0);
+                put64(&o, epoch);
+                for (int j = 0; j < PCC_NPRINTABLE; j++) {
+                    put64(&o, atomic_load_explicit(&slot->counts[j], memory_order_relaxed));
+                }
+                count++;
+            }
+        }
+        section_end(&o, at, count, &nsections);
+    }
+
+    if (s->tenants != NULL) {
+        const struct pcc_tenant_table *t = s->tenants;
+        uint32_t count = 0;
+        at = section_begin(&o, PCC_SNAP_TENANTS);
+        put64(&o, t->tab.nslots);
+        put64(&o, t->tab.evictions);
+        for (size_t i = 0; i < t->tab.nslots; i++) {
+            if (t->tab.hashes[i] == 0) continue;
+            const struct pcc_tenant *e = &t->entries[i];
+            put_id(&o, e->id);
+            put64(&o, e->requests);
+            put64(&o, e->bytes);
+            put64(&o, e->printable);
+            put64(&o, e->error);
+            put_counts(&o, e->counts);
+            count++;
+        }
+        section_end(&o, at, count, &nsections);
+    }
+
+    if (s->streams != NULL) {
+        const struct pcc_stream_table *t = s->streams;
+        uint32_t count = 0;
+        at = section_begin(&o, PCC_SNAP_STREAMS);
+        put64(&o, t->tab.nslots);
+        put64(&o, t->tab.evictions);
+        for (size_t i = 0; i < t->tab.nslots; i++) {
+            if (t->tab.hashes[i] == 0) continue;
+            const struct pcc_stream *e = &t->entries[i];
+            put_id(&o, e->id);
+            put64(&o, e->offset);
+            put64(&o, e->printable);
+            put64(&o, e->appends);
+            put64(&o, e->restarts);
+            put_counts(&o, e->counts);
+            count++;
+        }
+        section_end(&o, at, count, &nsections);
+    }
+
+    if (o.failed) {
+        free(o.buf);
+        errno = ENOMEM;
+        return -1;
+    }
+    uint32_t n = htole32(nsections);
+    memcpy(o.buf + 12, &n, 4);
+    put32(&o, pcc_crc32c(0, o.buf, o.len));
+    put32(&o, 0);
+    if (o.failed) {
+        free(o.buf);
+        errno = ENOMEM;
+        return -1;
+    }
+    *buf = o.buf;
+    *len = o.len;
+    return 0;
+}
+
+static uint32_t get32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return le32toh(v);
+}
+
+static uint64_t get64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return le64toh(v);
+}
+
+static void get_counts(const unsigned char *p, uint64_t counts[PCC_NPRINTABLE]) {
+    for (int i = 0; i < PCC_NPRINTABLE; i++) counts[i] = get64(p + 8 * i);
+}
+
+// the payload size a section of this type and count must have, *known 0 for types we
+// don't know
+static uint64_t section_size(uint32_t type, uint32_t count, int *known) {
+    *known = 1;
+    switch (type) {
+    case PCC_SNAP_TOTALS:
+    case PCC_SNAP_ESTIMATED:
+        return count == 1 ? TOTALS_SIZE : UINT64_MAX;
+    case PCC_SNAP_WINDOW:
+        return (uint64_t)count * WINDOW_RECORD;
+    case PCC_SNAP_TENANTS:
+        return TABLE_HDR + (uint64_t)count * TENANT_RECORD;
+    case PCC_SNAP_STREAMS:
+        return TABLE_HDR + (uint64_t)count * STREAM_RECORD;
+    default:
+        *known = 0;
+        return 0;
+    }
+}
+
+// walk the sections, calling fn for each. with fn NULL only checks that they are well
+// formed. returns 0, or -1 with errno set
+static int for_sections(const unsigned char *buf, size_t len,
+                        void (*fn)(uint32_t type, uint32_t count, const unsigned char *p, void *arg), void *arg) {
+    if (len < HDR_SIZE + TRAILER_SIZE || memcmp(buf, PCC_SNAP_MAGIC, 8) != 0) {
+        errno = EBADMSG;
+        return -1;
+    }
+    if (get32(buf + 8) != PCC_SNAP_VERSION) {
+        errno = EPROTONOSUPPORT;
+        return -1;
+    }
+    size_t end = len - TRAILER_SIZE;
+    if (fn == NULL && pcc_crc32c(0, buf, end) != get32(buf + end)) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    uint32_t nsections = get32(buf + 12);
+    size_t off = HDR_SIZE;
+    for (uint32_t i = 0; i < nsections; i++) {
+        if (end - off < SECTION_HDR_SIZE) {
+            errno = EBADMSG;
+            return -1;
+        }
+        uint32_t type = get32(buf + off), count = get32(buf + off + 4);
+        uint64_t slen = get64(buf + off + 8);
+        off += SECTION_HDR_SIZE;
+        int known;
+        uint64_t want = section_size(type, count, &known);
+        if (slen > end - off || (known && want != slen)) {
+            errno = EBADMSG;
+            return -1;
+        }
+        if (fn != NULL && known) fn(type, count, buf + off, arg);
+        off += slen;
+    }
+    if (off != end) {
+        errno = EBADMSG;
+        return -1;
+    }
+    return 0;
+}
+
+static void restore_section(uint32_t type, uint32_t count, const unsigned char *p, void *arg) {
+    struct pcc_snap *s = arg;
+
+    switch (type) {
+    case PCC_SNAP_TOTALS:
+        s->requests = get64(p);
+        get_counts(p + 8, s->totals);
+        break;
+    case PCC_SNAP_ESTIMATED:
+        s->sampled = get64(p);
+        get_counts(p + 8, s->est_totals);
+        break;
+    case PCC_SNAP_WINDOW:
+        for (uint32_t i = 0; s->win != NULL && i < count; i++, p += WINDOW_RECORD) {
+            uint64_t counts[PCC_NPRINTABLE];
+            get_counts(p + 16, counts);
+            pcc_window_restore(s->win, get32(p), get64(p + 8), counts);
+        }
+        break;
+    case PCC_SNAP_TENANTS:
+        if (s->tenants == NULL) break;
+        s->tenants->tab.evictions += get64(p + 8);
+        p += TABLE_HDR;
+        for (uint32_t i = 0; i < count; i++, p += TENANT_RECORD) {
+            struct pcc_tenant e = {0};
+            memcpy(e.id, p, PCC_TENANT_ID_MAX); // e.id[PCC_TENANT_ID_MAX] stays NUL
+            const unsigned char *q = p + ID_SIZE;
+            e.requests = get64(q);
+            e.bytes = get64(q + 8);
+            e.printable = get64(q + 16);
+            e.error = get64(q + 24);
+            get_counts(q + 32, e.counts);
+            if (e.id[0] != '\0') pcc_tenant_restore(s->tenants, &e);
+        }
+        break;
+    case PCC_SNAP_STREAMS:
+        if (s->streams == NULL) break;
+        s->streams->tab.evictions += get64(p + 8);
+        p += TABLE_HDR;
+        for (uint32_t i = 0; i < count; i++, p += STREAM_RECORD) {
+            struct pcc_stream e = {0};
+            memcpy(e.id, p, PCC_STREAM_ID_MAX);
+            const unsigned char *q = p + ID_SIZE;
+            e.offset = get64(q);
+            e.printable = get64(q + 8);
+            e.appends = get64(q + 16);
+            e.restarts = get64(q + 24);
+            get_counts(q + 32, e.counts);
+            if (e.id[0] != '\0') pcc_stream_restore(s->streams, &e);
+        }
+        break;
+    }
+}
+
+int pcc_snap_decode(const unsigned char *buf, size_t len, struct pcc_snap *s) {
+    // everything is checked before anything is restored, a broken file changes nothing
+    if (for_sections(buf, len, NULL, NULL) < 0) return -1;
+    s->created = get64(buf + 16);
+    return for_sections(buf, len, restore_section, s);
+}
+
+static void note_slots(uint32_t type, uint32_t count, const unsigned char *p, void *arg) {
+    size_t *slots = arg;
+    (void)count;
+    if (type == PCC_SNAP_TENANTS) slots[0] = get64(p);
+    if (type == PCC_SNAP_STREAMS) slots[1] = get64(p);
+}
+
+int pcc_snap_slots(const unsigned char *buf, size_t len, size_t *tenant_slots, size_t *stream_slots) {
+    size_t slots[2] = {0, 0};
+    if (for_sections(buf, len, NULL, NULL) < 0) return -1;
+    for_sections(buf, len, note_slots, slots);
+    *tenant_slots = slots[0];
+    *stream_slots = slots[1];
+    return 0;
+}
+
+int pcc_snap_write(const char *path, const unsigned char *buf, size_t len) {
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    // a name of its own, a writer never truncates the file of another one
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0) return -1;
+    if (fchmod(fd, 0644) < 0) goto fail;
+    for (size_t off = 0; off < len;) {
+        ssize_t w = write(fd, buf + off, len - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) goto fail;
+        off += w;
+    }
+    if (fsync(fd) < 0) goto fail;
+    if (close(fd) < 0) {
+        fd = -1;
+        goto fail;
+    }
+    if (rename(tmp, path) < 0) {
+        fd = -1;
+        goto fail;
+    }
+    return 0;
+
+fail:;
+    int err = errno;
+    if (fd >= 0) close(fd);
+    unlink(tmp);
+    errno = err;
+    return -1;
+}
+
+int pcc_snap_map(const char *path, const unsigned char **buf, size_t *len) {
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        errno = EBADMSG;
+        return -1;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    int err = errno;
+    close(fd);
+    if (p == MAP_FAILED) {
+        errno = err;
+        return -1;
+    }
+    *buf = p;
+    *len = st.st_size;
+    return 0;
+}
+
+void pcc_snap_unmap(const unsigned char *buf, size_t len) {
+    munmap((void *)buf, len);
+}
@@ -0,0 +1,84 @@
+#ifndef PCC_SNAP_H
+#define PCC_SNAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pcc_proto.h"
+#include "pcc_stream.h"
+#include "pcc_tenant.h"
+#include "pcc_window.h"
+
+/*
+    snapshots: the server's counters in one binary file, to look at offline (pcc_snap) or
+    to start a server from where another one stopped (pcc_server --load)
+
+    every integer is little endian, whatever the host is. the file is
+
+        header      magic "PCCSNAP\0", u32 version, u32 nsections, u64 created (unix time)
+        sections    u32 type, u32 count, u64 len, then len bytes of payload
+        trailer     u32 CRC32C (pcc_crc.h) of everything before it, u32 zero
+
+    sections, a reader skips the types it doesn't know, so new ones don't need a new
+    version (changing an existing layout does):
+
+        TOTALS      u64 requests, u64 counts[95], pcc_total of every request so far
+        ESTIMATED   u64 sampled requests, u64 counts[95], the estimated totals
+        WINDOW      count records of u32 tier, u32 zero, u64 epoch, u64 counts[95], every
+                    interval of pcc_window.h that has one
+        TENANTS     u64 nslots, u64 evictions, then count records of char id[72] (NUL
+                    padded), u64 requests, bytes, printable, error, counts[95]
+        STREAMS     u64 nslots, u64 evictions, then count records of char id[72],
+                    u64 offset, printable, appends, restarts, counts[95]
+
+    a section with a len that doesn't fit its count is a broken file, as is a checksum
+    mismatch: decoding fails as a whole and changes nothing. the records are fixed size,
+    so loading is a few memcpy()s and hash inserts, well under a millisecond for full
+    tables.
+*/
+
+#define PCC_SNAP_MAGIC "PCCSNAP"
+#define PCC_SNAP_VERSION 1
+
+enum {
+    PCC_SNAP_TOTALS = 1,
+    PCC_SNAP_ESTIMATED = 2,
+    PCC_SNAP_WINDOW = 3,
+    PCC_SNAP_TENANTS = 4,
+    PCC_SNAP_STREAMS = 5,
+};
+
+// what goes into a snapshot and comes out of one. the tables and the window are optional,
+// NULL ones are not written, and their sections are skipped when decoding
+struct pcc_snap {
+    uint64_t created;
+    uint64_t requests;
+    uint64_t totals[PCC_NPRINTABLE];
+    uint64_t sampled;
+    uint64_t est_totals[PCC_NPRINTABLE];
+    struct pcc_window *win;
+    struct pcc_tenant_table *tenants;
+    struct pcc_stream_table *streams;
+};
+
+// encode s into a new malloc()ed buffer. returns 0, or -1 with errno set
+int pcc_snap_encode(const struct pcc_snap *s, unsigned char **buf, size_t *len);
+// check buf and restore it into s: the counters are overwritten, intervals and entries
+// are added to s->win and the tables. returns 0, or -1 with errno EBADMSG for a broken
+// file or EPROTONOSUPPORT for another version, and then s is left alone
+int pcc_snap_decode(const unsigned char *buf, size_t len, struct pcc_snap *s);
+
+// the table sizes a snapshot was taken with (0 if it has no such section), so a reader
+// can make tables that take it without evicting anything. returns 0, or -1 with errno set
+// like pcc_snap_decode
+int pcc_snap_slots(const unsigned char *buf, size_t len, size_t *tenant_slots, size_t *stream_slots);
+
+// write buf to path atomically: a temporary file of its own next to it (path.XXXXXX),
+// fsync()ed and renamed over path. returns 0, or -1 with errno set
+int pcc_snap_write(const char *path, const unsigned char *buf, size_t len);
+// map the whole file, read only and populated up front, so decoding it neither copies nor
+// faults page by page. returns 0, or -1 with errno set (EBADMSG for an empty file)
+int pcc_snap_map(const char *path, const unsigned char **buf, size_t *len);
+void pcc_snap_unmap(const unsigned char *buf, size_t len);
+
+#endif
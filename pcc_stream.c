@@ -0,0 +1,71 @@
+#include <string.h>
+
+#include "pcc_stream.h"
+
+// the stream appended to longest ago goes first
+static uint64_t stream_weight(const void *entry) {
+    return ((const struct pcc_stream *)entry)->last;
+}
+
+int pcc_stream_init(struct pcc_stream_table *t, size_t nslots) {
+    if (pcc_table_init(&t->tab, nslots, sizeof(struct pcc_stream), stream_weight) < 0) return -1;
+    t->entries = t->tab.entries;
+    t->seq = 0;
+    return 0;
+}
+
+void pcc_stream_free(struct pcc_stream_table *t) {
+    pcc_table_free(&t->tab);
+    t->entries = NULL;
+}
+
+uint64_t pcc_stream_offset(const struct pcc_stream_table *t, const char *id) {
+    const struct pcc_stream *e = pcc_stream_find(t, id);
+    return e != NULL ? e->offset : 0;
+}
+
+const struct pcc_stream *pcc_stream_append(struct pcc_stream_table *t, const char *id, uint64_t offset, uint64_t bytes,
+                                           const uint64_t counts[PCC_NPRINTABLE]) {
+    uint64_t h = pcc_table_hash(id);
+    int found;
+    size_t s = pcc_table_slot(&t->tab, id, h, &found);
+    struct pcc_stream *e = &t->entries[s];
+
+    if (offset != 0 && (!found || offset != e->offset)) return NULL;
+
+    if (!found) {
+        pcc_table_take(&t->tab, s, h);
+        memset(e, 0, sizeof(*e));
+        strncpy(e->id, id, PCC_STREAM_ID_MAX);
+    } else if (offset == 0 && e->offset > 0) {
+        memset(e->counts, 0, sizeof(e->counts));
+        e->offset = e->printable = 0;
+        e->restarts++;
+    }
+
+    e->offset += bytes;
+    e->appends++;
+    e->last = ++t->seq;
+    for (size_t i = 0; i < PCC_NPRINTABLE; i++) {
+        e->counts[i] += counts[i];
+        e->printable += counts[i];
+    }
+    return e;
+}
+
+void pcc_stream_restore(struct pcc_stream_table *t, const struct pcc_stream *e) {
+    uint64_t h = pcc_table_hash(e->id);
+    int found;
+    size_t s = pcc_table_slot(&t->tab, e->id, h, &found);
+
+    if (!found) pcc_table_take(&t->tab, s, h);
+    t->entries[s] = *e;
+    t->entries[s].id[PCC_STREAM_ID_MAX] = '\0';
+    t->entries[s].last = ++t->seq;
+}
+
+const struct pcc_stream *pcc_stream_find(const struct pcc_stream_table *t, const char *id) {
+    int found;
+    size_t s = pcc_table_slot(&t->tab, id, pcc_table_hash(id), &found);
+    return found ? &t->entries[s] : NULL;
+}
@@ -0,0 +1,67 @@
+#ifndef PCC_STREAM_H
+#define PCC_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pcc_proto.h"
+#include "pcc_table.h"
+
+/*
+    append-only streams (PCC_OPT_STREAM)
+
+    a client that follows a growing file sends only the bytes appended since last time,
+    each request tagged with the stream id and the offset of its first byte. the server
+    keeps where every stream continues and its running histogram, so the reply is the
+    count of everything up to the new end while only the delta went over the wire.
+
+    an append is accepted only at the offset where the stream continues, or at offset 0,
+    which starts the stream over (the file was truncated or replaced). anything else is
+    refused with PCC_STATUS_STREAM_OFFSET and the offset the stream is at, the client
+    decides whether to continue from there or to start over.
+
+    the table is a pcc_table (pcc_table.h) whose weight is the sequence number of the last
+    append: when a new stream finds its probe window full, the one appended to longest ago
+    is evicted, its client has to start over at offset 0.
+
+    not thread safe, the server serializes access.
+*/
+
+#define PCC_STREAM_ID_MAX 64
+#define PCC_STREAM_DEFAULT_SLOTS 1024
+
+struct pcc_stream {
+    char id[PCC_STREAM_ID_MAX + 1]; // first, see pcc_table.h
+    uint64_t offset; // bytes so far, where the next append has to start
+    uint64_t printable;
+    uint64_t appends;
+    uint64_t restarts; // appends at offset 0 to a stream that had bytes
+    uint64_t last; // table sequence number of the last append, for eviction
+    uint64_t counts[PCC_NPRINTABLE];
+};
+
+struct pcc_stream_table {
+    struct pcc_table tab; // slots, hashes, used, max_used and evictions
+    struct pcc_stream *entries; // tab.entries
+    uint64_t seq;
+};
+
+// nslots is rounded up to a power of two. returns 0 on success, -1 with errno set
+int pcc_stream_init(struct pcc_stream_table *t, size_t nslots);
+void pcc_stream_free(struct pcc_stream_table *t);
+
+// where the stream continues, 0 for a stream the table does not have
+uint64_t pcc_stream_offset(const struct pcc_stream_table *t, const char *id);
+
+// append bytes (with their counts) at offset. returns the stream, or NULL if offset is
+// neither where it continues nor 0, and then the table is left alone
+const struct pcc_stream *pcc_stream_append(struct pcc_stream_table *t, const char *id, uint64_t offset, uint64_t bytes,
+                                           const uint64_t counts[PCC_NPRINTABLE]);
+
+// put a stream back as it was (loading a snapshot), as the most recently appended one
+void pcc_stream_restore(struct pcc_stream_table *t, const struct pcc_stream *e);
+
+// NULL if the stream is not (or no longer) in the table
+const struct pcc_stream *pcc_stream_find(const struct pcc_stream_table *t, const char *id);
+
+#endif
@@ -0,0 +1,107 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcc_table.h"
+
+uint64_t pcc_table_hash(const char *id) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const unsigned char *p = (const unsigned char *)id; *p != '\0'; p++) {
+        h ^= *p;
+        h *= 0x100000001b3ULL;
+    }
+    return h != 0 ? h : 1;
+}
+
+int pcc_table_init(struct pcc_table *t, size_t nslots, size_t entry_size, pcc_table_weight_fn weight) {
+    size_t n = PCC_TABLE_PROBE;
+    while (n < nslots) n <<= 1;
+
+    memset(t, 0, sizeof(*t));
+    t->nslots = n;
+    t->entry_size = entry_size;
+    t->weight = weight;
+    t->hashes = calloc(n, sizeof(*t->hashes));
+    t->entries = calloc(n, entry_size);
+    if (t->hashes == NULL || t->entries == NULL) {
+        pcc_table_free(t);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+void pcc_table_free(struct pcc_table *t) {
+    free(t->hashes);
+    free(t->entries);
+    t->hashes = NULL;
+    t->entries = NULL;
+    t->nslots = t->used = 0;
+}
+
+static int table_full(const struct pcc_table *t) {
+    return t->max_used != 0 && t->used >= t->max_used;
+}
+
+size_t pcc_table_slot(const struct pcc_table *t, const char *id, uint64_t h, int *found) {
+    size_t mask = t->nslots - 1;
+    size_t free_slot = (size_t)-1;
+    size_t victim = (size_t)-1;
+    uint64_t victim_weight = UINT64_MAX;
+
+    for (size_t i = 0; i < PCC_TABLE_PROBE; i++) {
+        size_t s = (h + i) & mask;
+        const void *e = pcc_table_entry(t, s);
+        if (t->hashes[s] == h && strcmp(e, id) == 0) {
+            *found = 1;
+            return s;
+        }
+        if (t->hashes[s] == 0) {
+            if (free_slot == (size_t)-1) free_slot = s;
+            continue;
+        }
+        uint64_t weight = t->weight(e);
+        if (weight < victim_weight) {
+            victim_weight = weight;
+            victim = s;
+        }
+    }
+    *found = 0;
+    // at max_used a free slot is only taken when there is nothing to evict
+    if (free_slot != (size_t)-1 && (victim == (size_t)-1 || !table_full(t))) return free_slot;
+    return victim;
+}
+
+// make room for one more below max_used when the probe window had none to evict: drop the
+// lightest entry of the whole table. returns its weight
+static uint64_t evict_lightest(struct pcc_table *t) {
+    size_t victim = (size_t)-1;
+    uint64_t victim_weight = UINT64_MAX;
+    for (size_t s = 0; s < t->nslots; s++) {
+        if (t->hashes[s] == 0) continue;
+        uint64_t weight = t->weight(pcc_table_entry(t, s));
+        if (weight < victim_weight) {
+            victim_weight = weight;
+            victim = s;
+        }
+    }
+    if (victim == (size_t)-1) return 0;
+    t->hashes[victim] = 0; // lookups scan the whole window, a hole doesn't hide anything
+    t->used--;
+    t->evictions++;
+    return victim_weight;
+}
+
+uint64_t pcc_table_take(struct pcc_table *t, size_t s, uint64_t h) {
+    uint64_t evicted = 0;
+    if (t->hashes[s] != 0) {
+        // probe window is full, recycle its lightest entry
+        evicted = t->weight(pcc_table_entry(t, s));
+        t->evictions++;
+    } else {
+        if (table_full(t)) evicted = evict_lightest(t);
+        t->used++;
+    }
+    t->hashes[s] = h;
+    return evicted;
+}
@@ -0,0 +1,64 @@
+#ifndef PCC_TABLE_H
+#define PCC_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    bounded hash table of text ids, what the tenant (pcc_tenant.h) and stream
+    (pcc_stream.h) tables are built on
+
+    open addressing with linear probing over a power of two number of slots. the 64-bit
+    key hashes live in their own dense array, so a lookup touches one or two cache lines
+    of hashes and then the single entry it found. a probe never goes further than
+    PCC_TABLE_PROBE slots: when a new id finds no free slot in its probe window, the
+    entry of that window with the smallest weight is evicted and the new one takes its
+    slot. so memory is bounded and what the table keeps is decided by the weight alone.
+
+    max_used caps the entries below nslots (a resource budget, see pcc_budget.h): once
+    that many are used, a new id evicts the lightest one of its probe window even when
+    the window has a free slot, or the lightest one of the table if the window is empty.
+
+    entries are entry_size bytes and start with their '\0' terminated id. the table only
+    finds slots and evicts, what an entry holds and how it is updated is the caller's.
+
+    not thread safe.
+*/
+
+#define PCC_TABLE_PROBE 8
+
+// of an entry, the lightest one is evicted
+typedef uint64_t (*pcc_table_weight_fn)(const void *entry);
+
+struct pcc_table {
+    size_t nslots; // power of two
+    size_t used;
+    size_t max_used; // 0 for nslots, set after init
+    uint64_t evictions;
+    uint64_t *hashes; // 0 = free slot
+    void *entries;
+    size_t entry_size;
+    pcc_table_weight_fn weight;
+};
+
+// FNV-1a of id, never 0 since 0 marks a free slot
+uint64_t pcc_table_hash(const char *id);
+
+// nslots is rounded up to a power of two. returns 0 on success, -1 with errno set
+int pcc_table_init(struct pcc_table *t, size_t nslots, size_t entry_size, pcc_table_weight_fn weight);
+void pcc_table_free(struct pcc_table *t);
+
+// the slot of id, whose hash is h, with *found set. otherwise the slot a new entry for
+// it goes to and *found 0, that slot may still hold the entry pcc_table_take evicts
+size_t pcc_table_slot(const struct pcc_table *t, const char *id, uint64_t h, int *found);
+
+// take slot s (from pcc_table_slot, not found) for a new entry with hash h, evicting
+// the entry in it, or the lightest of the table at max_used. returns the weight of the
+// evicted entry, 0 if none was. the caller fills the entry in
+uint64_t pcc_table_take(struct pcc_table *t, size_t s, uint64_t h);
+
+static inline void *pcc_table_entry(const struct pcc_table *t, size_t s) {
+    return (char *)t->entries + s * t->entry_size;
+}
+
+#endif
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcc_tenant.h"
+
+// what space-saving evicts by
+static uint64_t tenant_weight(const void *entry) {
+    const struct pcc_tenant *e = entry;
+    return e->bytes + e->error;
+}
+
+int pcc_tenant_init(struct pcc_tenant_table *t, size_t nslots) {
+    if (pcc_table_init(&t->tab, nslots, sizeof(struct pcc_tenant), tenant_weight) < 0) return -1;
+    t->entries = t->tab.entries;
+    return 0;
+}
+
+void pcc_tenant_free(struct pcc_tenant_table *t) {
+    pcc_table_free(&t->tab);
+    t->entries = NULL;
+}
+
+void pcc_tenant_add(struct pcc_tenant_table *t, const char *id, uint64_t bytes, const uint64_t counts[PCC_NPRINTABLE]) {
+    uint64_t h = pcc_table_hash(id);
+    int found;
+    size_t s = pcc_table_slot(&t->tab, id, h, &found);
+    struct pcc_tenant *e = &t->entries[s];
+
+    if (!found) {
+        uint64_t error = pcc_table_take(&t->tab, s, h);
+        memset(e, 0, sizeof(*e));
+        strncpy(e->id, id, PCC_TENANT_ID_MAX);
+        e->error = error;
+    }
+
+    e->requests++;
+    e->bytes += bytes;
+    for (size_t i = 0; i < PCC_NPRINTABLE; i++) {
+        e->counts[i] += counts[i];
+        e->printable += counts[i];
+    }
+}
+
+void pcc_tenant_restore(struct pcc_tenant_table *t, const struct pcc_tenant *e) {
+    uint64_t h = pcc_table_hash(e->id);
+    int found;
+    size_t s = pcc_table_slot(&t->tab, e->id, h, &found);
+    uint64_t error = found ? 0 : pcc_table_take(&t->tab, s, h);
+
+    t->entries[s] = *e;
+    t->entries[s].id[PCC_TENANT_ID_MAX] = '\0';
+    t->entries[s].error += error;
+}
+
+const struct pcc_tenant *pcc_tenant_find(const struct pcc_tenant_table *t, const char *id) {
+    int found;
+    size_t s = pcc_table_slot(&t->tab, id, pcc_table_hash(id), &found);
+    return found ? &t->entries[s] : NULL;
+}
+
+static int by_bytes_desc(const void *a, const void *b) {
+    const struct pcc_tenant *x = *(const struct pcc_tenant *const *)a;
+    const struct pcc_tenant *y = *(const struct pcc_tenant *const *)b;
+    if (x->bytes != y->bytes) return x->bytes < y->bytes ? 1 : -1;
+    return strcmp(x->id, y->id);
+}
+
+size_t pcc_tenant_top(const struct pcc_tenant_table *t, const struct pcc_tenant **out, size_t max) {
+    const struct pcc_tenant **all = malloc(t->tab.used * sizeof(*all) + 1);
+    size_t n = 0;
+    if (all == NULL) return 0;
+
+    for (size_t s = 0; s < t->tab.nslots; s++) {
+        if (t->tab.hashes[s] != 0) all[n++] = &t->entries[s];
+    }
+    qsort(all, n, sizeof(*all), by_bytes_desc);
+    if (n > max) n = max;
+    memcpy(out, all, n * sizeof(*all));
+    free(all);
+    return n;
+}
@@ -0,0 +1,63 @@
+#ifndef PCC_TENANT_H
+#define PCC_TENANT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pcc_proto.h"
+#include "pcc_table.h"
+
+/*
+    per tenant accounting
+
+    a tenant is the client supplied tenant id (PCC_OPT_TENANT) or, if there is none,
+    the peer IP address as text. every tenant has its own histogram and byte/request
+    counters.
+
+    the table is a pcc_table (pcc_table.h) whose weight is bytes + error: when a new
+    tenant finds its probe window full, the lightest tenant of it is evicted, space-saving
+    style, and the new tenant inherits that amount as its error. so the long tail gets
+    recycled while heavy tenants stay.
+
+    error is an upper bound on traffic of the tenant that is not in its counters
+    (it may have been evicted before). counters themselves are exact since the tenant
+    was admitted.
+
+    not thread safe, the server updates it from the thread that owns the request.
+*/
+
+#define PCC_TENANT_ID_MAX 64
+#define PCC_TENANT_DEFAULT_SLOTS 1024
+
+struct pcc_tenant {
+    char id[PCC_TENANT_ID_MAX + 1]; // first, see pcc_table.h
+    uint64_t requests;
+    uint64_t bytes;
+    uint64_t printable;
+    uint64_t error;
+    uint64_t counts[PCC_NPRINTABLE];
+};
+
+struct pcc_tenant_table {
+    struct pcc_table tab; // slots, hashes, used, max_used and evictions
+    struct pcc_tenant *entries; // tab.entries
+};
+
+// nslots is rounded up to a power of two. returns 0 on success, -1 with errno set
+int pcc_tenant_init(struct pcc_tenant_table *t, size_t nslots);
+void pcc_tenant_free(struct pcc_tenant_table *t);
+
+// account one completed request to a tenant, one hash lookup
+void pcc_tenant_add(struct pcc_tenant_table *t, const char *id, uint64_t bytes, const uint64_t counts[PCC_NPRINTABLE]);
+
+// put a tenant back as it was (loading a snapshot), replacing one with the same id. a full
+// probe window evicts like pcc_tenant_add does
+void pcc_tenant_restore(struct pcc_tenant_table *t, const struct pcc_tenant *e);
+
+// NULL if the tenant is not (or no longer) in the table
+const struct pcc_tenant *pcc_tenant_find(const struct pcc_tenant_table *t, const char *id);
+
+// fill out with up to max entries sorted by bytes, descending. returns how many
+size_t pcc_tenant_top(const struct pcc_tenant_table *t, const struct pcc_tenant **out, size_t max);
+
+#endif
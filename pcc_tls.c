@@ -0,0 +1,276 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#include "pcc_tls.h"
+
+#define TLS13_SUITES "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256"
+#define TLS12_CIPHERS                                                                                                  \
+    "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES256-GCM-SHA384:"                         \
+    "ECDHE-RSA-AES256-GCM-SHA384:ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305"
+
+struct pcc_tls_ctx {
+    SSL_CTX *ssl_ctx;
+};
+
+struct pcc_tls {
+    SSL *ssl;
+    int want_write;
+};
+
+static __thread char last_error[256];
+
+// keep why the last call failed, from OpenSSL's error queue or errno
+static void save_error(const char *what) {
+    unsigned long e = ERR_peek_last_error();
+    if (e != 0) {
+        char buf[200];
+        ERR_error_string_n(e, buf, sizeof(buf));
+        snprintf(last_error, sizeof(last_error), "%s: %s", what, buf);
+    } else {
+        snprintf(last_error, sizeof(last_error), "%s: %s", what, strerror(errno));
+    }
+    ERR_clear_error();
+}
+
+const char *pcc_tls_error(void) {
+    return last_error;
+}
+
+static struct pcc_tls_ctx *ctx_new(const SSL_METHOD *method) {
+    struct pcc_tls_ctx *ctx = calloc(1, sizeof(*ctx));
+    if (ctx == NULL || (ctx->ssl_ctx = SSL_CTX_new(method)) == NULL) {
+        save_error("SSL_CTX_new");
+        free(ctx);
+        return NULL;
+    }
+    SSL_CTX *c = ctx->ssl_ctx;
+    SSL_CTX_set_min_proto_version(c, TLS1_2_VERSION);
+    // a peer that just closes the socket is a plain end of stream for us, like without TLS
+    SSL_CTX_set_options(c, SSL_OP_ENABLE_KTLS | SSL_OP_IGNORE_UNEXPECTED_EOF);
+    // write() semantics: partial writes, and a retry may come from another buffer address
+    SSL_CTX_set_mode(c, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    if (SSL_CTX_set_ciphersuites(c, TLS13_SUITES) != 1 || SSL_CTX_set_cipher_list(c, TLS12_CIPHERS) != 1) {
+        save_error("cipher list");
+        pcc_tls_ctx_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+struct pcc_tls_ctx *pcc_tls_server_ctx(const char *cert_file, const char *key_file) {
+    struct pcc_tls_ctx *ctx = ctx_new(TLS_server_method());
+    if (ctx == NULL) return NULL;
+    if (SSL_CTX_use_certificate_chain_file(ctx->ssl_ctx, cert_file) != 1) {
+        save_error(cert_file);
+        pcc_tls_ctx_free(ctx);
+        return NULL;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx->ssl_ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx->ssl_ctx) != 1) {
+        save_error(key_file);
+        pcc_tls_ctx_free(ctx);
+        return NULL;
+    }
+    // no resumption, and no tickets to send after the handshake either
+    SSL_CTX_set_num_tickets(ctx->ssl_ctx, 0);
+    SSL_CTX_set_session_cache_mode(ctx->ssl_ctx, SSL_SESS_CACHE_OFF);
+    return ctx;
+}
+
+struct pcc_tls_ctx *pcc_tls_client_ctx(const char *ca_file) {
+    struct pcc_tls_ctx *ctx = ctx_new(TLS_client_method());
+    if (ctx == NULL) return NULL;
+    if (SSL_CTX_load_verify_locations(ctx->ssl_ctx, ca_file, NULL) != 1) {
+        save_error(ca_file);
+        pcc_tls_ctx_free(ctx);
+        return NULL;
+    }
+    SSL_CTX_set_verify(ctx->ssl_ctx, SSL_VERIFY_PEER, NULL);
+    return ctx;
+}
+
+void pcc_tls_ctx_free(struct pcc_tls_ctx *ctx) {
+    if (ctx == NULL) return;
+    SSL_CTX_free(ctx->ssl_ctx);
+    free(ctx);
+}
+
+static struct pcc_tls *tls_new(struct pcc_tls_ctx *ctx, int fd) {
+    struct pcc_tls *t = calloc(1, sizeof(*t));
+    if (t == NULL || (t->ssl = SSL_new(ctx->ssl_ctx)) == NULL || SSL_set_fd(t->ssl, fd) != 1) {
+        save_error("SSL_new");
+        if (t != NULL) SSL_free(t->ssl);
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+struct pcc_tls *pcc_tls_client_new(struct pcc_tls_ctx *ctx, int fd, const char *host) {
+    struct pcc_tls *t = tls_new(ctx, fd);
+    if (t == NULL) return NULL;
+
+    // the certificate has to name the server, by IP address or by DNS name
+    unsigned char addr[16];
+    int ok;
+    if (inet_pton(AF_INET, host, addr) == 1 || inet_pton(AF_INET6, host, addr) == 1) {
+        ok = X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(t->ssl), host);
+    } else {
+        ok = SSL_set1_host(t->ssl, host) && SSL_set_tlsext_host_name(t->ssl, host);
+    }
+    if (ok != 1) {
+        save_error(host);
+        pcc_tls_free(t, 0);
+        return NULL;
+    }
+    SSL_set_connect_state(t->ssl);
+    return t;
+}
+
+int pcc_tls_handshake(struct pcc_tls *t) {
+    ERR_clear_error();
+    int r = SSL_do_handshake(t->ssl);
+    if (r == 1) return 1;
+
+    int e = SSL_get_error(t->ssl, r);
+    if (e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE) {
+        t->want_write = e == SSL_ERROR_WANT_WRITE;
+        errno = EAGAIN;
+        return 0;
+    }
+    long verify = SSL_get_verify_result(t->ssl);
+    if (verify != X509_V_OK) {
+        snprintf(last_error, sizeof(last_error), "handshake: %s", X509_verify_cert_error_string(verify));
+        ERR_clear_error();
+    } else {
+        save_error("handshake");
+    }
+    errno = ECONNRESET;
+    return -1;
+}
+
+// run the handshake of a blocking socket with SO_RCVTIMEO/SO_SNDTIMEO as the deadline
+static struct pcc_tls *handshake_blocking(struct pcc_tls *t, int fd, int timeout_ms) {
+    struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000}, none = {0, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    int r = pcc_tls_handshake(t);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &none, sizeof(none));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &none, sizeof(none));
+    if (r == 1) return t;
+    if (r == 0) { // EAGAIN from a blocking socket is the timeout
+        snprintf(last_error, sizeof(last_error), "handshake: timed out");
+        errno = ETIMEDOUT;
+    }
+    int err = errno;
+    pcc_tls_free(t, 0);
+    errno = err;
+    return NULL;
+}
+
+struct pcc_tls *pcc_tls_accept(struct pcc_tls_ctx *ctx, int fd, int timeout_ms) {
+    struct pcc_tls *t = tls_new(ctx, fd);
+    if (t == NULL) return NULL;
+    SSL_set_accept_state(t->ssl);
+    return handshake_blocking(t, fd, timeout_ms);
+}
+
+struct pcc_tls *pcc_tls_connect(struct pcc_tls_ctx *ctx, int fd, const char *host, int timeout_ms) {
+    struct pcc_tls *t = pcc_tls_client_new(ctx, fd, host);
+    if (t == NULL) return NULL;
+    return handshake_blocking(t, fd, timeout_ms);
+}
+
+// the result of SSL_read/SSL_write as read(2)/write(2) would report it
+static ssize_t io_result(struct pcc_tls *t, int r, const char *what) {
+    if (r > 0) return r;
+    int e = SSL_get_error(t->ssl, r);
+    switch (e) {
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        t->want_write = e == SSL_ERROR_WANT_WRITE;
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_SYSCALL:
+        if (ERR_peek_error() == 0 && errno != 0) {
+            ERR_clear_error();
+            return -1; // errno of the failed read or write
+        }
+        save_error(what);
+        errno = ECONNRESET;
+        return -1;
+    default:
+        save_error(what);
+        errno = ECONNRESET;
+        return -1;
+    }
+}
+
+ssize_t pcc_tls_read(struct pcc_tls *t, void *buf, size_t len) {
+    size_t got;
+    ERR_clear_error();
+    errno = 0;
+    int r = SSL_read_ex(t->ssl, buf, len, &got);
+    return r == 1 ? (ssize_t)got : io_result(t, r, "read");
+}
+
+ssize_t pcc_tls_write(struct pcc_tls *t, const void *buf, size_t len) {
+    size_t sent;
+    ERR_clear_error();
+    errno = 0;
+    int r = SSL_write_ex(t->ssl, buf, len, &sent);
+    return r == 1 ? (ssize_t)sent : io_result(t, r, "write");
+}
+
+ssize_t pcc_tls_sendfile(struct pcc_tls *t, int in_fd, off_t off, size_t len) {
+    if (!(pcc_tls_ktls(t) & PCC_KTLS_TX)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    ERR_clear_error();
+    errno = 0;
+    ossl_ssize_t r = SSL_sendfile(t->ssl, in_fd, off, len, 0);
+    if (r >= 0) return r;
+    if (errno == 0) errno = EIO;
+    save_error("sendfile");
+    return -1;
+}
+
+int pcc_tls_pending(const struct pcc_tls *t) {
+    return SSL_pending(t->ssl) > 0 || SSL_has_pending(t->ssl);
+}
+
+int pcc_tls_want_write(const struct pcc_tls *t) {
+    return t->want_write;
+}
+
+int pcc_tls_ktls(const struct pcc_tls *t) {
+    return (BIO_get_ktls_send(SSL_get_wbio(t->ssl)) ? PCC_KTLS_TX : 0) |
+           (BIO_get_ktls_recv(SSL_get_rbio(t->ssl)) ? PCC_KTLS_RX : 0);
+}
+
+const char *pcc_tls_cipher(const struct pcc_tls *t) {
+    static __thread char buf[96];
+    snprintf(buf, sizeof(buf), "%s %s", SSL_get_version(t->ssl), SSL_get_cipher_name(t->ssl));
+    return buf;
+}
+
+void pcc_tls_free(struct pcc_tls *t, int notify) {
+    if (t == NULL) return;
+    if (notify) SSL_shutdown(t->ssl); // one way, the close that follows doesn't wait for the peer's
+    ERR_clear_error();
+    SSL_free(t->ssl);
+    free(t);
+}
@@ -0,0 +1,68 @@
+#ifndef PCC_TLS_H
+#define PCC_TLS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+    TLS for pcc_server, pcc_client and the client library, on OpenSSL
+
+    the session is set up with SSL_OP_ENABLE_KTLS: once the handshake is done OpenSSL
+    hands the record keys to the kernel (kTLS, the "tls" TCP ULP) when it supports the
+    cipher, and from then on the kernel encrypts and decrypts. pcc_tls_read/write still go
+    through OpenSSL, which then only does plain read()/write() on the socket, and
+    pcc_tls_sendfile sends a file without it ever reaching user space. without kTLS
+    (module not loaded, cipher not offloadable) everything works the same with OpenSSL
+    doing the crypto, pcc_tls_ktls tells which one it is.
+
+    the AES-GCM suites come first since those are the ones kTLS offloads.
+
+    read/write behave like read(2)/write(2): bytes, 0 at the end of the stream (close_notify
+    or a plain FIN), -1 with errno. EAGAIN on a non-blocking socket, then
+    pcc_tls_want_write tells whether to wait for POLLOUT instead of POLLIN. a TLS protocol
+    error is reported as ECONNRESET, the peer is as good as gone.
+*/
+
+struct pcc_tls_ctx;
+struct pcc_tls;
+
+// what is offloaded to the kernel, pcc_tls_ktls
+#define PCC_KTLS_TX 1
+#define PCC_KTLS_RX 2
+
+// NULL on failure, pcc_tls_error says why
+struct pcc_tls_ctx *pcc_tls_server_ctx(const char *cert_file, const char *key_file);
+// the server's certificate must chain to a certificate in ca_file (a self-signed one can be
+// its own CA) and name the host we connect to
+struct pcc_tls_ctx *pcc_tls_client_ctx(const char *ca_file);
+void pcc_tls_ctx_free(struct pcc_tls_ctx *ctx);
+
+// blocking handshakes on a connected blocking socket, at most timeout_ms.
+// NULL on failure, errno is ETIMEDOUT or ECONNRESET (see pcc_tls_error)
+struct pcc_tls *pcc_tls_accept(struct pcc_tls_ctx *ctx, int fd, int timeout_ms);
+struct pcc_tls *pcc_tls_connect(struct pcc_tls_ctx *ctx, int fd, const char *host, int timeout_ms);
+
+// non-blocking client: create, then call pcc_tls_handshake whenever the socket is ready
+// until it returns 1 (done). 0 means EAGAIN, -1 failed
+struct pcc_tls *pcc_tls_client_new(struct pcc_tls_ctx *ctx, int fd, const char *host);
+int pcc_tls_handshake(struct pcc_tls *t);
+
+ssize_t pcc_tls_read(struct pcc_tls *t, void *buf, size_t len);
+ssize_t pcc_tls_write(struct pcc_tls *t, const void *buf, size_t len);
+// len bytes of in_fd at off, only with PCC_KTLS_TX (-1 with ENOTSUP otherwise)
+ssize_t pcc_tls_sendfile(struct pcc_tls *t, int in_fd, off_t off, size_t len);
+
+// decrypted bytes buffered in user space, a poll() on the socket does not see them
+int pcc_tls_pending(const struct pcc_tls *t);
+int pcc_tls_want_write(const struct pcc_tls *t);
+int pcc_tls_ktls(const struct pcc_tls *t);
+// negotiated version and cipher, for logs
+const char *pcc_tls_cipher(const struct pcc_tls *t);
+
+// notify sends a close_notify first (without waiting for the peer's). the socket is left open
+void pcc_tls_free(struct pcc_tls *t, int notify);
+
+// the last OpenSSL error of this thread as text
+const char *pcc_tls_error(void);
+
+#endif
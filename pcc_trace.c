@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pcc_trace.h"
+
+#define WRITE_BUF (1 << 20) // stdio buffer of a trace being written
+
+struct pcc_trace {
+    FILE *f;
+    pthread_mutex_t lock;
+    uint64_t started; // CLOCK_MONOTONIC ns of t 0
+    _Atomic uint32_t next_conn;
+    int error; // errno of the first failed write, 0 if none
+};
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void le16(unsigned char *p, uint16_t v) {
+    v = htole16(v);
+    memcpy(p, &v, 2);
+}
+
+static void le32(unsigned char *p, uint32_t v) {
+    v = htole32(v);
+    memcpy(p, &v, 4);
+}
+
+static void le64(unsigned char *p, uint64_t v) {
+    v = htole64(v);
+    memcpy(p, &v, 8);
+}
+
+static uint16_t get16(const unsigned char *p) {
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return le16toh(v);
+}
+
+static uint32_t get32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return le32toh(v);
+}
+
+static uint64_t get64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return le64toh(v);
+}
+
+struct pcc_trace *pcc_trace_create(const char *path, uint32_t flags) {
+    struct pcc_trace *t = calloc(1, sizeof(*t));
+    if (t == NULL) return NULL;
+    if ((t->f = fopen(path, "we")) == NULL) {
+        int err = errno;
+        free(t);
+        errno = err;
+        return NULL;
+    }
+    setvbuf(t->f, NULL, _IOFBF, WRITE_BUF);
+    pthread_mutex_init(&t->lock, NULL);
+    atomic_init(&t->next_conn, 1);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    t->started = mono_ns();
+
+    unsigned char hdr[PCC_TRACE_HDR_LEN];
+    memcpy(hdr, PCC_TRACE_MAGIC, 8); // with its NUL
+    le32(hdr + 8, PCC_TRACE_VERSION);
+    le32(hdr + 12, flags);
+    le64(hdr + 16, (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec);
+    if (fwrite(hdr, sizeof(hdr), 1, t->f) != 1) t->error = errno ? errno : EIO;
+    return t;
+}
+
+uint32_t pcc_trace_conn(struct pcc_trace *t) {
+    return atomic_fetch_add_explicit(&t->next_conn, 1, memory_order_relaxed);
+}
+
+uint64_t pcc_trace_now(const struct pcc_trace *t) {
+    return mono_ns() - t->started;
+}
+
+void pcc_trace_write(struct pcc_trace *t, const struct pcc_trace_rec *rec, const void *opts, const void *data) {
+    unsigned char p[PCC_TRACE_REC_LEN];
+    p[0] = rec->type;
+    p[1] = rec->version;
+    p[2] = rec->op;
+    p[3] = rec->status;
+    le16(p + 4, rec->flags);
+    le16(p + 6, rec->opt_bytes);
+    le32(p + 8, rec->opt_len);
+    le32(p + 12, rec->conn);
+    le32(p + 16, rec->data_len);
+    le32(p + 20, 0);
+    le64(p + 24, rec->t);
+    le64(p + 32, rec->dur);
+    le64(p + 40, rec->n);
+    le64(p + 48, rec->c);
+
+    // one record at a time, so records of different threads never mix
+    pthread_mutex_lock(&t->lock);
+    if (t->error == 0 && (fwrite(p, sizeof(p), 1, t->f) != 1 ||
+                          (rec->opt_bytes > 0 && fwrite(opts, rec->opt_bytes, 1, t->f) != 1) ||
+                          (rec->data_len > 0 && fwrite(data, rec->data_len, 1, t->f) != 1))) {
+        t->error = errno ? errno : EIO;
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+int pcc_trace_finish(struct pcc_trace *t) {
+    int err = t->error;
+    if (fclose(t->f) != 0 && err == 0) err = errno;
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int pcc_trace_map(const char *path, struct pcc_trace_reader *r) {
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    if (st.st_size < PCC_TRACE_HDR_LEN) {
+        close(fd);
+        errno = EBADMSG;
+        return -1;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    int err = errno;
+    close(fd);
+    if (p == MAP_FAILED) {
+        errno = err;
+        return -1;
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->buf = p;
+    r->len = st.st_size;
+    if (memcmp(r->buf, PCC_TRACE_MAGIC, 8) != 0 || get32(r->buf + 8) != PCC_TRACE_VERSION) {
+        err = memcmp(r->buf, PCC_TRACE_MAGIC, 8) != 0 ? EBADMSG : EPROTONOSUPPORT;
+        pcc_trace_unmap(r);
+        errno = err;
+        return -1;
+    }
+    r->flags = get32(r->buf + 12);
+    r->started = get64(r->buf + 16);
+    r->pos = PCC_TRACE_HDR_LEN;
+    return 0;
+}
+
+int pcc_trace_next(struct pcc_trace_reader *r, struct pcc_trace_rec *rec, const unsigned char **opts,
+                   const unsigned char **data) {
+    if (r->pos == r->len) return 0;
+    if (r->len - r->pos < PCC_TRACE_REC_LEN) goto truncated;
+
+    const unsigned char *p = r->buf + r->pos;
+    rec->type = p[0];
+    rec->version = p[1];
+    rec->op = p[2];
+    rec->status = p[3];
+    rec->flags = get16(p + 4);
+    rec->opt_bytes = get16(p + 6);
+    rec->opt_len = get32(p + 8);
+    rec->conn = get32(p + 12);
+    rec->data_len = get32(p + 16);
+    rec->t = get64(p + 24);
+    rec->dur = get64(p + 32);
+    rec->n = get64(p + 40);
+    rec->c = get64(p + 48);
+    if (r->len - r->pos - PCC_TRACE_REC_LEN < (uint64_t)rec->opt_bytes + rec->data_len) goto truncated;
+
+    *opts = p + PCC_TRACE_REC_LEN;
+    *data = *opts + rec->opt_bytes;
+    r->pos += PCC_TRACE_REC_LEN + rec->opt_bytes + rec->data_len;
+    return 1;
+
+truncated:
+    r->truncated = 1;
+    r->pos = r->len;
+    return 0;
+}
+
+void pcc_trace_unmap(struct pcc_trace_reader *r) {
+    munmap((void *)r->buf, r->len);
+    r->buf = NULL;
+}
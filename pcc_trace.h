@@ -0,0 +1,108 @@
+#ifndef PCC_TRACE_H
+#define PCC_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pcc_proto.h"
+
+/*
+    traces: what clients did to a server, to replay it later (pcc_replay) against another
+    build of the server, at the pace it came in or as fast as possible
+
+    every integer is little endian. the file is the header
+        magic "PCCTRAC\0", u32 version, u32 flags (PCC_TRACE_PAYLOADS), u64 started (unix ns)
+    then records, each one a fixed part of PCC_TRACE_REC_LEN bytes
+        u8 type, u8 version, u8 op, u8 status, u16 flags, u16 opt_bytes, u32 opt_len,
+        u32 conn, u32 data_len, u32 zero, u64 t, u64 dur, u64 n, u64 c
+    followed by opt_bytes bytes of options and data_len bytes of payload.
+
+        OPEN        a connection was accepted, flags PCC_TRACE_LOCAL / PCC_TRACE_TLS
+        BASIC       a basic frame of n bytes, c the count replied
+        EXT         an extended frame: version, op, flags, opt_len and n of its header,
+                    status and c of its reply. opt_bytes are the options the server read
+                    (0 if it rejected the header first)
+        CLOSE       the connection was closed
+
+    conn numbers the connections from 1 in the order they were accepted. t is when the
+    record's event began, in ns since started (monotonic), dur how long a frame took until
+    its reply was sent. a frame the client didn't finish has status PCC_TRACE_GONE.
+
+    the payload of a frame is only kept with PCC_TRACE_PAYLOADS, and then at most
+    PCC_TRACE_MAX_DATA bytes of it, a replay makes up the rest. query commands are always
+    kept, they are the request. records of one connection are in order, records of
+    different connections interleave in the order they were written. a trace that ends in
+    the middle of a record (the server died) ends with the last whole one.
+*/
+
+#define PCC_TRACE_MAGIC "PCCTRAC"
+#define PCC_TRACE_VERSION 1
+#define PCC_TRACE_HDR_LEN 24
+#define PCC_TRACE_REC_LEN 56
+#define PCC_TRACE_MAX_DATA (16u << 20)
+
+// header flags
+#define PCC_TRACE_PAYLOADS 0x1
+
+enum {
+    PCC_TRACE_OPEN = 1,
+    PCC_TRACE_BASIC = 2,
+    PCC_TRACE_EXT = 3,
+    PCC_TRACE_CLOSE = 4,
+};
+
+// OPEN flags
+#define PCC_TRACE_LOCAL 0x1 // the UNIX socket
+#define PCC_TRACE_TLS 0x2
+
+#define PCC_TRACE_GONE 0xff // status of a frame whose client went away
+
+struct pcc_trace_rec {
+    uint8_t type;
+    uint8_t version;
+    uint8_t op;
+    uint8_t status;
+    uint16_t flags;
+    uint16_t opt_bytes;
+    uint32_t opt_len;
+    uint32_t conn;
+    uint32_t data_len;
+    uint64_t t;
+    uint64_t dur;
+    uint64_t n;
+    uint64_t c;
+};
+
+// a trace being written, by any number of threads
+struct pcc_trace;
+
+// a trace being read, see pcc_trace_map
+struct pcc_trace_reader {
+    const unsigned char *buf;
+    size_t len, pos;
+    uint32_t flags;
+    uint64_t started;
+    int truncated; // set once the last record turned out to be cut short
+};
+
+// create (truncate) path and write the header. returns NULL with errno set
+struct pcc_trace *pcc_trace_create(const char *path, uint32_t flags);
+// the number of a new connection
+uint32_t pcc_trace_conn(struct pcc_trace *t);
+// ns since the trace started
+uint64_t pcc_trace_now(const struct pcc_trace *t);
+// append a record with its options (rec->opt_bytes) and payload (rec->data_len). a failed
+// write is remembered and returned by pcc_trace_finish, the trace stops there
+void pcc_trace_write(struct pcc_trace *t, const struct pcc_trace_rec *rec, const void *opts, const void *data);
+// flush, close and free t. returns 0, or -1 with errno of the first error
+int pcc_trace_finish(struct pcc_trace *t);
+
+// map a trace and check its header. returns 0, or -1 with errno set (EBADMSG for a broken
+// header, EPROTONOSUPPORT for another version)
+int pcc_trace_map(const char *path, struct pcc_trace_reader *r);
+// the next record, opts and data point into the mapping. returns 1, or 0 at the end
+int pcc_trace_next(struct pcc_trace_reader *r, struct pcc_trace_rec *rec, const unsigned char **opts,
+                   const unsigned char **data);
+void pcc_trace_unmap(struct pcc_trace_reader *r);
+
+#endif
@@ -0,0 +1,152 @@
+#include <string.h>
+
+#include "pcc_window.h"
+
+/*
+    see pcc_window.h for the layout.
+
+    epoch of a slot is the index of the interval it holds plus one, so an all zero
+    slot is never mistaken for interval 0. the top bit marks a slot that is being
+    recycled.
+
+    a writer that read the old epoch and then got preempted across a recycle can
+    still land its adds in the new interval, this skews at most one request by
+    one ring length and is not worth a lock on the ingest path.
+*/
+
+#define EPOCH_BUSY (1ULL << 63)
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    if ((a % b != 0) && ((a < 0) != (b < 0))) q--;
+    return q;
+}
+
+static int64_t align_down(int64_t t, int64_t width) {
+    return floor_div(t, width) * width;
+}
+
+static int64_t align_up(int64_t t, int64_t width) {
+    return floor_div(t + width - 1, width) * width;
+}
+
+static struct pcc_window_slot *slot_for(const struct pcc_window_tier *tier, int64_t t, uint64_t *epoch) {
+    int64_t idx = floor_div(t, tier->width);
+    *epoch = (uint64_t)idx + 1;
+    int64_t pos = idx % (int64_t)tier->nslots;
+    if (pos < 0) pos += tier->nslots;
+    return &tier->slots[pos];
+}
+
+void pcc_window_init(struct pcc_window *w) {
+    memset(w, 0, sizeof(*w));
+    w->tiers[0] = (struct pcc_window_tier){1, PCC_WIN_SEC_SLOTS, w->sec};
+    w->tiers[1] = (struct pcc_window_tier){60, PCC_WIN_MIN_SLOTS, w->min};
+    w->tiers[2] = (struct pcc_window_tier){3600, PCC_WIN_HOUR_SLOTS, w->hour};
+}
+
+// make the slot hold the given epoch, zeroing it if it held an older interval.
+// returns 0 if the slot already moved past this epoch (the writer is too late)
+static int slot_acquire(struct pcc_window_slot *slot, uint64_t epoch) {
+    for (;;) {
+        uint64_t cur = atomic_load_explicit(&slot->epoch, memory_order_acquire);
+        if (cur == epoch) return 1;
+        if (cur & EPOCH_BUSY) continue; // someone else is recycling it, wait
+        if (cur > epoch) return 0;
+
+        if (atomic_compare_exchange_weak_explicit(&slot->epoch, &cur, epoch | EPOCH_BUSY,
+                                                  memory_order_acquire, memory_order_relaxed)) {
+            for (size_t i = 0; i < PCC_NPRINTABLE; i++) {
+                atomic_store_explicit(&slot->counts[i], 0, memory_order_relaxed);
+            }
+            atomic_store_explicit(&slot->epoch, epoch, memory_order_release);
+            return 1;
+        }
+    }
+}
+
+void pcc_window_add(struct pcc_window *w, time_t now, const uint64_t counts[PCC_NPRINTABLE]) {
+    for (size_t k = 0; k < PCC_WIN_TIERS; k++) {
+        uint64_t epoch;
+        struct pcc_window_slot *slot = slot_for(&w->tiers[k], now, &epoch);
+        if (!slot_acquire(slot, epoch)) continue;
+
+        for (size_t i = 0; i < PCC_NPRINTABLE; i++) {
+            if (counts[i] > 0) {
+                atomic_fetch_add_explicit(&slot->counts[i], counts[i], memory_order_relaxed);
+            }
+        }
+    }
+}
+
+// add all slots of one tier that fall in [lo, hi), both aligned to the tier width
+static void tier_sum(const struct pcc_window_tier *tier, int64_t lo, int64_t hi, uint64_t out[PCC_NPRINTABLE]) {
+    for (int64_t t = lo; t < hi; t += tier->width) {
+        uint64_t epoch;
+        struct pcc_window_slot *slot = slot_for(tier, t, &epoch);
+        if (atomic_load_explicit(&slot->epoch, memory_order_acquire) != epoch) continue; // recycled or never used
+
+        for (size_t i = 0; i < PCC_NPRINTABLE; i++) {
+            out[i] += atomic_load_explicit(&slot->counts[i], memory_order_relaxed);
+        }
+    }
+}
+
+void pcc_window_query(struct pcc_window *w, time_t now, time_t from, time_t to, struct pcc_window_result *res) {
+    memset(res, 0, sizeof(*res));
+    res->resolution = w->tiers[0].width;
+    if (from >= to) {
+        res->from = res->to = from;
+        return;
+    }
+
+    // nothing can be newer than the current interval
+    int64_t hi = align_up(to, w->tiers[0].width);
+    int64_t newest = align_down(now, w->tiers[0].width) + w->tiers[0].width;
+    if (hi > newest) hi = newest;
+    res->to = hi;
+    res->from = hi;
+
+    // walk from the finest tier to the coarsest one, each tier answers the part of
+    // the range it still holds and hands the older rest to the next tier.
+    // the hand-off boundary is aligned to the coarser width so no interval is
+    // counted twice
+    for (size_t k = 0; k < PCC_WIN_TIERS; k++) {
+        const struct pcc_window_tier *tier = &w->tiers[k];
+        int64_t oldest = (floor_div(now, tier->width) - (tier->nslots - 1)) * tier->width;
+        int64_t lo = align_down(from, tier->width);
+
+        if (lo >= oldest || k == PCC_WIN_TIERS - 1) {
+            if (lo < oldest) lo = oldest; // older than anything we keep
+            if (lo < hi) {
+                tier_sum(tier, lo, hi, res->counts);
+                res->from = lo;
+                res->resolution = tier->width;
+            }
+            return;
+        }
+
+        int64_t next_width = w->tiers[k + 1].width;
+        lo = align_up(oldest, next_width);
+        if (lo < hi) {
+            tier_sum(tier, lo, hi, res->counts);
+            res->from = lo;
+            res->resolution = tier->width;
+            hi = lo;
+        } else {
+            hi = align_up(hi, next_width);
+            if (res->from == res->to) res->to = res->from = hi; // nothing covered yet
+        }
+    }
+}
+
+void pcc_window_restore(struct pcc_window *w, size_t k, uint64_t epoch, const uint64_t counts[PCC_NPRINTABLE]) {
+    if (k >= PCC_WIN_TIERS || epoch == 0 || (epoch & EPOCH_BUSY)) return;
+    const struct pcc_window_tier *tier = &w->tiers[k];
+    struct pcc_window_slot *slot = &tier->slots[(epoch - 1) % tier->nslots];
+    if (!slot_acquire(slot, epoch)) return;
+
+    for (size_t i = 0; i < PCC_NPRINTABLE; i++) {
+        if (counts[i] > 0) atomic_fetch_add_explicit(&slot->counts[i], counts[i], memory_order_relaxed);
+    }
+}
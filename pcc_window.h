@@ -0,0 +1,70 @@
+#ifndef PCC_WINDOW_H
+#define PCC_WINDOW_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "pcc_proto.h"
+
+/*
+    windowed time-series histograms of printable chars
+
+    three tiers of ring buffers, each slot holds the histogram of one interval:
+        1s  slots, kept for PCC_WIN_SEC_SLOTS seconds
+        1m  slots, kept for PCC_WIN_MIN_SLOTS minutes
+        1h  slots, kept for PCC_WIN_HOUR_SLOTS hours
+    older data is only available at the coarser resolution (downsampled), so
+    memory is bounded no matter how long the server runs.
+
+    updates are lock free: every tier is updated from the ingest path with relaxed
+    atomic adds. a slot is recycled by the first writer that sees a stale epoch,
+    which marks the slot busy while it zeroes it, writers that race with the
+    recycle wait for it to finish (a few hundred stores at most).
+*/
+
+#define PCC_WIN_TIERS 3
+#define PCC_WIN_SEC_SLOTS 120
+#define PCC_WIN_MIN_SLOTS 120
+#define PCC_WIN_HOUR_SLOTS 168
+
+struct pcc_window_slot {
+    _Atomic uint64_t epoch; // interval index (time / width) + 1, 0 = never used
+    _Atomic uint64_t counts[PCC_NPRINTABLE];
+};
+
+struct pcc_window_tier {
+    uint32_t width; // seconds per slot
+    uint32_t nslots;
+    struct pcc_window_slot *slots;
+};
+
+struct pcc_window {
+    struct pcc_window_tier tiers[PCC_WIN_TIERS];
+    struct pcc_window_slot sec[PCC_WIN_SEC_SLOTS];
+    struct pcc_window_slot min[PCC_WIN_MIN_SLOTS];
+    struct pcc_window_slot hour[PCC_WIN_HOUR_SLOTS];
+};
+
+// result of a range query, the range actually covered is snapped to slot
+// boundaries of whatever tier answered that part of the range
+struct pcc_window_result {
+    time_t from;
+    time_t to;
+    uint32_t resolution; // coarsest slot width used to answer the query
+    uint64_t counts[PCC_NPRINTABLE];
+};
+
+void pcc_window_init(struct pcc_window *w);
+
+// add the histogram of one request, observed at time now
+void pcc_window_add(struct pcc_window *w, time_t now, const uint64_t counts[PCC_NPRINTABLE]);
+
+// sum of all histograms in [from, to), evaluated at time now
+void pcc_window_query(struct pcc_window *w, time_t now, time_t from, time_t to, struct pcc_window_result *res);
+
+// add counts to interval epoch (as in pcc_window_slot) of tier k, as if they had arrived
+// then. used to load a snapshot, an interval the slot already moved past is dropped
+void pcc_window_restore(struct pcc_window *w, size_t k, uint64_t epoch, const uint64_t counts[PCC_NPRINTABLE]);
+
+#endif